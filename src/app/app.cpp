@@ -50,6 +50,7 @@
 #include "app/tools/tool_box.h"
 #include "app/ui/color_bar.h"
 #include "app/ui/editor/editor.h"
+#include "app/ui/editor/editor_render_cache.h"
 #include "app/ui/editor/editor_view.h"
 #include "app/ui/main_window.h"
 #include "app/ui/status_bar.h"
@@ -133,6 +134,10 @@ App::App(int argc, const char* argv[])
     m_exporter->setDataFilename(options.data());
     m_exporter->setTextureFilename(options.sheet());
     m_exporter->setScale(options.scale());
+    m_exporter->setLayoutMode(options.sheetPack() ?
+                              DocumentExporter::PackedLayoutMode:
+                              DocumentExporter::SimpleLayoutMode);
+    m_exporter->setTrimFrames(options.trim());
   }
 
   // Register well-known image file types.
@@ -351,7 +356,8 @@ void app_refresh_screen()
   else
     set_current_palette(NULL, false);
 
-  // Invalidate the whole screen.
+  // Invalidate the whole screen (and render it again).
+  EditorRenderCache::invalidateAll();
   ui::Manager::getDefault()->invalidate();
 }
 
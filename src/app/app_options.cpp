@@ -36,6 +36,8 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_startUI(true)
   , m_startShell(false)
   , m_verbose(false)
+  , m_sheetPack(false)
+  , m_trim(false)
   , m_scale(1.0)
 {
   Option& palette = m_po.add("palette").requiresValue("<filename>").description("Use a specific palette by default");
@@ -45,6 +47,8 @@ AppOptions::AppOptions(int argc, const char* argv[])
   Option& data = m_po.add("data").requiresValue("<filename>").description("File to store the sprite sheet metadata (.json file)");
   //Option& textureFormat = m_po.add("texture-format").requiresValue("<name>").description("Output texture format.");
   Option& sheet = m_po.add("sheet").requiresValue("<filename>").description("Image file to save the texture (.png)");
+  Option& sheetPack = m_po.add("sheet-pack").description("Pack frames in the texture (duplicated frames are exported once)");
+  Option& trim = m_po.add("trim").description("Trim the transparent borders of each frame in the texture");
   //Option& scale = m_po.add("scale").requiresValue("<float>").description("");
   //Option& scaleMode = m_po.add("scale-mode").requiresValue("<mode>").description("Export the first given document to a JSON object");
   //Option& splitLayers = m_po.add("split-layers").description("Specifies that each layer of the given file should be saved as a different image in the sheet.");
@@ -64,6 +68,8 @@ AppOptions::AppOptions(int argc, const char* argv[])
     m_data = data.value();
     // m_textureFormat = textureFormat.value();
     m_sheet = sheet.value();
+    m_sheetPack = sheetPack.enabled();
+    m_trim = trim.enabled();
     // if (scale.enabled())
     //   m_scale = std::strtod(scale.value().c_str(), NULL);
     // m_scaleMode = scaleMode.value();
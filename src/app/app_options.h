@@ -47,6 +47,8 @@ public:
   const std::string& data() const { return m_data; }
   const std::string& textureFormat() const { return m_textureFormat; }
   const std::string& sheet() const { return m_sheet; }
+  bool sheetPack() const { return m_sheetPack; }
+  bool trim() const { return m_trim; }
   const double scale() const { return m_scale; }
   const std::string& scaleMode() const { return m_scaleMode; }
 
@@ -73,6 +75,8 @@ private:
   std::string m_data;
   std::string m_textureFormat;
   std::string m_sheet;
+  bool m_sheetPack;
+  bool m_trim;
   double m_scale;
   std::string m_scaleMode;
 };
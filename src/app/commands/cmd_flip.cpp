@@ -36,6 +36,8 @@
 #include "raster/sprite.h"
 #include "raster/stock.h"
 
+#include <set>
+
 namespace app {
 
 FlipCommand::FlipCommand()
@@ -85,6 +87,8 @@ void FlipCommand::onExecute(Context* context)
       if (!image)
         return;
 
+      image = api.unshareCelImage(sprite, writer.cel());
+
       Mask* mask = NULL;
       bool alreadyFlipped = false;
 
@@ -140,6 +144,9 @@ void FlipCommand::onExecute(Context* context)
       CelList cels;
       sprite->getCels(cels);
 
+      // Images shared by several cels are flipped just one time.
+      std::set<int> flipped;
+
       // for each cel...
       for (CelIterator it = cels.begin(); it != cels.end(); ++it) {
         Cel* cel = *it;
@@ -154,7 +161,8 @@ void FlipCommand::onExecute(Context* context)
             sprite->getHeight() - image->getHeight() - cel->getY():
             cel->getY()));
 
-        api.flipImage(image, image->getBounds(), m_flipType);
+        if (flipped.insert(cel->getImage()).second)
+          api.flipImage(image, image->getBounds(), m_flipType);
       }
     }
 
@@ -30,9 +30,7 @@
 #include "app/undoers/add_cel.h"
 #include "app/undoers/add_image.h"
 #include "app/undoers/remove_layer.h"
-#include "app/undoers/replace_image.h"
 #include "app/undoers/set_cel_position.h"
-#include "base/unique_ptr.h"
 #include "raster/cel.h"
 #include "raster/image.h"
 #include "raster/layer.h"
@@ -87,8 +85,7 @@ void MergeDownLayerCommand::onExecute(Context* context)
   Layer* src_layer = writer.layer();
   Layer* dst_layer = src_layer->getPrevious();
   Cel *src_cel, *dst_cel;
-  Image *src_image;
-  base::UniquePtr<Image> dst_image;
+  Image *src_image, *dst_image;
   int index;
 
   for (FrameNumber frpos(0); frpos<sprite->getTotalFrames(); ++frpos) {
@@ -103,7 +100,9 @@ void MergeDownLayerCommand::onExecute(Context* context)
       src_image = NULL;
 
     if (dst_cel != NULL)
-      dst_image.reset(sprite->getStock()->getImage(dst_cel->getImage()));
+      dst_image = sprite->getStock()->getImage(dst_cel->getImage());
+    else
+      dst_image = NULL;
 
     // With source image?
     if (src_image != NULL) {
@@ -111,11 +110,8 @@ void MergeDownLayerCommand::onExecute(Context* context)
       if (dst_image == NULL) {  // Only a transparent layer can have a null cel
         // Copy this cel to the destination layer...
 
-        // Creating a copy of the image
-        dst_image.reset(Image::createCopy(src_image));
-
-        // Adding it in the stock of images
-        index = sprite->getStock()->addImage(dst_image.release());
+        // Adding a copy of the image in the stock of images
+        index = sprite->getStock()->addImage(Image::createCopy(src_image));
         if (undo.isEnabled())
           undo.pushUndoer(new undoers::AddImage(
               undo.getObjects(), sprite->getStock(), index));
@@ -169,11 +165,8 @@ void MergeDownLayerCommand::onExecute(Context* context)
 
         dst_cel->setPosition(x1, y1);
 
-        if (undo.isEnabled())
-          undo.pushUndoer(new undoers::ReplaceImage(undo.getObjects(),
-              sprite->getStock(), dst_cel->getImage()));
-
-        sprite->getStock()->replaceImage(dst_cel->getImage(), new_image);
+        // Replace the image (it could be shared with other cels)
+        document->getApi().replaceCelImage(sprite, dst_cel, new_image);
       }
     }
   }
@@ -43,6 +43,7 @@
 #include "ui/ui.h"
 
 #include <allegro/unicode.h>
+#include <set>
 
 #define PERC_FORMAT     "%.1f"
 
@@ -89,6 +90,9 @@ protected:
     CelList cels;
     m_sprite->getCels(cels);
 
+    // Images shared by several cels are resized just one time.
+    std::set<int> resized;
+
     // For each cel...
     int progress = 0;
     for (CelIterator it = cels.begin(); it != cels.end(); ++it, ++progress) {
@@ -99,7 +103,7 @@ protected:
 
       // Get cel's image
       Image* image = m_sprite->getStock()->getImage(cel->getImage());
-      if (!image)
+      if (!image || !resized.insert(cel->getImage()).second)
         continue;
 
       // Resize the image
@@ -221,6 +225,7 @@ void SpriteSizeCommand::onExecute(Context* context)
 
   method->addItem("Nearest-neighbor");
   method->addItem("Bilinear");
+  method->addItem("Box (area average)");
   method->setSelectedItemIndex(get_config_int("SpriteSize", "Method",
                                               raster::algorithm::RESIZE_METHOD_NEAREST_NEIGHBOR));
 
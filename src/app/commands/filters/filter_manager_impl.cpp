@@ -23,17 +23,23 @@
 #include "app/commands/filters/filter_manager_impl.h"
 
 #include "app/context_access.h"
+#include "app/document.h"
+#include "app/document_api.h"
 #include "app/ini_file.h"
 #include "app/modules/editors.h"
 #include "app/ui/editor/editor.h"
 #include "app/undo_transaction.h"
 #include "app/undoers/image_area.h"
+#include "base/mutex.h"
+#include "base/parallel_for.h"
+#include "base/scoped_lock.h"
 #include "filters/filter.h"
 #include "raster/cel.h"
 #include "raster/image.h"
 #include "raster/images_collector.h"
 #include "raster/layer.h"
 #include "raster/mask.h"
+#include "raster/rgbmap.h"
 #include "raster/sprite.h"
 #include "raster/stock.h"
 #include "ui/manager.h"
@@ -47,7 +53,206 @@ namespace app {
 
 using namespace std;
 using namespace ui;
-  
+
+namespace {
+
+  // Number of rows of each band of the image that is filtered in
+  // parallel by FilterManagerImpl::apply().
+  const int kFilterBandHeight = 8;
+
+  // Images with less pixels are filtered in the calling thread.
+  const int kMinParallelPixels = 128*128;
+
+  // Palette and RgbMap obtained from the sprite before the worker
+  // threads are launched (Sprite::getRgbMap() can regenerate the map).
+  class FixedIndexedData : public FilterIndexedData {
+  public:
+    FixedIndexedData(Palette* palette, RgbMap* rgbmap)
+      : m_palette(palette), m_rgbmap(rgbmap) { }
+
+    Palette* getPalette() OVERRIDE { return m_palette; }
+    RgbMap* getRgbMap() OVERRIDE { return m_rgbmap; }
+
+  private:
+    Palette* m_palette;
+    RgbMap* m_rgbmap;
+  };
+
+  // State shared by all threads that filter bands of the same image.
+  // It reports the progress (and asks for cancellation) to the
+  // IProgressDelegate from one thread at a time, once per band and
+  // only when the percentage changes.
+  class FilterBandsProgress {
+  public:
+    FilterBandsProgress(FilterManagerImpl::IProgressDelegate* delegate,
+                        float base, float width, int rows)
+      : m_delegate(delegate)
+      , m_base(base)
+      , m_width(width)
+      , m_rows(rows)
+      , m_rowsDone(0)
+      , m_percent(0)
+      , m_cancelled(false) {
+    }
+
+    void bandDone(int rows) {
+      if (!m_delegate)
+        return;
+
+      base::scoped_lock hold(m_mutex);
+      m_rowsDone += rows;
+
+      int percent = 100 * m_rowsDone / m_rows;
+      if (percent != m_percent && !m_cancelled) {
+        m_percent = percent;
+        m_delegate->reportProgress(m_base + m_width * m_rowsDone / m_rows);
+        if (m_delegate->isCancelled())
+          m_cancelled = true;
+      }
+    }
+
+    // Called for each row without locking the mutex, the flag is
+    // only changed from false to true.
+    bool isCancelled() const {
+      return m_cancelled;
+    }
+
+  private:
+    base::mutex m_mutex;
+    FilterManagerImpl::IProgressDelegate* m_delegate;
+    float m_base;
+    float m_width;
+    int m_rows;
+    int m_rowsDone;
+    int m_percent;
+    volatile bool m_cancelled;
+  };
+
+  // FilterManager to apply the filter to the rows of one band. Each
+  // band has its own instance because the FilterManager keeps the
+  // current row and mask iterator.
+  class BandFilterManager : public FilterManager {
+  public:
+    BandFilterManager(const Image* src, Image* dst, const Mask* mask,
+                      int x, int w, int offset_x, int offset_y,
+                      Target target, FilterIndexedData* indexedData)
+      : m_src(src), m_dst(dst), m_mask(mask)
+      , m_x(x), m_y(0), m_w(w)
+      , m_offset_x(offset_x), m_offset_y(offset_y)
+      , m_target(target)
+      , m_indexedData(indexedData) {
+    }
+
+    void applyToRow(Filter* filter, PixelFormat pixelFormat, int y) {
+      m_y = y;
+
+      if (m_mask && m_mask->getBitmap()) {
+        int x = m_x - m_mask->getBounds().x + m_offset_x;
+        int y = m_y - m_mask->getBounds().y + m_offset_y;
+
+        m_maskBits = m_mask->getBitmap()
+          ->lockBits<BitmapTraits>(Image::ReadLock,
+                                   gfx::Rect(x, y, m_w, 1));
+        m_maskIterator = m_maskBits.begin();
+      }
+
+      switch (pixelFormat) {
+        case IMAGE_RGB:       filter->applyToRgba(this); break;
+        case IMAGE_GRAYSCALE: filter->applyToGrayscale(this); break;
+        case IMAGE_INDEXED:   filter->applyToIndexed(this); break;
+      }
+    }
+
+    // FilterManager implementation
+    const void* getSourceAddress() OVERRIDE { return m_src->getPixelAddress(m_x, m_y); }
+    void* getDestinationAddress() OVERRIDE { return m_dst->getPixelAddress(m_x, m_y); }
+    int getWidth() OVERRIDE { return m_w; }
+    Target getTarget() OVERRIDE { return m_target; }
+    FilterIndexedData* getIndexedData() OVERRIDE { return m_indexedData; }
+    const Image* getSourceImage() OVERRIDE { return m_src; }
+    int getX() OVERRIDE { return m_x; }
+    int getY() OVERRIDE { return m_y; }
+
+    bool skipPixel() OVERRIDE {
+      bool skip = false;
+
+      if (m_mask && m_mask->getBitmap()) {
+        if (!*m_maskIterator)
+          skip = true;
+
+        ++m_maskIterator;
+      }
+
+      return skip;
+    }
+
+  private:
+    const Image* m_src;
+    Image* m_dst;
+    const Mask* m_mask;
+    int m_x, m_y, m_w;
+    int m_offset_x, m_offset_y;
+    Target m_target;
+    FilterIndexedData* m_indexedData;
+    ImageBits<BitmapTraits> m_maskBits;
+    ImageBits<BitmapTraits>::iterator m_maskIterator;
+  };
+
+  // Function object for base::parallel_for() to filter each band.
+  class FilterBands {
+  public:
+    FilterBands(Filter* filter, PixelFormat pixelFormat,
+                const Image* src, Image* dst, const Mask* mask,
+                int x, int y, int w, int h, int offset_x, int offset_y,
+                Target target, FilterIndexedData* indexedData,
+                FilterBandsProgress& progress)
+      : m_filter(filter), m_pixelFormat(pixelFormat)
+      , m_src(src), m_dst(dst), m_mask(mask)
+      , m_x(x), m_y(y), m_w(w), m_h(h)
+      , m_offset_x(offset_x), m_offset_y(offset_y)
+      , m_target(target), m_indexedData(indexedData)
+      , m_progress(progress) {
+    }
+
+    int getBandsCount() const {
+      return (m_h + kFilterBandHeight - 1) / kFilterBandHeight;
+    }
+
+    // Called from base::parallel_for()
+    void operator()(int i) const {
+      BandFilterManager mgr(m_src, m_dst, m_mask, m_x, m_w,
+                            m_offset_x, m_offset_y,
+                            m_target, m_indexedData);
+
+      int y1 = m_y + i*kFilterBandHeight;
+      int y2 = MIN(y1+kFilterBandHeight, m_y+m_h);
+
+      for (int y=y1; y<y2; ++y) {
+        if (m_progress.isCancelled())
+          return;
+
+        mgr.applyToRow(m_filter, m_pixelFormat, y);
+      }
+
+      m_progress.bandDone(y2-y1);
+    }
+
+  private:
+    Filter* m_filter;
+    PixelFormat m_pixelFormat;
+    const Image* m_src;
+    Image* m_dst;
+    const Mask* m_mask;
+    int m_x, m_y, m_w, m_h;
+    int m_offset_x, m_offset_y;
+    Target m_target;
+    FilterIndexedData* m_indexedData;
+    FilterBandsProgress& m_progress;
+  };
+
+} // anonymous namespace
+
+
 FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   : m_context(context)
   , m_location(context->getActiveLocation())
@@ -195,18 +400,30 @@ bool FilterManagerImpl::applyStep()
 
 void FilterManagerImpl::apply()
 {
-  bool cancelled = false;
-
   begin();
-  while (!cancelled && applyStep()) {
-    if (m_progressDelegate) {
-      // Report progress.
-      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_h);
 
-      // Does the user cancelled the whole process?
-      cancelled = m_progressDelegate->isCancelled();
-    }
-  }
+  // Bands of rows are filtered in parallel, each one with its own
+  // FilterManager (Filter implementations don't modify their own
+  // state in applyTo*() functions).
+  FixedIndexedData indexedData(getPalette(), getRgbMap());
+  FilterBandsProgress progress(m_progressDelegate,
+                               m_progressBase, m_progressWidth, m_h);
+  FilterBands bands(m_filter, m_location.sprite()->getPixelFormat(),
+                    m_src, m_dst, m_mask,
+                    m_x, m_y, m_w, m_h, m_offset_x, m_offset_y,
+                    m_target, &indexedData, progress);
+
+  // The RgbMap must be completely calculated before it's used from
+  // several threads.
+  bool parallel = (m_w*m_h >= kMinParallelPixels);
+  if (parallel && m_location.sprite()->getPixelFormat() == IMAGE_INDEXED)
+    indexedData.getRgbMap()->regenerateAll();
+
+  base::parallel_for(0, bands.getBandsCount(), bands,
+                     (parallel ? 0: 1));
+
+  m_row = m_h;
+  bool cancelled = progress.isCancelled();
 
   if (!cancelled) {
     UndoTransaction undo(m_context, m_filter->getName(), undo::ModifyDocument);
@@ -217,6 +434,7 @@ void FilterManagerImpl::apply()
 
     // Copy "dst" to "src"
     copy_image(m_src, m_dst, 0, 0);
+    m_src->invalidateHash(gfx::Rect(m_x, m_y, m_w, m_h));
 
     undo.commit();
   }
@@ -247,7 +465,11 @@ void FilterManagerImpl::applyToTarget()
   for (ImagesCollector::ItemsIterator it = images.begin();
        it != images.end() && !cancelled;
        ++it) {
-    applyToImage(it->layer(), it->image(), it->cel()->getX(), it->cel()->getY());
+    // Cels that share the image must be filtered independently.
+    Image* image = m_location.document()->getApi()
+      .unshareCelImage(m_location.sprite(), it->cel());
+
+    applyToImage(it->layer(), image, it->cel()->getX(), it->cel()->getY());
 
     // Is there a delegate to know if the process was cancelled by the user?
     if (m_progressDelegate)
@@ -272,6 +494,11 @@ void FilterManagerImpl::flush()
     rect.w = (m_w << editor->getZoom());
     rect.h = (1 << editor->getZoom());
 
+    // The preview image was modified directly (without notifying the
+    // document), so the editor's render cache must be updated.
+    editor->invalidateRenderCache(
+      gfx::Region(gfx::Rect(m_x+m_offset_x, m_y+m_offset_y+m_row-1, m_w, 1)));
+
     gfx::Region reg1(rect);
     gfx::Region reg2;
     editor->getDrawableRegion(reg2, Widget::kCutTopWindows);
@@ -43,6 +43,8 @@
 #include "raster/sprite.h"
 #include "raster/stock.h"
 
+#include <map>
+
 namespace app {
 
 using namespace base;
@@ -370,9 +372,11 @@ void Document::copyLayerContent(const Layer* sourceLayer0, Document* destDoc, La
     const LayerImage* sourceLayer = static_cast<const LayerImage*>(sourceLayer0);
     LayerImage* destLayer = static_cast<LayerImage*>(destLayer0);
 
-    // copy cels
+    // copy cels (images shared by several cels are copied just one
+    // time, so the new cels share them too)
     CelConstIterator it = sourceLayer->getCelBegin();
     CelConstIterator end = sourceLayer->getCelEnd();
+    std::map<int, int> copiedImages;
 
     for (; it != end; ++it) {
       const Cel* sourceCel = *it;
@@ -381,11 +385,18 @@ void Document::copyLayerContent(const Layer* sourceLayer0, Document* destDoc, La
       ASSERT((sourceCel->getImage() >= 0) &&
              (sourceCel->getImage() < sourceLayer->getSprite()->getStock()->size()));
 
-      const Image* sourceImage = sourceLayer->getSprite()->getStock()->getImage(sourceCel->getImage());
-      ASSERT(sourceImage != NULL);
+      std::map<int, int>::iterator copied = copiedImages.find(sourceCel->getImage());
+      if (copied != copiedImages.end()) {
+        newCel->setImage(copied->second);
+      }
+      else {
+        const Image* sourceImage = sourceLayer->getSprite()->getStock()->getImage(sourceCel->getImage());
+        ASSERT(sourceImage != NULL);
 
-      Image* newImage = Image::createCopy(sourceImage);
-      newCel->setImage(destLayer->getSprite()->getStock()->addImage(newImage));
+        Image* newImage = Image::createCopy(sourceImage);
+        newCel->setImage(destLayer->getSprite()->getStock()->addImage(newImage));
+        copiedImages[sourceCel->getImage()] = newCel->getImage();
+      }
 
       destLayer->addCel(newCel);
       newCel.release();
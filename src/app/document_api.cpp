@@ -43,6 +43,7 @@
 #include "app/undoers/remove_palette.h"
 #include "app/undoers/replace_image.h"
 #include "app/undoers/set_cel_frame.h"
+#include "app/undoers/set_cel_image.h"
 #include "app/undoers/set_cel_opacity.h"
 #include "app/undoers/set_cel_position.h"
 #include "app/undoers/set_frame_duration.h"
@@ -73,6 +74,8 @@
 #include "raster/sprite.h"
 #include "raster/stock.h"
 
+#include <vector>
+
 namespace app {
 
 DocumentApi::DocumentApi(Document* document, undo::UndoersCollector* undoers)
@@ -154,8 +157,6 @@ void DocumentApi::trimSprite(Sprite* sprite, color_t bgcolor)
 
 void DocumentApi::setPixelFormat(Sprite* sprite, PixelFormat newFormat, DitheringMethod dithering_method)
 {
-  Image* old_image;
-  Image* new_image;
   int c;
 
   if (sprite->getPixelFormat() == newFormat)
@@ -180,27 +181,37 @@ void DocumentApi::setPixelFormat(Sprite* sprite, PixelFormat newFormat, Ditherin
   if (sprite->getBackgroundLayer() != NULL)
     sprite->getBackgroundLayer()->getCels(bgCels);
 
+  std::vector<int> indexes;
+  std::vector<const Image*> old_images;
+  std::vector<bool> is_image_from_background;
+
   for (c=0; c<sprite->getStock()->size(); c++) {
-    old_image = sprite->getStock()->getImage(c);
+    Image* old_image = sprite->getStock()->getImage(c);
     if (!old_image)
       continue;
 
-    bool is_image_from_background = false;
+    bool from_background = false;
     for (CelList::iterator it=bgCels.begin(), end=bgCels.end(); it != end; ++it) {
       if ((*it)->getImage() == c) {
-        is_image_from_background = true;
+        from_background = true;
         break;
       }
     }
 
-    new_image = quantization::convert_pixel_format
-      (old_image, newFormat, dithering_method, rgbmap,
-       sprite->getPalette(frame),
-       is_image_from_background);
-
-    replaceStockImage(sprite, c, new_image);
+    indexes.push_back(c);
+    old_images.push_back(old_image);
+    is_image_from_background.push_back(from_background);
   }
 
+  // Convert all images at the same time
+  std::vector<Image*> new_images;
+  quantization::convert_pixel_format
+    (old_images, is_image_from_background, newFormat, dithering_method, rgbmap,
+     sprite->getPalette(frame), new_images);
+
+  for (c=0; c<(int)indexes.size(); c++)
+    replaceStockImage(sprite, indexes[c], new_images[c]);
+
   // Change sprite's pixel format.
   if (undoEnabled())
     m_undoers->pushUndoer(new undoers::SetSpritePixelFormat(getObjects(), sprite));
@@ -594,6 +605,16 @@ void DocumentApi::setCelOpacity(Sprite* sprite, Cel* cel, int newOpacity)
   m_document->notifyObservers<DocumentEvent&>(&DocumentObserver::onCelOpacityChanged, ev);
 }
 
+void DocumentApi::setCelImage(Sprite* sprite, Cel* cel, int imageIndex)
+{
+  ASSERT(cel);
+
+  if (undoEnabled())
+    m_undoers->pushUndoer(new undoers::SetCelImage(getObjects(), cel));
+
+  cel->setImage(imageIndex);
+}
+
 void DocumentApi::cropCel(Sprite* sprite, Cel* cel, int x, int y, int w, int h, color_t bgcolor)
 {
   Image* cel_image = sprite->getStock()->getImage(cel->getImage());
@@ -602,8 +623,8 @@ void DocumentApi::cropCel(Sprite* sprite, Cel* cel, int x, int y, int w, int h,
   // create the new image through a crop
   Image* new_image = crop_image(cel_image, x-cel->getX(), y-cel->getY(), w, h, bgcolor);
 
-  // replace the image in the stock that is pointed by the cel
-  replaceStockImage(sprite, cel->getImage(), new_image);
+  // replace the image that is pointed by the cel
+  replaceCelImage(sprite, cel, new_image);
 
   // update the cel's position
   setCelPosition(sprite, cel, x, y);
@@ -662,6 +683,11 @@ void DocumentApi::moveCel(Sprite* sprite,
         newCel->setOpacity(255);
         newCel->setImage(addImageInStock(sprite, dstImage));
       }
+      // Images can be shared only between cels of the same layer.
+      else if (sprite->getImageRefs(srcCel->getImage()) > 1) {
+        Image* srcImage = sprite->getStock()->getImage(srcCel->getImage());
+        newCel->setImage(addImageInStock(sprite, Image::createCopy(srcImage)));
+      }
 
       // Add and the remove, so the Stock's image is reused.
       addCel(dstLayer, newCel);
@@ -698,6 +724,18 @@ void DocumentApi::copyCel(Sprite* sprite,
     int dstCel_y;
     int dstCel_opacity;
 
+    // Copying a cel in the same layer (e.g. duplicating a frame), the
+    // new cel shares the image with the original one (it will be
+    // unshared when one of them is modified).
+    if (srcLayer == dstLayer) {
+      dstCel = new Cel(*srcCel);
+      dstCel->setFrame(dstFrame);
+      addCel(dstLayer, dstCel);
+
+      m_document->notifyCelCopied(srcLayer, srcFrame, dstLayer, dstFrame);
+      return;
+    }
+
     // If we are moving a cel from a transparent layer to the
     // background layer, we have to clear the background of the image.
     if (!srcLayer->isBackground() &&
@@ -890,8 +928,9 @@ void DocumentApi::backgroundFromLayer(LayerImage* layer, color_t bgcolor)
     ASSERT((cel->getImage() > 0) &&
            (cel->getImage() < sprite->getStock()->size()));
 
-    // get the image from the sprite's stock of images
-    Image* cel_image = sprite->getStock()->getImage(cel->getImage());
+    // get the image from the sprite's stock of images (we'll modify
+    // it, so it cannot be shared with other cels)
+    Image* cel_image = unshareCelImage(sprite, cel);
     ASSERT(cel_image);
 
     clear_image(bg_image, bgcolor);
@@ -912,6 +951,7 @@ void DocumentApi::backgroundFromLayer(LayerImage* layer, color_t bgcolor)
           cel_image, 0, 0, cel_image->getWidth(), cel_image->getHeight()));
 
       copy_image(cel_image, bg_image, 0, 0);
+      cel_image->invalidateHash();
     }
     else {
       replaceStockImage(sprite, cel->getImage(), Image::createCopy(bg_image));
@@ -986,7 +1026,7 @@ void DocumentApi::flattenLayers(Sprite* sprite, color_t bgcolor)
 
     cel = background->getCel(frame);
     if (cel) {
-      cel_image = sprite->getStock()->getImage(cel->getImage());
+      cel_image = unshareCelImage(sprite, cel);
       ASSERT(cel_image != NULL);
 
       // We have to save the current state of `cel_image' in the undo.
@@ -1013,6 +1053,7 @@ void DocumentApi::flattenLayers(Sprite* sprite, color_t bgcolor)
     }
 
     copy_image(cel_image, image, 0, 0);
+    cel_image->invalidateHash();
   }
 
   // Delete old layers.
@@ -1094,6 +1135,32 @@ Image* DocumentApi::getCelImage(Sprite* sprite, Cel* cel)
     return NULL;
 }
 
+// Returns the image of the cel to be modified. If the image is shared
+// with other cels, the given cel gets its own copy of the image.
+Image* DocumentApi::unshareCelImage(Sprite* sprite, Cel* cel)
+{
+  Image* image = getCelImage(sprite, cel);
+  if (!image)
+    return NULL;
+
+  if (sprite->getImageRefs(cel->getImage()) > 1) {
+    image = Image::createCopy(image);
+    setCelImage(sprite, cel, addImageInStock(sprite, image));
+  }
+
+  return image;
+}
+
+// Replaces the image of the given cel. If the old image is shared
+// with other cels, it's kept in the stock for them.
+void DocumentApi::replaceCelImage(Sprite* sprite, Cel* cel, Image* newImage)
+{
+  if (sprite->getImageRefs(cel->getImage()) > 1)
+    setCelImage(sprite, cel, addImageInStock(sprite, newImage));
+  else
+    replaceStockImage(sprite, cel->getImage(), newImage);
+}
+
 // Clears the mask region in the current sprite with the specified background color.
 void DocumentApi::clearMask(Layer* layer, Cel* cel, color_t bgcolor)
 {
@@ -1108,12 +1175,15 @@ void DocumentApi::clearMask(Layer* layer, Cel* cel, color_t bgcolor)
   if (!m_document->isMaskVisible()) {
     // If the layer is the background then we clear the image.
     if (layer->isBackground()) {
+      image = unshareCelImage(layer->getSprite(), cel);
+
       if (undoEnabled())
         m_undoers->pushUndoer(new undoers::ImageArea(getObjects(),
           image, 0, 0, image->getWidth(), image->getHeight()));
 
       // clear all
       clear_image(image, bgcolor);
+      image->invalidateHash();
     }
     // If the layer is transparent we can remove the cel (and its
     // associated image).
@@ -1135,6 +1205,8 @@ void DocumentApi::clearMask(Layer* layer, Cel* cel, color_t bgcolor)
     if (x1 > x2 || y1 > y2)
       return;
 
+    image = unshareCelImage(layer->getSprite(), cel);
+
     if (undoEnabled())
       m_undoers->pushUndoer(new undoers::ImageArea(getObjects(),
           image, x1, y1, x2-x1+1, y2-y1+1));
@@ -1155,6 +1227,8 @@ void DocumentApi::clearMask(Layer* layer, Cel* cel, color_t bgcolor)
     }
 
     ASSERT(it == maskBits.end());
+
+    image->invalidateHash(gfx::Rect(x1, y1, x2-x1+1, y2-y1+1));
   }
 }
 
@@ -1170,6 +1244,7 @@ void DocumentApi::flipImage(Image* image, const gfx::Rect& bounds,
 
   // Flip the portion of the bitmap.
   raster::algorithm::flip_image(image, bounds, flipType);
+  image->invalidateHash(bounds);
 }
 
 void DocumentApi::flipImageWithMask(Image* image, const Mask* mask, raster::algorithm::FlipType flipType, color_t bgcolor)
@@ -1189,6 +1264,7 @@ void DocumentApi::flipImageWithMask(Image* image, const Mask* mask, raster::algo
 
   // Copy the flipped image into the image specified as argument.
   copy_image(image, flippedImage, 0, 0);
+  image->invalidateHash();
 }
 
 void DocumentApi::pasteImage(Sprite* sprite, Cel* cel, const Image* src_image, int x, int y, int opacity)
@@ -1199,7 +1275,7 @@ void DocumentApi::pasteImage(Sprite* sprite, Cel* cel, const Image* src_image, i
   Image* cel_image2 = Image::createCopy(cel_image);
   composite_image(cel_image2, src_image, x-cel->getX(), y-cel->getY(), opacity, BLEND_MODE_NORMAL);
 
-  replaceStockImage(sprite, cel->getImage(), cel_image2); // TODO fix this, improve, avoid replacing the whole image
+  replaceCelImage(sprite, cel, cel_image2); // TODO fix this, improve, avoid replacing the whole image
 }
 
 void DocumentApi::copyToCurrentMask(Mask* mask)
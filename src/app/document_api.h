@@ -81,6 +81,7 @@ namespace app {
     void removeCel(LayerImage* layer, Cel* cel);
     void setCelPosition(Sprite* sprite, Cel* cel, int x, int y);
     void setCelOpacity(Sprite* sprite, Cel* cel, int newOpacity);
+    void setCelImage(Sprite* sprite, Cel* cel, int imageIndex);
     void cropCel(Sprite* sprite, Cel* cel, int x, int y, int w, int h, color_t bgcolor);
     void moveCel(Sprite* sprite,
       LayerImage* srcLayer, LayerImage* dstLayer,
@@ -109,6 +110,8 @@ namespace app {
 
     // Image API
     Image* getCelImage(Sprite* sprite, Cel* cel);
+    Image* unshareCelImage(Sprite* sprite, Cel* cel);
+    void replaceCelImage(Sprite* sprite, Cel* cel, Image* newImage);
     void clearMask(Layer* layer, Cel* cel, color_t bgcolor);
     void flipImage(Image* image, const gfx::Rect& bounds, raster::algorithm::FlipType flipType);
     void flipImageWithMask(Image* image, const Mask* mask, raster::algorithm::FlipType flipType, color_t bgcolor);
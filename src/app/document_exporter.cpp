@@ -23,23 +23,30 @@
 #include "app/document_exporter.h"
 
 #include "app/document.h"
-#include "app/document_api.h"
 #include "app/file/file.h"
 #include "base/compiler_specific.h"
+#include "base/parallel_for.h"
 #include "base/path.h"
+#include "base/shared_ptr.h"
 #include "base/unique_ptr.h"
 #include "gfx/size.h"
+#include "raster/algorithm/shrink_bounds.h"
 #include "raster/cel.h"
 #include "raster/dithering_method.h"
 #include "raster/image.h"
 #include "raster/layer.h"
 #include "raster/palette.h"
+#include "raster/primitives.h"
+#include "raster/quantization.h"
 #include "raster/sprite.h"
 #include "raster/stock.h"
 
+#include <algorithm>
+#include <cmath>
 #include <cstdio>
 #include <fstream>
 #include <iostream>
+#include <map>
 
 using namespace raster;
 
@@ -52,7 +59,9 @@ public:
     m_document(document),
     m_sprite(sprite),
     m_frame(frame),
-    m_filename(filename) {
+    m_filename(filename),
+    m_hash(0),
+    m_duplicateOf(NULL) {
   }
 
   Document* document() const { return m_document; }
@@ -63,6 +72,15 @@ public:
   const gfx::Rect& trimmedBounds() const { return m_trimmedBounds; }
   const gfx::Rect& inTextureBounds() const { return m_inTextureBounds; }
 
+  // Rendered frame (only the trimmed bounds) in the texture pixel
+  // format, and its hash to find duplicated frames.
+  const Image* image() const { return m_image.get(); }
+  uint32_t hash() const { return m_hash; }
+
+  // Returns the sample with the same image that is rendered in the
+  // texture (NULL if this is not a duplicate).
+  const Sample* duplicateOf() const { return m_duplicateOf; }
+
   bool trimmed() const {
     return m_trimmedBounds.x > 0
       || m_trimmedBounds.y > 0
@@ -73,6 +91,9 @@ public:
   void setOriginalSize(const gfx::Size& size) { m_originalSize = size; }
   void setTrimmedBounds(const gfx::Rect& bounds) { m_trimmedBounds = bounds; }
   void setInTextureBounds(const gfx::Rect& bounds) { m_inTextureBounds = bounds; }
+  void setImage(Image* image) { m_image.reset(image); }
+  void setHash(uint32_t hash) { m_hash = hash; }
+  void setDuplicateOf(const Sample* sample) { m_duplicateOf = sample; }
 
 private:
   Document* m_document;
@@ -82,6 +103,9 @@ private:
   gfx::Size m_originalSize;
   gfx::Rect m_trimmedBounds;
   gfx::Rect m_inTextureBounds;
+  SharedPtr<Image> m_image;
+  uint32_t m_hash;
+  const Sample* m_duplicateOf;
 };
 
 class DocumentExporter::Samples {
@@ -116,29 +140,233 @@ public:
     const Sprite* oldSprite = NULL;
 
     gfx::Point framePt(0, 0);
+    int rowHeight = 0;
     for (Samples::iterator it=samples.begin(), end=samples.end();
          it != end; ++it) {
-      const Sprite* sprite = it->sprite();
-      gfx::Size size(sprite->getWidth(), sprite->getHeight());
-
-      it->setOriginalSize(size);
-      it->setTrimmedBounds(gfx::Rect(gfx::Point(0, 0), size));
-      it->setInTextureBounds(gfx::Rect(framePt, size));
+      gfx::Size size = it->trimmedBounds().getSize();
 
       // All frames of each sprite in one row.
       if (oldSprite != NULL && oldSprite != it->sprite()) {
         framePt.x = 0;
-        framePt.y += size.h;
-      }
-      else {
-        framePt.x += size.w;
+        framePt.y += rowHeight;
+        rowHeight = 0;
       }
 
+      it->setInTextureBounds(gfx::Rect(framePt, size));
+
+      framePt.x += size.w;
+      rowHeight = MAX(rowHeight, size.h);
       oldSprite = it->sprite();
     }
   }
 };
 
+// Packs the frames with the skyline bottom-left algorithm. Several
+// texture widths are tried and the one with the smallest area is used.
+// Duplicated frames use the texture bounds of the original one.
+class DocumentExporter::PackedLayoutSamples :
+    public DocumentExporter::LayoutSamples {
+public:
+  void layoutSamples(Samples& samples) OVERRIDE {
+    std::vector<Sample*> unique;
+    int maxWidth = 0;
+    double area = 0.0;
+
+    for (Samples::iterator it=samples.begin(), end=samples.end();
+         it != end; ++it) {
+      if (it->duplicateOf())
+        continue;
+
+      const gfx::Rect& bounds = it->trimmedBounds();
+      unique.push_back(&(*it));
+      maxWidth = MAX(maxWidth, bounds.w);
+      area += bounds.w * bounds.h;
+    }
+
+    // Taller frames first.
+    std::sort(unique.begin(), unique.end(), compareSamples);
+
+    std::vector<gfx::Point> positions, bestPositions;
+    int bestWidth = 0, bestHeight = 0;
+    const double factors[] = { 1.0, 1.1, 1.25, 1.5, 2.0 };
+
+    for (int i=-1; i<(int)(sizeof(factors)/sizeof(factors[0])); ++i) {
+      int width = (i < 0 ? maxWidth:
+                   MAX(maxWidth, (int)std::ceil(std::sqrt(area) * factors[i])));
+      int height = packSamples(unique, width, positions);
+
+      if (bestPositions.empty() ||
+          (double)width * height < (double)bestWidth * bestHeight) {
+        bestPositions = positions;
+        bestWidth = width;
+        bestHeight = height;
+      }
+    }
+
+    for (int i=0; i<(int)unique.size(); ++i)
+      unique[i]->setInTextureBounds(
+        gfx::Rect(bestPositions[i], unique[i]->trimmedBounds().getSize()));
+
+    for (Samples::iterator it=samples.begin(), end=samples.end();
+         it != end; ++it) {
+      if (it->duplicateOf())
+        it->setInTextureBounds(it->duplicateOf()->inTextureBounds());
+    }
+  }
+
+private:
+  // Segment of the skyline (the top of the frames already placed).
+  struct Segment {
+    int x, y, w;
+    Segment(int x, int y, int w) : x(x), y(y), w(w) { }
+  };
+
+  static bool compareSamples(const Sample* a, const Sample* b) {
+    const gfx::Rect& ra = a->trimmedBounds();
+    const gfx::Rect& rb = b->trimmedBounds();
+    if (ra.h != rb.h)
+      return ra.h > rb.h;
+    return ra.w > rb.w;
+  }
+
+  // Returns the height of the texture used to place all the samples
+  // in a texture with the given width.
+  static int packSamples(const std::vector<Sample*>& samples, int width,
+                         std::vector<gfx::Point>& positions) {
+    std::vector<Segment> skyline(1, Segment(0, 0, width));
+    int height = 0;
+
+    positions.resize(samples.size());
+
+    for (int i=0; i<(int)samples.size(); ++i) {
+      const gfx::Rect& bounds = samples[i]->trimmedBounds();
+      int bestIndex = -1;
+      int bestY = 0;
+
+      // Find the lowest position (the leftmost one for equal heights).
+      for (int j=0; j<(int)skyline.size(); ++j) {
+        if (skyline[j].x + bounds.w > width)
+          break;
+
+        int y = 0;
+        for (int k=j, remaining=bounds.w; remaining > 0; ++k) {
+          y = MAX(y, skyline[k].y);
+          remaining -= skyline[k].w;
+        }
+
+        if (bestIndex < 0 || y < bestY) {
+          bestIndex = j;
+          bestY = y;
+        }
+      }
+
+      ASSERT(bestIndex >= 0);
+      int x = skyline[bestIndex].x;
+      positions[i] = gfx::Point(x, bestY);
+      height = MAX(height, bestY + bounds.h);
+
+      // Replace the covered segments with the top of the new frame.
+      int right = x + bounds.w;
+      int k = bestIndex;
+      while (k < (int)skyline.size() && skyline[k].x + skyline[k].w <= right)
+        ++k;
+      if (k < (int)skyline.size() && skyline[k].x < right) {
+        skyline[k].w -= right - skyline[k].x;
+        skyline[k].x = right;
+      }
+      skyline.erase(skyline.begin()+bestIndex, skyline.begin()+k);
+      skyline.insert(skyline.begin()+bestIndex, Segment(x, bestY + bounds.h, bounds.w));
+
+      // Merge segments with the same height.
+      for (k=(int)skyline.size()-1; k > 0; --k) {
+        if (skyline[k-1].y == skyline[k].y) {
+          skyline[k-1].w += skyline[k].w;
+          skyline.erase(skyline.begin()+k);
+        }
+      }
+    }
+
+    return height;
+  }
+};
+
+// Renders each sample in its own image (converted to the texture
+// pixel format and trimmed).
+class DocumentExporter::RenderSamples {
+public:
+  RenderSamples(const std::vector<Sample*>& samples,
+                PixelFormat pixelFormat, bool trim)
+    : m_samples(samples)
+    , m_pixelFormat(pixelFormat)
+    , m_trim(trim) {
+  }
+
+  // Called from base::parallel_for()
+  void operator()(int i) const {
+    Sample* sample = m_samples[i];
+    const Sprite* sprite = sample->sprite();
+    gfx::Size size(sprite->getWidth(), sprite->getHeight());
+
+    base::UniquePtr<Image> image(Image::create(sprite->getPixelFormat(), size.w, size.h));
+    image->setMaskColor(sprite->getTransparentColor());
+    sprite->render(image, 0, 0, sample->frame());
+
+    // Make the image compatible with the texture (the source sprite
+    // is not modified).
+    if (image->getPixelFormat() != m_pixelFormat) {
+      image.reset(quantization::convert_pixel_format(
+          image, m_pixelFormat, DITHERING_NONE, NULL,
+          sprite->getPalette(sample->frame()),
+          sprite->getBackgroundLayer() != NULL));
+    }
+
+    gfx::Rect bounds(gfx::Point(0, 0), size);
+    if (m_trim) {
+      color_t transparent = (m_pixelFormat == IMAGE_INDEXED ?
+                             sprite->getTransparentColor(): 0);
+
+      // Completely transparent frames are trimmed to one pixel.
+      if (!algorithm::shrink_bounds(image, bounds, transparent))
+        bounds = gfx::Rect(0, 0, 1, 1);
+
+      if (bounds != image->getBounds())
+        image.reset(crop_image(image, bounds.x, bounds.y, bounds.w, bounds.h, transparent));
+    }
+
+    sample->setOriginalSize(size);
+    sample->setTrimmedBounds(bounds);
+    sample->setHash(calculate_image_hash(image));
+    sample->setImage(image.release());
+  }
+
+private:
+  const std::vector<Sample*>& m_samples;
+  PixelFormat m_pixelFormat;
+  bool m_trim;
+};
+
+// Copies the image of each sample in its place of the texture (the
+// bounds in the texture of two samples never overlap).
+class DocumentExporter::CopySamples {
+public:
+  CopySamples(const std::vector<const Sample*>& samples, Image* textureImage)
+    : m_samples(samples)
+    , m_textureImage(textureImage) {
+  }
+
+  // Called from base::parallel_for()
+  void operator()(int i) const {
+    const Sample* sample = m_samples[i];
+    copy_image(m_textureImage, sample->image(),
+               sample->inTextureBounds().x,
+               sample->inTextureBounds().y);
+  }
+
+private:
+  const std::vector<const Sample*>& m_samples;
+  Image* m_textureImage;
+};
+
 void DocumentExporter::exportSheet()
 {
   // We output the metadata to std::cout if the user didn't specify a file.
@@ -157,13 +385,26 @@ void DocumentExporter::exportSheet()
   Samples samples;
   captureSamples(samples);
 
-  // 2) Layout those samples in a texture field.
-  SimpleLayoutSamples layout;
-  layout.layoutSamples(samples);
+  // 2) Render each sample (in parallel) in the texture pixel format.
+  Palette* palette = NULL;
+  PixelFormat pixelFormat = getTexturePixelFormat(samples, &palette);
+  renderSamples(samples, pixelFormat);
+
+  // 3) Layout those samples in a texture field.
+  if (m_layoutMode == PackedLayoutMode) {
+    findDuplicatedSamples(samples);
 
-  // 3) Create and render the texture.
+    PackedLayoutSamples layout;
+    layout.layoutSamples(samples);
+  }
+  else {
+    SimpleLayoutSamples layout;
+    layout.layoutSamples(samples);
+  }
+
+  // 4) Create and render the texture.
   base::UniquePtr<Document> textureDocument(
-    createEmptyTexture(samples));
+    createEmptyTexture(samples, pixelFormat, palette));
 
   Sprite* texture = textureDocument->getSprite();
   Image* textureImage = texture->getStock()->getImage(
@@ -214,12 +455,10 @@ void DocumentExporter::captureSamples(Samples& samples)
   }
 }
 
-Document* DocumentExporter::createEmptyTexture(const Samples& samples)
+PixelFormat DocumentExporter::getTexturePixelFormat(const Samples& samples, Palette** palette)
 {
-  Palette* palette = NULL;
   PixelFormat pixelFormat = IMAGE_INDEXED;
-  gfx::Rect fullTextureBounds;
-  int maxColors = 256;
+  *palette = NULL;
 
   for (Samples::const_iterator
          it = samples.begin(),
@@ -227,21 +466,68 @@ Document* DocumentExporter::createEmptyTexture(const Samples& samples)
     // We try to render an indexed image. But if we find a sprite with
     // two or more palettes, or two of the sprites have different
     // palettes, we've to use RGB format.
-    if (pixelFormat == IMAGE_INDEXED) {
-      if (it->sprite()->getPixelFormat() != IMAGE_INDEXED) {
-        pixelFormat = IMAGE_RGB;
-      }
-      else if (it->sprite()->getPalettes().size() > 1) {
-        pixelFormat = IMAGE_RGB;
-      }
-      else if (palette != NULL
-        && palette->countDiff(it->sprite()->getPalette(FrameNumber(0)), NULL, NULL) > 0) {
-        pixelFormat = IMAGE_RGB;
+    if (it->sprite()->getPixelFormat() != IMAGE_INDEXED) {
+      pixelFormat = IMAGE_RGB;
+    }
+    else if (it->sprite()->getPalettes().size() > 1) {
+      pixelFormat = IMAGE_RGB;
+    }
+    else if (*palette != NULL
+      && (*palette)->countDiff(it->sprite()->getPalette(FrameNumber(0)), NULL, NULL) > 0) {
+      pixelFormat = IMAGE_RGB;
+    }
+    else
+      *palette = it->sprite()->getPalette(FrameNumber(0));
+
+    if (pixelFormat != IMAGE_INDEXED) {
+      *palette = NULL;
+      break;
+    }
+  }
+
+  return pixelFormat;
+}
+
+void DocumentExporter::renderSamples(Samples& samples, PixelFormat pixelFormat)
+{
+  std::vector<Sample*> list;
+  for (Samples::iterator it=samples.begin(), end=samples.end(); it != end; ++it)
+    list.push_back(&(*it));
+
+  base::parallel_for(0, (int)list.size(),
+                     RenderSamples(list, pixelFormat, m_trimFrames));
+}
+
+void DocumentExporter::findDuplicatedSamples(Samples& samples)
+{
+  // Samples with the same hash are compared pixel by pixel.
+  typedef std::multimap<uint32_t, const Sample*> HashMap;
+  HashMap hashes;
+
+  for (Samples::iterator it=samples.begin(), end=samples.end(); it != end; ++it) {
+    std::pair<HashMap::iterator, HashMap::iterator> range =
+      hashes.equal_range(it->hash());
+
+    for (HashMap::iterator it2=range.first; it2 != range.second; ++it2) {
+      if (is_same_image(it->image(), it2->second->image())) {
+        it->setDuplicateOf(it2->second);
+        break;
       }
-      else
-        palette = it->sprite()->getPalette(FrameNumber(0));
     }
 
+    if (!it->duplicateOf())
+      hashes.insert(std::make_pair(it->hash(), &(*it)));
+  }
+}
+
+Document* DocumentExporter::createEmptyTexture(const Samples& samples, PixelFormat pixelFormat, Palette* palette)
+{
+  gfx::Rect fullTextureBounds;
+  int maxColors = 256;
+
+  for (Samples::const_iterator
+         it = samples.begin(),
+         end = samples.end(); it != end; ++it) {
     fullTextureBounds = fullTextureBounds.createUnion(it->inTextureBounds());
   }
 
@@ -256,24 +542,15 @@ Document* DocumentExporter::createEmptyTexture(const Samples& samples)
 
 void DocumentExporter::renderTexture(const Samples& samples, Image* textureImage)
 {
-  textureImage->clear(0);
+  std::vector<const Sample*> list;
+  for (Samples::const_iterator it=samples.begin(), end=samples.end(); it != end; ++it) {
+    if (!it->duplicateOf())
+      list.push_back(&(*it));
+  }
 
-  for (Samples::const_iterator
-         it = samples.begin(),
-         end = samples.end(); it != end; ++it) {
-    // Make the sprite compatible with the texture so the render()
-    // works correctly.
-    if (it->sprite()->getPixelFormat() != textureImage->getPixelFormat()) {
-      DocumentApi docApi(it->document(), NULL); // DocumentApi without undo
-      docApi.setPixelFormat(it->sprite(), textureImage->getPixelFormat(),
-        DITHERING_NONE);
-    }
+  textureImage->clear(0);
 
-    it->sprite()->render(textureImage,
-      it->inTextureBounds().x - it->trimmedBounds().x,
-      it->inTextureBounds().y - it->trimmedBounds().y,
-      it->frame());
-  }
+  base::parallel_for(0, (int)list.size(), CopySamples(list, textureImage));
 }
 
 void DocumentExporter::createDataFile(const Samples& samples, std::ostream& os, Image* textureImage)
@@ -22,6 +22,7 @@
 
 #include "base/disable_copying.h"
 #include "gfx/fwd.h"
+#include "raster/pixel_format.h"
 
 #include <iosfwd>
 #include <vector>
@@ -29,6 +30,7 @@
 
 namespace raster {
   class Image;
+  class Palette;
 }
 
 namespace app {
@@ -50,10 +52,18 @@ namespace app {
       DefaultScaleMode
     };
 
+    enum LayoutMode {
+      SimpleLayoutMode,         // All frames of each sprite in one row
+      PackedLayoutMode,         // Pack frames (without duplicates) in the smallest texture
+      DefaultLayoutMode = SimpleLayoutMode
+    };
+
     DocumentExporter() :
       m_dataFormat(DefaultDataFormat),
       m_textureFormat(DefaultTextureFormat),
-      m_scaleMode(DefaultScaleMode) {
+      m_scaleMode(DefaultScaleMode),
+      m_layoutMode(DefaultLayoutMode),
+      m_trimFrames(false) {
     }
 
     void setDataFormat(DataFormat format) {
@@ -80,6 +90,16 @@ namespace app {
       m_scaleMode = mode;
     }
 
+    void setLayoutMode(LayoutMode mode) {
+      m_layoutMode = mode;
+    }
+
+    // Removes the transparent borders of each frame in the texture
+    // (the data file contains the trimmed bounds of each frame).
+    void setTrimFrames(bool trim) {
+      m_trimFrames = trim;
+    }
+
     void addDocument(Document* document) {
       m_documents.push_back(document);
     }
@@ -91,9 +111,15 @@ namespace app {
     class Samples;
     class LayoutSamples;
     class SimpleLayoutSamples;
+    class PackedLayoutSamples;
+    class RenderSamples;
+    class CopySamples;
 
     void captureSamples(Samples& samples);
-    Document* createEmptyTexture(const Samples& samples);
+    raster::PixelFormat getTexturePixelFormat(const Samples& samples, raster::Palette** palette);
+    void renderSamples(Samples& samples, raster::PixelFormat pixelFormat);
+    void findDuplicatedSamples(Samples& samples);
+    Document* createEmptyTexture(const Samples& samples, raster::PixelFormat pixelFormat, raster::Palette* palette);
     void renderTexture(const Samples& samples, raster::Image* textureImage);
     void createDataFile(const Samples& samples, std::ostream& os, raster::Image* textureImage);
 
@@ -103,6 +129,8 @@ namespace app {
     std::string m_textureFilename;
     double m_scale;
     ScaleMode m_scaleMode;
+    LayoutMode m_layoutMode;
+    bool m_trimFrames;
     std::vector<Document*> m_documents;
 
     DISABLE_COPYING(DocumentExporter);
@@ -24,13 +24,25 @@
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
+#include "app/ini_file.h"
 #include "base/cfile.h"
 #include "base/exception.h"
 #include "base/file_handle.h"
+#include "base/mutex.h"
+#include "base/parallel_for.h"
+#include "base/scoped_lock.h"
+#include "base/shared_ptr.h"
+#include "base/unique_ptr.h"
 #include "raster/raster.h"
 #include "zlib.h"
 
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <stdexcept>
 #include <stdio.h>
+#include <string>
+#include <vector>
 
 #define ASE_FILE_MAGIC                  0xA5E0
 #define ASE_FILE_FRAME_MAGIC            0xF1FA
@@ -80,6 +92,101 @@ struct ASE_Chunk {
   int start;
 };
 
+// The .ase file kept open to read the compressed cels when they are
+// used (FILE_LOAD_LAZY). It's shared by all the AseCelLoaders of a
+// sprite, which can be used (and deleted) from several threads, so
+// the file and the counter of references are used with the mutex
+// locked. The file is closed when the last reference is released.
+class AseLazyFile {
+public:
+  AseLazyFile(const FileHandle& file) : m_file(file), m_refs(1) { }
+
+  void addRef();
+  void release();
+
+  // Reads "size" bytes from "offset" (less bytes if the file was
+  // truncated).
+  void read(long offset, size_t size, std::vector<uint8_t>& data);
+
+  struct Release {
+    void operator()(AseLazyFile* file) { file->release(); }
+  };
+
+private:
+  FileHandle m_file;
+  base::mutex m_mutex;
+  int m_refs;
+};
+
+// Reads and decompresses the pixels of a cel the first time that its
+// image is used (FILE_LOAD_LAZY), so only the cels that are used
+// consume memory.
+class AseCelLoader : public StockImageLoader {
+public:
+  AseCelLoader(AseLazyFile* file, long offset, size_t size,
+               PixelFormat pixelFormat, int width, int height,
+               const std::string& name)
+    : m_file(file)
+    , m_offset(offset)
+    , m_size(size)
+    , m_pixelFormat(pixelFormat)
+    , m_width(width)
+    , m_height(height)
+    , m_name(name) {
+    m_file->addRef();
+  }
+
+  ~AseCelLoader() {
+    m_file->release();
+  }
+
+  Image* loadImage(std::string& error) OVERRIDE;
+
+private:
+  AseLazyFile* m_file;
+  long m_offset;                // Position of the compressed data in the file
+  size_t m_size;
+  PixelFormat m_pixelFormat;
+  int m_width;
+  int m_height;
+  std::string m_name;           // Layer and frame of the cel (for errors)
+};
+
+// Compressed cels read from the file. They are decompressed with
+// several threads in batches (to limit the memory used by the
+// compressed data).
+class ASE_DecompressQueue {
+public:
+  ASE_DecompressQueue(FileOp* fop) : m_fop(fop), m_bytes(0) { }
+
+  // Adds the image to be decompressed (the data is swapped).
+  void add(Image* image, std::vector<uint8_t>& data);
+
+  // Decompresses all images in the queue.
+  void flush();
+
+private:
+  FileOp* m_fop;
+  std::vector<Image*> m_images;
+  std::deque<std::vector<uint8_t> > m_data;
+  size_t m_bytes;
+};
+
+// Compressed pixels of the images used in the next frames to be
+// saved (they are compressed in parallel).
+typedef std::map<const Image*, std::vector<uint8_t> > ASE_CompressedImages;
+
+// Cels are compressed/decompressed with several threads only if
+// there are enough pixels.
+const int kParallelCelsPixels = 256*256;
+
+// Maximum number of compressed bytes read before decompressing them.
+const size_t kMaxDecompressQueueBytes = 32*1024*1024;
+
+// Limits of each batch of images compressed in parallel.
+const int kCompressBatchImages = 64;
+const int kCompressBatchPixels = 4096*4096;
+
 static bool ase_file_read_header(FILE* f, ASE_Header* header);
 static void ase_file_prepare_header(FILE* f, ASE_Header* header, const Sprite* sprite);
 static void ase_file_write_header(FILE* f, ASE_Header* header);
@@ -90,7 +197,8 @@ static void ase_file_prepare_frame_header(FILE* f, ASE_FrameHeader* frame_header
 static void ase_file_write_frame_header(FILE* f, ASE_FrameHeader* frame_header);
 
 static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, Layer* layer);
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, FrameNumber frame);
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, FrameNumber frame, const ASE_CompressedImages& compressed);
+static FrameNumber ase_file_compress_cels(Sprite* sprite, FrameNumber from, int level, ASE_CompressedImages& compressed);
 
 static void ase_file_read_padding(FILE* f, int bytes);
 static void ase_file_write_padding(FILE* f, int bytes);
@@ -105,8 +213,9 @@ static Palette* ase_file_read_color2_chunk(FILE* f, Sprite* sprite, FrameNumber
 static void ase_file_write_color2_chunk(FILE* f, ASE_FrameHeader* frame_header, Palette* pal);
 static Layer* ase_file_read_layer_chunk(FILE* f, Sprite* sprite, Layer** previous_layer, int* current_level);
 static void ase_file_write_layer_chunk(FILE* f, ASE_FrameHeader* frame_header, Layer* layer);
-static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end);
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite);
+static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame, PixelFormat pixelFormat, FileOp* fop, ASE_Header* header, size_t chunk_end, AseLazyFile* lazyFile, ASE_DecompressQueue* queue);
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite, const ASE_CompressedImages& compressed);
+static Cel* ase_file_get_linked_cel(LayerImage* layer, Cel* cel);
 static Mask* ase_file_read_mask_chunk(FILE* f);
 static void ase_file_write_mask_chunk(FILE* f, ASE_FrameHeader* frame_header, Mask* mask);
 
@@ -126,6 +235,12 @@ private:
 };
 
 class AseFormat : public FileFormat {
+  // Data for ASE files
+  class AseOptions : public FormatOptions {
+  public:
+    int compressionLevel;       // ZLib compression level of cels
+  };
+
   const char* onGetName() const { return "ase"; }
   const char* onGetExtensions() const { return "ase,aseprite"; }
   int onGetFlags() const {
@@ -139,13 +254,16 @@ class AseFormat : public FileFormat {
       FILE_SUPPORT_INDEXED |
       FILE_SUPPORT_LAYERS |
       FILE_SUPPORT_FRAMES |
-      FILE_SUPPORT_PALETTES;
+      FILE_SUPPORT_PALETTES |
+      FILE_SUPPORT_GET_FORMAT_OPTIONS;
   }
 
   bool onLoad(FileOp* fop) OVERRIDE;
 #ifdef ENABLE_SAVE
   bool onSave(FileOp* fop) OVERRIDE;
 #endif
+
+  SharedPtr<FormatOptions> onGetFormatOptions(FileOp* fop) OVERRIDE;
 };
 
 FileFormat* CreateAseFormat()
@@ -183,6 +301,12 @@ bool AseFormat::onLoad(FileOp* fop)
   Layer* last_layer = sprite->getFolder();
   int current_level = -1;
 
+  ASE_DecompressQueue queue(fop);
+
+  // Compressed cels are read later by the loaders of lazy cels.
+  UniquePtr<AseLazyFile, AseLazyFile::Release> lazyFile(
+    fop->lazy ? new AseLazyFile(f): NULL, AseLazyFile::Release());
+
   /* read frame by frame to end-of-file */
   for (FrameNumber frame(0); frame<sprite->getTotalFrames(); ++frame) {
     /* start frame position */
@@ -247,7 +371,7 @@ bool AseFormat::onLoad(FileOp* fop)
 
             ase_file_read_cel_chunk(f, sprite, frame,
                                     sprite->getPixelFormat(), fop, &header,
-                                    chunk_pos+chunk_size);
+                                    chunk_pos+chunk_size, lazyFile, &queue);
             break;
           }
 
@@ -290,6 +414,9 @@ bool AseFormat::onLoad(FileOp* fop)
       break;
   }
 
+  // Decompress the last cels
+  queue.flush();
+
   fop->document = new Document(sprite);
 
   if (ferror(f)) {
@@ -312,8 +439,20 @@ bool AseFormat::onSave(FileOp* fop)
   ase_file_prepare_header(f, &header, sprite);
   ase_file_write_header(f, &header);
 
+  int compression_level = Z_DEFAULT_COMPRESSION;
+  SharedPtr<AseOptions> ase_options = fop->seq.format_options;
+  if (ase_options)
+    compression_level = ase_options->compressionLevel;
+
+  ASE_CompressedImages compressed;
+  FrameNumber compressed_end(0);
+
   // Write frames
   for (FrameNumber frame(0); frame<sprite->getTotalFrames(); ++frame) {
+    // Compress the cels of the next frames
+    if (frame >= compressed_end)
+      compressed_end = ase_file_compress_cels(sprite, frame, compression_level, compressed);
+
     // Prepare the frame header
     ASE_FrameHeader frame_header;
     ase_file_prepare_frame_header(f, &frame_header);
@@ -340,7 +479,7 @@ bool AseFormat::onSave(FileOp* fop)
     }
 
     // Write cel chunks
-    ase_file_write_cels(f, &frame_header, sprite, sprite->getFolder(), frame);
+    ase_file_write_cels(f, &frame_header, sprite, sprite->getFolder(), frame, compressed);
 
     // Write the frame header
     ase_file_write_frame_header(f, &frame_header);
@@ -366,6 +505,14 @@ bool AseFormat::onSave(FileOp* fop)
 }
 #endif
 
+SharedPtr<FormatOptions> AseFormat::onGetFormatOptions(FileOp* fop)
+{
+  SharedPtr<AseOptions> ase_options(new AseOptions());
+  ase_options->compressionLevel =
+    MID(-1, get_config_int("ASE", "CompressionLevel", Z_DEFAULT_COMPRESSION), 9);
+  return ase_options;
+}
+
 static bool ase_file_read_header(FILE* f, ASE_Header* header)
 {
   header->pos = ftell(f);
@@ -503,7 +650,8 @@ static void ase_file_write_layers(FILE* f, ASE_FrameHeader* frame_header, Layer*
   }
 }
 
-static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, FrameNumber frame)
+static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite* sprite, Layer* layer, FrameNumber frame,
+                                const ASE_CompressedImages& compressed)
 {
   if (layer->isImage()) {
     Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame);
@@ -511,7 +659,7 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite*
 /*       fop_error(fop, "New cel in frame %d, in layer %d\n", */
 /*                   frame, sprite_layer2index(sprite, layer)); */
 
-      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite);
+      ase_file_write_cel_chunk(f, frame_header, cel, static_cast<LayerImage*>(layer), sprite, compressed);
     }
   }
 
@@ -520,7 +668,7 @@ static void ase_file_write_cels(FILE* f, ASE_FrameHeader* frame_header, Sprite*
     LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
 
     for (; it != end; ++it)
-      ase_file_write_cels(f, frame_header, sprite, *it, frame);
+      ase_file_write_cels(f, frame_header, sprite, *it, frame, compressed);
   }
 }
 
@@ -872,8 +1020,9 @@ static void write_raw_image(FILE* f, Image* image)
 // Compressed Image
 //////////////////////////////////////////////////////////////////////
 
+// Compresses the pixels of an image in memory.
 template<typename ImageTraits>
-static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileOp* fop, ASE_Header* header)
+static void compress_image(const Image* image, int level, std::vector<uint8_t>& output)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -882,73 +1031,66 @@ static void read_compressed_image(FILE* f, Image* image, size_t chunk_end, FileO
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-
-  err = inflateInit(&zstream);
+  err = deflateInit(&zstream, level);
   if (err != Z_OK)
-    throw base::Exception("ZLib error %d in inflateInit().", err);
+    throw base::Exception("ZLib error %d in deflateInit().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->getWidth()));
-  std::vector<uint8_t> uncompressed(image->getHeight() * ImageTraits::getRowStrideBytes(image->getWidth()));
   std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
 
-  while (true) {
-    size_t input_bytes;
-
-    if (ftell(f)+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - ftell(f); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
+  for (y=0; y<image->getHeight(); y++) {
+    typename ImageTraits::address_t address =
+      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
 
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
-    }
-    else
-      input_bytes = compressed.size();
+    pixel_io.write_scanline(address, image->getWidth(), &scanline[0]);
 
-    size_t bytes_read = fread(&compressed[0], 1, input_bytes, f);
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
+    zstream.next_in = (Bytef*)&scanline[0];
+    zstream.avail_in = scanline.size();
+    int flush = (y == image->getHeight()-1 ? Z_FINISH: Z_NO_FLUSH);
 
     do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
-
-      err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in inflate().", err);
-
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
-
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
+      zstream.next_out = (Bytef*)&compressed[0];
+      zstream.avail_out = compressed.size();
 
-        uncompressed_offset += uncompressed_bytes;
+      // Compress
+      err = deflate(&zstream, flush);
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
+        throw base::Exception("ZLib error %d in deflate().", err);
       }
-    } while (zstream.avail_out == 0);
 
-    fop_progress(fop, (float)ftell(f) / (float)header->size);
+      int output_bytes = compressed.size() - zstream.avail_out;
+      if (output_bytes > 0)
+        output.insert(output.end(), compressed.begin(), compressed.begin()+output_bytes);
+    } while (zstream.avail_out == 0);
   }
 
-  uncompressed_offset = 0;
-  for (y=0; y<image->getHeight(); y++) {
-    typename ImageTraits::address_t address =
-      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
+  err = deflateEnd(&zstream);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in deflateEnd().", err);
+}
 
-    pixel_io.read_scanline(address, image->getWidth(), &uncompressed[uncompressed_offset]);
+static void compress_image(const Image* image, int level, std::vector<uint8_t>& output)
+{
+  switch (image->getPixelFormat()) {
 
-    uncompressed_offset += ImageTraits::getRowStrideBytes(image->getWidth());
-  }
+    case IMAGE_RGB:
+      compress_image<RgbTraits>(image, level, output);
+      break;
 
-  err = inflateEnd(&zstream);
-  if (err != Z_OK)
-    throw base::Exception("ZLib error %d in inflateEnd().", err);
+    case IMAGE_GRAYSCALE:
+      compress_image<GrayscaleTraits>(image, level, output);
+      break;
+
+    case IMAGE_INDEXED:
+      compress_image<IndexedTraits>(image, level, output);
+      break;
+  }
 }
 
+// Decompresses the pixels of a cel from memory.
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, Image* image)
+static void inflate_image(const uint8_t* data, size_t size, Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -957,44 +1099,200 @@ static void write_compressed_image(FILE* f, Image* image)
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-  err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+
+  err = inflateInit(&zstream);
   if (err != Z_OK)
-    throw base::Exception("ZLib error %d in deflateInit().", err);
+    throw base::Exception("ZLib error %d in inflateInit().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->getWidth()));
-  std::vector<uint8_t> compressed(4096);
+
+  zstream.next_in = (Bytef*)data;
+  zstream.avail_in = size;
 
   for (y=0; y<image->getHeight(); y++) {
+    zstream.next_out = (Bytef*)&scanline[0];
+    zstream.avail_out = scanline.size();
+
+    err = inflate(&zstream, Z_SYNC_FLUSH);
+    if ((err != Z_OK && err != Z_STREAM_END) || zstream.avail_out != 0) {
+      inflateEnd(&zstream);
+      if (err != Z_OK && err != Z_STREAM_END)
+        throw base::Exception("ZLib error %d in inflate().", err);
+      else
+        throw base::Exception("Bad compressed image.");
+    }
+
     typename ImageTraits::address_t address =
       (typename ImageTraits::address_t)image->getPixelAddress(0, y);
 
-    pixel_io.write_scanline(address, image->getWidth(), &scanline[0]);
+    pixel_io.read_scanline(address, image->getWidth(), &scanline[0]);
+  }
 
-    zstream.next_in = (Bytef*)&scanline[0];
-    zstream.avail_in = scanline.size();
-    int flush = (y == image->getHeight()-1 ? Z_FINISH: Z_NO_FLUSH);
+  err = inflateEnd(&zstream);
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in inflateEnd().", err);
+}
 
-    do {
-      zstream.next_out = (Bytef*)&compressed[0];
-      zstream.avail_out = compressed.size();
+static void inflate_image(const uint8_t* data, size_t size, Image* image)
+{
+  switch (image->getPixelFormat()) {
 
-      // Compress
-      err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in deflate().", err);
+    case IMAGE_RGB:
+      inflate_image<RgbTraits>(data, size, image);
+      break;
 
-      int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
-      }
-    } while (zstream.avail_out == 0);
+    case IMAGE_GRAYSCALE:
+      inflate_image<GrayscaleTraits>(data, size, image);
+      break;
+
+    case IMAGE_INDEXED:
+      inflate_image<IndexedTraits>(data, size, image);
+      break;
   }
+}
 
-  err = deflateEnd(&zstream);
-  if (err != Z_OK)
-    throw base::Exception("ZLib error %d in deflateEnd().", err);
+void AseLazyFile::addRef()
+{
+  base::scoped_lock hold(m_mutex);
+  ++m_refs;
+}
+
+void AseLazyFile::release()
+{
+  bool last;
+  {
+    base::scoped_lock hold(m_mutex);
+    last = (--m_refs == 0);
+  }
+  if (last)
+    delete this;
+}
+
+void AseLazyFile::read(long offset, size_t size, std::vector<uint8_t>& data)
+{
+  base::scoped_lock hold(m_mutex);
+
+  data.resize(size);
+  if (size > 0 && fseek(m_file, offset, SEEK_SET) == 0)
+    data.resize(fread(&data[0], 1, size, m_file));
+  else
+    data.clear();
+}
+
+Image* AseCelLoader::loadImage(std::string& error)
+{
+  UniquePtr<Image> image(Image::create(m_pixelFormat, m_width, m_height));
+  clear_image(image, 0);
+
+  // Like in ASE_DecompressQueue, a corrupted cel is not fatal (we
+  // keep the pixels that were decompressed).
+  try {
+    // Only the file access is serialized, cels are decompressed at
+    // the same time.
+    std::vector<uint8_t> data;
+    m_file->read(m_offset, m_size, data);
+
+    if (!data.empty())
+      inflate_image(&data[0], data.size(), image);
+    else
+      throw base::Exception("Bad compressed image.");
+  }
+  catch (const std::exception& e) {
+    error = m_name + ": " + e.what();
+  }
+
+  return image.release();
+}
+
+namespace {
+
+  // Decompresses each image of the queue (called from several
+  // threads).
+  class InflateImages {
+  public:
+    InflateImages(const std::vector<Image*>& images,
+                  const std::deque<std::vector<uint8_t> >& data,
+                  std::vector<std::string>& errors)
+      : m_images(images)
+      , m_data(data)
+      , m_errors(errors) {
+    }
+
+    void operator()(int i) const {
+      const std::vector<uint8_t>& data = m_data[i];
+      try {
+        if (!data.empty())
+          inflate_image(&data[0], data.size(), m_images[i]);
+        else
+          throw base::Exception("Bad compressed image.");
+      }
+      catch (const std::exception& e) {
+        m_errors[i] = e.what();
+      }
+    }
+
+  private:
+    const std::vector<Image*>& m_images;
+    const std::deque<std::vector<uint8_t> >& m_data;
+    std::vector<std::string>& m_errors;
+  };
+
+  // Compresses each image of a batch (called from several threads).
+  class CompressImages {
+  public:
+    CompressImages(const std::vector<const Image*>& images, int level,
+                   std::vector<std::vector<uint8_t> >& output)
+      : m_images(images)
+      , m_level(level)
+      , m_output(output) {
+    }
+
+    void operator()(int i) const {
+      compress_image(m_images[i], m_level, m_output[i]);
+    }
+
+  private:
+    const std::vector<const Image*>& m_images;
+    int m_level;
+    std::vector<std::vector<uint8_t> >& m_output;
+  };
+
+} // anonymous namespace
+
+void ASE_DecompressQueue::add(Image* image, std::vector<uint8_t>& data)
+{
+  m_images.push_back(image);
+  m_data.push_back(std::vector<uint8_t>());
+  m_data.back().swap(data);
+  m_bytes += m_data.back().size();
+
+  if (m_bytes >= kMaxDecompressQueueBytes)
+    flush();
+}
+
+void ASE_DecompressQueue::flush()
+{
+  if (m_images.empty())
+    return;
+
+  int pixels = 0;
+  for (size_t i=0; i<m_images.size() && pixels < kParallelCelsPixels; ++i)
+    pixels += m_images[i]->getWidth() * m_images[i]->getHeight();
+
+  std::vector<std::string> errors(m_images.size());
+  base::parallel_for(0, (int)m_images.size(),
+                     InflateImages(m_images, m_data, errors),
+                     (pixels >= kParallelCelsPixels ? 0: 1));
+
+  // OK, in case of error we can show the problem, but continue
+  // loading more cels.
+  for (size_t i=0; i<errors.size(); ++i)
+    if (!errors[i].empty())
+      fop_error(m_fop, "%s", errors[i].c_str());
+
+  m_images.clear();
+  m_data.clear();
+  m_bytes = 0;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1003,7 +1301,8 @@ static void write_compressed_image(FILE* f, Image* image)
 
 static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
                                     PixelFormat pixelFormat,
-                                    FileOp* fop, ASE_Header* header, size_t chunk_end)
+                                    FileOp* fop, ASE_Header* header, size_t chunk_end,
+                                    AseLazyFile* lazyFile, ASE_DecompressQueue* queue)
 {
   /* read chunk data */
   LayerIndex layer_index = LayerIndex(fgetw(f));
@@ -1069,9 +1368,9 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
       Cel* link = static_cast<LayerImage*>(layer)->getCel(link_frame);
 
       if (link) {
-        // Create a copy of the linked cel (avoid using links cel)
-        Image* image = Image::createCopy(sprite->getStock()->getImage(link->getImage()));
-        cel->setImage(sprite->getStock()->addImage(image));
+        // Both cels share the same image (it's copied when one of
+        // them is modified).
+        cel->setImage(link->getImage());
       }
       else {
         // Linked cel doesn't found
@@ -1086,32 +1385,31 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
       int h = fgetw(f);
 
       if (w > 0 && h > 0) {
-        Image* image = Image::create(pixelFormat, w, h);
-
-        // Try to read pixel data
-        try {
-          switch (image->getPixelFormat()) {
-
-            case IMAGE_RGB:
-              read_compressed_image<RgbTraits>(f, image, chunk_end, fop, header);
-              break;
-
-            case IMAGE_GRAYSCALE:
-              read_compressed_image<GrayscaleTraits>(f, image, chunk_end, fop, header);
-              break;
-
-            case IMAGE_INDEXED:
-              read_compressed_image<IndexedTraits>(f, image, chunk_end, fop, header);
-              break;
-          }
-        }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          fop_error(fop, e.what());
+        long offset = ftell(f);
+        size_t size = (offset >= 0 && (size_t)offset < chunk_end ?
+                       chunk_end - offset: 0);
+
+        // The compressed pixels are read when the image is used.
+        if (lazyFile) {
+          char name[256];
+          sprintf(name, "Layer \"%.200s\", frame %d",
+                       layer->getName().c_str(), (int)frame+1);
+
+          cel->setImage(sprite->getStock()->addImageLoader(
+              new AseCelLoader(lazyFile, offset, size, pixelFormat, w, h, name)));
+          break;
         }
 
+        // Read the compressed pixels.
+        std::vector<uint8_t> data(size);
+        if (!data.empty())
+          data.resize(fread(&data[0], 1, data.size(), f));
+
+        Image* image = Image::create(pixelFormat, w, h);
         cel->setImage(sprite->getStock()->addImage(image));
+
+        // They are decompressed in parallel with other cels.
+        queue->add(image, data);
       }
       break;
     }
@@ -1123,12 +1421,17 @@ static Cel* ase_file_read_cel_chunk(FILE* f, Sprite* sprite, FrameNumber frame,
   return newCel;
 }
 
-static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite)
+static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel* cel, LayerImage* layer, Sprite* sprite,
+                                     const ASE_CompressedImages& compressed)
 {
   ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
 
+  // Cels that share the image with a cel in a previous frame are
+  // saved as links to that frame.
+  Cel* link = ase_file_get_linked_cel(layer, cel);
+
   int layer_index = sprite->layerToIndex(layer);
-  int cel_type = ASE_FILE_COMPRESSED_CEL;
+  int cel_type = (link ? ASE_FILE_LINK_CEL: ASE_FILE_COMPRESSED_CEL);
 
   fputw(layer_index, f);
   fputw(cel->getX(), f);
@@ -1173,8 +1476,7 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel
 
     case ASE_FILE_LINK_CEL:
       // Linked cel to another frame
-      //fputw(link->frame, f);
-      fputw(0, f);
+      fputw(link->getFrame(), f);
       break;
 
     case ASE_FILE_COMPRESSED_CEL: {
@@ -1185,21 +1487,17 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel
         fputw(image->getWidth(), f);
         fputw(image->getHeight(), f);
 
-        // Pixel data
-        switch (image->getPixelFormat()) {
+        // Pixel data (it should be already compressed)
+        ASE_CompressedImages::const_iterator it = compressed.find(image);
+        std::vector<uint8_t> data;
+        if (it == compressed.end())
+          compress_image(image, Z_DEFAULT_COMPRESSION, data);
+        const std::vector<uint8_t>& output = (it != compressed.end() ? it->second: data);
 
-          case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
-          case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
-          case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
-            break;
-        }
+        if (!output.empty() &&
+            ((fwrite(&output[0], 1, output.size(), f) != output.size())
+             || ferror(f)))
+          throw base::Exception("Error writing compressed image pixels.\n");
       }
       else {
         // Width and height
@@ -1211,6 +1509,80 @@ static void ase_file_write_cel_chunk(FILE* f, ASE_FrameHeader* frame_header, Cel
   }
 }
 
+// Returns the cel of a previous frame in the same layer that uses the
+// same image than the given cel (or NULL if the image isn't shared).
+static Cel* ase_file_get_linked_cel(LayerImage* layer, Cel* cel)
+{
+  Cel* link = NULL;
+  for (CelIterator it=layer->getCelBegin(), end=layer->getCelEnd(); it != end; ++it) {
+    Cel* other = *it;
+    if (other->getImage() == cel->getImage() &&
+        other->getFrame() < cel->getFrame() &&
+        (!link || other->getFrame() < link->getFrame()))
+      link = other;
+  }
+  return link;
+}
+
+static void ase_file_collect_cel_images(Sprite* sprite, Layer* layer, FrameNumber frame,
+                                        std::vector<const Image*>& images)
+{
+  if (layer->isImage()) {
+    Cel* cel = static_cast<LayerImage*>(layer)->getCel(frame);
+    if (cel && !ase_file_get_linked_cel(static_cast<LayerImage*>(layer), cel)) {
+      const Image* image = sprite->getStock()->getImage(cel->getImage());
+      if (image)
+        images.push_back(image);
+    }
+  }
+
+  if (layer->isFolder()) {
+    LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
+    LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
+
+    for (; it != end; ++it)
+      ase_file_collect_cel_images(sprite, *it, frame, images);
+  }
+}
+
+// Compresses (in parallel) the images of the cels from the frame
+// "from" to the returned frame (not included).
+static FrameNumber ase_file_compress_cels(Sprite* sprite, FrameNumber from, int level,
+                                          ASE_CompressedImages& compressed)
+{
+  std::vector<const Image*> images;
+  FrameNumber frame = from;
+  int pixels = 0;
+
+  compressed.clear();
+
+  while (frame < sprite->getTotalFrames() &&
+         (int)images.size() < kCompressBatchImages &&
+         pixels < kCompressBatchPixels) {
+    size_t first = images.size();
+    ase_file_collect_cel_images(sprite, sprite->getFolder(), frame, images);
+
+    for (size_t i=first; i<images.size(); ++i)
+      pixels += images[i]->getWidth() * images[i]->getHeight();
+
+    ++frame;
+  }
+
+  // Each image is compressed just one time
+  std::sort(images.begin(), images.end());
+  images.erase(std::unique(images.begin(), images.end()), images.end());
+
+  std::vector<std::vector<uint8_t> > output(images.size());
+  base::parallel_for(0, (int)images.size(),
+                     CompressImages(images, level, output),
+                     (pixels >= kParallelCelsPixels ? 0: 1));
+
+  for (size_t i=0; i<images.size(); ++i)
+    compressed[images[i]].swap(output[i]);
+
+  return frame;
+}
+
 static Mask* ase_file_read_mask_chunk(FILE* f)
 {
   int c, u, v, byte;
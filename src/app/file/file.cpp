@@ -33,6 +33,7 @@
 #include "app/ui/status_bar.h"
 #include "base/fs.h"
 #include "base/mutex.h"
+#include "base/parallel_for.h"
 #include "base/path.h"
 #include "base/scoped_lock.h"
 #include "base/shared_ptr.h"
@@ -50,6 +51,9 @@ using namespace base;
 
 static FileOp* fop_new(FileOpType type);
 static void fop_prepare_for_sequence(FileOp* fop);
+static FileOp* fop_new_sequence_frame(FileOp* fop, FrameNumber frame);
+static void fop_free_sequence_frames(std::vector<FileOp*>& frame_fops);
+static void fop_copy_sequence_errors(FileOp* fop, FileOp* frame_fop);
 
 static FileFormat* get_fileformat(const char* extension);
 static int split_filename(const char* filename, char* left, char* right, int* width);
@@ -227,6 +231,10 @@ FileOp* fop_to_load_document(const char* filename, int flags)
   if (flags & FILE_LOAD_ONE_FRAME)
     fop->oneframe = true;
 
+  /* load the pixels of each image when they are used */
+  if (flags & FILE_LOAD_LAZY)
+    fop->lazy = true;
+
 done:;
   return fop;
 }
@@ -400,6 +408,76 @@ FileOp* fop_to_save_document(Document* document)
   return fop;
 }
 
+namespace {
+
+// Maximum number of files of a sequence that are loaded/saved at the
+// same time (each one of them keeps a whole image in memory).
+const int kSequenceWindowSize = 16;
+
+// Loads each file of the window with its own FileOp.
+class LoadSequenceFiles {
+public:
+  LoadSequenceFiles(const std::vector<FileOp*>& frame_fops, std::vector<char>& results)
+    : m_frame_fops(frame_fops)
+    , m_results(results) {
+  }
+
+  // Called from base::parallel_for()
+  void operator()(int i) const {
+    FileOp* frame_fop = m_frame_fops[i];
+    if (fop_is_stop(frame_fop))
+      return;
+
+    try {
+      m_results[i] = frame_fop->format->load(frame_fop);
+    }
+    catch (const std::exception& e) {
+      fop_error(frame_fop, "%s\n", e.what());
+    }
+  }
+
+private:
+  const std::vector<FileOp*>& m_frame_fops;
+  std::vector<char>& m_results;
+};
+
+#ifdef ENABLE_SAVE
+
+// Renders and saves each frame of the window with its own FileOp.
+class SaveSequenceFiles {
+public:
+  SaveSequenceFiles(const std::vector<FileOp*>& frame_fops, std::vector<char>& results)
+    : m_frame_fops(frame_fops)
+    , m_results(results) {
+  }
+
+  // Called from base::parallel_for()
+  void operator()(int i) const {
+    FileOp* frame_fop = m_frame_fops[i];
+    if (fop_is_stop(frame_fop))
+      return;
+
+    try {
+      // Draw the frame in "frame_fop->seq.image"
+      frame_fop->document->getSprite()->render(frame_fop->seq.image, 0, 0,
+                                               frame_fop->seq.frame);
+
+      m_results[i] = frame_fop->format->save(frame_fop);
+    }
+    catch (const std::exception& e) {
+      fop_error(frame_fop, "%s\n", e.what());
+    }
+  }
+
+private:
+  const std::vector<FileOp*>& m_frame_fops;
+  std::vector<char>& m_results;
+};
+
+#endif
+
+} // anonymous namespace
+
 // Executes the file operation: loads or saves the sprite.
 //
 // It can be called from a different thread of the one used
@@ -457,13 +535,62 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
       fop->seq.progress_offset = 0.0f;
       fop->seq.progress_fraction = 1.0f / (double)frames;
 
-      std::vector<std::string>::iterator it = fop->seq.filename_list.begin();
-      std::vector<std::string>::iterator end = fop->seq.filename_list.end();
-      for (; it != end; ++it) {
-        fop->filename = it->c_str();
+      // The first file creates the document, so it is loaded directly
+      // with "fop". The other files are loaded by several threads
+      // (kSequenceWindowSize files at the same time) and then added
+      // to the sprite in order.
+      std::vector<FileOp*> window;
+      std::vector<char> results;
+      size_t window_pos = 0;
+
+      while (frame < frames) {
+        if (frame == 0) {
+          fop->filename = fop->seq.filename_list[0];
+
+          // Call the "load" procedure to read the first bitmap.
+          loadres = fop->format->load(fop);
+        }
+        else {
+          // Load the next window of files.
+          if (window_pos == window.size()) {
+            fop_free_sequence_frames(window);
+            if (fop_is_stop(fop))
+              break;
+
+            int n = MIN(kSequenceWindowSize, frames - frame);
+            for (int i=0; i<n; ++i)
+              window.push_back(fop_new_sequence_frame(fop, frame.next(i)));
+
+            results.assign(n, false);
+            base::parallel_for(0, n, LoadSequenceFiles(window, results));
+            window_pos = 0;
+          }
+
+          FileOp* frame_fop = window[window_pos];
+          loadres = (results[window_pos] ? true: false);
+          ++window_pos;
+
+          // Move the loaded image and palette to "fop".
+          fop->filename = frame_fop->filename;
+          fop_copy_sequence_errors(fop, frame_fop);
+
+          fop->seq.image = frame_fop->seq.image;
+          fop->seq.last_cel = frame_fop->seq.last_cel;
+          frame_fop->seq.image = NULL;
+          frame_fop->seq.last_cel = NULL;
+
+          for (int i=0; i<(int)frame_fop->seq.modified_entries.size(); ++i)
+            if (frame_fop->seq.modified_entries[i])
+              fop->seq.palette->setEntry(i, frame_fop->seq.palette->getEntry(i));
+          if (frame_fop->seq.has_alpha)
+            fop->seq.has_alpha = true;
+          if (fop->seq.format_options == NULL)
+            fop->seq.format_options = frame_fop->seq.format_options;
+
+          fop->document->getSprite()->setTransparentColor(
+            frame_fop->document->getSprite()->getTransparentColor());
+        }
 
-        // Call the "load" procedure to read the first bitmap.
-        loadres = fop->format->load(fop);
         if (!loadres) {
           fop_error(fop, "Error loading frame %d from file \"%s\"\n",
                     frame+1, fop->filename.c_str());
@@ -517,7 +644,9 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
 
         ++frame;
         fop->seq.progress_offset += fop->seq.progress_fraction;
+        fop_progress(fop, 0.0f);
       }
+      fop_free_sequence_frames(window);
       fop->filename = *fop->seq.filename_list.begin();
 
       // Final setup
@@ -547,48 +676,61 @@ void fop_operate(FileOp *fop, IFileOpProgress* progress)
            fop->format != NULL &&
            fop->format->support(FILE_SUPPORT_SAVE)) {
 #ifdef ENABLE_SAVE
+    // Images that are still compressed (see FILE_LOAD_LAZY) are
+    // loaded to report corrupted ones before they are saved.
+    {
+      Stock* stock = fop->document->getSprite()->getStock();
+      std::vector<std::string> errors;
+      stock->loadAllImages();
+      stock->takeLoadErrors(errors);
+      for (size_t i=0; i<errors.size(); ++i)
+        fop_error(fop, "%s\n", errors[i].c_str());
+    }
+
     // Save a sequence
     if (fop->is_sequence()) {
       ASSERT(fop->format->support(FILE_SUPPORT_SEQUENCES));
 
-      Sprite* sprite = fop->document->getSprite();
-
-      // Create a temporary bitmap
-      fop->seq.image = Image::create(sprite->getPixelFormat(),
-                                     sprite->getWidth(),
-                                     sprite->getHeight());
-      if (fop->seq.image != NULL) {
-        fop->seq.progress_offset = 0.0f;
-        fop->seq.progress_fraction = 1.0f / (double)sprite->getTotalFrames();
-
-        // For each frame in the sprite.
-        for (FrameNumber frame(0); frame < sprite->getTotalFrames(); ++frame) {
-          // Draw the "frame" in "fop->seq.image"
-          sprite->render(fop->seq.image, 0, 0, frame);
-
-          // Setup the palette.
-          sprite->getPalette(frame)->copyColorsTo(fop->seq.palette);
+      FrameNumber frames = fop->document->getSprite()->getTotalFrames();
+      FrameNumber frame(0);
+      std::vector<FileOp*> window;
+      std::vector<char> results;
+      bool saveres = true;
 
-          // Setup the filename to be used.
-          fop->filename = fop->seq.filename_list[frame];
+      fop->seq.progress_offset = 0.0f;
+      fop->seq.progress_fraction = 1.0f / (double)frames;
 
-          // Call the "save" procedure... did it fail?
-          if (!fop->format->save(fop)) {
-            fop_error(fop, "Error saving frame %d in the file \"%s\"\n",
-                      frame+1, fop->filename.c_str());
+      // Each window of kSequenceWindowSize frames is rendered and
+      // saved by several threads, then errors and progress are
+      // reported in frame order.
+      while (saveres && frame < frames && !fop_is_stop(fop)) {
+        int n = MIN(kSequenceWindowSize, frames - frame);
+        for (int i=0; i<n; ++i)
+          window.push_back(fop_new_sequence_frame(fop, frame.next(i)));
+
+        results.assign(n, false);
+        base::parallel_for(0, n, SaveSequenceFiles(window, results));
+
+        for (int i=0; i<n; ++i) {
+          FileOp* frame_fop = window[i];
+          fop_copy_sequence_errors(fop, frame_fop);
+
+          // Did the "save" procedure fail?
+          if (!results[i]) {
+            if (!fop_is_stop(fop))
+              fop_error(fop, "Error saving frame %d in the file \"%s\"\n",
+                        frame+1, frame_fop->filename.c_str());
+            saveres = false;
             break;
           }
 
+          ++frame;
           fop->seq.progress_offset += fop->seq.progress_fraction;
+          fop_progress(fop, 0.0f);
         }
-        fop->filename = *fop->seq.filename_list.begin();
-
-        // Destroy the image
-        delete fop->seq.image;
-      }
-      else {
-        fop_error(fop, "Not enough memory for the temporary bitmap.\n");
+        fop_free_sequence_frames(window);
       }
+      fop->filename = *fop->seq.filename_list.begin();
     }
     // Direct save to a file.
     else {
@@ -658,6 +800,10 @@ void fop_post_load(FileOp* fop)
   }
 
   if (fop->document->getSprite() != NULL) {
+    // Identical cels (e.g. repeated frames of a GIF animation or an
+    // image sequence) share the same image.
+    fop->document->getSprite()->mergeDuplicateImages();
+
     // Creates a suitable palette for RGB images
     if (fop->document->getSprite()->getPixelFormat() == IMAGE_RGB &&
         fop->document->getSprite()->getPalettes().size() <= 1 &&
@@ -683,6 +829,9 @@ void fop_sequence_set_format_options(FileOp* fop, const SharedPtr<FormatOptions>
 void fop_sequence_set_color(FileOp *fop, int index, int r, int g, int b)
 {
   fop->seq.palette->setEntry(index, rgba(r, g, b, 255));
+
+  if (!fop->seq.modified_entries.empty())
+    fop->seq.modified_entries[index] = true;
 }
 
 void fop_sequence_get_color(FileOp *fop, int index, int *r, int *g, int *b)
@@ -767,7 +916,7 @@ void fop_progress(FileOp *fop, double progress)
   }
 
   if (fop->progressInterface)
-    fop->progressInterface->ackFileOpProgress(progress);
+    fop->progressInterface->ackFileOpProgress(fop->progress);
 }
 
 double fop_get_progress(FileOp *fop)
@@ -799,6 +948,9 @@ bool fop_is_stop(FileOp *fop)
     scoped_lock lock(*fop->mutex);
     stop = fop->stop;
   }
+  // A file of a sequence is stopped with the whole sequence.
+  if (!stop && fop->parent)
+    stop = fop_is_stop(fop->parent);
   return stop;
 }
 
@@ -810,6 +962,7 @@ static FileOp* fop_new(FileOpType type)
   fop->format = NULL;
   fop->format_data = NULL;
   fop->document = NULL;
+  fop->parent = NULL;
 
   fop->mutex = new base::mutex();
   fop->progress = 0.0f;
@@ -817,6 +970,7 @@ static FileOp* fop_new(FileOpType type)
   fop->done = false;
   fop->stop = false;
   fop->oneframe = false;
+  fop->lazy = false;
 
   fop->seq.palette = NULL;
   fop->seq.image = NULL;
@@ -835,6 +989,76 @@ static void fop_prepare_for_sequence(FileOp* fop)
   fop->seq.format_options.reset();
 }
 
+// Creates a FileOp to load/save the given frame of the "fop" sequence
+// from other thread. The new FileOp doesn't share modifiable data with
+// "fop" (e.g. each loaded file gets its own sprite).
+static FileOp* fop_new_sequence_frame(FileOp* fop, FrameNumber frame)
+{
+  FileOp* frame_fop = fop_new(fop->type);
+  Sprite* sprite = fop->document->getSprite();
+
+  frame_fop->format = fop->format;
+  frame_fop->parent = fop;
+  frame_fop->filename = fop->seq.filename_list[frame];
+  frame_fop->oneframe = fop->oneframe;
+  frame_fop->lazy = fop->lazy;
+  frame_fop->seq.frame = frame;
+  frame_fop->seq.has_alpha = false;
+  fop_prepare_for_sequence(frame_fop);
+
+  if (fop->type == FileOpLoad) {
+    // A sprite like the one of the sequence, so the file format can
+    // check the pixel format and use the transparent color.
+    Sprite* frame_sprite = new Sprite(sprite->getPixelFormat(),
+                                      sprite->getWidth(),
+                                      sprite->getHeight(), 256);
+    LayerImage* layer = new LayerImage(frame_sprite);
+    frame_sprite->getFolder()->addLayer(layer);
+    frame_sprite->setTransparentColor(sprite->getTransparentColor());
+
+    frame_fop->document = new Document(frame_sprite);
+    frame_fop->seq.layer = layer;
+
+    // Colors that the file doesn't set must be the ones from the
+    // previous files, but they are loaded at the same time, so we
+    // keep track of the modified entries to merge palettes in order.
+    frame_fop->seq.modified_entries.resize(frame_fop->seq.palette->size(), false);
+  }
+  else {
+    frame_fop->document = fop->document;
+    frame_fop->seq.format_options = fop->seq.format_options;
+    frame_fop->seq.image = Image::create(sprite->getPixelFormat(),
+                                         sprite->getWidth(),
+                                         sprite->getHeight());
+    sprite->getPalette(frame)->copyColorsTo(frame_fop->seq.palette);
+  }
+
+  return frame_fop;
+}
+
+static void fop_free_sequence_frames(std::vector<FileOp*>& frame_fops)
+{
+  for (size_t i=0; i<frame_fops.size(); ++i) {
+    FileOp* frame_fop = frame_fops[i];
+
+    delete frame_fop->seq.image;
+    if (frame_fop->type == FileOpLoad) {
+      delete frame_fop->seq.last_cel;
+      delete frame_fop->document;
+    }
+    fop_free(frame_fop);
+  }
+  frame_fops.clear();
+}
+
+static void fop_copy_sequence_errors(FileOp* fop, FileOp* frame_fop)
+{
+  if (frame_fop->has_error()) {
+    scoped_lock lock(*fop->mutex);
+    fop->error += frame_fop->error;
+  }
+}
+
 static FileFormat* get_fileformat(const char* extension)
 {
   FileFormatsList::iterator it = FileFormatsManager::instance().begin();
@@ -32,6 +32,7 @@
 #define FILE_LOAD_SEQUENCE_ASK          0x00000002
 #define FILE_LOAD_SEQUENCE_YES          0x00000004
 #define FILE_LOAD_ONE_FRAME             0x00000008
+#define FILE_LOAD_LAZY                  0x00000010
 
 namespace base {
   class mutex;
@@ -72,6 +73,9 @@ namespace app {
     void* format_data;            // Custom data for the FileFormat::onLoad/onSave operations.
     Document* document;           // Loaded document, or document to be saved.
     std::string filename;         // File-name to load/save.
+    FileOp* parent;               // Sequence operation that this one is part of
+                                  // (used to load/save each file of a sequence
+                                  // in a different thread).
 
     // Shared fields between threads.
     base::mutex* mutex;           // Mutex to access to the next two fields.
@@ -83,6 +87,9 @@ namespace app {
     bool oneframe : 1;            // Load just one frame (in formats
     // that support animation like
     // GIF/FLI/ASE).
+    bool lazy : 1;                // Load the pixels of each image
+    // when they are used for first time (in formats that support
+    // it like ASE).
 
     // Data for sequences.
     struct {
@@ -98,6 +105,9 @@ namespace app {
       LayerImage* layer;
       Cel* last_cel;
       SharedPtr<FormatOptions> format_options;
+      // Palette entries set by the file (only for files of a sequence
+      // that are loaded in parallel, see fop_new_sequence_frame()).
+      std::vector<bool> modified_entries;
     } seq;
 
     ~FileOp();
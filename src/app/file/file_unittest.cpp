@@ -23,19 +23,33 @@
 #include "app/file/file.h"
 #include "app/file/file_formats_manager.h"
 #include "raster/raster.h"
-#include "she/she.h"
 
+#include <allegro.h>
+#include <gif_lib.h>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <string>
 #include <vector>
 
-using namespace app::file;
+using namespace app;
+using namespace raster;
+
+// Initializes Allegro (used by file formats to read/write files) and
+// registers all possible image formats.
+static void init_file_formats()
+{
+  static bool initialized = false;
+  if (!initialized) {
+    install_allegro(SYSTEM_NONE, &errno, atexit);
+    FileFormatsManager::instance().registerAllFormats();
+    initialized = true;
+  }
+}
 
 TEST(File, SeveralSizes)
 {
-  she::ScopedHandle<she::System> system(she::CreateSystem());
-  // Register all possible image formats.
-  FileFormatsManager::instance().registerAllFormats();
+  init_file_formats();
   std::vector<char> fn(256);
 
   for (int w=10; w<=10+503*2; w+=503) {
@@ -85,4 +99,426 @@ TEST(File, SeveralSizes)
       }
     }
   }
+
+  std::remove(&fn[0]);
+}
+
+TEST(File, LazyLoad)
+{
+  init_file_formats();
+  const char* fn = "test_lazy.ase";
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, 64, 32, 256));
+    doc->setFilename(fn);
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(doc->getSprite()->getFolder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    Image* image = doc->getSprite()->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage());
+    for (int y=0; y<32; y++)
+      for (int x=0; x<64; x++)
+        put_pixel_fast<RgbTraits>(image, x, y, rgba(x, y, x+y, 255));
+
+    save_document(doc);
+  }
+
+  FileOp* fop = fop_to_load_document(fn, FILE_LOAD_SEQUENCE_NONE | FILE_LOAD_LAZY);
+  ASSERT_TRUE(fop != NULL);
+  fop_operate(fop, NULL);
+  fop_done(fop);
+  ASSERT_FALSE(fop->has_error());
+
+  base::UniquePtr<Document> doc(fop->document);
+  fop_free(fop);
+
+  // The cel is read and decompressed when its image is used for
+  // first time.
+  LayerImage* layer = dynamic_cast<LayerImage*>(doc->getSprite()->getFolder()->getFirstLayer());
+  ASSERT_TRUE(layer != NULL);
+  int index = layer->getCel(FrameNumber(0))->getImage();
+  EXPECT_FALSE(doc->getSprite()->getStock()->isImageLoaded(index));
+
+  Image* image = doc->getSprite()->getStock()->getImage(index);
+  EXPECT_TRUE(doc->getSprite()->getStock()->isImageLoaded(index));
+  for (int y=0; y<32; y++)
+    for (int x=0; x<64; x++)
+      ASSERT_EQ(rgba(x, y, x+y, 255), get_pixel_fast<RgbTraits>(image, x, y));
+
+  std::vector<std::string> errors;
+  doc->getSprite()->getStock()->takeLoadErrors(errors);
+  EXPECT_TRUE(errors.empty());
+
+  std::remove(fn);
+}
+
+TEST(File, LazyLoadCorruptedCel)
+{
+  init_file_formats();
+  const char* fn = "test_lazy.ase";
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, 64, 32, 256));
+    doc->setFilename(fn);
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(doc->getSprite()->getFolder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    Image* image = doc->getSprite()->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage());
+    for (int y=0; y<32; y++)
+      for (int x=0; x<64; x++)
+        put_pixel_fast<RgbTraits>(image, x, y, rgba(x*4, y*8, 0, 255));
+
+    save_document(doc);
+  }
+
+  // The cel chunk is the last one of the file, so we corrupt the end
+  // of its compressed data.
+  FILE* f = std::fopen(fn, "r+b");
+  ASSERT_TRUE(f != NULL);
+  std::fseek(f, -32, SEEK_END);
+  for (int i=0; i<32; ++i)
+    std::fputc(0xff, f);
+  std::fclose(f);
+
+  FileOp* fop = fop_to_load_document(fn, FILE_LOAD_SEQUENCE_NONE | FILE_LOAD_LAZY);
+  ASSERT_TRUE(fop != NULL);
+  fop_operate(fop, NULL);
+  fop_done(fop);
+
+  base::UniquePtr<Document> doc(fop->document);
+  fop_free(fop);
+  ASSERT_TRUE(doc != NULL);
+
+  // The image is created anyway, and the error is reported by the stock.
+  LayerImage* layer = dynamic_cast<LayerImage*>(doc->getSprite()->getFolder()->getFirstLayer());
+  ASSERT_TRUE(layer != NULL);
+  int index = layer->getCel(FrameNumber(0))->getImage();
+  Image* image = doc->getSprite()->getStock()->getImage(index);
+  ASSERT_TRUE(image != NULL);
+  EXPECT_EQ(64, image->getWidth());
+  EXPECT_EQ(32, image->getHeight());
+
+  std::vector<std::string> errors;
+  doc->getSprite()->getStock()->takeLoadErrors(errors);
+  ASSERT_EQ(1, (int)errors.size());
+  EXPECT_NE(std::string::npos, errors[0].find("frame 1"));
+
+  std::remove(fn);
+}
+
+TEST(File, LinkedCels)
+{
+  init_file_formats();
+  const char* fn = "test_linked.ase";
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, 16, 16, 256));
+    doc->setFilename(fn);
+
+    Sprite* sprite = doc->getSprite();
+    sprite->setTotalFrames(FrameNumber(3));
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    int index = layer->getCel(FrameNumber(0))->getImage();
+    clear_image(sprite->getStock()->getImage(index), rgba(255, 0, 0, 255));
+
+    // Frame 1 shares the image with frame 0, frame 2 has a copy.
+    layer->addCel(new Cel(FrameNumber(1), index));
+    layer->addCel(new Cel(FrameNumber(2), sprite->getStock()->addImage(
+          Image::createCopy(sprite->getStock()->getImage(index)))));
+
+    save_document(doc);
+  }
+
+  FileOp* fop = fop_to_load_document(fn, FILE_LOAD_SEQUENCE_NONE);
+  ASSERT_TRUE(fop != NULL);
+  fop_operate(fop, NULL);
+  fop_done(fop);
+  ASSERT_FALSE(fop->has_error());
+
+  base::UniquePtr<Document> doc(fop->document);
+  fop_free(fop);
+
+  Sprite* sprite = doc->getSprite();
+  LayerImage* layer = dynamic_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+  ASSERT_TRUE(layer != NULL);
+
+  // The shared image was saved as a linked cel
+  int index = layer->getCel(FrameNumber(0))->getImage();
+  EXPECT_EQ(index, layer->getCel(FrameNumber(1))->getImage());
+  EXPECT_NE(index, layer->getCel(FrameNumber(2))->getImage());
+
+  // The copy is merged with the original image
+  EXPECT_EQ(1, sprite->mergeDuplicateImages());
+  EXPECT_EQ(index, layer->getCel(FrameNumber(2))->getImage());
+  EXPECT_EQ(3u, sprite->getImageRefs(index));
+
+  std::remove(fn);
+}
+
+TEST(File, GifFrames)
+{
+  init_file_formats();
+  const char* fn = "test.gif";
+  const int w = 37, h = 23, frames = 40;
+
+  base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_INDEXED, w, h, 256));
+  doc->setFilename(fn);
+
+  Sprite* sprite = doc->getSprite();
+  sprite->setTotalFrames(FrameNumber(frames));
+
+  LayerImage* layer = dynamic_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+  ASSERT_TRUE(layer != NULL);
+
+  // Frames with random rectangles (some of them are repeated).
+  std::srand(frames);
+  int index = layer->getCel(FrameNumber(0))->getImage();
+  for (int i=1; i<frames; ++i) {
+    if ((i % 5) != 0) {
+      Image* image = Image::createCopy(sprite->getStock()->getImage(index));
+      int x = std::rand()%w, y = std::rand()%h;
+      fill_rect(image, x, y, x+std::rand()%8, y+std::rand()%8, 1+std::rand()%255);
+      index = sprite->getStock()->addImage(image);
+    }
+    layer->addCel(new Cel(FrameNumber(i), index));
+  }
+
+  save_document(doc);
+
+  base::UniquePtr<Document> doc2(load_document(fn));
+  Sprite* sprite2 = doc2->getSprite();
+  ASSERT_EQ(frames, sprite2->getTotalFrames());
+
+  base::UniquePtr<Image> image(Image::create(IMAGE_INDEXED, w, h));
+  base::UniquePtr<Image> image2(Image::create(IMAGE_INDEXED, w, h));
+  for (FrameNumber frame(0); frame<frames; ++frame) {
+    sprite->render(image, 0, 0, frame);
+    sprite2->render(image2, 0, 0, frame);
+    ASSERT_EQ(0, count_diff_between_images(image, image2)) << "Frame " << frame;
+  }
+
+  std::remove(fn);
+}
+
+// Draws the frames of a GIF file one over the other (as the frames
+// of an opaque sprite are displayed) and returns the RGB colors of
+// the last one.
+static Image* compose_gif_frames(const char* fn, int frames)
+{
+  int errCode;
+  GifFileType* gif = DGifOpenFileName(fn, &errCode);
+  if (!gif)
+    return NULL;
+  if (DGifSlurp(gif) == GIF_ERROR || gif->ImageCount < frames) {
+    DGifCloseFile(gif, &errCode);
+    return NULL;
+  }
+
+  Image* image = Image::create(IMAGE_RGB, gif->SWidth, gif->SHeight);
+  clear_image(image, rgba(0, 0, 0, 0));
+
+  for (int i=0; i<frames; ++i) {
+    const SavedImage& frame = gif->SavedImages[i];
+    const ColorMapObject* colormap = (frame.ImageDesc.ColorMap ?
+                                      frame.ImageDesc.ColorMap: gif->SColorMap);
+    GraphicsControlBlock gcb;
+    gcb.TransparentColor = NO_TRANSPARENT_COLOR;
+    DGifSavedExtensionToGCB(gif, i, &gcb);
+
+    for (int y=0; y<frame.ImageDesc.Height; ++y)
+      for (int x=0; x<frame.ImageDesc.Width; ++x) {
+        int index = frame.RasterBits[y*frame.ImageDesc.Width + x];
+        if (index == gcb.TransparentColor)
+          continue;
+
+        const GifColorType& c = colormap->Colors[index];
+        put_pixel(image, frame.ImageDesc.Left + x, frame.ImageDesc.Top + y,
+                  rgba(c.Red, c.Green, c.Blue, 255));
+      }
+  }
+
+  DGifCloseFile(gif, &errCode);
+  return image;
+}
+
+TEST(File, GifFramesWithDifferentPalettes)
+{
+  init_file_formats();
+  const char* fn = "test_pal.gif";
+  const int w = 16, h = 12, frames = 4, changeFrame = 2;
+
+  base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_INDEXED, w, h, 256));
+  doc->setFilename(fn);
+
+  Sprite* sprite = doc->getSprite();
+  sprite->setTotalFrames(FrameNumber(frames));
+
+  // Opaque sprite, frames are drawn over the previous one.
+  LayerImage* layer = dynamic_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+  ASSERT_TRUE(layer != NULL);
+  layer->configureAsBackground();
+
+  Palette pal(FrameNumber(0), 256);
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba(i, 0, 0, 255));
+  sprite->setPalette(&pal, true);
+
+  pal.setFrame(FrameNumber(changeFrame));
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba(0, i, 0, 255));
+  sprite->setPalette(&pal, true);
+
+  // Each frame changes just a small rectangle (the indexes of the
+  // other pixels are the same, but not their colors when the palette
+  // changes).
+  int index = layer->getCel(FrameNumber(0))->getImage();
+  clear_image(sprite->getStock()->getImage(index), 1);
+  for (int i=1; i<frames; ++i) {
+    Image* image = Image::createCopy(sprite->getStock()->getImage(index));
+    fill_rect(image, i, i, i+2, i+2, 10+i);
+    index = sprite->getStock()->addImage(image);
+    layer->addCel(new Cel(FrameNumber(i), index));
+  }
+
+  save_document(doc);
+
+  base::UniquePtr<Image> image(Image::create(IMAGE_INDEXED, w, h));
+  for (int i=0; i<frames; ++i) {
+    base::UniquePtr<Image> gifImage(compose_gif_frames(fn, i+1));
+    ASSERT_TRUE(gifImage != NULL);
+
+    FrameNumber frame(i);
+    const Palette* palette = sprite->getPalette(frame);
+    sprite->render(image, 0, 0, frame);
+
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        ASSERT_EQ(palette->getEntry(get_pixel(image, x, y)),
+                  get_pixel(gifImage, x, y))
+          << "Pixel " << x << "," << y << " of frame " << i;
+  }
+
+  std::remove(fn);
+}
+
+TEST(File, PngSequence)
+{
+  init_file_formats();
+  // Non-const, split_filename() modifies the file name temporarily.
+  char fn[] = "test_seq00.png";
+  const int w = 19, h = 11, frames = 37;
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_RGB, w, h, 256));
+    doc->setFilename(fn);
+
+    Sprite* sprite = doc->getSprite();
+    sprite->setTotalFrames(FrameNumber(frames));
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    clear_image(sprite->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage()),
+                rgba(0, 0, 0, 255));
+
+    for (int i=1; i<frames; ++i) {
+      Image* image = Image::create(IMAGE_RGB, w, h);
+      clear_image(image, rgba(i, 255-i, 2*i, 255));
+      layer->addCel(new Cel(FrameNumber(i), sprite->getStock()->addImage(image)));
+    }
+
+    save_document(doc);
+  }
+
+  // Load all files of the sequence
+  FileOp* fop = fop_to_load_document(fn, FILE_LOAD_SEQUENCE_YES);
+  ASSERT_TRUE(fop != NULL);
+  ASSERT_EQ(frames, (int)fop->seq.filename_list.size());
+  fop_operate(fop, NULL);
+  fop_done(fop);
+  ASSERT_FALSE(fop->has_error());
+
+  base::UniquePtr<Document> doc(fop->document);
+  fop_free(fop);
+
+  // Frames are in the same order of the files
+  Sprite* sprite = doc->getSprite();
+  ASSERT_EQ(frames, sprite->getTotalFrames());
+
+  base::UniquePtr<Image> image(Image::create(IMAGE_RGB, w, h));
+  for (FrameNumber frame(0); frame<frames; ++frame) {
+    int i = frame;
+    sprite->render(image, 0, 0, frame);
+    ASSERT_EQ(i == 0 ? rgba(0, 0, 0, 255): rgba(i, 255-i, 2*i, 255),
+              get_pixel(image, w/2, h/2)) << "Frame " << i;
+  }
+
+  for (int i=0; i<frames; ++i) {
+    char buf[256];
+    std::sprintf(buf, "test_seq%02d.png", i);
+    std::remove(buf);
+  }
+}
+
+TEST(File, PngSequencePalettes)
+{
+  init_file_formats();
+  char fn[] = "test_pal00.png";
+  const int w = 8, h = 8, frames = 24, changeFrame = 20;
+
+  {
+    base::UniquePtr<Document> doc(Document::createBasicDocument(IMAGE_INDEXED, w, h, 256));
+    doc->setFilename(fn);
+
+    Sprite* sprite = doc->getSprite();
+    sprite->setTotalFrames(FrameNumber(frames));
+
+    // The palette changes in the middle of a window of files that
+    // are loaded at the same time.
+    Palette pal(FrameNumber(0), 256);
+    for (int i=0; i<256; ++i)
+      pal.setEntry(i, rgba(i, 0, 0, 255));
+    sprite->setPalette(&pal, true);
+
+    pal.setFrame(FrameNumber(changeFrame));
+    for (int i=0; i<256; ++i)
+      pal.setEntry(i, rgba(0, i, 0, 255));
+    sprite->setPalette(&pal, true);
+
+    LayerImage* layer = dynamic_cast<LayerImage*>(sprite->getFolder()->getFirstLayer());
+    ASSERT_TRUE(layer != NULL);
+    clear_image(sprite->getStock()->getImage(layer->getCel(FrameNumber(0))->getImage()), 1);
+
+    for (int i=1; i<frames; ++i) {
+      Image* image = Image::create(IMAGE_INDEXED, w, h);
+      clear_image(image, 1+i);
+      layer->addCel(new Cel(FrameNumber(i), sprite->getStock()->addImage(image)));
+    }
+
+    save_document(doc);
+  }
+
+  FileOp* fop = fop_to_load_document(fn, FILE_LOAD_SEQUENCE_YES);
+  ASSERT_TRUE(fop != NULL);
+  fop_operate(fop, NULL);
+  fop_done(fop);
+  ASSERT_FALSE(fop->has_error());
+
+  base::UniquePtr<Document> doc(fop->document);
+  fop_free(fop);
+
+  Sprite* sprite = doc->getSprite();
+  ASSERT_EQ(frames, sprite->getTotalFrames());
+
+  for (FrameNumber frame(0); frame<frames; ++frame) {
+    int i = frame;
+    EXPECT_EQ(i < changeFrame ? rgba(1+i, 0, 0, 255): rgba(0, 1+i, 0, 255),
+              sprite->getPalette(frame)->getEntry(1+i)) << "Frame " << i;
+  }
+
+  for (int i=0; i<frames; ++i) {
+    char buf[256];
+    std::sprintf(buf, "test_pal%02d.png", i);
+    std::remove(buf);
+  }
 }
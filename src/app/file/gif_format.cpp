@@ -24,15 +24,21 @@
 #include "app/file/file.h"
 #include "app/file/file_format.h"
 #include "app/file/format_options.h"
+#include "app/ini_file.h"
 #include "app/modules/gui.h"
-#include "app/util/autocrop.h"
 #include "base/file_handle.h"
+#include "base/parallel_for.h"
+#include "base/shared_ptr.h"
 #include "base/unique_ptr.h"
 #include "raster/raster.h"
 #include "ui/alert.h"
 
 #include <gif_lib.h>
 
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
 namespace app {
 
 using namespace base;
@@ -516,72 +522,270 @@ void GifFormat::onDestroyData(FileOp* fop)
 }
 
 #ifdef ENABLE_SAVE
-bool GifFormat::onSave(FileOp* fop)
-{
-  int errCode;
-  GifFilePtr gif_file(EGifOpenFileHandle(open_file_descriptor_with_exception(fop->filename, "wb"), &errCode), &EGifCloseFile);
 
-  if (!gif_file)
-    throw Exception("Error creating GIF file.\n");
+namespace {
+
+  // Frames are rendered and compressed in batches of this size (in
+  // parallel), then they are written in the file in order.
+  const int kGifFramesPerBatch = 32;
+
+  // GIF variant of the LZW compression (it produces the same output
+  // as EGifPutLine(), but several frames can be compressed at the
+  // same time). The output are data sub-blocks (the first byte of
+  // each block is its size) to be written with EGifPutCode().
+  class GifLzwEncoder {
+  public:
+    enum {
+      kMaxCode = 4095,
+      kHashSize = 8192,
+    };
+
+    GifLzwEncoder(int codeSize, std::vector<uint8_t>& output)
+      : m_output(output)
+      , m_clearCode(1 << codeSize)
+      , m_eofCode(m_clearCode + 1)
+      , m_initialBits(codeSize + 1)
+      , m_currentCode(-1)
+      , m_bitBuffer(0)
+      , m_bitCount(0)
+      , m_hashKeys(kHashSize)
+      , m_hashCodes(kHashSize) {
+      m_output.clear();
+      m_blockStart = 0;
+      m_output.push_back(0);
+      clearTable();
+      writeCode(m_clearCode);
+    }
 
-  Sprite* sprite = fop->document->getSprite();
-  int sprite_w = sprite->getWidth();
-  int sprite_h = sprite->getHeight();
-  PixelFormat sprite_format = sprite->getPixelFormat();
-  bool interlace = false;
-  int loop = 0;
-  int background_color = (sprite_format == IMAGE_INDEXED ? sprite->getTransparentColor(): 0);
-  int transparent_index = (sprite->getBackgroundLayer() ? -1: sprite->getTransparentColor());
+    void encode(const uint8_t* pixels, int n) {
+      int i = 0;
+      if (m_currentCode < 0 && n > 0)
+        m_currentCode = pixels[i++];
 
-  Palette* current_palette = sprite->getPalette(FrameNumber(0));
-  Palette* previous_palette = current_palette;
-  ColorMapObject* color_map = GifMakeMapObject(current_palette->size(), NULL);
-  for (int i = 0; i < current_palette->size(); ++i) {
-    color_map->Colors[i].Red   = rgba_getr(current_palette->getEntry(i));
-    color_map->Colors[i].Green = rgba_getg(current_palette->getEntry(i));
-    color_map->Colors[i].Blue  = rgba_getb(current_palette->getEntry(i));
+      for (; i<n; ++i) {
+        int pixel = pixels[i];
+        int key = (m_currentCode << 8) | pixel;
+        int code = findCode(key);
+
+        if (code >= 0) {
+          m_currentCode = code;
+          continue;
+        }
+
+        writeCode(m_currentCode);
+        m_currentCode = pixel;
+
+        if (m_nextCode >= kMaxCode) {
+          writeCode(m_clearCode);
+          clearTable();
+        }
+        else
+          insertCode(key, m_nextCode++);
+      }
+    }
+
+    void finish() {
+      if (m_currentCode >= 0)
+        writeCode(m_currentCode);
+      writeCode(m_eofCode);
+
+      if (m_bitCount > 0)
+        writeByte(m_bitBuffer & 0xff);
+
+      // Remove the last block if it's empty.
+      if (m_output[m_blockStart] == 0)
+        m_output.resize(m_blockStart);
+    }
+
+  private:
+    void clearTable() {
+      std::fill(m_hashKeys.begin(), m_hashKeys.end(), -1);
+      m_nextCode = m_eofCode + 1;
+      m_codeBits = m_initialBits;
+    }
+
+    static int hashKey(int key) {
+      return ((key >> 12) ^ key) & (kHashSize-1);
+    }
+
+    int findCode(int key) const {
+      for (int i=hashKey(key); m_hashKeys[i] >= 0; i=(i+1) & (kHashSize-1))
+        if (m_hashKeys[i] == key)
+          return m_hashCodes[i];
+      return -1;
+    }
+
+    void insertCode(int key, int code) {
+      int i = hashKey(key);
+      while (m_hashKeys[i] >= 0)
+        i = (i+1) & (kHashSize-1);
+      m_hashKeys[i] = key;
+      m_hashCodes[i] = code;
+    }
+
+    void writeCode(int code) {
+      m_bitBuffer |= code << m_bitCount;
+      m_bitCount += m_codeBits;
+      while (m_bitCount >= 8) {
+        writeByte(m_bitBuffer & 0xff);
+        m_bitBuffer >>= 8;
+        m_bitCount -= 8;
+      }
+
+      // The decoder adds the new code after reading this one.
+      if (m_nextCode >= (1 << m_codeBits) && m_codeBits < 12)
+        ++m_codeBits;
+    }
+
+    void writeByte(int byte) {
+      if (m_output[m_blockStart] == 255) {
+        m_blockStart = m_output.size();
+        m_output.push_back(0);
+      }
+      m_output.push_back(byte);
+      ++m_output[m_blockStart];
+    }
+
+    std::vector<uint8_t>& m_output;
+    size_t m_blockStart;
+    int m_clearCode;
+    int m_eofCode;
+    int m_initialBits;
+    int m_codeBits;
+    int m_nextCode;
+    int m_currentCode;
+    int m_bitBuffer;
+    int m_bitCount;
+    std::vector<int> m_hashKeys;
+    std::vector<int> m_hashCodes;
+  };
+
+  // Returns the bounds of the pixels that are different in both
+  // images (or an empty rectangle if the images are equal).
+  gfx::Rect get_diff_bounds(const Image* image, const Image* prev)
+  {
+    int w = image->getWidth();
+    int h = image->getHeight();
+    int x1 = w, y1 = h, x2 = -1, y2 = -1;
+
+    for (int y=0; y<h; ++y) {
+      const uint8_t* a = image->getPixelAddress(0, y);
+      const uint8_t* b = prev->getPixelAddress(0, y);
+      if (std::memcmp(a, b, w) == 0)
+        continue;
+
+      int u1 = 0, u2 = w-1;
+      while (a[u1] == b[u1]) ++u1;
+      while (a[u2] == b[u2]) --u2;
+
+      x1 = MIN(x1, u1);
+      x2 = MAX(x2, u2);
+      y1 = MIN(y1, y);
+      y2 = y;
+    }
+
+    return (x2 >= 0 ? gfx::Rect(x1, y1, x2-x1+1, y2-y1+1): gfx::Rect());
   }
 
-  if (EGifPutScreenDesc(gif_file, sprite_w, sprite_h,
-                        color_map->BitsPerPixel,
-                        background_color, color_map) == GIF_ERROR)
-    throw Exception("Error writing GIF header.\n");
+  // Returns the bounds of the pixels that are not the background color.
+  gfx::Rect get_content_bounds(const Image* image, int bgcolor)
+  {
+    int w = image->getWidth();
+    int h = image->getHeight();
+    int x1 = w, y1 = h, x2 = -1, y2 = -1;
+
+    for (int y=0; y<h; ++y) {
+      const uint8_t* a = image->getPixelAddress(0, y);
+      int u1 = 0, u2 = w-1;
+      while (u1 < w && a[u1] == bgcolor) ++u1;
+      if (u1 == w)
+        continue;
+      while (a[u2] == bgcolor) --u2;
+
+      x1 = MIN(x1, u1);
+      x2 = MAX(x2, u2);
+      y1 = MIN(y1, y);
+      y2 = y;
+    }
 
-  UniquePtr<Image> buffer_image;
-  UniquePtr<Image> current_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
-  UniquePtr<Image> previous_image(Image::create(IMAGE_INDEXED, sprite_w, sprite_h));
-  int frame_x, frame_y, frame_w, frame_h;
-  int u1, v1, u2, v2;
-  int i1, j1, i2, j2;
+    return (x2 >= 0 ? gfx::Rect(x1, y1, x2-x1+1, y2-y1+1): gfx::Rect());
+  }
 
-  // If the sprite is not Indexed type, we will need a temporary
-  // buffer to render the full RGB or Grayscale sprite.
-  if (sprite_format != IMAGE_INDEXED)
-    buffer_image.reset(Image::create(sprite_format, sprite_w, sprite_h));
+  // A frame ready to be written in the GIF file.
+  struct GifEncodedFrame {
+    SharedPtr<Image> image;     // Indexed image of the whole frame
+    Palette* palette;
+    bool local_color_map;       // True if the palette is different from the global one
+    bool new_palette;           // True if the palette is different from the previous frame
+    int code_size;              // Minimum LZW code size
+    gfx::Rect bounds;           // Bounds to write in the file
+    int transparent_index;      // -1 if it's not used in this frame
+    std::vector<uint8_t> data;  // Compressed pixels (see GifLzwEncoder)
+  };
+
+  // Shared options to render/compress the frames.
+  struct GifEncoderParams {
+    Sprite* sprite;
+    int background_color;
+    int transparent_index;
+
+    // Index used for pixels that don't change from the previous
+    // frame (-1 if there is no unused index for that).
+    int unchanged_index;
+    const RgbMap* optimized_rgbmap;
+    bool interlace;
+  };
+
+  // Renders each frame of a batch in an indexed image (called from
+  // several threads).
+  class RenderGifFrames {
+  public:
+    RenderGifFrames(const GifEncoderParams& params,
+                    FrameNumber firstFrame,
+                    std::vector<GifEncodedFrame>& frames)
+      : m_params(params)
+      , m_firstFrame(firstFrame)
+      , m_frames(frames) {
+    }
 
-  clear_image(current_image, background_color);
-  clear_image(previous_image, background_color);
+    void operator()(int i) const {
+      Sprite* sprite = m_params.sprite;
+      FrameNumber frame_num = m_firstFrame.next(i);
+      int sprite_w = sprite->getWidth();
+      int sprite_h = sprite->getHeight();
+      Image* current_image = Image::create(IMAGE_INDEXED, sprite_w, sprite_h);
+      m_frames[i].image.reset(current_image);
+
+      // If the sprite is Indexed, we can render directly into "current_image".
+      if (sprite->getPixelFormat() == IMAGE_INDEXED) {
+        clear_image(current_image, m_params.background_color);
+        layer_render(sprite->getFolder(), current_image, 0, 0, frame_num);
+        return;
+      }
 
-  for (FrameNumber frame_num(0); frame_num<sprite->getTotalFrames(); ++frame_num) {
-    current_palette = sprite->getPalette(frame_num);
+      // If the sprite is RGB or Grayscale, we must to convert it to Indexed on the fly.
+      UniquePtr<Image> buffer_image(Image::create(sprite->getPixelFormat(), sprite_w, sprite_h));
+      const Palette* palette = m_frames[i].palette;
+      const RgbMap* rgbmap = m_params.optimized_rgbmap;
+      int transparent_index = m_params.transparent_index;
 
-    // If the sprite is RGB or Grayscale, we must to convert it to Indexed on the fly.
-    if (sprite_format != IMAGE_INDEXED) {
       clear_image(buffer_image, 0);
       layer_render(sprite->getFolder(), buffer_image, 0, 0, frame_num);
 
-      switch (sprite_format) {
+      switch (sprite->getPixelFormat()) {
 
         // Convert the RGB image to Indexed
         case IMAGE_RGB:
           for (int y = 0; y < sprite_h; ++y)
             for (int x = 0; x < sprite_w; ++x) {
               uint32_t pixel_value = get_pixel_fast<RgbTraits>(buffer_image, x, y);
+              int r = rgba_getr(pixel_value);
+              int g = rgba_getg(pixel_value);
+              int b = rgba_getb(pixel_value);
               put_pixel_fast<IndexedTraits>(current_image, x, y,
                                             (rgba_geta(pixel_value) >= 128) ?
-                                            current_palette->findBestfit(rgba_getr(pixel_value),
-                                                                         rgba_getg(pixel_value),
-                                                                         rgba_getb(pixel_value)):
+                                            (rgbmap ? rgbmap->mapColor(r, g, b):
+                                                      palette->findBestfit(r, g, b)):
                                             transparent_index);
             }
           break;
@@ -593,134 +797,300 @@ bool GifFormat::onSave(FileOp* fop)
               uint16_t pixel_value = get_pixel_fast<GrayscaleTraits>(buffer_image, x, y);
               put_pixel_fast<IndexedTraits>(current_image, x, y,
                                             (graya_geta(pixel_value) >= 128) ?
-                                            current_palette->findBestfit(graya_getv(pixel_value),
-                                                                         graya_getv(pixel_value),
-                                                                         graya_getv(pixel_value)):
+                                            palette->findBestfit(graya_getv(pixel_value),
+                                                                 graya_getv(pixel_value),
+                                                                 graya_getv(pixel_value)):
                                             transparent_index);
             }
           break;
       }
     }
-    // If the sprite is Indexed, we can render directly into "current_image".
-    else {
-      clear_image(current_image, background_color);
-      layer_render(sprite->getFolder(), current_image, 0, 0, frame_num);
-    }
 
-    if (frame_num == 0) {
-      frame_x = 0;
-      frame_y = 0;
-      frame_w = sprite->getWidth();
-      frame_h = sprite->getHeight();
+  private:
+    const GifEncoderParams& m_params;
+    FrameNumber m_firstFrame;
+    std::vector<GifEncodedFrame>& m_frames;
+  };
+
+  // Calculates the bounds of each frame of a batch (comparing it with
+  // the previous frame) and compresses its pixels (called from several
+  // threads).
+  class CompressGifFrames {
+  public:
+    CompressGifFrames(const GifEncoderParams& params,
+                      const SharedPtr<Image>& previousImage,
+                      std::vector<GifEncodedFrame>& frames)
+      : m_params(params)
+      , m_previousImage(previousImage)
+      , m_frames(frames) {
     }
-    else {
-      // Get the rectangle where start differences with the previous frame.
-      if (get_shrink_rect2(&u1, &v1, &u2, &v2, current_image, previous_image)) {
-        // Check the minimal area with the background color.
-        if (get_shrink_rect(&i1, &j1, &i2, &j2, current_image, background_color)) {
-          frame_x = MIN(u1, i1);
-          frame_y = MIN(v1, j1);
-          frame_w = MAX(u2, i2) - MIN(u1, i1) + 1;
-          frame_h = MAX(v2, j2) - MIN(v1, j1) + 1;
+
+    void operator()(int i) const {
+      GifEncodedFrame& frame = m_frames[i];
+      const Image* image = frame.image.get();
+      const Image* prev = (i > 0 ? m_frames[i-1].image.get(): m_previousImage.get());
+      int unchanged_index = -1;
+
+      frame.transparent_index = m_params.transparent_index;
+
+      // The first frame is complete. If the palette changes, pixels
+      // with the same index can have a different color, so the whole
+      // frame is needed too.
+      if (!prev || frame.new_palette) {
+        frame.bounds = image->getBounds();
+      }
+      // Frames of opaque sprites are drawn over the previous one
+      // (DISPOSAL_METHOD_DO_NOT_DISPOSE), so we need just the
+      // modified pixels. If we have an unused index, pixels that
+      // didn't change are transparent (they are compressed better).
+      else if (m_params.sprite->getBackgroundLayer()) {
+        frame.bounds = get_diff_bounds(image, prev);
+        unchanged_index = m_params.unchanged_index;
+        if (unchanged_index >= 0)
+          frame.transparent_index = unchanged_index;
+      }
+      // Frames of transparent sprites are drawn over the background
+      // (DISPOSAL_METHOD_RESTORE_BGCOLOR clears the previous frame),
+      // so we need all pixels that aren't the background.
+      else {
+        frame.bounds = get_content_bounds(image, m_params.background_color);
+      }
+
+      // Nothing to draw (one pixel is enough).
+      if (frame.bounds.isEmpty())
+        frame.bounds = gfx::Rect(0, 0, 1, 1);
+
+      GifLzwEncoder encoder(frame.code_size, frame.data);
+      std::vector<uint8_t> row(frame.bounds.w);
+
+      for (int pass=0; pass<(m_params.interlace ? 4: 1); ++pass) {
+        int y1 = (m_params.interlace ? interlaced_offset[pass]: 0);
+        int dy = (m_params.interlace ? interlaced_jumps[pass]: 1);
+
+        for (int y=y1; y<frame.bounds.h; y+=dy) {
+          const uint8_t* src = image->getPixelAddress(frame.bounds.x, frame.bounds.y+y);
+
+          if (unchanged_index >= 0) {
+            const uint8_t* src_prev = prev->getPixelAddress(frame.bounds.x, frame.bounds.y+y);
+            for (int x=0; x<frame.bounds.w; ++x)
+              row[x] = (src[x] == src_prev[x] ? unchanged_index: src[x]);
+            src = &row[0];
+          }
+
+          encoder.encode(src, frame.bounds.w);
         }
       }
+
+      encoder.finish();
     }
 
-    // Specify loop extension.
-    if (frame_num == 0 && loop >= 0) {
-      if (EGifPutExtensionLeader(gif_file, APPLICATION_EXT_FUNC_CODE) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record (header section).");
+  private:
+    const GifEncoderParams& m_params;
+    const SharedPtr<Image>& m_previousImage;
+    std::vector<GifEncodedFrame>& m_frames;
+  };
 
-      unsigned char extension_bytes[11];
-      memcpy(extension_bytes, "NETSCAPE2.0", 11);
-      if (EGifPutExtensionBlock(gif_file, 11, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record (first block).");
+} // anonymous namespace
 
-      extension_bytes[0] = 1;
-      extension_bytes[1] = (loop & 0xff);
-      extension_bytes[2] = (loop >> 8) & 0xff;
-      if (EGifPutExtensionBlock(gif_file, 3, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record (second block).");
+bool GifFormat::onSave(FileOp* fop)
+{
+  int errCode;
+  GifFilePtr gif_file(EGifOpenFileHandle(open_file_descriptor_with_exception(fop->filename, "wb"), &errCode), &EGifCloseFile);
+
+  if (!gif_file)
+    throw Exception("Error creating GIF file.\n");
 
-      if (EGifPutExtensionTrailer(gif_file) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record (trailer section).");
+  Sprite* sprite = fop->document->getSprite();
+  int sprite_w = sprite->getWidth();
+  int sprite_h = sprite->getHeight();
+  PixelFormat sprite_format = sprite->getPixelFormat();
+  bool interlace = false;
+  int loop = 0;
+  int background_color = (sprite_format == IMAGE_INDEXED ? sprite->getTransparentColor(): 0);
+  int transparent_index = (sprite->getBackgroundLayer() ? -1: sprite->getTransparentColor());
+
+  // For RGB sprites we can create one optimized palette with the
+  // colors of all frames (instead of using the sprite palette).
+  UniquePtr<Palette> optimized_palette;
+  UniquePtr<RgbMap> optimized_rgbmap;
+  if (sprite_format == IMAGE_RGB &&
+      get_config_bool("GIF", "OptimizePalette", true)) {
+    UniquePtr<Image> frame_image(Image::create(IMAGE_RGB, sprite_w, sprite_h));
+    quantization::PaletteGenerator generator;
+
+    for (FrameNumber frame_num(0); frame_num<sprite->getTotalFrames(); ++frame_num) {
+      clear_image(frame_image, 0);
+      layer_render(sprite->getFolder(), frame_image, 0, 0, frame_num);
+      generator.addImage(frame_image);
     }
 
-    // Add Aseprite block (at this moment, it's empty).
-    if (frame_num == 0) {
-      if (EGifPutExtensionLeader(gif_file, APPLICATION_EXT_FUNC_CODE) == GIF_ERROR)
-        throw Exception("Error writing GIF comment (header section).");
+    // The entry 0 is kept for the transparent color.
+    optimized_palette.reset(new Palette(FrameNumber(0), 256));
+    generator.createPalette(optimized_palette, 1,
+                            get_config_int("GIF", "PaletteRefinementTime",
+                                           quantization::DefaultRefineTime));
 
-      unsigned char extension_bytes[11];
-      memcpy(extension_bytes, "ASEPRITE1.0", 11);
-      if (EGifPutExtensionBlock(gif_file, sizeof(extension_bytes), extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF comment (first block).");
+    optimized_rgbmap.reset(new RgbMap);
+    optimized_rgbmap->regenerate(optimized_palette);
 
-      if (EGifPutExtensionTrailer(gif_file) == GIF_ERROR)
-        throw Exception("Error writing GIF comment (trailer section).");
-    }
+    if (transparent_index >= 0)
+      transparent_index = 0;
+  }
+
+  Palette* current_palette = (optimized_palette ? optimized_palette.get():
+                                                  sprite->getPalette(FrameNumber(0)));
+  Palette* previous_palette = current_palette;
+  ColorMapObject* color_map = GifMakeMapObject(current_palette->size(), NULL);
+  for (int i = 0; i < current_palette->size(); ++i) {
+    color_map->Colors[i].Red   = rgba_getr(current_palette->getEntry(i));
+    color_map->Colors[i].Green = rgba_getg(current_palette->getEntry(i));
+    color_map->Colors[i].Blue  = rgba_getb(current_palette->getEntry(i));
+  }
+
+  if (EGifPutScreenDesc(gif_file, sprite_w, sprite_h,
+                        color_map->BitsPerPixel,
+                        background_color, color_map) == GIF_ERROR)
+    throw Exception("Error writing GIF header.\n");
 
-    // Write graphics extension record (to save the duration of the
-    // frame and maybe the transparency index).
-    {
-      unsigned char extension_bytes[5];
-      int disposal_method = (sprite->getBackgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
-                                                            DISPOSAL_METHOD_RESTORE_BGCOLOR);
-      int frame_delay = sprite->getFrameDuration(frame_num) / 10;
-
-      extension_bytes[0] = (((disposal_method & 7) << 2) |
-                            (transparent_index >= 0 ? 1: 0));
-      extension_bytes[1] = (frame_delay & 0xff);
-      extension_bytes[2] = (frame_delay >> 8) & 0xff;
-      extension_bytes[3] = (transparent_index >= 0 ? transparent_index: 0);
-
-      if (EGifPutExtension(gif_file, GRAPHICS_EXT_FUNC_CODE, 4, extension_bytes) == GIF_ERROR)
-        throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
+  GifEncoderParams params;
+  params.sprite = sprite;
+  params.background_color = background_color;
+  params.transparent_index = transparent_index;
+  params.unchanged_index = (sprite->getBackgroundLayer() && optimized_palette ? 0: -1);
+  params.optimized_rgbmap = optimized_rgbmap.get();
+  params.interlace = interlace;
+
+  // Palette::findBestfit() initializes its tables the first time
+  // it's used, so we call it here before using it from several threads.
+  current_palette->findBestfit(0, 0, 0);
+
+  // The same for the RgbMap, its cells are calculated on demand.
+  if (optimized_rgbmap)
+    optimized_rgbmap->regenerateAll();
+
+  SharedPtr<Image> previous_image;
+  std::vector<GifEncodedFrame> frames;
+
+  for (FrameNumber first_frame(0); first_frame<sprite->getTotalFrames();
+       first_frame += FrameNumber(kGifFramesPerBatch)) {
+    int nframes = MIN(kGifFramesPerBatch, sprite->getTotalFrames() - first_frame);
+
+    frames.clear();
+    frames.resize(nframes);
+    for (int i=0; i<nframes; ++i) {
+      GifEncodedFrame& frame = frames[i];
+      Palette* prev_palette = (i > 0 ? frames[i-1].palette: previous_palette);
+
+      frame.palette = (optimized_palette ? optimized_palette.get():
+                                           sprite->getPalette(first_frame.next(i)));
+      // Frames without a local color map use the global one (not the
+      // palette of the previous frame).
+      frame.local_color_map = (frame.palette != current_palette);
+      frame.new_palette = (frame.palette != prev_palette);
+      frame.code_size = MAX(2, (frame.local_color_map ?
+                                GifBitSize(frame.palette->size()):
+                                color_map->BitsPerPixel));
     }
+    previous_palette = frames.back().palette;
+
+    // Render and compress frames in parallel.
+    base::parallel_for(0, nframes, RenderGifFrames(params, first_frame, frames));
+    base::parallel_for(0, nframes, CompressGifFrames(params, previous_image, frames));
+
+    for (int i=0; i<nframes; ++i) {
+      GifEncodedFrame& frame = frames[i];
+      FrameNumber frame_num = first_frame.next(i);
+
+      // Specify loop extension.
+      if (frame_num == 0 && loop >= 0) {
+        if (EGifPutExtensionLeader(gif_file, APPLICATION_EXT_FUNC_CODE) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record (header section).");
+
+        unsigned char extension_bytes[11];
+        memcpy(extension_bytes, "NETSCAPE2.0", 11);
+        if (EGifPutExtensionBlock(gif_file, 11, extension_bytes) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record (first block).");
+
+        extension_bytes[0] = 1;
+        extension_bytes[1] = (loop & 0xff);
+        extension_bytes[2] = (loop >> 8) & 0xff;
+        if (EGifPutExtensionBlock(gif_file, 3, extension_bytes) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record (second block).");
+
+        if (EGifPutExtensionTrailer(gif_file) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record (trailer section).");
+      }
+
+      // Add Aseprite block (at this moment, it's empty).
+      if (frame_num == 0) {
+        if (EGifPutExtensionLeader(gif_file, APPLICATION_EXT_FUNC_CODE) == GIF_ERROR)
+          throw Exception("Error writing GIF comment (header section).");
+
+        unsigned char extension_bytes[11];
+        memcpy(extension_bytes, "ASEPRITE1.0", 11);
+        if (EGifPutExtensionBlock(gif_file, sizeof(extension_bytes), extension_bytes) == GIF_ERROR)
+          throw Exception("Error writing GIF comment (first block).");
 
-    // Image color map
-    ColorMapObject* image_color_map = NULL;
-    if (current_palette != previous_palette) {
-      image_color_map = GifMakeMapObject(current_palette->size(), NULL);
-      for (int i = 0; i < current_palette->size(); ++i) {
-        image_color_map->Colors[i].Red   = rgba_getr(current_palette->getEntry(i));
-        image_color_map->Colors[i].Green = rgba_getg(current_palette->getEntry(i));
-        image_color_map->Colors[i].Blue  = rgba_getb(current_palette->getEntry(i));
+        if (EGifPutExtensionTrailer(gif_file) == GIF_ERROR)
+          throw Exception("Error writing GIF comment (trailer section).");
+      }
+
+      // Write graphics extension record (to save the duration of the
+      // frame and maybe the transparency index).
+      {
+        unsigned char extension_bytes[5];
+        int disposal_method = (sprite->getBackgroundLayer() ? DISPOSAL_METHOD_DO_NOT_DISPOSE:
+                                                              DISPOSAL_METHOD_RESTORE_BGCOLOR);
+        int frame_delay = sprite->getFrameDuration(frame_num) / 10;
+
+        extension_bytes[0] = (((disposal_method & 7) << 2) |
+                              (frame.transparent_index >= 0 ? 1: 0));
+        extension_bytes[1] = (frame_delay & 0xff);
+        extension_bytes[2] = (frame_delay >> 8) & 0xff;
+        extension_bytes[3] = (frame.transparent_index >= 0 ? frame.transparent_index: 0);
+
+        if (EGifPutExtension(gif_file, GRAPHICS_EXT_FUNC_CODE, 4, extension_bytes) == GIF_ERROR)
+          throw Exception("Error writing GIF graphics extension record for frame %d.\n", (int)frame_num);
       }
-      previous_palette = current_palette;
-    }
 
-    // Write the image record.
-    if (EGifPutImageDesc(gif_file,
-                         frame_x, frame_y,
-                         frame_w, frame_h, interlace ? 1: 0,
-                         image_color_map) == GIF_ERROR)
-      throw Exception("Error writing GIF frame %d.\n", (int)frame_num);
-
-    // Write the image data (pixels).
-    if (interlace) {
-      // Need to perform 4 passes on the images.
-      for (int i=0; i<4; ++i)
-        for (int y = interlaced_offset[i]; y < frame_h; y += interlaced_jumps[i]) {
-          IndexedTraits::address_t addr =
-            (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
-
-          if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
-            throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
+      // Image color map
+      ColorMapObject* image_color_map = NULL;
+      if (frame.local_color_map) {
+        image_color_map = GifMakeMapObject(frame.palette->size(), NULL);
+        for (int i = 0; i < frame.palette->size(); ++i) {
+          image_color_map->Colors[i].Red   = rgba_getr(frame.palette->getEntry(i));
+          image_color_map->Colors[i].Green = rgba_getg(frame.palette->getEntry(i));
+          image_color_map->Colors[i].Blue  = rgba_getb(frame.palette->getEntry(i));
         }
-    }
-    else {
-      // Write all image scanlines (not interlaced in this case).
-      for (int y = 0; y < frame_h; ++y) {
-        IndexedTraits::address_t addr =
-          (IndexedTraits::address_t)current_image->getPixelAddress(frame_x, frame_y + y);
-
-        if (EGifPutLine(gif_file, addr, frame_w) == GIF_ERROR)
-          throw Exception("Error writing GIF image scanlines for frame %d.\n", (int)frame_num);
       }
+
+      // Write the image record (giflib keeps a copy of the color map).
+      int res = EGifPutImageDesc(gif_file,
+                                 frame.bounds.x, frame.bounds.y,
+                                 frame.bounds.w, frame.bounds.h, interlace ? 1: 0,
+                                 image_color_map);
+      if (image_color_map)
+        GifFreeMapObject(image_color_map);
+      if (res == GIF_ERROR)
+        throw Exception("Error writing GIF frame %d.\n", (int)frame_num);
+
+      // Write the image data (pixels compressed by CompressGifFrames).
+      ASSERT(!frame.data.empty());
+      const uint8_t* block = &frame.data[0];
+      const uint8_t* end = block + frame.data.size();
+      if (EGifPutCode(gif_file, frame.code_size, block) == GIF_ERROR)
+        throw Exception("Error writing GIF image data for frame %d.\n", (int)frame_num);
+
+      for (block += block[0]+1; block < end; block += block[0]+1) {
+        if (EGifPutCodeNext(gif_file, block) == GIF_ERROR)
+          throw Exception("Error writing GIF image data for frame %d.\n", (int)frame_num);
+      }
+
+      if (EGifPutCodeNext(gif_file, NULL) == GIF_ERROR)
+        throw Exception("Error writing GIF image data for frame %d.\n", (int)frame_num);
     }
 
-    copy_image(previous_image, current_image, 0, 0);
+    previous_image = frames.back().image;
   }
 
   return true;
@@ -75,11 +75,14 @@ public:
 
   void transformPoint(ToolLoop* loop, int x, int y)
   {
-    algo_floodfill(loop->getSrcImage(), x, y, loop->getTolerance(), loop, (AlgoHLine)doInkHline);
+    algo_floodfill(loop->getSrcImage(), x, y, loop->getTolerance(), loop->getContiguous(),
+                   loop, (AlgoHLine)doInkHline);
   }
   void getModifiedArea(ToolLoop* loop, int x, int y, Rect& area)
   {
-    area = Rect(0, 0, 9999, 9999);
+    // Any pixel of the image can be filled
+    Image* image = loop->getSrcImage();
+    area = Rect(0, 0, image->getWidth(), image->getHeight());
   }
 };
 
@@ -85,7 +85,8 @@ namespace app {
       // Should return an image where we can read pixels (readonly image)
       virtual Image* getSrcImage() = 0;
 
-      // Should return an image where we can write pixels
+      // Should return an image where we can write pixels (it must
+      // have the same pixels as getSrcImage() when the loop starts)
       virtual Image* getDstImage() = 0;
 
       // Returns the RGB map used to convert RGB values to palette index.
@@ -124,6 +125,11 @@ namespace app {
       // Returns the tolerance to be used by the ink (Ink).
       virtual int getTolerance() = 0;
 
+      // Returns true if the flood fill must fill only the pixels
+      // connected to the clicked point (or all similar pixels if it's
+      // false).
+      virtual bool getContiguous() = 0;
+
       // Returns the selection mode (if the ink is of selection type).
       virtual SelectionMode getSelectionMode() = 0;
 
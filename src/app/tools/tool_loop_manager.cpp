@@ -61,10 +61,6 @@ void ToolLoopManager::prepareLoop(const Pointer& pointer)
   // Start with no points at all
   m_points.clear();
 
-  // Prepare the image where we will draw on
-  copy_image(m_toolLoop->getDstImage(),
-             m_toolLoop->getSrcImage(), 0, 0);
-
   // Prepare the ink
   m_toolLoop->getInk()->prepareInk(m_toolLoop);
   m_toolLoop->getIntertwine()->prepareIntertwine();
@@ -169,15 +165,15 @@ void ToolLoopManager::doLoopStep(bool last_step)
 
     case TracePolicyLast:
       // Copy source to destination (reset the previous trace). Useful
-      // for tools like Line and Ellipse tools (we kept the last trace only).
-      clear_image(m_toolLoop->getDstImage(), 0);
-      copy_image(m_toolLoop->getDstImage(), m_toolLoop->getSrcImage(), 0, 0);
+      // for tools like Line and Ellipse tools (we kept the last trace
+      // only). Only the area modified by the previous trace is copied.
+      copyOldDirtyArea(m_toolLoop->getDstImage(), m_toolLoop->getSrcImage());
       break;
 
     case TracePolicyOverlap:
       // Copy destination to source (yes, destination to source). In
       // this way each new trace overlaps the previous one.
-      copy_image(m_toolLoop->getSrcImage(), m_toolLoop->getDstImage(), 0, 0);
+      copyOldDirtyArea(m_toolLoop->getSrcImage(), m_toolLoop->getDstImage());
       break;
   }
 
@@ -191,16 +187,37 @@ void ToolLoopManager::doLoopStep(bool last_step)
   Region& dirty_area = m_toolLoop->getDirtyArea();
   calculateDirtyArea(m_toolLoop, points_to_interwine, dirty_area);
 
-  if (m_toolLoop->getTracePolicy() == TracePolicyLast) {
-    Region prev_dirty_area = dirty_area;
-    dirty_area.createUnion(dirty_area, m_oldDirtyArea);
-    m_oldDirtyArea = prev_dirty_area;
+  switch (m_toolLoop->getTracePolicy()) {
+
+    case TracePolicyLast: {
+      Region prev_dirty_area = dirty_area;
+      dirty_area.createUnion(dirty_area, m_oldDirtyArea);
+      m_oldDirtyArea = prev_dirty_area;
+      break;
+    }
+
+    case TracePolicyOverlap:
+      m_oldDirtyArea = dirty_area;
+      break;
   }
 
   if (!dirty_area.isEmpty())
     m_toolLoop->updateDirtyArea();
 }
 
+// Copies the area modified by the previous trace (m_oldDirtyArea)
+// from "src" to "dst". Outside this area both images are equal.
+void ToolLoopManager::copyOldDirtyArea(Image* dst, const Image* src)
+{
+  Point offset(m_toolLoop->getOffset());
+
+  for (Region::const_iterator it = m_oldDirtyArea.begin(),
+         end = m_oldDirtyArea.end(); it != end; ++it) {
+    // The dirty area is in sprite coordinates
+    copy_image_area(dst, src, Rect(*it).offset(offset));
+  }
+}
+
 // Applies the grid settings to the specified sprite point.
 void ToolLoopManager::snapToGrid(Point& point)
 {
@@ -26,6 +26,7 @@
 #include "gfx/region.h"
 
 namespace gfx { class Region; }
+namespace raster { class Image; }
 
 namespace app {
   namespace tools {
@@ -98,6 +99,7 @@ namespace app {
       typedef std::vector<gfx::Point> Points;
 
       void doLoopStep(bool last_step);
+      void copyOldDirtyArea(raster::Image* dst, const raster::Image* src);
       void snapToGrid(gfx::Point& point);
 
       static void calculateDirtyArea(ToolLoop* loop,
@@ -263,6 +263,25 @@ protected:
   }
 };
 
+class ContextBar::ContiguousField : public CheckBox
+{
+public:
+  ContiguousField() : CheckBox("Contiguous") {
+    setup_mini_font(this);
+  }
+
+  void onClick(Event& ev) OVERRIDE {
+    CheckBox::onClick(ev);
+
+    ISettings* settings = UIContext::instance()->getSettings();
+    Tool* currentTool = settings->getCurrentTool();
+    settings->getToolSettings(currentTool)
+      ->setContiguous(isSelected());
+
+    releaseFocus();
+  }
+};
+
 class ContextBar::InkTypeField : public ComboBox
 {
 public:
@@ -540,6 +559,7 @@ ContextBar::ContextBar()
 
   addChild(m_toleranceLabel = new Label("Tolerance:"));
   addChild(m_tolerance = new ToleranceField());
+  addChild(m_contiguous = new ContiguousField());
 
   addChild(m_inkType = new InkTypeField());
 
@@ -661,6 +681,7 @@ void ContextBar::updateFromTool(tools::Tool* tool)
   m_brushAngle->setTextf("%d", penSettings->getAngle());
 
   m_tolerance->setTextf("%d", toolSettings->getTolerance());
+  m_contiguous->setSelected(toolSettings->getContiguous());
 
   m_inkType->setInkType(toolSettings->getInkType());
   m_inkOpacity->setTextf("%d", toolSettings->getOpacity());
@@ -712,6 +733,7 @@ void ContextBar::updateFromTool(tools::Tool* tool)
   m_freehandBox->setVisible(isFreehand && hasOpacity);
   m_toleranceLabel->setVisible(hasTolerance);
   m_tolerance->setVisible(hasTolerance);
+  m_contiguous->setVisible(hasTolerance);
   m_sprayBox->setVisible(hasSprayOptions);
   m_selectionOptionsBox->setVisible(hasSelectOptions);
   m_selectionMode->setVisible(true);
@@ -66,6 +66,7 @@ namespace app {
     class BrushAngleField;
     class BrushSizeField;
     class ToleranceField;
+    class ContiguousField;
     class InkTypeField;
     class InkOpacityField;
     class SprayWidthField;
@@ -83,6 +84,7 @@ namespace app {
     BrushSizeField* m_brushSize;
     ui::Label* m_toleranceLabel;
     ToleranceField* m_tolerance;
+    ContiguousField* m_contiguous;
     InkTypeField* m_inkType;
     ui::Label* m_opacityLabel;
     InkOpacityField* m_inkOpacity;
@@ -42,6 +42,7 @@
 #include "app/ui/context_bar.h"
 #include "app/ui/editor/editor_customization_delegate.h"
 #include "app/ui/editor/editor_decorator.h"
+#include "app/ui/editor/editor_render_cache.h"
 #include "app/ui/editor/moving_pixels_state.h"
 #include "app/ui/editor/pixels_movement.h"
 #include "app/ui/editor/standby_state.h"
@@ -137,6 +138,7 @@ Editor::Editor(Document* document, EditorFlags flags)
   , m_layer(m_sprite->getFolder()->getFirstLayer())
   , m_frame(FrameNumber(0))
   , m_zoom(0)
+  , m_renderCache(new EditorRenderCache(document))
   , m_mask_timer(100, this)
   , m_customizationDelegate(NULL)
   , m_docView(NULL)
@@ -168,6 +170,10 @@ Editor::Editor(Document* document, EditorFlags flags)
   UIContext::instance()->getSettings()
     ->getDocumentSettings(m_document)
     ->addObserver(this);
+
+  // The cache is added as an observer before the DocumentView, so it
+  // is invalidated before the view redraws the modified region.
+  m_document->addObserver(m_renderCache);
 }
 
 Editor::~Editor()
@@ -176,6 +182,9 @@ Editor::~Editor()
     ->getDocumentSettings(m_document)
     ->removeObserver(this);
 
+  m_document->removeObserver(m_renderCache);
+  delete m_renderCache;
+
   setCustomizationDelegate(NULL);
 
   m_mask_timer.stop();
@@ -380,6 +389,20 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc, in
 
   // Draw the sprite
   if ((width > 0) && (height > 0)) {
+    // If the decorator doesn't modify the rendered image, the cached
+    // render can be blitted directly.
+    if (!m_decorator || !m_decorator->hasPreRenderDecorations()) {
+      try {
+        m_renderCache->draw(g, gfx::Rect(source_x, source_y, width, height),
+                            dest_x, dest_y, m_layer, m_frame, m_zoom,
+                            ((m_flags & kShowOnionskin) == kShowOnionskin));
+      }
+      catch (const std::exception& e) {
+        Console::showException(e);
+      }
+      return;
+    }
+
     RenderEngine renderEngine(m_document, m_sprite, m_layer, m_frame);
 
     // Generate the rendered image
@@ -517,6 +540,16 @@ void Editor::drawSpriteClipped(const gfx::Region& updateRegion)
   }
 }
 
+void Editor::invalidateRenderCache()
+{
+  m_renderCache->invalidate();
+}
+
+void Editor::invalidateRenderCache(const gfx::Region& spriteRegion)
+{
+  m_renderCache->invalidate(spriteRegion);
+}
+
 /**
  * Draws the boundaries, really this routine doesn't use the "mask"
  * field of the sprite, only the "bound" field (so you can have other
@@ -1046,6 +1079,14 @@ void Editor::onPaint(ui::PaintEvent& ev)
       // Draw the sprite in the editor
       drawSpriteUnclippedRect(g, gfx::Rect(0, 0, m_sprite->getWidth(), m_sprite->getHeight()));
 
+      // Show the cels that were loaded with errors (they are loaded
+      // when they are drawn for first time).
+      std::vector<std::string> errors;
+      m_sprite->getStock()->takeLoadErrors(errors);
+      if (!errors.empty())
+        StatusBar::instance()->setStatusText(5000, "Corrupted data in %d cel(s). %.160s",
+                                             (int)errors.size(), errors[0].c_str());
+
       // Draw the mask boundaries
       if (m_document->getBoundariesSegments()) {
         drawMask(g);
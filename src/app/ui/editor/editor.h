@@ -54,6 +54,7 @@ namespace app {
   class DocumentLocation;
   class DocumentView;
   class EditorCustomizationDelegate;
+  class EditorRenderCache;
   class PixelsMovement;
 
   namespace tools {
@@ -125,6 +126,12 @@ namespace app {
     // Draws the sprite taking care of the whole clipping region.
     void drawSpriteClipped(const gfx::Region& updateRegion);
 
+    // Discards the cached rendered sprite (or just the given region in
+    // sprite coordinates). It must be called when the sprite is
+    // modified without a document notification.
+    void invalidateRenderCache();
+    void invalidateRenderCache(const gfx::Region& spriteRegion);
+
     void flashCurrentLayer();
 
     void screenToEditor(int xin, int yin, int* xout, int* yout);
@@ -237,6 +244,9 @@ namespace app {
     FrameNumber m_frame;          // Active frame in the editor
     int m_zoom;                   // Zoom in the editor
 
+    // Rendered sprite to avoid compositing all layers in each paint
+    EditorRenderCache* m_renderCache;
+
     // Drawing cursor
     int m_cursor_thick;
     int m_cursor_screen_x; // Position in the screen (view)
@@ -58,6 +58,10 @@ namespace app {
     virtual ~EditorDecorator() { }
     virtual void preRenderDecorator(EditorPreRender* render) = 0;
     virtual void postRenderDecorator(EditorPostRender* render) = 0;
+
+    // Returns false if preRenderDecorator() doesn't modify the
+    // rendered image, so the editor can use its cached render.
+    virtual bool hasPreRenderDecorations() { return true; }
   };
     
 } // namespace app
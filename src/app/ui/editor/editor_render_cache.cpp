@@ -0,0 +1,329 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/editor_render_cache.h"
+
+#include "app/document.h"
+#include "app/document_event.h"
+#include "app/settings/document_settings.h"
+#include "app/settings/settings.h"
+#include "app/ui_context.h"
+#include "app/util/render.h"
+#include "base/unique_ptr.h"
+#include "raster/conversion_alleg.h"
+#include "raster/raster.h"
+#include "ui/graphics.h"
+
+#include <allegro.h>
+#include <new>
+
+namespace app {
+
+// Size of each cached tile (in zoomed sprite coordinates).
+static const int kTileSize = 256;
+
+// Maximum number of tiles kept by each editor (256 tiles of 256x256
+// in 32bpp use 64 MB).
+static const size_t kMaxTiles = 256;
+
+// Incremented by invalidateAll() to discard the cache of all editors.
+static int cache_generation = 0;
+
+static void collect_visible_layers(const Layer* layer, std::vector<const Layer*>& layers)
+{
+  if (!layer->isReadable())
+    return;
+
+  layers.push_back(layer);
+
+  if (layer->isFolder()) {
+    LayerConstIterator it = static_cast<const LayerFolder*>(layer)->getLayerBegin();
+    LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
+
+    for (; it != end; ++it)
+      collect_visible_layers(*it, layers);
+  }
+}
+
+bool EditorRenderCache::Key::operator==(const Key& other) const
+{
+  return
+    generation == other.generation &&
+    frame == other.frame &&
+    zoom == other.zoom &&
+    layer == other.layer &&
+    visibleLayers == other.visibleLayers &&
+    palette == other.palette &&
+    paletteModifications == other.paletteModifications &&
+    pixelFormat == other.pixelFormat &&
+    transparentColor == other.transparentColor &&
+    spriteWidth == other.spriteWidth &&
+    spriteHeight == other.spriteHeight &&
+    previewVersion == other.previewVersion &&
+    checkedBgType == other.checkedBgType &&
+    checkedBgZoom == other.checkedBgZoom &&
+    checkedBgColor1 == other.checkedBgColor1 &&
+    checkedBgColor2 == other.checkedBgColor2 &&
+    onionskin == other.onionskin &&
+    onionskinPrevs == other.onionskinPrevs &&
+    onionskinNexts == other.onionskinNexts &&
+    onionskinOpacityBase == other.onionskinOpacityBase &&
+    onionskinOpacityStep == other.onionskinOpacityStep &&
+    onionskinType == other.onionskinType;
+}
+
+EditorRenderCache::EditorRenderCache(Document* document)
+  : m_document(document)
+  , m_sprite(document->getSprite())
+  , m_validKey(false)
+  , m_useCounter(0)
+{
+}
+
+EditorRenderCache::~EditorRenderCache()
+{
+  destroyTiles();
+}
+
+void EditorRenderCache::draw(ui::Graphics* g, const gfx::Rect& source, int dest_x, int dest_y,
+                             const Layer* layer, FrameNumber frame, int zoom, bool onionskin)
+{
+  Key key = makeKey(layer, frame, zoom, onionskin);
+  if (!m_validKey || key != m_key) {
+    destroyTiles();
+    m_key = key;
+    m_validKey = true;
+  }
+
+  gfx::Rect spriteBounds(0, 0,
+                         m_sprite->getWidth() << zoom,
+                         m_sprite->getHeight() << zoom);
+
+  ++m_useCounter;
+
+  int u1 = source.x / kTileSize;
+  int v1 = source.y / kTileSize;
+  int u2 = (source.x+source.w-1) / kTileSize;
+  int v2 = (source.y+source.h-1) / kTileSize;
+
+  for (int v=v1; v<=v2; ++v) {
+    for (int u=u1; u<=u2; ++u) {
+      Tile* tile = getTile(u, v);
+      if (!tile->invalid.isEmpty())
+        renderTile(tile, spriteBounds);
+
+      tile->lastUse = m_useCounter;
+
+      gfx::Rect part = tile->bounds.createIntersect(source);
+      g->blit(tile->bmp,
+              part.x - tile->bounds.x,
+              part.y - tile->bounds.y,
+              dest_x + part.x - source.x,
+              dest_y + part.y - source.y,
+              part.w, part.h);
+    }
+  }
+
+  removeUnusedTiles();
+}
+
+void EditorRenderCache::invalidate()
+{
+  for (Tiles::iterator it=m_tiles.begin(), end=m_tiles.end(); it != end; ++it) {
+    Tile* tile = it->second;
+    tile->invalid = gfx::Region(tile->bounds);
+  }
+}
+
+void EditorRenderCache::invalidate(const gfx::Region& spriteRegion)
+{
+  if (!m_validKey || m_tiles.empty())
+    return;
+
+  int zoom = m_key.zoom;
+
+  // Convert the region to zoomed coordinates.
+  gfx::Region region;
+  for (gfx::Region::const_iterator it=spriteRegion.begin(), end=spriteRegion.end();
+       it != end; ++it) {
+    const gfx::Rect& rc = *it;
+    region.createUnion(region,
+                       gfx::Region(gfx::Rect(rc.x << zoom, rc.y << zoom,
+                                             rc.w << zoom, rc.h << zoom)));
+  }
+
+  gfx::Region tmp;
+  for (Tiles::iterator it=m_tiles.begin(), end=m_tiles.end(); it != end; ++it) {
+    Tile* tile = it->second;
+
+    tmp.createIntersection(region, gfx::Region(tile->bounds));
+    if (!tmp.isEmpty())
+      tile->invalid.createUnion(tile->invalid, tmp);
+  }
+}
+
+// static
+void EditorRenderCache::invalidateAll()
+{
+  ++cache_generation;
+}
+
+void EditorRenderCache::onGeneralUpdate(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onAddLayer(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onAddFrame(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onAddCel(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onAfterRemoveLayer(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onRemoveFrame(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onRemoveCel(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onSpriteSizeChanged(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onSpriteTransparentColorChanged(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onLayerRestacked(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onLayerMergedDown(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onCelMoved(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onCelCopied(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onCelFrameChanged(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onCelPositionChanged(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onCelOpacityChanged(DocumentEvent& ev) { invalidate(); }
+void EditorRenderCache::onImagePixelsModified(DocumentEvent& ev) { invalidate(); }
+
+void EditorRenderCache::onSpritePixelsModified(DocumentEvent& ev)
+{
+  invalidate(ev.region());
+}
+
+EditorRenderCache::Key EditorRenderCache::makeKey(const Layer* layer, FrameNumber frame,
+                                                  int zoom, bool onionskin) const
+{
+  Key key;
+
+  key.generation = cache_generation;
+  key.frame = frame;
+  key.zoom = zoom;
+  key.layer = layer;
+  collect_visible_layers(m_sprite->getFolder(), key.visibleLayers);
+  key.palette = m_sprite->getPalette(frame);
+  key.paletteModifications = key.palette->getModifications();
+  key.pixelFormat = m_sprite->getPixelFormat();
+  key.transparentColor = m_sprite->getTransparentColor();
+  key.spriteWidth = m_sprite->getWidth();
+  key.spriteHeight = m_sprite->getHeight();
+  key.previewVersion = RenderEngine::getPreviewImageVersion();
+  key.checkedBgType = RenderEngine::getCheckedBgType();
+  key.checkedBgZoom = RenderEngine::getCheckedBgZoom();
+  key.checkedBgColor1 = RenderEngine::getCheckedBgColor1();
+  key.checkedBgColor2 = RenderEngine::getCheckedBgColor2();
+
+  IDocumentSettings* docSettings = UIContext::instance()
+    ->getSettings()->getDocumentSettings(m_document);
+
+  key.onionskin = (onionskin && docSettings->getUseOnionskin());
+  if (key.onionskin) {
+    key.onionskinPrevs = docSettings->getOnionskinPrevFrames();
+    key.onionskinNexts = docSettings->getOnionskinNextFrames();
+    key.onionskinOpacityBase = docSettings->getOnionskinOpacityBase();
+    key.onionskinOpacityStep = docSettings->getOnionskinOpacityStep();
+    key.onionskinType = docSettings->getOnionskinType();
+  }
+  else {
+    key.onionskinPrevs = 0;
+    key.onionskinNexts = 0;
+    key.onionskinOpacityBase = 0;
+    key.onionskinOpacityStep = 0;
+    key.onionskinType = 0;
+  }
+
+  return key;
+}
+
+EditorRenderCache::Tile* EditorRenderCache::getTile(int u, int v)
+{
+  TilePos pos(u, v);
+  Tiles::iterator it = m_tiles.find(pos);
+  if (it != m_tiles.end())
+    return it->second;
+
+  base::UniquePtr<Tile> tile(new Tile);
+  tile->bmp = create_bitmap(kTileSize, kTileSize);
+  if (!tile->bmp)
+    throw std::bad_alloc();
+
+  tile->bounds = gfx::Rect(u*kTileSize, v*kTileSize, kTileSize, kTileSize);
+  tile->invalid = gfx::Region(tile->bounds);
+  tile->lastUse = m_useCounter;
+
+  m_tiles[pos] = tile.get();
+  return tile.release();
+}
+
+void EditorRenderCache::renderTile(Tile* tile, const gfx::Rect& spriteBounds)
+{
+  gfx::Rect rc = tile->invalid.getBounds().createIntersect(spriteBounds);
+  if (!rc.isEmpty()) {
+    RenderEngine renderEngine(m_document, m_sprite, m_key.layer, m_key.frame);
+
+    base::UniquePtr<Image> rendered(renderEngine.renderSprite(
+        rc.x, rc.y, rc.w, rc.h,
+        m_key.frame, m_key.zoom, true, m_key.onionskin));
+
+    if (rendered)
+      convert_image_to_allegro(rendered, tile->bmp,
+                               rc.x - tile->bounds.x,
+                               rc.y - tile->bounds.y,
+                               m_sprite->getPalette(m_key.frame));
+  }
+
+  tile->invalid.clear();
+}
+
+void EditorRenderCache::removeUnusedTiles()
+{
+  // Remove the least recently used tiles (but never the ones that
+  // were drawn in the last call).
+  while (m_tiles.size() > kMaxTiles) {
+    Tiles::iterator oldest = m_tiles.end();
+
+    for (Tiles::iterator it=m_tiles.begin(), end=m_tiles.end(); it != end; ++it) {
+      if (oldest == m_tiles.end() ||
+          it->second->lastUse < oldest->second->lastUse)
+        oldest = it;
+    }
+
+    if (oldest == m_tiles.end() ||
+        oldest->second->lastUse == m_useCounter)
+      break;
+
+    destroy_bitmap(oldest->second->bmp);
+    delete oldest->second;
+    m_tiles.erase(oldest);
+  }
+}
+
+void EditorRenderCache::destroyTiles()
+{
+  for (Tiles::iterator it=m_tiles.begin(), end=m_tiles.end(); it != end; ++it) {
+    destroy_bitmap(it->second->bmp);
+    delete it->second;
+  }
+  m_tiles.clear();
+}
+
+} // namespace app
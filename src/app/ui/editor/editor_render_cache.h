@@ -0,0 +1,161 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UI_EDITOR_EDITOR_RENDER_CACHE_H_INCLUDED
+#define APP_UI_EDITOR_EDITOR_RENDER_CACHE_H_INCLUDED
+#pragma once
+
+#include "app/color.h"
+#include "app/document_observer.h"
+#include "base/compiler_specific.h"
+#include "base/disable_copying.h"
+#include "gfx/rect.h"
+#include "gfx/region.h"
+#include "raster/frame_number.h"
+
+#include <map>
+#include <utility>
+#include <vector>
+
+struct BITMAP;
+
+namespace raster {
+  class Layer;
+  class Palette;
+  class Sprite;
+}
+
+namespace ui {
+  class Graphics;
+}
+
+namespace app {
+  class Document;
+
+  using namespace raster;
+
+  // Keeps the composited sprite of one Editor (with the zoom applied)
+  // in tiles of screen bitmaps. Areas that weren't modified since the
+  // last paint (e.g. when the editor is scrolled or exposed, or the
+  // mouse cursor is moved) are drawn with a plain blit.
+  //
+  // The cache observes the document to invalidate the regions
+  // reported by Document::notifySpritePixelsModified(). Other document
+  // changes (structure, undo, etc.) invalidate the whole cache.
+  class EditorRenderCache : public DocumentObserver {
+  public:
+    EditorRenderCache(Document* document);
+    ~EditorRenderCache();
+
+    // Draws the area "source" of the sprite (in zoomed coordinates,
+    // like RenderEngine::renderSprite()) in the given graphics at
+    // (dest_x, dest_y). Only the invalid parts are rendered again.
+    void draw(ui::Graphics* g, const gfx::Rect& source, int dest_x, int dest_y,
+              const Layer* layer, FrameNumber frame, int zoom, bool onionskin);
+
+    // Invalidates everything, or just the given region of the sprite
+    // (in sprite coordinates, without zoom).
+    void invalidate();
+    void invalidate(const gfx::Region& spriteRegion);
+
+    // Invalidates the cache of all editors (e.g. when the screen color
+    // depth is changed).
+    static void invalidateAll();
+
+    // DocumentObserver impl
+    void onGeneralUpdate(DocumentEvent& ev) OVERRIDE;
+    void onAddLayer(DocumentEvent& ev) OVERRIDE;
+    void onAddFrame(DocumentEvent& ev) OVERRIDE;
+    void onAddCel(DocumentEvent& ev) OVERRIDE;
+    void onAfterRemoveLayer(DocumentEvent& ev) OVERRIDE;
+    void onRemoveFrame(DocumentEvent& ev) OVERRIDE;
+    void onRemoveCel(DocumentEvent& ev) OVERRIDE;
+    void onSpriteSizeChanged(DocumentEvent& ev) OVERRIDE;
+    void onSpriteTransparentColorChanged(DocumentEvent& ev) OVERRIDE;
+    void onLayerRestacked(DocumentEvent& ev) OVERRIDE;
+    void onLayerMergedDown(DocumentEvent& ev) OVERRIDE;
+    void onCelMoved(DocumentEvent& ev) OVERRIDE;
+    void onCelCopied(DocumentEvent& ev) OVERRIDE;
+    void onCelFrameChanged(DocumentEvent& ev) OVERRIDE;
+    void onCelPositionChanged(DocumentEvent& ev) OVERRIDE;
+    void onCelOpacityChanged(DocumentEvent& ev) OVERRIDE;
+    void onImagePixelsModified(DocumentEvent& ev) OVERRIDE;
+    void onSpritePixelsModified(DocumentEvent& ev) OVERRIDE;
+
+  private:
+    // Everything (besides the pixels) that changes the rendered
+    // sprite. If the key changes, the whole cache is discarded.
+    struct Key {
+      int generation;
+      FrameNumber frame;
+      int zoom;
+      const Layer* layer;
+      std::vector<const Layer*> visibleLayers;
+      const Palette* palette;
+      int paletteModifications;
+      int pixelFormat;
+      int transparentColor;
+      int spriteWidth;
+      int spriteHeight;
+      int previewVersion;
+      int checkedBgType;
+      bool checkedBgZoom;
+      app::Color checkedBgColor1;
+      app::Color checkedBgColor2;
+      bool onionskin;
+      int onionskinPrevs;
+      int onionskinNexts;
+      int onionskinOpacityBase;
+      int onionskinOpacityStep;
+      int onionskinType;
+
+      bool operator==(const Key& other) const;
+      bool operator!=(const Key& other) const {
+        return !operator==(other);
+      }
+    };
+
+    struct Tile {
+      BITMAP* bmp;
+      gfx::Rect bounds;         // Bounds in zoomed sprite coordinates
+      gfx::Region invalid;      // Area to be rendered again
+      int lastUse;
+    };
+
+    typedef std::pair<int, int> TilePos;
+    typedef std::map<TilePos, Tile*> Tiles;
+
+    Key makeKey(const Layer* layer, FrameNumber frame, int zoom, bool onionskin) const;
+    Tile* getTile(int u, int v);
+    void renderTile(Tile* tile, const gfx::Rect& spriteBounds);
+    void removeUnusedTiles();
+    void destroyTiles();
+
+    Document* m_document;
+    Sprite* m_sprite;
+    Key m_key;
+    bool m_validKey;
+    Tiles m_tiles;
+    int m_useCounter;
+
+    DISABLE_COPYING(EditorRenderCache);
+  };
+
+} // namespace app
+
+#endif
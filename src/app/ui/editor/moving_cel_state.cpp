@@ -128,6 +128,7 @@ bool MovingCelState::onMouseMove(Editor* editor, MouseMessage* msg)
     m_cel->setPosition(m_celNewX, m_celNewY);
 
   // Redraw the new cel position.
+  editor->invalidateRenderCache();
   editor->invalidate();
 
   // Use StandbyState implementation
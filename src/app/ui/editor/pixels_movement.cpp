@@ -62,6 +62,7 @@ PixelsMovement::PixelsMovement(Context* context,
   , m_handle(NoHandle)
   , m_originalImage(Image::createCopy(moveThis))
   , m_maskColor(m_sprite->getTransparentColor())
+  , m_isPreview(false)
 {
   m_initialData = gfx::Transformation(gfx::Rect(initialX, initialY, moveThis->getWidth(), moveThis->getHeight()));
   m_currentData = m_initialData;
@@ -102,6 +103,9 @@ void PixelsMovement::flipImage(raster::algorithm::FlipType flipType)
                                                     m_initialMask->getBounds().h)),
                                 flipType);
 
+  m_imageRotSprite.invalidate();
+  m_maskRotSprite.invalidate();
+
   {
     ContextWriter writer(m_reader);
 
@@ -173,6 +177,7 @@ void PixelsMovement::maskImage(const Image* image, int x, int y)
 {
   m_currentMask->replace(m_currentData.bounds());
   m_initialMask->copyFrom(m_currentMask);
+  m_maskRotSprite.invalidate();
 
   ContextWriter writer(m_reader);
 
@@ -438,7 +443,7 @@ Image* PixelsMovement::getDraggedImageCopy(gfx::Point& origin)
   int height = rightBottom.y - leftTop.y;
   base::UniquePtr<Image> image(Image::create(m_sprite->getPixelFormat(), width, height));
 
-  drawImage(image, leftTop);
+  drawImage(image, leftTop, false);
 
   origin = leftTop;
 
@@ -447,6 +452,12 @@ Image* PixelsMovement::getDraggedImageCopy(gfx::Point& origin)
 
 void PixelsMovement::stampImage()
 {
+  // Replace the preview with the final transformation.
+  if (m_isPreview) {
+    ContextWriter writer(m_reader);
+    redrawExtraImage();
+  }
+
   const Cel* cel = m_document->getExtraCel();
   const Image* image = m_document->getExtraCelImage();
 
@@ -507,6 +518,10 @@ void PixelsMovement::dropImageTemporarily()
       m_currentData.displacePivotTo(gfx::Point(newPivot.x, newPivot.y));
     }
 
+    // Replace the preview with the final transformation.
+    if (m_isPreview)
+      redrawExtraImage();
+
     redrawCurrentMask();
     updateDocumentMask();
 
@@ -581,8 +596,10 @@ void PixelsMovement::setMaskColor(color_t mask_color)
 void PixelsMovement::redrawExtraImage()
 {
   // Draw the transformed pixels in the extra-cel which is the chunk
-  // of pixels that the user is moving.
-  drawImage(m_document->getExtraCelImage(), gfx::Point(0, 0));
+  // of pixels that the user is moving. While the user is dragging we
+  // can use a faster approximation of the transformation.
+  m_isPreview = m_isDragging;
+  drawImage(m_document->getExtraCelImage(), gfx::Point(0, 0), m_isPreview);
 }
 
 void PixelsMovement::redrawCurrentMask()
@@ -596,12 +613,12 @@ void PixelsMovement::redrawCurrentMask()
   m_currentMask->freeze();
   clear_image(m_currentMask->getBitmap(), 0);
   drawParallelogram(m_currentMask->getBitmap(), m_initialMask->getBitmap(),
-    corners, gfx::Point(0, 0));
+    &m_maskRotSprite, corners, gfx::Point(0, 0), false);
 
   m_currentMask->unfreeze();
 }
 
-void PixelsMovement::drawImage(raster::Image* dst, const gfx::Point& pt)
+void PixelsMovement::drawImage(raster::Image* dst, const gfx::Point& pt, bool preview)
 {
   gfx::Transformation::Corners corners;
   m_currentData.transformBox(corners);
@@ -610,12 +627,13 @@ void PixelsMovement::drawImage(raster::Image* dst, const gfx::Point& pt)
   clear_image(dst, dst->getMaskColor());
 
   m_originalImage->setMaskColor(m_maskColor);
-  drawParallelogram(dst, m_originalImage, corners, pt);
+  drawParallelogram(dst, m_originalImage, &m_imageRotSprite, corners, pt, preview);
 }
 
 void PixelsMovement::drawParallelogram(raster::Image* dst, raster::Image* src,
+  raster::RotSpriteCache* rotSpriteCache,
   const gfx::Transformation::Corners& corners,
-  const gfx::Point& leftTop)
+  const gfx::Point& leftTop, bool preview)
 {
   switch (UIContext::instance()->getSettings()->selection()->getRotationAlgorithm()) {
 
@@ -628,11 +646,18 @@ void PixelsMovement::drawParallelogram(raster::Image* dst, raster::Image* src,
       break;
 
     case kRotSpriteRotationAlgorithm:
-      image_rotsprite(dst, src,
-        corners.leftTop().x-leftTop.x, corners.leftTop().y-leftTop.y,
-        corners.rightTop().x-leftTop.x, corners.rightTop().y-leftTop.y,
-        corners.rightBottom().x-leftTop.x, corners.rightBottom().y-leftTop.y,
-        corners.leftBottom().x-leftTop.x, corners.leftBottom().y-leftTop.y);
+      if (preview)
+        image_rotsprite_preview(dst, src, rotSpriteCache,
+          corners.leftTop().x-leftTop.x, corners.leftTop().y-leftTop.y,
+          corners.rightTop().x-leftTop.x, corners.rightTop().y-leftTop.y,
+          corners.rightBottom().x-leftTop.x, corners.rightBottom().y-leftTop.y,
+          corners.leftBottom().x-leftTop.x, corners.leftBottom().y-leftTop.y);
+      else
+        image_rotsprite(dst, src, rotSpriteCache,
+          corners.leftTop().x-leftTop.x, corners.leftTop().y-leftTop.y,
+          corners.rightTop().x-leftTop.x, corners.rightTop().y-leftTop.y,
+          corners.rightBottom().x-leftTop.x, corners.rightBottom().y-leftTop.y,
+          corners.leftBottom().x-leftTop.x, corners.leftBottom().y-leftTop.y);
       break;
 
   }
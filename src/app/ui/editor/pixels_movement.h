@@ -28,6 +28,7 @@
 #include "base/shared_ptr.h"
 #include "gfx/size.h"
 #include "raster/algorithm/flip_type.h"
+#include "raster/rotsprite.h"
 
 namespace raster {
   class Image;
@@ -104,10 +105,11 @@ namespace app {
   private:
     void redrawExtraImage();
     void redrawCurrentMask();
-    void drawImage(raster::Image* dst, const gfx::Point& pt);
+    void drawImage(raster::Image* dst, const gfx::Point& pt, bool preview);
     void drawParallelogram(raster::Image* dst, raster::Image* src,
+      raster::RotSpriteCache* rotSpriteCache,
       const gfx::Transformation::Corners& corners,
-      const gfx::Point& leftTop);
+      const gfx::Point& leftTop, bool preview);
     void updateDocumentMask();
 
     const ContextReader m_reader;
@@ -126,6 +128,14 @@ namespace app {
     Mask* m_initialMask;
     Mask* m_currentMask;
     color_t m_maskColor;
+
+    // RotSprite scaled versions of m_originalImage and m_initialMask.
+    raster::RotSpriteCache m_imageRotSprite;
+    raster::RotSpriteCache m_maskRotSprite;
+
+    // True if the extra cel contains a fast preview of the
+    // transformation (drawn while the user is dragging the image).
+    bool m_isPreview;
   };
 
   inline PixelsMovement::MoveModifier& operator|=(PixelsMovement::MoveModifier& a,
@@ -69,6 +69,7 @@ namespace app {
       // EditorDecorator overrides
       void preRenderDecorator(EditorPreRender* render) OVERRIDE;
       void postRenderDecorator(EditorPostRender* render) OVERRIDE;
+      bool hasPreRenderDecorations() OVERRIDE { return false; }
     private:
       TransformHandles* m_transfHandles;
       StandbyState* m_standbyState;
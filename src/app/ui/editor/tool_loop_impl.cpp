@@ -76,6 +76,7 @@ class ToolLoopImpl : public tools::ToolLoop,
   gfx::Point m_maskOrigin;
   int m_opacity;
   int m_tolerance;
+  bool m_contiguous;
   gfx::Point m_offset;
   gfx::Point m_speed;
   bool m_canceled;
@@ -121,7 +122,10 @@ public:
                           getInk()->isScrollMovement() ||
                           getInk()->isZoom()) ? undo::DoesntModifyDocument:
                                                 undo::ModifyDocument))
-    , m_expandCelCanvas(m_context, m_docSettings->getTiledMode(), m_undoTransaction)
+    , m_expandCelCanvas(m_context, m_docSettings->getTiledMode(), m_undoTransaction,
+                        (tool->getTracePolicy(button) == tools::TracePolicyOverlap ?
+                         ExpandCelCanvas::NeedsModifiableSource:
+                         ExpandCelCanvas::None))
     , m_shadeTable(NULL)
   {
     // Settings
@@ -174,6 +178,7 @@ public:
 
     m_opacity = m_toolSettings->getOpacity();
     m_tolerance = m_toolSettings->getTolerance();
+    m_contiguous = m_toolSettings->getContiguous();
     m_speed.x = 0;
     m_speed.y = 0;
 
@@ -224,6 +229,7 @@ public:
   void setSecondaryColor(int color) OVERRIDE { m_secondary_color = color; }
   int getOpacity() OVERRIDE { return m_opacity; }
   int getTolerance() OVERRIDE { return m_tolerance; }
+  bool getContiguous() OVERRIDE { return m_contiguous; }
   SelectionMode getSelectionMode() OVERRIDE { return m_selectionMode; }
   ISettings* getSettings() OVERRIDE { return m_settings; }
   IDocumentSettings* getDocumentSettings() OVERRIDE { return m_docSettings; }
@@ -260,6 +266,7 @@ public:
   void updateDirtyArea() OVERRIDE
   {
     m_dirtyBounds = m_dirtyBounds.createUnion(m_dirtyArea.getBounds());
+    m_expandCelCanvas.addModifiedArea(m_dirtyArea);
     m_document->notifySpritePixelsModified(m_sprite, m_dirtyArea);
   }
 
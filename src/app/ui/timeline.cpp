@@ -1216,18 +1216,10 @@ void Timeline::drawCel(ui::Graphics* g, int layer_index, FrameNumber frame, Cel*
     style = m_timelineEmptyFrameStyle;
   }
   else {
-#if 0 // TODO We must find a fast-way to compare keyframes. Cels could
-      // share images until the user draw over them. Also, we could
-      // calculate a hash for each image (and recalculate it when the
-      // user draw over it), so then we can compare hashes.  Other
-      // option is to use a thread to calculate differences, but I
-      // think it's too much for just UI stuff.
-    Cel* left = (layer->isImage() ? static_cast<LayerImage*>(layer)->getCel(frame.previous()): NULL);
+    Cel* left = (layer->isImage() && frame > 0 ? static_cast<LayerImage*>(layer)->getCel(frame.previous()): NULL);
     Cel* right = (layer->isImage() ? static_cast<LayerImage*>(layer)->getCel(frame.next()): NULL);
-    Image* leftImg = (left ? m_sprite->getStock()->getImage(left->getImage()): NULL);
-    Image* rightImg = (right ? m_sprite->getStock()->getImage(right->getImage()): NULL);
-    bool fromLeft = (leftImg && count_diff_between_images(image, leftImg) == 0);
-    bool fromRight = (rightImg && count_diff_between_images(image, rightImg) == 0);
+    bool fromLeft = (left && isSameCel(cel, left));
+    bool fromRight = (right && isSameCel(cel, right));
 
     if (fromLeft && fromRight)
       style = m_timelineFromBothStyle;
@@ -1236,12 +1228,37 @@ void Timeline::drawCel(ui::Graphics* g, int layer_index, FrameNumber frame, Cel*
     else if (fromRight)
       style = m_timelineFromRightStyle;
     else
-#endif
       style = m_timelineKeyframeStyle;
   }
   drawPart(g, bounds, NULL, style, is_active, is_hover);
 }
 
+// Returns true if both cels look the same. Images are compared with
+// their cached hashes (without comparing pixels) so it's fast enough
+// to be used in each paint. It's used just to choose the style of
+// the cel, so a hash collision can only show a wrong style.
+bool Timeline::isSameCel(const Cel* cel1, const Cel* cel2) const
+{
+  if (cel1->getX() != cel2->getX() ||
+      cel1->getY() != cel2->getY() ||
+      cel1->getOpacity() != cel2->getOpacity())
+    return false;
+
+  // Shared image
+  if (cel1->getImage() == cel2->getImage())
+    return true;
+
+  const Stock* stock = m_sprite->getStock();
+  const Image* image1 = stock->getImage(cel1->getImage());
+  const Image* image2 = stock->getImage(cel2->getImage());
+  if (!image1 || !image2)
+    return false;
+
+  return (image1->getWidth() == image2->getWidth() &&
+          image1->getHeight() == image2->getHeight() &&
+          stock->getImageHash(cel1->getImage()) == stock->getImageHash(cel2->getImage()));
+}
+
 void Timeline::drawLoopRange(ui::Graphics* g)
 {
   ISettings* settings = UIContext::instance()->getSettings();
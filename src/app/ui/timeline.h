@@ -167,6 +167,7 @@ namespace app {
     void drawHeaderFrame(ui::Graphics* g, FrameNumber frame);
     void drawLayer(ui::Graphics* g, int layer_index);
     void drawCel(ui::Graphics* g, int layer_index, FrameNumber frame, Cel* cel);
+    bool isSameCel(const Cel* cel1, const Cel* cel2) const;
     void drawLoopRange(ui::Graphics* g);
     void drawRangeOutline(ui::Graphics* g);
     void drawPaddings(ui::Graphics* g);
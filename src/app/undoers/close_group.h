@@ -44,6 +44,7 @@ namespace app {
 
       void dispose() OVERRIDE;
       size_t getMemSize() const OVERRIDE { return sizeof(*this); }
+      size_t swapOut() OVERRIDE { return 0; }
       Modification getModification() const { return m_modification; }
       bool isOpenGroup() const OVERRIDE { return false; }
       bool isCloseGroup() const OVERRIDE { return true; }
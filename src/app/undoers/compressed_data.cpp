@@ -0,0 +1,156 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/undoers/compressed_data.h"
+
+#include "undo/undo_exception.h"
+
+#include <algorithm>
+#include <new>
+#include <zlib.h>
+
+namespace app {
+namespace undoers {
+
+using namespace undo;
+
+// Blocks smaller than this are not worth to be swapped out.
+static const size_t kMinSwapSize = 1024;
+
+CompressedData::CompressedData()
+  : m_size(0)
+  , m_compressed(false)
+  , m_swapOffset(0)
+  , m_swapSize(0)
+{
+}
+
+CompressedData::~CompressedData()
+{
+  clear();
+}
+
+void CompressedData::compress(const void* data, size_t size)
+{
+  clear();
+  m_size = size;
+
+  if (size == 0)
+    return;
+
+  // The fastest level is enough, pixel art (big areas with the same
+  // color) is compressed well even with it.
+  uLongf compressedSize = compressBound(size);
+  std::vector<uint8_t> compressed(compressedSize);
+  int err = compress2(&compressed[0], &compressedSize,
+                      (const Bytef*)data, size, Z_BEST_SPEED);
+  if (err == Z_MEM_ERROR)
+    throw std::bad_alloc();
+
+  if (err == Z_OK && compressedSize < size) {
+    compressed.resize(compressedSize);
+    m_data.swap(compressed);
+    m_compressed = true;
+  }
+  else {
+    // Keep the data as is if it cannot be compressed.
+    m_data.assign((const uint8_t*)data, (const uint8_t*)data + size);
+  }
+}
+
+size_t CompressedData::swapOut()
+{
+  size_t size = m_data.size();
+  if (m_swapSize > 0 || size < kMinSwapSize)
+    return 0;
+
+  try {
+    m_swapOffset = SwapFile::instance()->write(&m_data[0], size);
+  }
+  catch (const std::exception&) {
+    // Keep the data in memory.
+    return 0;
+  }
+
+  m_swapSize = size;
+  std::vector<uint8_t>().swap(m_data);
+  return size;
+}
+
+void CompressedData::decompress(std::vector<uint8_t>& data) const
+{
+  data.resize(m_size);
+  if (m_size > 0)
+    decompress(&data[0], m_size);
+}
+
+std::string CompressedData::decompress() const
+{
+  std::string data(m_size, 0);
+  if (m_size > 0)
+    decompress((uint8_t*)&data[0], m_size);
+  return data;
+}
+
+void CompressedData::clear()
+{
+  if (m_swapSize > 0) {
+    SwapFile::instance()->release(m_swapOffset, m_swapSize);
+    m_swapSize = 0;
+  }
+
+  m_size = 0;
+  m_compressed = false;
+  m_data.clear();
+}
+
+void CompressedData::decompress(uint8_t* data, size_t size) const
+{
+  // Load the swapped out data.
+  std::vector<uint8_t> swapped;
+  if (m_swapSize > 0) {
+    swapped.resize(m_swapSize);
+    try {
+      SwapFile::instance()->read(m_swapOffset, &swapped[0], m_swapSize);
+    }
+    catch (const std::exception& e) {
+      throw UndoException(e.what());
+    }
+  }
+  const std::vector<uint8_t>& src = (m_swapSize > 0 ? swapped: m_data);
+
+  if (!m_compressed) {
+    std::copy(src.begin(), src.end(), data);
+    return;
+  }
+
+  uLongf uncompressedSize = size;
+  int err = uncompress(data, &uncompressedSize, &src[0], src.size());
+  if (err == Z_MEM_ERROR)
+    throw std::bad_alloc();
+
+  if (err != Z_OK || uncompressedSize != size)
+    throw UndoException("Error decompressing undo data");
+}
+
+} // namespace undoers
+} // namespace app
@@ -0,0 +1,81 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UNDOERS_COMPRESSED_DATA_H_INCLUDED
+#define APP_UNDOERS_COMPRESSED_DATA_H_INCLUDED
+#pragma once
+
+#include "app/undoers/swap_file.h"
+#include "base/disable_copying.h"
+
+#include <string>
+#include <vector>
+
+namespace app {
+  namespace undoers {
+
+    // Keeps a block of bytes compressed with zlib. Undoers use it to
+    // store pixels (which are decompressed only when the undoer is
+    // reverted), so the undo history can keep more steps before it
+    // reaches the undo size limit. The compressed bytes can be moved
+    // to the SwapFile with swapOut().
+    class CompressedData {
+    public:
+      CompressedData();
+      ~CompressedData();
+
+      // Replaces the content with the given bytes.
+      void compress(const void* data, size_t size);
+      void compress(const std::string& data) {
+        compress(data.data(), data.size());
+      }
+
+      // Returns the original bytes. Throws an UndoException if the
+      // data cannot be decompressed.
+      void decompress(std::vector<uint8_t>& data) const;
+      std::string decompress() const;
+
+      // Bytes used by the compressed data in memory (zero if the data
+      // was swapped out).
+      size_t getMemSize() const { return m_data.size(); }
+
+      // Saves the compressed data in the SwapFile and releases its
+      // memory. Returns the number of released bytes (zero if the data
+      // is too small or it couldn't be saved).
+      size_t swapOut();
+
+    private:
+      void clear();
+      void decompress(uint8_t* data, size_t size) const;
+
+      size_t m_size;            // Size of the uncompressed data
+      bool m_compressed;        // False if m_data is stored as is
+      std::vector<uint8_t> m_data;
+
+      // Position and size of the data in the SwapFile (m_swapSize is
+      // zero if the data is in memory).
+      SwapFile::Offset m_swapOffset;
+      size_t m_swapSize;
+
+      DISABLE_COPYING(CompressedData);
+    };
+
+  } // namespace undoers
+} // namespace app
+
+#endif  // APP_UNDOERS_COMPRESSED_DATA_H_INCLUDED
@@ -0,0 +1,146 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "app/undoers/compressed_data.h"
+#include "app/undoers/swap_file.h"
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+using namespace app::undoers;
+
+// Rows of pixels with big areas of the same color (compressed well).
+static std::vector<uint8_t> make_pixel_art(size_t size)
+{
+  std::vector<uint8_t> data(size);
+  for (size_t i=0; i<size; ++i)
+    data[i] = (uint8_t)((i / 64) % 4);
+  return data;
+}
+
+// Random bytes (zlib cannot compress them).
+static std::vector<uint8_t> make_noise(size_t size)
+{
+  std::vector<uint8_t> data(size);
+  for (size_t i=0; i<size; ++i)
+    data[i] = (uint8_t)(std::rand() & 0xff);
+  return data;
+}
+
+TEST(CompressedData, Compressible)
+{
+  std::vector<uint8_t> input = make_pixel_art(64*1024);
+  std::vector<uint8_t> output;
+
+  CompressedData data;
+  data.compress(&input[0], input.size());
+  EXPECT_LT(data.getMemSize(), input.size() / 10);
+
+  data.decompress(output);
+  EXPECT_TRUE(input == output);
+
+  // It can be decompressed several times
+  output.clear();
+  data.decompress(output);
+  EXPECT_TRUE(input == output);
+}
+
+TEST(CompressedData, Incompressible)
+{
+  std::srand(1);
+  std::vector<uint8_t> input = make_noise(4096);
+  std::vector<uint8_t> output;
+
+  // The data is stored as is
+  CompressedData data;
+  data.compress(&input[0], input.size());
+  EXPECT_EQ(input.size(), data.getMemSize());
+
+  data.decompress(output);
+  EXPECT_TRUE(input == output);
+}
+
+TEST(CompressedData, SmallAndEmpty)
+{
+  CompressedData data;
+  EXPECT_EQ("", data.decompress());
+
+  data.compress(std::string("a"));
+  EXPECT_EQ("a", data.decompress());
+
+  data.compress(std::string());
+  EXPECT_EQ(0, (int)data.getMemSize());
+  EXPECT_EQ("", data.decompress());
+
+  std::string str(1000, 'x');
+  data.compress(str);
+  EXPECT_EQ(str, data.decompress());
+}
+
+TEST(CompressedData, SwapOut)
+{
+  std::srand(2);
+  std::vector<uint8_t> input1 = make_pixel_art(256*1024);
+  std::vector<uint8_t> input2 = make_noise(8192);
+  std::vector<uint8_t> output;
+  SwapFile::Offset used = SwapFile::instance()->getUsedSize();
+
+  {
+    CompressedData data1, data2;
+    data1.compress(&input1[0], input1.size());
+    data2.compress(&input2[0], input2.size());
+
+    size_t size1 = data1.getMemSize();
+    EXPECT_EQ(size1, data1.swapOut());
+    EXPECT_EQ(input2.size(), data2.swapOut());
+    EXPECT_EQ(0, (int)data1.getMemSize());
+    EXPECT_EQ(0, (int)data2.getMemSize());
+    EXPECT_EQ(used + (SwapFile::Offset)(size1 + input2.size()),
+              SwapFile::instance()->getUsedSize());
+
+    // Already swapped out
+    EXPECT_EQ(0, (int)data1.swapOut());
+
+    data1.decompress(output);
+    EXPECT_TRUE(input1 == output);
+    data2.decompress(output);
+    EXPECT_TRUE(input2 == output);
+
+    // Compressing new data releases the swapped out block
+    data2.compress(&input1[0], input1.size());
+    EXPECT_EQ(used + (SwapFile::Offset)size1,
+              SwapFile::instance()->getUsedSize());
+    data2.decompress(output);
+    EXPECT_TRUE(input1 == output);
+  }
+
+  EXPECT_EQ(used, SwapFile::instance()->getUsedSize());
+}
+
+TEST(CompressedData, TooSmallToSwapOut)
+{
+  std::vector<uint8_t> input = make_pixel_art(100);
+
+  CompressedData data;
+  data.compress(&input[0], input.size());
+  EXPECT_EQ(0, (int)data.swapOut());
+  EXPECT_NE(0, (int)data.getMemSize());
+}
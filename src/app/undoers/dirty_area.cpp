@@ -29,6 +29,8 @@
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
 
+#include <sstream>
+
 namespace app {
 namespace undoers {
 
@@ -37,7 +39,9 @@ using namespace undo;
 DirtyArea::DirtyArea(ObjectsContainer* objects, Image* image, Dirty* dirty)
   : m_imageId(objects->addObject(image))
 {
-  raster::write_dirty(m_stream, dirty);
+  std::ostringstream os;
+  raster::write_dirty(os, dirty);
+  m_data.compress(os.str());
 }
 
 void DirtyArea::dispose()
@@ -48,10 +52,14 @@ void DirtyArea::dispose()
 void DirtyArea::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   Image* image = objects->getObjectT<Image>(m_imageId);
-  base::UniquePtr<Dirty> dirty(raster::read_dirty(m_stream));
+  std::istringstream is(m_data.decompress());
+  base::UniquePtr<Dirty> dirty(raster::read_dirty(is));
 
   // Swap the saved pixels in the dirty with the pixels in the image
   dirty->swapImagePixels(image);
+  image->invalidateHash(gfx::Rect(dirty->x1(), dirty->y1(),
+                                  dirty->x2()-dirty->x1()+1,
+                                  dirty->y2()-dirty->y1()+1));
 
   // Save the dirty in the "redoers" (the dirty area now contains the
   // pixels before the undo)
@@ -20,11 +20,10 @@
 #define APP_UNDOERS_DIRTY_AREA_H_INCLUDED
 #pragma once
 
+#include "app/undoers/compressed_data.h"
 #include "app/undoers/undoer_base.h"
 #include "undo/object_id.h"
 
-#include <sstream>
-
 namespace raster {
   class Dirty;
   class Image;
@@ -40,16 +39,13 @@ namespace app {
       DirtyArea(ObjectsContainer* objects, Image* image, Dirty* dirty);
 
       void dispose() OVERRIDE;
-      size_t getMemSize() const OVERRIDE { return sizeof(*this) + getStreamSize(); }
+      size_t getMemSize() const OVERRIDE { return sizeof(*this) + m_data.getMemSize(); }
+      size_t swapOut() OVERRIDE { return m_data.swapOut(); }
       void revert(ObjectsContainer* objects, UndoersCollector* redoers) OVERRIDE;
 
     private:
-      size_t getStreamSize() const {
-        return const_cast<std::stringstream*>(&m_stream)->tellp();
-      }
-
       ObjectId m_imageId;
-      std::stringstream m_stream;
+      CompressedData m_data;
     };
 
   } // namespace undoers
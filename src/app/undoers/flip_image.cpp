@@ -68,6 +68,7 @@ void FlipImage::revert(ObjectsContainer* objects, UndoersCollector* redoers)
   redoers->pushUndoer(new FlipImage(objects, image, bounds, flipType));
 
   raster::algorithm::flip_image(image, bounds, flipType);
+  image->invalidateHash(bounds);
 }
 
 } // namespace undoers
@@ -27,6 +27,9 @@
 #include "undo/undo_exception.h"
 #include "undo/undoers_collector.h"
 
+#include <cstring>
+#include <vector>
+
 namespace app {
 namespace undoers {
 
@@ -37,13 +40,15 @@ ImageArea::ImageArea(ObjectsContainer* objects, Image* image, int x, int y, int
   , m_format(image->getPixelFormat())
   , m_x(x), m_y(y), m_w(w), m_h(h)
   , m_lineSize(image->getRowStrideSize(w))
-  , m_data(m_lineSize * h)
 {
   ASSERT(w >= 1 && h >= 1);
   ASSERT(x >= 0 && y >= 0 && x+w <= image->getWidth() && y+h <= image->getHeight());
 
+  std::vector<uint8_t> data(m_lineSize * h);
   for (int v=0; v<h; ++v)
-    memcpy(&m_data[m_lineSize*v], image->getPixelAddress(x, y+v), m_lineSize);
+    memcpy(&data[m_lineSize*v], image->getPixelAddress(x, y+v), m_lineSize);
+
+  m_data.compress(&data[0], data.size());
 }
 
 void ImageArea::dispose()
@@ -58,12 +63,17 @@ void ImageArea::revert(ObjectsContainer* objects, UndoersCollector* redoers)
   if (image->getPixelFormat() != m_format)
     throw UndoException("Image type does not match");
 
+  std::vector<uint8_t> data;
+  m_data.decompress(data);
+
   // Backup the current image portion
   redoers->pushUndoer(new ImageArea(objects, image, m_x, m_y, m_w, m_h));
 
   // Restore the old image portion
   for (int v=0; v<m_h; ++v)
-    memcpy(image->getPixelAddress(m_x, m_y+v), &m_data[m_lineSize*v], m_lineSize);
+    memcpy(image->getPixelAddress(m_x, m_y+v), &data[m_lineSize*v], m_lineSize);
+
+  image->invalidateHash(gfx::Rect(m_x, m_y, m_w, m_h));
 }
 
 } // namespace undoers
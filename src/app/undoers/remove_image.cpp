@@ -30,6 +30,8 @@
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
 
+#include <sstream>
+
 namespace app {
 namespace undoers {
 
@@ -42,7 +44,9 @@ RemoveImage::RemoveImage(ObjectsContainer* objects, Stock* stock, int imageIndex
 {
   Image* image = stock->getImage(imageIndex);
 
-  write_object(objects, m_stream, image, raster::write_image);
+  std::ostringstream os;
+  write_object(objects, os, image, raster::write_image);
+  m_data.compress(os.str());
 }
 
 void RemoveImage::dispose()
@@ -53,7 +57,8 @@ void RemoveImage::dispose()
 void RemoveImage::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 {
   Stock* stock = objects->getObjectT<Stock>(m_stockId);
-  Image* image = read_object<Image>(objects, m_stream, raster::read_image);
+  std::istringstream is(m_data.decompress());
+  Image* image = read_object<Image>(objects, is, raster::read_image);
 
   // Push an AddImage as redoer
   redoers->pushUndoer(new AddImage(objects, stock, m_imageIndex));
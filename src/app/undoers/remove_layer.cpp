@@ -35,6 +35,8 @@
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
 
+#include <sstream>
+
 namespace app {
 namespace undoers {
 
@@ -100,7 +102,9 @@ RemoveLayer::RemoveLayer(ObjectsContainer* objects, Document* document, Layer* l
   m_afterId = (after ? objects->addObject(after): 0);
 
   LayerSubObjectsSerializerImpl serializer(objects, layer->getSprite());
-  write_object(objects, m_stream, layer, serializer);
+  std::ostringstream os;
+  write_object(objects, os, layer, serializer);
+  m_data.compress(os.str());
 }
 
 void RemoveLayer::dispose()
@@ -116,7 +120,8 @@ void RemoveLayer::revert(ObjectsContainer* objects, UndoersCollector* redoers)
 
   // Read the layer from the stream
   LayerSubObjectsSerializerImpl serializer(objects, folder->getSprite());
-  Layer* layer = read_object<Layer>(objects, m_stream, serializer);
+  std::istringstream is(m_data.decompress());
+  Layer* layer = read_object<Layer>(objects, is, serializer);
 
   document->getApi(redoers).addLayer(folder, layer, after);
 }
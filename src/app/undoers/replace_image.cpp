@@ -29,6 +29,8 @@
 #include "undo/objects_container.h"
 #include "undo/undoers_collector.h"
 
+#include <sstream>
+
 namespace app {
 namespace undoers {
 
@@ -40,7 +42,9 @@ ReplaceImage::ReplaceImage(ObjectsContainer* objects, Stock* stock, int imageInd
 {
   Image* image = stock->getImage(imageIndex);
 
-  write_object(objects, m_stream, image, raster::write_image);
+  std::ostringstream os;
+  write_object(objects, os, image, raster::write_image);
+  m_data.compress(os.str());
 }
 
 void ReplaceImage::dispose()
@@ -53,7 +57,8 @@ void ReplaceImage::revert(ObjectsContainer* objects, UndoersCollector* redoers)
   Stock* stock = objects->getObjectT<Stock>(m_stockId);
 
   // Read the image to be restored from the stream
-  Image* image = read_object<Image>(objects, m_stream, raster::read_image);
+  std::istringstream is(m_data.decompress());
+  Image* image = read_object<Image>(objects, is, raster::read_image);
 
   // Save the current image in the redoers
   redoers->pushUndoer(new ReplaceImage(objects, stock, m_imageIndex));
@@ -0,0 +1,56 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/undoers/set_cel_image.h"
+
+#include "raster/cel.h"
+#include "undo/objects_container.h"
+#include "undo/undoers_collector.h"
+
+namespace app {
+namespace undoers {
+
+using namespace undo;
+
+SetCelImage::SetCelImage(ObjectsContainer* objects, Cel* cel)
+  : m_celId(objects->addObject(cel))
+  , m_imageIndex(cel->getImage())
+{
+}
+
+void SetCelImage::dispose()
+{
+  delete this;
+}
+
+void SetCelImage::revert(ObjectsContainer* objects, UndoersCollector* redoers)
+{
+  Cel* cel = objects->getObjectT<Cel>(m_celId);
+
+  // Push another SetCelImage as redoer
+  redoers->pushUndoer(new SetCelImage(objects, cel));
+
+  cel->setImage(m_imageIndex);
+}
+
+} // namespace undoers
+} // namespace app
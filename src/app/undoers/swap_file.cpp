@@ -0,0 +1,191 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/undoers/swap_file.h"
+
+#include "base/exception.h"
+#include "base/file_handle.h"
+#include "base/fs.h"
+#include "base/path.h"
+#include "base/scoped_lock.h"
+#include "base/temp_dir.h"
+
+namespace app {
+namespace undoers {
+
+SwapFile::SwapFile()
+  : m_tempDir(NULL)
+  , m_file(NULL)
+  , m_end(0)
+  , m_used(0)
+{
+}
+
+SwapFile::~SwapFile()
+{
+  close();
+  delete m_tempDir;
+}
+
+// static
+SwapFile* SwapFile::instance()
+{
+  static SwapFile swapFile;
+  return &swapFile;
+}
+
+SwapFile::Offset SwapFile::write(const void* data, size_t size)
+{
+  base::scoped_lock hold(m_mutex);
+
+  if (!m_file)
+    open();
+
+  Offset offset = findFreeRange(size);
+  seek(offset);
+  // If the block is incomplete, the range is not marked as used so
+  // the next write() will overwrite it.
+  if (fwrite(data, 1, size, m_file) != size)
+    throw base::Exception("Error writing the undo swap file");
+
+  if (offset == m_end)
+    m_end += size;
+  else {
+    // Use the beginning of the free range.
+    FreeRanges::iterator it = m_free.find(offset);
+    ASSERT(it != m_free.end());
+    Offset rest = it->second - size;
+    m_free.erase(it);
+    if (rest > 0)
+      m_free[offset+size] = rest;
+  }
+
+  m_used += size;
+  return offset;
+}
+
+void SwapFile::read(Offset offset, void* data, size_t size)
+{
+  base::scoped_lock hold(m_mutex);
+
+  if (!m_file || offset+(Offset)size > m_end)
+    throw base::Exception("Invalid block in the undo swap file");
+
+  seek(offset);
+  if (fread(data, 1, size, m_file) != size)
+    throw base::Exception("Error reading the undo swap file");
+}
+
+void SwapFile::release(Offset offset, size_t size)
+{
+  base::scoped_lock hold(m_mutex);
+
+  ASSERT(m_used >= (Offset)size);
+  ASSERT(offset+(Offset)size <= m_end);
+  m_used -= size;
+
+  // Truncate the file when there are no more blocks in use.
+  if (m_used == 0) {
+    close();
+    return;
+  }
+
+  Offset end = offset+size;
+
+  // Merge with the next free range.
+  FreeRanges::iterator next = m_free.find(end);
+  if (next != m_free.end()) {
+    end += next->second;
+    m_free.erase(next);
+  }
+
+  // Merge with the previous free range.
+  FreeRanges::iterator prev = m_free.lower_bound(offset);
+  if (prev != m_free.begin()) {
+    --prev;
+    if (prev->first + prev->second == offset) {
+      offset = prev->first;
+      m_free.erase(prev);
+    }
+  }
+
+  // A range at the end of the file is not needed, the next write()
+  // will append blocks there.
+  if (end == m_end)
+    m_end = offset;
+  else
+    m_free[offset] = end - offset;
+}
+
+SwapFile::Offset SwapFile::findFreeRange(size_t size) const
+{
+  for (FreeRanges::const_iterator it=m_free.begin(), end=m_free.end();
+       it != end; ++it) {
+    if (it->second >= (Offset)size)
+      return it->first;
+  }
+  return m_end;
+}
+
+void SwapFile::open()
+{
+  if (!m_tempDir)
+    m_tempDir = new base::TempDir(PACKAGE);
+
+  m_filename = base::join_path(m_tempDir->path(), "undo.swp");
+  m_file = base::open_file_raw(m_filename, "w+b");
+  if (!m_file)
+    throw base::Exception("Error creating the undo swap file");
+
+  m_end = 0;
+}
+
+void SwapFile::close()
+{
+  if (m_file) {
+    fclose(m_file);
+    m_file = NULL;
+    m_end = 0;
+    m_free.clear();
+
+    try {
+      base::delete_file(m_filename);
+    }
+    catch (const std::exception&) {
+      // Ignore errors deleting the file.
+    }
+  }
+}
+
+void SwapFile::seek(Offset offset)
+{
+#ifdef _WIN32
+  int res = _fseeki64(m_file, offset, SEEK_SET);
+#else
+  int res = fseeko(m_file, offset, SEEK_SET);
+#endif
+  if (res != 0)
+    throw base::Exception("Error seeking in the undo swap file");
+}
+
+} // namespace undoers
+} // namespace app
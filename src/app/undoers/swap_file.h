@@ -0,0 +1,96 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef APP_UNDOERS_SWAP_FILE_H_INCLUDED
+#define APP_UNDOERS_SWAP_FILE_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+
+#include <cstdio>
+#include <map>
+#include <string>
+
+namespace base {
+  class TempDir;
+}
+
+namespace app {
+  namespace undoers {
+
+    // A file in a temporary directory where undoers save their data
+    // when the undo history exceeds the undo size limit (see
+    // Undoer::swapOut()). The file is created when it is used the
+    // first time, and it is truncated each time all the saved blocks
+    // are released. The space of released blocks is reused by the next
+    // write() calls.
+    class SwapFile {
+    public:
+      typedef long long Offset;
+
+      SwapFile();
+      ~SwapFile();
+
+      // Returns the swap file shared by all documents.
+      static SwapFile* instance();
+
+      // Saves the given bytes in the first released range where they
+      // fit (or at the end of the file) and returns the position where
+      // they were saved. Throws a base::Exception if the file cannot be
+      // written.
+      Offset write(const void* data, size_t size);
+
+      // Reads a block saved with write(). Throws a base::Exception if
+      // the file cannot be read.
+      void read(Offset offset, void* data, size_t size);
+
+      // Indicates that a block saved with write() is not needed
+      // anymore, so its space can be reused.
+      void release(Offset offset, size_t size);
+
+      // Bytes of the blocks that weren't released yet.
+      Offset getUsedSize() const { return m_used; }
+
+      // Size of the file (including released ranges).
+      Offset getFileSize() const { return m_end; }
+
+    private:
+      void open();
+      void close();
+      void seek(Offset offset);
+      Offset findFreeRange(size_t size) const;
+
+      // Released ranges (offset -> size), adjacent ranges are merged.
+      typedef std::map<Offset, Offset> FreeRanges;
+
+      base::mutex m_mutex;
+      base::TempDir* m_tempDir;
+      std::string m_filename;
+      FILE* m_file;
+      Offset m_end;
+      Offset m_used;
+      FreeRanges m_free;
+
+      DISABLE_COPYING(SwapFile);
+    };
+
+  } // namespace undoers
+} // namespace app
+
+#endif  // APP_UNDOERS_SWAP_FILE_H_INCLUDED
@@ -0,0 +1,146 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "tests/test.h"
+
+#include "app/undoers/swap_file.h"
+
+#include <vector>
+
+using namespace app::undoers;
+
+typedef SwapFile::Offset Offset;
+
+static std::vector<uint8_t> make_block(size_t size, int seed)
+{
+  std::vector<uint8_t> block(size);
+  for (size_t i=0; i<size; ++i)
+    block[i] = (uint8_t)(i*7 + seed);
+  return block;
+}
+
+static void expect_block(SwapFile& swap, Offset offset, size_t size, int seed)
+{
+  std::vector<uint8_t> block(size);
+  swap.read(offset, &block[0], size);
+  EXPECT_TRUE(block == make_block(size, seed));
+}
+
+TEST(SwapFile, WriteAndRead)
+{
+  SwapFile swap;
+  std::vector<uint8_t> a = make_block(100, 1);
+  std::vector<uint8_t> b = make_block(200, 2);
+
+  Offset offsetA = swap.write(&a[0], a.size());
+  Offset offsetB = swap.write(&b[0], b.size());
+  EXPECT_EQ(0, offsetA);
+  EXPECT_EQ(100, offsetB);
+  EXPECT_EQ(300, swap.getUsedSize());
+  EXPECT_EQ(300, swap.getFileSize());
+
+  expect_block(swap, offsetB, 200, 2);
+  expect_block(swap, offsetA, 100, 1);
+
+  swap.release(offsetA, a.size());
+  swap.release(offsetB, b.size());
+  EXPECT_EQ(0, swap.getUsedSize());
+  EXPECT_EQ(0, swap.getFileSize());
+}
+
+TEST(SwapFile, ReuseReleasedRanges)
+{
+  SwapFile swap;
+  std::vector<uint8_t> a = make_block(100, 1);
+  std::vector<uint8_t> b = make_block(200, 2);
+  std::vector<uint8_t> c = make_block(300, 3);
+  std::vector<uint8_t> d = make_block(150, 4);
+  std::vector<uint8_t> e = make_block(200, 5);
+  std::vector<uint8_t> f = make_block(300, 6);
+  std::vector<uint8_t> g = make_block(50, 7);
+
+  Offset offsetA = swap.write(&a[0], a.size());
+  Offset offsetB = swap.write(&b[0], b.size());
+  Offset offsetC = swap.write(&c[0], c.size());
+  EXPECT_EQ(600, swap.getFileSize());
+
+  // "d" is saved in the space of "b"
+  swap.release(offsetB, b.size());
+  Offset offsetD = swap.write(&d[0], d.size());
+  EXPECT_EQ(offsetB, offsetD);
+  EXPECT_EQ(550, swap.getUsedSize());
+  EXPECT_EQ(600, swap.getFileSize());
+
+  // The rest of "b" (50 bytes) is merged with the space of "d"
+  swap.release(offsetD, d.size());
+  Offset offsetE = swap.write(&e[0], e.size());
+  EXPECT_EQ(offsetB, offsetE);
+  EXPECT_EQ(600, swap.getFileSize());
+
+  // "a" and "e" are merged in one range for "f"
+  swap.release(offsetA, a.size());
+  swap.release(offsetE, e.size());
+  Offset offsetF = swap.write(&f[0], f.size());
+  EXPECT_EQ(0, offsetF);
+  EXPECT_EQ(600, swap.getFileSize());
+
+  expect_block(swap, offsetF, 300, 6);
+  expect_block(swap, offsetC, 300, 3);
+
+  // The space at the end of the file is reused by new blocks
+  swap.release(offsetC, c.size());
+  EXPECT_EQ(300, swap.getFileSize());
+  Offset offsetG = swap.write(&g[0], g.size());
+  EXPECT_EQ(300, offsetG);
+  EXPECT_EQ(350, swap.getFileSize());
+
+  expect_block(swap, offsetF, 300, 6);
+  expect_block(swap, offsetG, 50, 7);
+
+  swap.release(offsetF, f.size());
+  swap.release(offsetG, g.size());
+  EXPECT_EQ(0, swap.getUsedSize());
+  EXPECT_EQ(0, swap.getFileSize());
+}
+
+TEST(SwapFile, FileDoesNotGrow)
+{
+  SwapFile swap;
+  std::vector<uint8_t> blocks[4];
+  Offset offsets[4];
+
+  for (int i=0; i<4; ++i) {
+    blocks[i] = make_block(1000, i);
+    offsets[i] = swap.write(&blocks[i][0], blocks[i].size());
+  }
+
+  // Release and write blocks of the same size many times
+  for (int i=0; i<100; ++i) {
+    int j = (i*3) % 4;
+    swap.release(offsets[j], blocks[j].size());
+    blocks[j] = make_block(1000, i);
+    offsets[j] = swap.write(&blocks[j][0], blocks[j].size());
+    EXPECT_EQ(4000, swap.getFileSize());
+  }
+
+  for (int i=0; i<4; ++i) {
+    std::vector<uint8_t> block(1000);
+    swap.read(offsets[i], &block[0], block.size());
+    EXPECT_TRUE(block == blocks[i]);
+  }
+}
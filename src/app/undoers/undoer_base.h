@@ -27,9 +27,11 @@ namespace app {
   namespace undoers {
 
     // Helper class to make new Undoers, derive from here and implement
-    // revert(), getMemSize(), and dispose() methods only.
+    // revert(), getMemSize(), and dispose() methods only (and
+    // swapOut() if the undoer keeps a big amount of data).
     class UndoerBase : public undo::Undoer {
     public:
+      size_t swapOut() OVERRIDE { return 0; }
       undo::Modification getModification() const OVERRIDE { return undo::DoesntModifyDocument; }
       bool isOpenGroup() const OVERRIDE { return false; }
       bool isCloseGroup() const OVERRIDE { return false; }
@@ -25,12 +25,12 @@
 #include "app/app.h"
 #include "app/context.h"
 #include "app/document.h"
+#include "app/document_api.h"
 #include "app/document_location.h"
 #include "app/undo_transaction.h"
 #include "app/undoers/add_cel.h"
 #include "app/undoers/add_image.h"
 #include "app/undoers/dirty_area.h"
-#include "app/undoers/replace_image.h"
 #include "app/undoers/set_cel_position.h"
 #include "base/unique_ptr.h"
 #include "raster/cel.h"
@@ -42,6 +42,9 @@
 
 namespace {
 
+// Size of the tiles used to track the modified area of the canvas.
+const int kTileSize = 64;
+
 static raster::ImageBufferPtr src_buffer;
 static raster::ImageBufferPtr dst_buffer;
 
@@ -65,12 +68,14 @@ static void create_buffers()
 
 namespace app {
 
-ExpandCelCanvas::ExpandCelCanvas(Context* context, TiledMode tiledMode, UndoTransaction& undo)
+ExpandCelCanvas::ExpandCelCanvas(Context* context, TiledMode tiledMode, UndoTransaction& undo,
+                                 Flags flags)
   : m_cel(NULL)
   , m_celImage(NULL)
   , m_celCreated(false)
   , m_closed(false)
   , m_committed(false)
+  , m_useModifiedTiles(false)
   , m_undo(undo)
 {
   create_buffers();
@@ -123,16 +128,30 @@ ExpandCelCanvas::ExpandCelCanvas(Context* context, TiledMode tiledMode, UndoTran
     bounds = spriteBounds;
   }
 
-  // create two copies of the image region which we'll modify with the tool
-  m_srcImage = crop_image(m_celImage,
-    bounds.x - celBounds.x,
-    bounds.y - celBounds.y,
-    bounds.w,
-    bounds.h,
-    m_sprite->getTransparentColor(),
-    src_buffer);
+  // If the cel already covers the whole region, the source canvas is
+  // the cel image itself (it isn't modified until commit()), so we
+  // avoid one copy of the whole sprite each time a tool is used.
+  if (celBounds == bounds && !(flags & NeedsModifiableSource)) {
+    m_srcImage = m_celImage;
+    m_srcImageOwned = false;
+  }
+  // In other case we create a copy of the image region
+  else {
+    m_srcImage = crop_image(m_celImage,
+      bounds.x - celBounds.x,
+      bounds.y - celBounds.y,
+      bounds.w,
+      bounds.h,
+      m_sprite->getTransparentColor(),
+      src_buffer);
+    m_srcImageOwned = true;
+  }
 
+  // The destination canvas is the image we'll modify with the tool.
+  // It's a complete copy because it's rendered (as the preview image
+  // of the layer) while the tool is used.
   m_dstImage = Image::createCopy(m_srcImage, dst_buffer);
+  m_bounds = bounds;
 
   // We have to adjust the cel position to match the m_dstImage
   // position (the new m_dstImage will be used in RenderEngine to
@@ -149,7 +168,8 @@ ExpandCelCanvas::~ExpandCelCanvas()
   catch (...) {
     // Do nothing
   }
-  delete m_srcImage;
+  if (m_srcImageOwned)
+    delete m_srcImage;
   delete m_dstImage;
 }
 
@@ -164,12 +184,24 @@ void ExpandCelCanvas::commit(const gfx::Rect& bounds)
       m_cel->getY() == m_originalCelY &&
       m_celImage->getWidth() == m_dstImage->getWidth() &&
       m_celImage->getHeight() == m_dstImage->getHeight()) {
+    // Area of m_celImage that can be different in m_dstImage (both
+    // images have the same bounds in the sprite).
+    gfx::Region dirtyArea(m_celImage->getBounds());
+    if (!bounds.isEmpty())
+      dirtyArea.createIntersection(dirtyArea,
+        gfx::Region(gfx::Rect(bounds).offset(-m_originalCelX, -m_originalCelY)));
+    if (m_useModifiedTiles)
+      dirtyArea.createIntersection(dirtyArea, m_modifiedTiles);
+
     // Was m_celImage created in the start of the tool-loop?.
     if (m_celCreated) {
       // We can keep the m_celImage
 
-      // We copy the destination image to the m_celImage
-      copy_image(m_celImage, m_dstImage, 0, 0);
+      // We copy the destination image to the m_celImage (outside the
+      // dirty area both images are clear).
+      for (gfx::Region::const_iterator it = dirtyArea.begin(), end = dirtyArea.end();
+           it != end; ++it)
+        copy_image_area(m_celImage, m_dstImage, *it);
 
       // Add the m_celImage in the images stock of the sprite.
       m_cel->setImage(m_sprite->getStock()->addImage(m_celImage));
@@ -192,24 +224,26 @@ void ExpandCelCanvas::commit(const gfx::Rect& bounds)
     }
     // If the m_celImage was already created before the whole process...
     else {
-      // Add to the undo history the differences between m_celImage and m_dstImage
-      if (m_undo.isEnabled()) {
-        gfx::Rect dirtyBounds;
-        if (bounds.isEmpty())
-          dirtyBounds = m_celImage->getBounds();
-        else
-          dirtyBounds = m_celImage->getBounds().createIntersect(
-            gfx::Rect(bounds).offset(-m_originalCelX, -m_originalCelY));
+      // The image could be shared with other cels, in that case this
+      // cel needs its own copy to be modified.
+      m_celImage = m_document->getApi().unshareCelImage(m_sprite, m_cel);
 
-        base::UniquePtr<Dirty> dirty(new Dirty(m_celImage, m_dstImage, dirtyBounds));
+      // Add to the undo history the differences between m_celImage and m_dstImage
+      if (m_undo.isEnabled() && !dirtyArea.isEmpty()) {
+        base::UniquePtr<Dirty> dirty(new Dirty(m_celImage, m_dstImage, dirtyArea));
 
         dirty->saveImagePixels(m_celImage);
         if (dirty != NULL)
           m_undo.pushUndoer(new undoers::DirtyArea(m_undo.getObjects(), m_celImage, dirty));
       }
 
-      // Copy the destination to the cel image.
-      copy_image(m_celImage, m_dstImage, 0, 0);
+      // Copy the dirty area from the destination to the cel image
+      // (only these rows need a new hash).
+      for (gfx::Region::const_iterator it = dirtyArea.begin(), end = dirtyArea.end();
+           it != end; ++it) {
+        copy_image_area(m_celImage, m_dstImage, *it);
+        m_celImage->invalidateHash(*it);
+      }
     }
   }
   // If the size of both images are different, we have to
@@ -224,23 +258,41 @@ void ExpandCelCanvas::commit(const gfx::Rect& bounds)
         m_undo.pushUndoer(new undoers::SetCelPosition(m_undo.getObjects(), m_cel));
         m_cel->setPosition(newX, newY);
       }
-
-      m_undo.pushUndoer(new undoers::ReplaceImage(m_undo.getObjects(),
-          m_sprite->getStock(), m_cel->getImage()));
     }
 
-    // Replace the image in the stock. We need to create a copy of
-    // image because m_dstImage's ImageBuffer cannot be shared.
-    m_sprite->getStock()->replaceImage(m_cel->getImage(),
+    // Replace the cel image (the old image is destroyed if it isn't
+    // shared with other cels). We need to create a copy of image
+    // because m_dstImage's ImageBuffer cannot be shared.
+    m_document->getApi().replaceCelImage(m_sprite, m_cel,
       Image::createCopy(m_dstImage));
-
-    // Destroy the old cel image.
-    delete m_celImage;
   }
 
   m_committed = true;
 }
 
+void ExpandCelCanvas::addModifiedArea(const gfx::Region& area)
+{
+  m_useModifiedTiles = true;
+
+  for (gfx::Region::const_iterator it = area.begin(), end = area.end();
+       it != end; ++it) {
+    gfx::Rect rc = gfx::Rect(*it).offset(-m_bounds.x, -m_bounds.y)
+      .createIntersect(m_dstImage->getBounds());
+    if (rc.isEmpty())
+      continue;
+
+    // Expand the rectangle to the tiles that it touches.
+    int x1 = rc.x / kTileSize * kTileSize;
+    int y1 = rc.y / kTileSize * kTileSize;
+    int x2 = MIN((rc.x2() + kTileSize - 1) / kTileSize * kTileSize, m_dstImage->getWidth());
+    int y2 = MIN((rc.y2() + kTileSize - 1) / kTileSize * kTileSize, m_dstImage->getHeight());
+    gfx::Rect tiles(x1, y1, x2-x1, y2-y1);
+
+    if (m_modifiedTiles.contains(tiles) != gfx::Region::In)
+      m_modifiedTiles.createUnion(m_modifiedTiles, gfx::Region(tiles));
+  }
+}
+
 void ExpandCelCanvas::rollback()
 {
   ASSERT(!m_closed);
@@ -22,6 +22,7 @@
 
 #include "filters/tiled_mode.h"
 #include "gfx/rect.h"
+#include "gfx/region.h"
 
 namespace raster {
   class Cel;
@@ -46,7 +47,16 @@ namespace app {
   // state using "Undo" command.
   class ExpandCelCanvas {
   public:
-    ExpandCelCanvas(Context* context, TiledMode tiledMode, UndoTransaction& undo);
+    enum Flags {
+      None = 0,
+
+      // The source canvas will be modified (e.g. tools with
+      // TracePolicyOverlap), so it cannot be the cel image itself.
+      NeedsModifiableSource = 1
+    };
+
+    ExpandCelCanvas(Context* context, TiledMode tiledMode, UndoTransaction& undo,
+                    Flags flags = None);
     ~ExpandCelCanvas();
 
     // Commit changes made in getDestCanvas() in the cel's image. Adds
@@ -54,11 +64,17 @@ namespace app {
     // modifications in the canvas.
     void commit(const gfx::Rect& bounds = gfx::Rect());
 
+    // Indicates that the given area (in sprite coordinates) of
+    // getDestCanvas() was modified. If this function is used, commit()
+    // compares and copies only the tiles touched by these areas.
+    void addModifiedArea(const gfx::Region& area);
+
     // Restore the cel as its original state as when ExpandCelCanvas()
     // was created.
     void rollback();
 
-    // You can read pixels from here
+    // You can read pixels from here (it can be the cel image itself
+    // if NeedsModifiableSource wasn't specified)
     Image* getSourceCanvas() {    // TODO this should be "const"
       return m_srcImage;
     }
@@ -82,7 +98,11 @@ namespace app {
     int m_originalCelX;
     int m_originalCelY;
     Image* m_srcImage;
+    bool m_srcImageOwned;         // False if m_srcImage is m_celImage
     Image* m_dstImage;
+    gfx::Rect m_bounds;           // Bounds of m_srcImage/m_dstImage in the sprite
+    gfx::Region m_modifiedTiles;  // Modified tiles of m_dstImage (see addModifiedArea())
+    bool m_useModifiedTiles;
     bool m_closed;
     bool m_committed;
     UndoTransaction& m_undo;
@@ -29,32 +29,38 @@
 #include "app/settings/document_settings.h"
 #include "app/settings/settings.h"
 #include "app/ui_context.h"
+#include "base/mutex.h"
+#include "base/parallel_for.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+#include "base/unique_ptr.h"
+
+#include <vector>
 
 namespace app {
 
 //////////////////////////////////////////////////////////////////////
 // Zoomed merge
 
+// Each BlenderHelper blends a row of "src" pixels over the "scanline"
+// (which contains the "dst" pixels).
+
 template<class DstTraits, class SrcTraits>
 class BlenderHelper
 {
-  BLEND_COLOR m_blend_color;
-  uint32_t m_mask_color;
+  typename SrcTraits::blend_row_t m_blend_row;
+  typename SrcTraits::pixel_t m_mask_color;
 public:
-  BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
+  BlenderHelper(color_t mask_color, const Palette* pal, int blend_mode)
   {
-    m_blend_color = SrcTraits::get_blender(blend_mode);
-    m_mask_color = src->getMaskColor();
+    m_blend_row = SrcTraits::get_row_blender(blend_mode);
+    m_mask_color = mask_color;
   }
-  inline void operator()(typename DstTraits::pixel_t& scanline,
-                         const typename DstTraits::pixel_t& dst,
-                         const typename SrcTraits::pixel_t& src,
-                         int opacity)
+  inline void blendRow(typename DstTraits::pixel_t* scanline,
+                       const typename SrcTraits::pixel_t* src,
+                       int n, int opacity)
   {
-    if (src != m_mask_color)
-      scanline = (*m_blend_color)(dst, src, opacity);
-    else
-      scanline = dst;
+    (*m_blend_row)(scanline, scanline, src, n, opacity, m_mask_color);
   }
 };
 
@@ -64,10 +70,10 @@ class BlenderHelper<RgbTraits, GrayscaleTraits>
   BLEND_COLOR m_blend_color;
   uint32_t m_mask_color;
 public:
-  BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
+  BlenderHelper(color_t mask_color, const Palette* pal, int blend_mode)
   {
     m_blend_color = RgbTraits::get_blender(blend_mode);
-    m_mask_color = src->getMaskColor();
+    m_mask_color = mask_color;
   }
   inline void operator()(RgbTraits::pixel_t& scanline,
                          const RgbTraits::pixel_t& dst,
@@ -81,6 +87,13 @@ public:
     else
       scanline = dst;
   }
+  inline void blendRow(RgbTraits::pixel_t* scanline,
+                       const GrayscaleTraits::pixel_t* src,
+                       int n, int opacity)
+  {
+    for (int x=0; x<n; ++x)
+      operator()(scanline[x], scanline[x], src[x], opacity);
+  }
 };
 
 template<>
@@ -90,10 +103,10 @@ class BlenderHelper<RgbTraits, IndexedTraits>
   int m_blend_mode;
   uint32_t m_mask_color;
 public:
-  BlenderHelper(const Image* src, const Palette* pal, int blend_mode)
+  BlenderHelper(color_t mask_color, const Palette* pal, int blend_mode)
   {
     m_blend_mode = blend_mode;
-    m_mask_color = src->getMaskColor();
+    m_mask_color = mask_color;
     m_pal = pal;
   }
   inline void operator()(RgbTraits::pixel_t& scanline,
@@ -112,14 +125,28 @@ public:
         scanline = dst;
     }
   }
+  inline void blendRow(RgbTraits::pixel_t* scanline,
+                       const IndexedTraits::pixel_t* src,
+                       int n, int opacity)
+  {
+    for (int x=0; x<n; ++x)
+      operator()(scanline[x], scanline[x], src[x], opacity);
+  }
 };
 
+// The mask color is given as a parameter (instead of using
+// src->getMaskColor()) so source images are never modified while
+// they are rendered (several threads can be reading the same image).
+typedef void (*ZoomedMergeFunc)(Image* dst, const Image* src, color_t mask_color,
+                                const Palette* pal, int x, int y, int opacity,
+                                int blend_mode, int zoom);
+
 template<class DstTraits, class SrcTraits>
-static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
-                               int x, int y, int opacity,
+static void merge_zoomed_image(Image* dst, const Image* src, color_t mask_color,
+                               const Palette* pal, int x, int y, int opacity,
                                int blend_mode, int zoom)
 {
-  BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blend_mode);
+  BlenderHelper<DstTraits, SrcTraits> blender(mask_color, pal, blend_mode);
   int src_x, src_y, src_w, src_h;
   int dst_x, dst_y, dst_w, dst_h;
   int box_x, box_y, box_w, box_h;
@@ -182,6 +209,11 @@ static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
   typename Scanline::iterator scanline_it;
   typename Scanline::iterator scanline_end = scanline.end();
 
+  // srcline contains the source pixels of the current line
+  typedef std::vector<typename SrcTraits::pixel_t> Srcline;
+  Srcline srcline(src_w);
+  typename Srcline::iterator srcline_it;
+
   // Lock all necessary bits
   const LockImageBits<SrcTraits> srcBits(src, gfx::Rect(src_x, src_y, src_w, src_h));
   LockImageBits<DstTraits> dstBits(dst, gfx::Rect(dst_x, dst_y, dst_w, dst_h));
@@ -193,16 +225,19 @@ static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
     dst_it = dstBits.begin_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
     dst_end = dstBits.end_area(gfx::Rect(dst_x, dst_y, dst_w, 1));
 
-    // Read 'src' and 'dst' and blend them, put the result in `scanline'
+    // Read 'src' and 'dst' in 'srcline' and 'scanline'
     scanline_it = scanline.begin();
+    srcline_it = srcline.begin();
     for (x=0; x<src_w; ++x) {
       ASSERT(src_it >= srcBits.begin() && src_it < src_end);
       ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
       ASSERT(scanline_it >= scanline.begin() && scanline_it < scanline_end);
 
-      blender(*scanline_it, *dst_it, *src_it, opacity);
+      *scanline_it = *dst_it;
+      *srcline_it = *src_it;
 
       ++src_it;
+      ++srcline_it;
 
       int delta;
       if ((x == 0) && (first_box_w > 0))
@@ -216,6 +251,9 @@ static void merge_zoomed_image(Image* dst, const Image* src, const Palette* pal,
       ++scanline_it;
     }
 
+    // Blend them, put the result in `scanline'
+    blender.blendRow(&scanline[0], &srcline[0], src_w, opacity);
+
     // Get the 'height' of the line to be painted in 'dst'
     if ((y == 0) && (first_box_h > 0))
       line_h = first_box_h;
@@ -277,14 +315,125 @@ done_with_blit:;
 //////////////////////////////////////////////////////////////////////
 // Render Engine
 
+// Size of each tile in parallel rendering. A 128x128 RGB tile uses
+// 64 KB, so the tile and the source pixels fit in the L2 cache.
+static const int kRenderTileSize = 128;
+
 static RenderEngine::CheckedBgType checked_bg_type;
 static bool checked_bg_zoom;
 static app::Color checked_bg_color1;
 static app::Color checked_bg_color2;
+static bool parallel_rendering = true;
 
-static int global_opacity = 255;
+// The preview image can be changed from the UI thread while other
+// thread (e.g. the thumbnail generator) is rendering.
+static base::mutex preview_mutex;
 static const Layer* selected_layer = NULL;
 static Image* rastering_image = NULL;
+static int rastering_image_version = 0;
+
+// Keeps the preview_mutex locked while a sprite that uses the preview
+// image is rendered, so setPreviewImage() cannot replace (or the
+// owner delete) the image in the middle of the render.
+class PreviewLock {
+public:
+  PreviewLock(const Sprite* sprite, const Layer*& layer, const Image*& image)
+    : m_locked(true) {
+    preview_mutex.lock();
+    if (selected_layer && rastering_image &&
+        selected_layer->getSprite() == sprite) {
+      layer = selected_layer;
+      image = rastering_image;
+    }
+    else {
+      layer = NULL;
+      image = NULL;
+      unlock();
+    }
+  }
+
+  ~PreviewLock() {
+    if (m_locked)
+      unlock();
+  }
+
+private:
+  void unlock() {
+    preview_mutex.unlock();
+    m_locked = false;
+  }
+
+  bool m_locked;
+};
+
+// One layer-tree pass to render. The first pass is the current frame,
+// the other ones are the onion-skin frames.
+struct RenderPass {
+  FrameNumber frame;
+  int opacity;
+  int blend_mode;
+
+  RenderPass(FrameNumber frame, int opacity, int blend_mode)
+    : frame(frame), opacity(opacity), blend_mode(blend_mode) {
+  }
+};
+
+// State of one renderSprite() call. It's calculated before starting
+// to render and then it's only read, so all the tiles of the same
+// render can use it at the same time from different threads.
+struct RenderEngine::RenderState {
+  ZoomedMergeFunc zoomed_func;
+  int zoom;
+  bool checked_bg;
+  uint32_t bg_color;
+  const Layer* preview_layer;
+  const Image* preview_image;
+  std::vector<RenderPass> passes;
+};
+
+// Renders one tile of the output image in each call (it's used as the
+// function of base::parallel_for()).
+class RenderEngine::TilesRenderer {
+public:
+  TilesRenderer(RenderEngine* engine, const RenderState& state,
+                Image* image, int source_x, int source_y)
+    : m_engine(engine)
+    , m_state(state)
+    , m_image(image)
+    , m_source_x(source_x)
+    , m_source_y(source_y)
+    , m_cols((image->getWidth()+kRenderTileSize-1) / kRenderTileSize)
+    , m_rows((image->getHeight()+kRenderTileSize-1) / kRenderTileSize) {
+  }
+
+  int getTilesCount() const {
+    return m_cols * m_rows;
+  }
+
+  void operator()(int i) const {
+    gfx::Rect tile((i % m_cols) * kRenderTileSize,
+                   (i / m_cols) * kRenderTileSize,
+                   kRenderTileSize, kRenderTileSize);
+    tile = tile.createIntersect(m_image->getBounds());
+
+    base::UniquePtr<Image> tileImage(Image::create(IMAGE_RGB, tile.w, tile.h));
+    m_engine->renderFrame(m_state, tileImage,
+                          m_source_x + tile.x,
+                          m_source_y + tile.y);
+
+    // Each tile writes a different area of the output image.
+    copy_image(m_image, tileImage, tile.x, tile.y);
+  }
+
+private:
+  RenderEngine* m_engine;
+  const RenderState& m_state;
+  Image* m_image;
+  int m_source_x;
+  int m_source_y;
+  int m_cols;
+  int m_rows;
+};
 
 // static
 void RenderEngine::loadConfig()
@@ -294,8 +443,8 @@ void RenderEngine::loadConfig()
   checked_bg_zoom = get_config_bool("Options", "CheckedBgZoom", true);
   checked_bg_color1 = get_config_color("Options", "CheckedBgColor1", app::Color::fromRgb(128, 128, 128));
   checked_bg_color2 = get_config_color("Options", "CheckedBgColor2", app::Color::fromRgb(192, 192, 192));
+  parallel_rendering = get_config_bool("Options", "ParallelRendering", true);
 }
-
 // static
 RenderEngine::CheckedBgType RenderEngine::getCheckedBgType()
 {
@@ -348,6 +497,19 @@ void RenderEngine::setCheckedBgColor2(const app::Color& color)
   set_config_color("Options", "CheckedBgColor2", color);
 }
 
+// static
+bool RenderEngine::getParallelRendering()
+{
+  return parallel_rendering;
+}
+
+// static
+void RenderEngine::setParallelRendering(bool state)
+{
+  parallel_rendering = state;
+  set_config_bool("Options", "ParallelRendering", state);
+}
+
 //////////////////////////////////////////////////////////////////////
 
 RenderEngine::RenderEngine(const Document* document,
@@ -364,8 +526,17 @@ RenderEngine::RenderEngine(const Document* document,
 // static
 void RenderEngine::setPreviewImage(const Layer* layer, Image* image)
 {
+  base::scoped_lock hold(preview_mutex);
   selected_layer = layer;
   rastering_image = image;
+  ++rastering_image_version;
+}
+
+// static
+int RenderEngine::getPreviewImageVersion()
+{
+  base::scoped_lock hold(preview_mutex);
+  return rastering_image_version;
 }
 
 /**
@@ -381,47 +552,43 @@ Image* RenderEngine::renderSprite(int source_x, int source_y,
   bool draw_tiled_bg,
   bool enable_onionskin)
 {
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int);
   const LayerImage* background = m_sprite->getBackgroundLayer();
   bool need_checked_bg = (background != NULL ? !background->isReadable(): true);
-  uint32_t bg_color = 0;
-  Image *image;
+  RenderState state;
+
+  state.zoom = zoom;
+  state.checked_bg = (need_checked_bg && draw_tiled_bg);
+  state.bg_color = 0;
 
   switch (m_sprite->getPixelFormat()) {
 
     case IMAGE_RGB:
-      zoomed_func = merge_zoomed_image<RgbTraits, RgbTraits>;
+      state.zoomed_func = merge_zoomed_image<RgbTraits, RgbTraits>;
       break;
 
     case IMAGE_GRAYSCALE:
-      zoomed_func = merge_zoomed_image<RgbTraits, GrayscaleTraits>;
+      state.zoomed_func = merge_zoomed_image<RgbTraits, GrayscaleTraits>;
       break;
 
     case IMAGE_INDEXED:
-      zoomed_func = merge_zoomed_image<RgbTraits, IndexedTraits>;
+      state.zoomed_func = merge_zoomed_image<RgbTraits, IndexedTraits>;
       if (!need_checked_bg)
-        bg_color = m_sprite->getPalette(frame)->getEntry(m_sprite->getTransparentColor());
+        state.bg_color = m_sprite->getPalette(frame)->getEntry(m_sprite->getTransparentColor());
       break;
 
     default:
       return NULL;
   }
 
+  PreviewLock previewLock(m_sprite, state.preview_layer, state.preview_image);
+
   // Create a temporary RGB bitmap to draw all to it
-  image = Image::create(IMAGE_RGB, width, height);
+  base::UniquePtr<Image> image(Image::create(IMAGE_RGB, width, height));
   if (!image)
     return NULL;
 
-  // Draw checked background
-  if (need_checked_bg && draw_tiled_bg)
-    renderCheckedBackground(image, source_x, source_y, zoom);
-  else
-    clear_image(image, bg_color);
-
   // Draw the current frame.
-  global_opacity = 255;
-  renderLayer(m_sprite->getFolder(), image,
-    source_x, source_y, frame, zoom, zoomed_func, true, true, -1);
+  state.passes.push_back(RenderPass(frame, 255, -1));
 
   // Onion-skin feature: Draw previous/next frames with different
   // opacity (<255) (it is the onion-skinning)
@@ -433,17 +600,18 @@ Image* RenderEngine::renderSprite(int source_x, int source_y,
     int nexts = docSettings->getOnionskinNextFrames();
     int opacity_base = docSettings->getOnionskinOpacityBase();
     int opacity_step = docSettings->getOnionskinOpacityStep();
+    int opacity;
 
     for (FrameNumber f=frame.previous(prevs); f <= frame.next(nexts); ++f) {
       if (f == frame || f < 0 || f > m_sprite->getLastFrame())
         continue;
       else if (f < frame)
-        global_opacity = opacity_base - opacity_step * ((frame - f)-1);
+        opacity = opacity_base - opacity_step * ((frame - f)-1);
       else
-        global_opacity = opacity_base - opacity_step * ((f - frame)-1);
+        opacity = opacity_base - opacity_step * ((f - frame)-1);
 
-      if (global_opacity > 0) {
-        global_opacity = MID(0, global_opacity, 255);
+      if (opacity > 0) {
+        opacity = MID(0, opacity, 255);
 
         int blend_mode = -1;
         if (docSettings->getOnionskinType() == IDocumentSettings::Onionskin_Merge)
@@ -451,14 +619,42 @@ Image* RenderEngine::renderSprite(int source_x, int source_y,
         else if (docSettings->getOnionskinType() == IDocumentSettings::Onionskin_RedBlueTint)
           blend_mode = (f < frame ? BLEND_MODE_RED_TINT: BLEND_MODE_BLUE_TINT);
 
-        renderLayer(m_sprite->getFolder(), image,
-          source_x, source_y, f, zoom, zoomed_func,
-          true, true, blend_mode);
+        state.passes.push_back(RenderPass(f, opacity, blend_mode));
       }
     }
   }
 
-  return image;
+  // Big areas are split in tiles and rendered in several threads.
+  TilesRenderer tiles(this, state, image, source_x, source_y);
+  if (parallel_rendering &&
+      tiles.getTilesCount() > 1 &&
+      base::thread::hardware_concurrency() > 1) {
+    base::parallel_for(0, tiles.getTilesCount(), tiles);
+  }
+  else
+    renderFrame(state, image, source_x, source_y);
+
+  return image.release();
+}
+
+void RenderEngine::renderFrame(
+  const RenderState& state,
+  Image* image,
+  int source_x, int source_y)
+{
+  // Draw checked background
+  if (state.checked_bg)
+    renderCheckedBackground(image, source_x, source_y, state.zoom);
+  else
+    clear_image(image, state.bg_color);
+
+  for (size_t i=0; i<state.passes.size(); ++i) {
+    const RenderPass& pass = state.passes[i];
+
+    renderLayer(state, m_sprite->getFolder(), image,
+      source_x, source_y, pass.frame, pass.opacity,
+      true, true, pass.blend_mode);
+  }
 }
 
 // static
@@ -530,7 +726,7 @@ void RenderEngine::renderCheckedBackground(Image* image,
 void RenderEngine::renderImage(Image* rgb_image, Image* src_image, const Palette* pal,
                                int x, int y, int zoom)
 {
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int);
+  ZoomedMergeFunc zoomed_func;
 
   ASSERT(rgb_image->getPixelFormat() == IMAGE_RGB && "renderImage accepts RGB destination images only");
 
@@ -552,19 +748,23 @@ void RenderEngine::renderImage(Image* rgb_image, Image* src_image, const Palette
       return;
   }
 
-  (*zoomed_func)(rgb_image, src_image, pal, x, y, 255, BLEND_MODE_NORMAL, zoom);
+  (*zoomed_func)(rgb_image, src_image, src_image->getMaskColor(), pal,
+                 x, y, 255, BLEND_MODE_NORMAL, zoom);
 }
 
 void RenderEngine::renderLayer(
+  const RenderState& state,
   const Layer* layer,
   Image *image,
   int source_x, int source_y,
-  FrameNumber frame, int zoom,
-  void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int),
+  FrameNumber frame,
+  int global_opacity,
   bool render_background,
   bool render_transparent,
   int blend_mode)
 {
+  int zoom = state.zoom;
+
   // we can't read from this layer
   if (!layer->isReadable())
     return;
@@ -578,13 +778,13 @@ void RenderEngine::renderLayer(
 
       const Cel* cel = static_cast<const LayerImage*>(layer)->getCel(frame);
       if (cel != NULL) {
-        Image* src_image;
+        const Image* src_image;
 
-        // Is the 'rastering_image' set to be used with this layer?
+        // Is the 'preview_image' set to be used with this layer?
         if ((frame == m_currentFrame) &&
-            (selected_layer == layer) &&
-            (rastering_image != NULL)) {
-          src_image = rastering_image;
+            (state.preview_layer == layer) &&
+            (state.preview_image != NULL)) {
+          src_image = state.preview_image;
         }
         // If not, we use the original cel-image from the images' stock
         else if ((cel->getImage() >= 0) &&
@@ -600,9 +800,9 @@ void RenderEngine::renderLayer(
           output_opacity = MID(0, cel->getOpacity(), 255);
           output_opacity = INT_MULT(output_opacity, global_opacity, t);
 
-          src_image->setMaskColor(m_sprite->getTransparentColor());
-
-          (*zoomed_func)(image, src_image, m_sprite->getPalette(frame),
+          (*state.zoomed_func)(image, src_image,
+            m_sprite->getTransparentColor(),
+            m_sprite->getPalette(frame),
             (cel->getX() << zoom) - source_x,
             (cel->getY() << zoom) - source_y,
             output_opacity,
@@ -620,9 +820,9 @@ void RenderEngine::renderLayer(
       LayerConstIterator end = static_cast<const LayerFolder*>(layer)->getLayerEnd();
 
       for (; it != end; ++it) {
-        renderLayer(*it, image,
+        renderLayer(state, *it, image,
           source_x, source_y,
-          frame, zoom, zoomed_func,
+          frame, global_opacity,
           render_background,
           render_transparent,
           blend_mode);
@@ -639,10 +839,11 @@ void RenderEngine::renderLayer(
     if (extraCel->getOpacity() > 0) {
       Image* extraImage = m_document->getExtraCelImage();
 
-      (*zoomed_func)(image, extraImage, m_sprite->getPalette(frame),
-                     (extraCel->getX() << zoom) - source_x,
-                     (extraCel->getY() << zoom) - source_y,
-                     extraCel->getOpacity(), BLEND_MODE_NORMAL, zoom);
+      (*state.zoomed_func)(image, extraImage, extraImage->getMaskColor(),
+                           m_sprite->getPalette(frame),
+                           (extraCel->getX() << zoom) - source_x,
+                           (extraCel->getY() << zoom) - source_y,
+                           extraCel->getOpacity(), BLEND_MODE_NORMAL, zoom);
     }
   }
 }
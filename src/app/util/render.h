@@ -60,11 +60,23 @@ namespace app {
     static app::Color getCheckedBgColor2();
     static void setCheckedBgColor2(const app::Color& color);
 
+    //////////////////////////////////////////////////////////////////////
+    // Parallel rendering configuration
+
+    // When it's enabled, big areas are split in tiles that are
+    // rendered in several threads.
+    static bool getParallelRendering();
+    static void setParallelRendering(bool state);
+
     //////////////////////////////////////////////////////////////////////
     // Preview image
 
     static void setPreviewImage(const Layer* layer, Image* drawable);
 
+    // Returns a number that changes each time the preview image is
+    // set, so caches of rendered images know when to discard them.
+    static int getPreviewImageVersion();
+
     //////////////////////////////////////////////////////////////////////
     // Main function used by sprite-editors to render the sprite
 
@@ -85,12 +97,21 @@ namespace app {
                             int x, int y, int zoom);
 
   private:
+    struct RenderState;
+    class TilesRenderer;
+
+    void renderFrame(
+      const RenderState& state,
+      Image* image,
+      int source_x, int source_y);
+
     void renderLayer(
+      const RenderState& state,
       const Layer* layer,
       Image* image,
       int source_x, int source_y,
-      FrameNumber frame, int zoom,
-      void (*zoomed_func)(Image*, const Image*, const Palette*, int, int, int, int, int),
+      FrameNumber frame,
+      int global_opacity,
       bool render_background,
       bool render_transparent,
       int blend_mode);
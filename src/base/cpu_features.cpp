@@ -0,0 +1,95 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/cpu_features.h"
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  #include <intrin.h>
+  #define BASE_CPU_X86
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+  #include <cpuid.h>
+  #define BASE_CPU_X86
+#endif
+
+namespace base {
+
+#ifdef BASE_CPU_X86
+
+static void cpuid(int leaf, int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+  int r[4];
+  __cpuidex(r, leaf, subleaf);
+  for (int i=0; i<4; ++i)
+    regs[i] = (unsigned int)r[i];
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static unsigned int cpuid_max_leaf()
+{
+  unsigned int regs[4];
+  cpuid(0, 0, regs);
+  return regs[0];
+}
+
+// Returns the low 32 bits of the XCR0 register (the state components
+// that the OS saves/restores on context switches).
+static unsigned int xgetbv0()
+{
+#ifdef _MSC_VER
+  return (unsigned int)_xgetbv(0);
+#else
+  unsigned int eax, edx;
+  __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0" : "=a"(eax), "=d"(edx) : "c"(0));
+  return eax;
+#endif
+}
+
+bool cpu_has_sse2()
+{
+  if (cpuid_max_leaf() < 1)
+    return false;
+
+  unsigned int regs[4];
+  cpuid(1, 0, regs);
+  return (regs[3] & (1 << 26)) ? true: false;
+}
+
+bool cpu_has_avx2()
+{
+  if (cpuid_max_leaf() < 7)
+    return false;
+
+  unsigned int regs[4];
+  cpuid(1, 0, regs);
+
+  // OSXSAVE and AVX bits
+  const unsigned int osxsave_avx = (1 << 27) | (1 << 28);
+  if ((regs[2] & osxsave_avx) != osxsave_avx)
+    return false;
+
+  // The OS must save the XMM and YMM registers
+  if ((xgetbv0() & 6) != 6)
+    return false;
+
+  cpuid(7, 0, regs);
+  return (regs[1] & (1 << 5)) ? true: false;
+}
+
+#else
+
+bool cpu_has_sse2() { return false; }
+bool cpu_has_avx2() { return false; }
+
+#endif
+
+} // namespace base
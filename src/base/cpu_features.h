@@ -0,0 +1,21 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BASE_CPU_FEATURES_H_INCLUDED
+#define BASE_CPU_FEATURES_H_INCLUDED
+#pragma once
+
+namespace base {
+
+  // Returns true if the running CPU (and the OS, in the case of AVX2
+  // which needs the OS support to save the YMM registers) can execute
+  // the given instruction set. Always false on non-x86 platforms.
+  bool cpu_has_sse2();
+  bool cpu_has_avx2();
+
+} // namespace base
+
+#endif
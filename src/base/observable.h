@@ -30,17 +30,17 @@ public:
 
   template<typename A1>
   void notifyObservers(void (Observer::*method)(A1), A1 a1) {
-    m_observers.notifyObservers<A1>(method, a1);
+    m_observers.template notifyObservers<A1>(method, a1);
   }
 
   template<typename A1, typename A2>
   void notifyObservers(void (Observer::*method)(A1, A2), A1 a1, A2 a2) {
-    m_observers.notifyObservers<A1, A2>(method, a1, a2);
+    m_observers.template notifyObservers<A1, A2>(method, a1, a2);
   }
 
   template<typename A1, typename A2, typename A3>
   void notifyObservers(void (Observer::*method)(A1, A2, A3), A1 a1, A2 a2, A3 a3) {
-    m_observers.notifyObservers<A1, A2, A3>(method, a1, a2, a3);
+    m_observers.template notifyObservers<A1, A2, A3>(method, a1, a2, a3);
   }
 
 private:
@@ -0,0 +1,240 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "base/parallel_for.h"
+
+#include "base/disable_copying.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+
+#ifdef WIN32
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+#include <vector>
+
+namespace {
+
+using namespace base;
+using namespace base::details;
+
+// Auto-reset event: wait() blocks the thread until set() is called.
+class event {
+public:
+#ifdef WIN32
+  event() : m_handle(::CreateEvent(NULL, FALSE, FALSE, NULL)) { }
+  ~event() { ::CloseHandle(m_handle); }
+
+  void set() { ::SetEvent(m_handle); }
+  void wait() { ::WaitForSingleObject(m_handle, INFINITE); }
+#else
+  event() : m_signaled(false) {
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_cond, NULL);
+  }
+
+  ~event() {
+    pthread_cond_destroy(&m_cond);
+    pthread_mutex_destroy(&m_mutex);
+  }
+
+  void set() {
+    pthread_mutex_lock(&m_mutex);
+    m_signaled = true;
+    pthread_cond_signal(&m_cond);
+    pthread_mutex_unlock(&m_mutex);
+  }
+
+  void wait() {
+    pthread_mutex_lock(&m_mutex);
+    while (!m_signaled)
+      pthread_cond_wait(&m_cond, &m_mutex);
+    m_signaled = false;
+    pthread_mutex_unlock(&m_mutex);
+  }
+#endif
+
+private:
+#ifdef WIN32
+  HANDLE m_handle;
+#else
+  pthread_mutex_t m_mutex;
+  pthread_cond_t m_cond;
+  bool m_signaled;
+#endif
+
+  DISABLE_COPYING(event);
+};
+
+// A run_in_threads() call waiting for its workers.
+class parallel_call {
+public:
+  parallel_call(int workers) : m_pending(workers) { }
+
+  void workerFinished() {
+    bool last;
+    {
+      scoped_lock hold(m_mutex);
+      last = (--m_pending == 0);
+    }
+    if (last)
+      m_done.set();
+  }
+
+  void wait() {
+    m_done.wait();
+  }
+
+private:
+  mutex m_mutex;
+  int m_pending;
+  event m_done;
+
+  DISABLE_COPYING(parallel_call);
+};
+
+// A thread of the pool. It sleeps until start() is called.
+class worker {
+public:
+  worker()
+    : m_proc(NULL)
+    , m_data(NULL)
+    , m_call(NULL)
+    , m_quit(false)
+    , m_thread(&worker::thread_proc, this) {
+  }
+
+  void start(parallel_for_proc proc, void* data, parallel_call* call) {
+    m_proc = proc;
+    m_data = data;
+    m_call = call;
+    m_wake.set();
+  }
+
+  void quit() {
+    m_quit = true;
+    m_wake.set();
+    m_thread.join();
+  }
+
+private:
+  static void thread_proc(worker* w) {
+    w->run();
+  }
+
+  void run();
+
+  parallel_for_proc m_proc;
+  void* m_data;
+  parallel_call* m_call;
+  bool m_quit;
+  event m_wake;
+  thread m_thread;              // Must be the last member (it uses the others)
+
+  DISABLE_COPYING(worker);
+};
+
+// Threads kept between parallel_for() calls. A worker is used by one
+// call at a time, so if all workers are busy (e.g. nested or
+// concurrent calls) new workers are created.
+class worker_pool {
+public:
+  worker_pool() { }
+
+  ~worker_pool() {
+    for (size_t i=0; i<m_workers.size(); ++i) {
+      m_workers[i]->quit();
+      delete m_workers[i];
+    }
+  }
+
+  // Adds to "workers" up to "n" idle workers (less if new threads
+  // cannot be created).
+  void acquire(int n, std::vector<worker*>& workers) {
+    {
+      scoped_lock hold(m_mutex);
+      while ((int)workers.size() < n && !m_idle.empty()) {
+        workers.push_back(m_idle.back());
+        m_idle.pop_back();
+      }
+    }
+
+    try {
+      while ((int)workers.size() < n) {
+        worker* w = new worker;
+        {
+          scoped_lock hold(m_mutex);
+          m_workers.push_back(w);
+        }
+        workers.push_back(w);
+      }
+    }
+    catch (...) {
+      // Continue with the workers that we've got.
+    }
+  }
+
+  void release(worker* w) {
+    scoped_lock hold(m_mutex);
+    m_idle.push_back(w);
+  }
+
+private:
+  mutex m_mutex;
+  std::vector<worker*> m_workers; // All workers
+  std::vector<worker*> m_idle;
+
+  DISABLE_COPYING(worker_pool);
+};
+
+worker_pool pool;
+
+void worker::run()
+{
+  for (;;) {
+    m_wake.wait();
+    if (m_quit)
+      break;
+
+    parallel_call* call = m_call;
+    m_proc(m_data);
+
+    // The worker is idle before the call is finished, so the next
+    // parallel_for() of the caller can use it again.
+    pool.release(this);
+    call->workerFinished();
+  }
+}
+
+} // anonymous namespace
+
+namespace base {
+namespace details {
+
+void run_in_threads(parallel_for_proc proc, void* data, int nthreads)
+{
+  std::vector<worker*> workers;
+  pool.acquire(nthreads-1, workers);
+
+  parallel_call call(workers.size());
+  for (size_t i=0; i<workers.size(); ++i)
+    workers[i]->start(proc, data, &call);
+
+  proc(data);
+
+  if (!workers.empty())
+    call.wait();
+}
+
+} // namespace details
+} // namespace base
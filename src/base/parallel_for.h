@@ -0,0 +1,133 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef BASE_PARALLEL_FOR_H_INCLUDED
+#define BASE_PARALLEL_FOR_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/exception.h"
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+
+#include <exception>
+#include <string>
+
+namespace base {
+
+  namespace details {
+
+    typedef void (*parallel_for_proc)(void* data);
+
+    // Calls proc(data) from "nthreads" threads (the calling thread and
+    // nthreads-1 threads from a pool that is kept between calls) and
+    // returns when all of them have finished. Less threads are used if
+    // new threads cannot be created.
+    void run_in_threads(parallel_for_proc proc, void* data, int nthreads);
+
+    // Shared state between all threads that are running the same
+    // parallel_for() call. Indexes are given to threads one at a time.
+    template<class Callable>
+    class parallel_for_state {
+    public:
+      parallel_for_state(int begin, int end, const Callable& f)
+        : m_next(begin)
+        , m_end(end)
+        , m_f(f)
+        , m_failed(false) {
+      }
+
+      // Processes indexes until the range is empty (or some call fails).
+      void run() {
+        int i;
+        while (next(i)) {
+          try {
+            m_f(i);
+          }
+          catch (const std::exception& e) {
+            fail(e.what());
+          }
+          catch (...) {
+            fail("Unknown error in parallel task");
+          }
+        }
+      }
+
+      bool failed() const { return m_failed; }
+      const std::string& failureMessage() const { return m_failureMessage; }
+
+      static void thread_proc(void* state) {
+        static_cast<parallel_for_state*>(state)->run();
+      }
+
+    private:
+      bool next(int& i) {
+        scoped_lock hold(m_mutex);
+        if (m_failed || m_next >= m_end)
+          return false;
+
+        i = m_next++;
+        return true;
+      }
+
+      void fail(const char* msg) {
+        scoped_lock hold(m_mutex);
+        if (!m_failed) {
+          m_failed = true;
+          m_failureMessage = msg;
+        }
+      }
+
+      mutex m_mutex;
+      int m_next;
+      int m_end;
+      const Callable& m_f;
+      bool m_failed;
+      std::string m_failureMessage;
+
+      DISABLE_COPYING(parallel_for_state);
+    };
+
+  } // namespace details
+
+  // Calls f(i) for each i in [begin, end) distributing the calls
+  // between "nthreads" threads (the calling thread is one of them).
+  // If nthreads <= 0, thread::hardware_concurrency() is used. The
+  // function returns when all calls are finished.
+  //
+  // The threads aren't created on each call, they wait in a pool for
+  // the next parallel_for() (only idle threads are used, so f(i) can
+  // call parallel_for() too).
+  //
+  // Calls can be executed in any order, so f(i) must only write
+  // memory that is not touched by other indexes. If some call throws
+  // an exception, the pending indexes are skipped and a
+  // base::Exception with the same message is thrown in the calling
+  // thread.
+  template<class Callable>
+  void parallel_for(int begin, int end, const Callable& f, int nthreads = 0)
+  {
+    if (begin >= end)
+      return;
+
+    if (nthreads <= 0)
+      nthreads = thread::hardware_concurrency();
+    if (nthreads > end - begin)
+      nthreads = end - begin;
+
+    typedef details::parallel_for_state<Callable> State;
+    State state(begin, end, f);
+
+    details::run_in_threads(&State::thread_proc, &state, nthreads);
+
+    if (state.failed())
+      throw Exception(state.failureMessage());
+  }
+
+} // namespace base
+
+#endif
@@ -0,0 +1,107 @@
+// Aseprite Base Library
+// Copyright (c) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#include <gtest/gtest.h>
+
+#include "base/parallel_for.h"
+
+#include <stdexcept>
+#include <vector>
+
+using namespace base;
+
+class Square {
+public:
+  Square(std::vector<int>& v) : m_v(v) { }
+  void operator()(int i) const { m_v[i] = i*i; }
+private:
+  std::vector<int>& m_v;
+};
+
+class ThrowOn {
+public:
+  ThrowOn(int n) : m_n(n) { }
+  void operator()(int i) const {
+    if (i == m_n)
+      throw std::runtime_error("failed");
+  }
+private:
+  int m_n;
+};
+
+TEST(ParallelFor, EmptyRange)
+{
+  std::vector<int> v(1, -1);
+  parallel_for(0, 0, Square(v));
+  EXPECT_EQ(-1, v[0]);
+}
+
+TEST(ParallelFor, AllIndexes)
+{
+  for (int nthreads=1; nthreads<=8; ++nthreads) {
+    std::vector<int> v(1000, -1);
+    parallel_for(0, (int)v.size(), Square(v), nthreads);
+
+    for (int i=0; i<(int)v.size(); ++i)
+      EXPECT_EQ(i*i, v[i]);
+  }
+}
+
+TEST(ParallelFor, SubRange)
+{
+  std::vector<int> v(10, -1);
+  parallel_for(2, 5, Square(v), 4);
+
+  EXPECT_EQ(-1, v[1]);
+  EXPECT_EQ(4, v[2]);
+  EXPECT_EQ(9, v[3]);
+  EXPECT_EQ(16, v[4]);
+  EXPECT_EQ(-1, v[5]);
+}
+
+TEST(ParallelFor, Exception)
+{
+  EXPECT_THROW(parallel_for(0, 100, ThrowOn(50), 4), base::Exception);
+  EXPECT_THROW(parallel_for(0, 100, ThrowOn(50), 1), base::Exception);
+}
+
+class SquareRows {
+public:
+  SquareRows(std::vector<std::vector<int> >& rows) : m_rows(rows) { }
+  void operator()(int i) const {
+    parallel_for(0, (int)m_rows[i].size(), Square(m_rows[i]), 4);
+  }
+private:
+  std::vector<std::vector<int> >& m_rows;
+};
+
+TEST(ParallelFor, Nested)
+{
+  std::vector<std::vector<int> > rows(8, std::vector<int>(100, -1));
+  parallel_for(0, (int)rows.size(), SquareRows(rows), 4);
+
+  for (int j=0; j<(int)rows.size(); ++j)
+    for (int i=0; i<(int)rows[j].size(); ++i)
+      EXPECT_EQ(i*i, rows[j][i]);
+}
+
+TEST(ParallelFor, SeveralCalls)
+{
+  // Threads of the pool are reused between calls.
+  for (int j=0; j<1000; ++j) {
+    std::vector<int> v(64, -1);
+    parallel_for(0, (int)v.size(), Square(v), 4);
+
+    for (int i=0; i<(int)v.size(); ++i)
+      ASSERT_EQ(i*i, v[i]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
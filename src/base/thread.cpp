@@ -89,6 +89,28 @@ base::thread::native_handle_type base::thread::native_handle()
   return m_native_handle;
 }
 
+// static
+int base::thread::hardware_concurrency()
+{
+#ifdef WIN32
+
+  SYSTEM_INFO si;
+  ::GetSystemInfo(&si);
+  int n = (int)si.dwNumberOfProcessors;
+
+#elif defined(_SC_NPROCESSORS_ONLN)
+
+  int n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+#else
+
+  int n = 1;
+
+#endif
+
+  return (n > 0 ? n: 1);
+}
+
 void base::thread::launch_thread(func_wrapper* f)
 {
   m_native_handle = (native_handle_type)0;
@@ -31,95 +31,231 @@
 #include "raster/primitives_fast.h"
 #include "raster/rgbmap.h"
 
+#include <cstdlib>
+
 namespace filters {
 
 using namespace raster;
 
 namespace {
 
-  struct GetPixelsDelegate {
-    uint32_t color;
-    int div;
-    const int* matrixData;
-
-    void reset(const ConvolutionMatrix* matrix) {
-      div = matrix->getDiv();
-      matrixData = &matrix->value(0, 0);
-    }
-
+  // Maximum number of components of each pixel (r, g, b, a for RGB,
+  // v, a for grayscale, and r, g, b, index for indexed images).
+  const int kMaxComponents = 4;
+
+  // Weighted sums of the components of the neighboring pixels of each
+  // pixel in the row, and the sum of the weights of transparent
+  // pixels (which are not used to calculate the color, so they must
+  // be subtracted from the matrix divisor).
+  struct RowSums {
+    std::vector<int> comps[kMaxComponents];
+    std::vector<int> transparent;
   };
 
-  struct GetPixelsDelegateRgba : public GetPixelsDelegate {
-    int r, g, b, a;
+  struct RgbaComponents {
+    enum { count = 4 };
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = a = 0;
+    // Returns true if the pixel is transparent.
+    bool operator()(RgbTraits::pixel_t color, int* comps) const {
+      if (rgba_geta(color) == 0) {
+        comps[0] = comps[1] = comps[2] = comps[3] = 0;
+        return true;
+      }
+      comps[0] = rgba_getr(color);
+      comps[1] = rgba_getg(color);
+      comps[2] = rgba_getb(color);
+      comps[3] = rgba_geta(color);
+      return false;
     }
+  };
 
-    void operator()(RgbTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        if (rgba_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          r += rgba_getr(color) * (*matrixData);
-          g += rgba_getg(color) * (*matrixData);
-          b += rgba_getb(color) * (*matrixData);
-          a += rgba_geta(color) * (*matrixData);
-        }
+  struct GrayscaleComponents {
+    enum { count = 2 };
+
+    bool operator()(GrayscaleTraits::pixel_t color, int* comps) const {
+      if (graya_geta(color) == 0) {
+        comps[0] = comps[1] = 0;
+        return true;
       }
-      matrixData++;
+      comps[0] = graya_getv(color);
+      comps[1] = graya_geta(color);
+      return false;
     }
-
   };
 
-  struct GetPixelsDelegateGrayscale : public GetPixelsDelegate {
-    int v, a;
+  struct IndexedComponents {
+    enum { count = 4 };
+    const Palette* pal;
+
+    IndexedComponents(const Palette* pal) : pal(pal) { }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      v = a = 0;
+    bool operator()(IndexedTraits::pixel_t color, int* comps) const {
+      comps[0] = rgba_getr(pal->getEntry(color));
+      comps[1] = rgba_getg(pal->getEntry(color));
+      comps[2] = rgba_getb(pal->getEntry(color));
+      comps[3] = color;
+      return false;
     }
+  };
+
+  // dst[i] += weight * src[i] (the compiler can vectorize this loop).
+  inline void add_weighted(int* dst, const int* src, int weight, int n)
+  {
+    for (int i=0; i<n; ++i)
+      dst[i] += weight * src[i];
+  }
+
+  // Calculates the RowSums of the pixels [x, x+width) of the row "y".
+  //
+  // The components of each needed source row are unpacked in a buffer
+  // padded with the pixels outside the image (wrapped or clamped as in
+  // get_neighboring_pixels()), so the matrix is applied with plain
+  // loops over arrays of integers. If the matrix is separable
+  // (colKernel x rowKernel), a vertical pass is done for each column
+  // and then a horizontal pass for each pixel, so each pixel costs
+  // width+height multiplications instead of width*height.
+  template<typename Traits, typename Components>
+  void convolve_row(const Image* src, int x, int y, int width,
+                    const ConvolutionMatrix* matrix,
+                    const std::vector<int>& rowKernel,
+                    const std::vector<int>& colKernel,
+                    TiledMode tiledMode,
+                    const Components& components,
+                    RowSums& sums)
+  {
+    const int ncomps = Components::count;
+    const int mw = matrix->getWidth();
+    const int mh = matrix->getHeight();
+    const int padded = width + mw - 1;
+    const bool separable = !rowKernel.empty();
+    int comps[kMaxComponents];
+
+    std::vector<int> cols(padded);
+    for (int k=0; k<padded; ++k)
+      cols[k] = wrap_coordinate(x - matrix->getCenterX() + k, src->getWidth(),
+                                (tiledMode & TILED_X_AXIS) ? true: false);
+
+    for (int c=0; c<ncomps; ++c)
+      sums.comps[c].assign(width, 0);
+    sums.transparent.assign(width, 0);
+
+    // Unpacked components (and transparent flags) of one source row
+    // (or the vertical pass of all rows in the separable case).
+    std::vector<int> buf((ncomps+1) * padded);
+    std::vector<int> row;
+    if (separable)
+      row.resize((ncomps+1) * padded);
+    else
+      row.swap(buf);
+
+    for (int j=0; j<mh; ++j) {
+      int rowWeight = (separable ? colKernel[j]: 1);
+      if (rowWeight == 0)
+        continue;
 
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        if (graya_geta(color) == 0)
-          div -= *matrixData;
-        else {
-          v += graya_getv(color) * (*matrixData);
-          a += graya_geta(color) * (*matrixData);
+      int v = wrap_coordinate(y - matrix->getCenterY() + j, src->getHeight(),
+                              (tiledMode & TILED_Y_AXIS) ? true: false);
+
+      for (int k=0; k<padded; ++k) {
+        bool transparent = components(get_pixel_fast<Traits>(src, cols[k], v), comps);
+        for (int c=0; c<ncomps; ++c)
+          row[c*padded + k] = comps[c];
+        row[ncomps*padded + k] = (transparent ? 1: 0);
+      }
+
+      if (separable) {
+        // Vertical pass
+        add_weighted(&buf[0], &row[0], rowWeight, (ncomps+1) * padded);
+      }
+      else {
+        for (int i=0; i<mw; ++i) {
+          int weight = matrix->value(i, j);
+          if (weight == 0)
+            continue;
+
+          for (int c=0; c<ncomps; ++c)
+            add_weighted(&sums.comps[c][0], &row[c*padded + i], weight, width);
+          add_weighted(&sums.transparent[0], &row[ncomps*padded + i], weight, width);
         }
       }
-      matrixData++;
     }
 
-  };
-
-  struct GetPixelsDelegateIndexed : public GetPixelsDelegate {
-    const Palette* pal;
-    int r, g, b, index;
+    // Horizontal pass
+    if (separable) {
+      for (int i=0; i<mw; ++i) {
+        int weight = rowKernel[i];
+        if (weight == 0)
+          continue;
 
-    GetPixelsDelegateIndexed(const Palette* pal) : pal(pal) { }
+        for (int c=0; c<ncomps; ++c)
+          add_weighted(&sums.comps[c][0], &buf[c*padded + i], weight, width);
+        add_weighted(&sums.transparent[0], &buf[ncomps*padded + i], weight, width);
+      }
+    }
+  }
 
-    void reset(const ConvolutionMatrix* matrix) {
-      GetPixelsDelegate::reset(matrix);
-      r = g = b = index = 0;
+  int gcd(int a, int b)
+  {
+    a = std::abs(a);
+    b = std::abs(b);
+    while (b != 0) {
+      int t = a % b;
+      a = b;
+      b = t;
     }
+    return a;
+  }
 
-    void operator()(GrayscaleTraits::pixel_t color)
-    {
-      if (*matrixData) {
-        r += rgba_getr(pal->getEntry(color)) * (*matrixData);
-        g += rgba_getg(pal->getEntry(color)) * (*matrixData);
-        b += rgba_getb(pal->getEntry(color)) * (*matrixData);
-        index += color * (*matrixData);
-      }
-      matrixData++;
+  // Returns true if the matrix is the product of a column kernel and
+  // a row kernel (matrix(x, y) = colKernel[y] * rowKernel[x]) with
+  // integer values (e.g. box and gaussian blurs).
+  bool separate_matrix(const ConvolutionMatrix* matrix,
+                       std::vector<int>& rowKernel,
+                       std::vector<int>& colKernel)
+  {
+    const int w = matrix->getWidth();
+    const int h = matrix->getHeight();
+
+    rowKernel.clear();
+    colKernel.clear();
+
+    // Find a row with some value different than zero.
+    int r0 = -1, c0 = -1;
+    for (int y=0; y<h && r0 < 0; ++y)
+      for (int x=0; x<w; ++x)
+        if (matrix->value(x, y) != 0) {
+          r0 = y;
+          c0 = x;
+          break;
+        }
+    if (r0 < 0)
+      return false;
+
+    // The row kernel is that row divided by the GCD of its values, so
+    // the column kernel can be made of integers too.
+    int g = 0;
+    for (int x=0; x<w; ++x)
+      g = gcd(g, matrix->value(x, r0));
+
+    std::vector<int> row(w), col(h);
+    for (int x=0; x<w; ++x)
+      row[x] = matrix->value(x, r0) / g;
+
+    for (int y=0; y<h; ++y) {
+      if (matrix->value(c0, y) % row[c0] != 0)
+        return false;
+      col[y] = matrix->value(c0, y) / row[c0];
     }
 
-  };
+    for (int y=0; y<h; ++y)
+      for (int x=0; x<w; ++x)
+        if (matrix->value(x, y) != col[y] * row[x])
+          return false;
+
+    rowKernel.swap(row);
+    colKernel.swap(col);
+    return true;
+  }
 
 }
 
@@ -132,7 +268,13 @@ ConvolutionMatrixFilter::ConvolutionMatrixFilter()
 void ConvolutionMatrixFilter::setMatrix(const SharedPtr<ConvolutionMatrix>& matrix)
 {
   m_matrix = matrix;
-  m_lines.resize(matrix->getHeight());
+
+  // Matrices with just one row or column don't need two passes.
+  if (matrix->getWidth() == 1 || matrix->getHeight() == 1 ||
+      !separate_matrix(matrix, m_rowKernel, m_colKernel)) {
+    m_rowKernel.clear();
+    m_colKernel.clear();
+  }
 }
 
 void ConvolutionMatrixFilter::setTiledMode(TiledMode tiledMode)
@@ -154,61 +296,59 @@ void ConvolutionMatrixFilter::applyToRgba(FilterManager* filterMgr)
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint32_t color;
-  GetPixelsDelegateRgba delegate;
+  int r, g, b, a;
   int x = filterMgr->getX();
-  int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
+  int w = filterMgr->getWidth();
+  RowSums sums;
+
+  convolve_row<RgbTraits>(src, x, y, w, m_matrix, m_rowKernel, m_colKernel,
+                          m_tiledMode, RgbaComponents(), sums);
 
-  for (; x<x2; ++x) {
+  for (int i=0; i<w; ++i, ++x) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix);
-    get_neighboring_pixels<RgbTraits>(src, x, y,
-                                      m_matrix->getWidth(),
-                                      m_matrix->getHeight(),
-                                      m_matrix->getCenterX(),
-                                      m_matrix->getCenterY(),
-                                      m_tiledMode, delegate);
-
     color = get_pixel_fast<RgbTraits>(src, x, y);
-    if (delegate.div == 0) {
+
+    int div = m_matrix->getDiv() - sums.transparent[i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_RED_CHANNEL) {
-      delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-      delegate.r = MID(0, delegate.r, 255);
+      r = sums.comps[0][i] / div + m_matrix->getBias();
+      r = MID(0, r, 255);
     }
     else
-      delegate.r = rgba_getr(color);
+      r = rgba_getr(color);
 
     if (target & TARGET_GREEN_CHANNEL) {
-      delegate.g = delegate.g / delegate.div + m_matrix->getBias();
-      delegate.g = MID(0, delegate.g, 255);
+      g = sums.comps[1][i] / div + m_matrix->getBias();
+      g = MID(0, g, 255);
     }
     else
-      delegate.g = rgba_getg(color);
+      g = rgba_getg(color);
 
     if (target & TARGET_BLUE_CHANNEL) {
-      delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-      delegate.b = MID(0, delegate.b, 255);
+      b = sums.comps[2][i] / div + m_matrix->getBias();
+      b = MID(0, b, 255);
     }
     else
-      delegate.b = rgba_getb(color);
+      b = rgba_getb(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = MID(0, delegate.a, 255);
+      a = sums.comps[3][i] / m_matrix->getDiv() + m_matrix->getBias();
+      a = MID(0, a, 255);
     }
     else
-      delegate.a = rgba_geta(color);
+      a = rgba_geta(color);
 
-    *(dst_address++) = rgba(delegate.r, delegate.g, delegate.b, delegate.a);
+    *(dst_address++) = rgba(r, g, b, a);
   }
 }
 
@@ -221,47 +361,45 @@ void ConvolutionMatrixFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   uint16_t color;
-  GetPixelsDelegateGrayscale delegate;
+  int k, a;
   int x = filterMgr->getX();
-  int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
+  int w = filterMgr->getWidth();
+  RowSums sums;
+
+  convolve_row<GrayscaleTraits>(src, x, y, w, m_matrix, m_rowKernel, m_colKernel,
+                                m_tiledMode, GrayscaleComponents(), sums);
 
-  for (; x<x2; ++x) {
+  for (int i=0; i<w; ++i, ++x) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix);
-    get_neighboring_pixels<GrayscaleTraits>(src, x, y,
-                                            m_matrix->getWidth(),
-                                            m_matrix->getHeight(),
-                                            m_matrix->getCenterX(),
-                                            m_matrix->getCenterY(),
-                                            m_tiledMode, delegate);
-
     color = get_pixel_fast<GrayscaleTraits>(src, x, y);
-    if (delegate.div == 0) {
+
+    int div = m_matrix->getDiv() - sums.transparent[i];
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_GRAY_CHANNEL) {
-      delegate.v = delegate.v / delegate.div + m_matrix->getBias();
-      delegate.v = MID(0, delegate.v, 255);
+      k = sums.comps[0][i] / div + m_matrix->getBias();
+      k = MID(0, k, 255);
     }
     else
-      delegate.v = graya_getv(color);
+      k = graya_getv(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      delegate.a = delegate.a / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.a = MID(0, delegate.a, 255);
+      a = sums.comps[1][i] / m_matrix->getDiv() + m_matrix->getBias();
+      a = MID(0, a, 255);
     }
     else
-      delegate.a = graya_geta(color);
+      a = graya_geta(color);
 
-    *(dst_address++) = graya(delegate.v, delegate.a);
+    *(dst_address++) = graya(k, a);
   }
 }
 
@@ -276,61 +414,59 @@ void ConvolutionMatrixFilter::applyToIndexed(FilterManager* filterMgr)
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
   uint8_t color;
-  GetPixelsDelegateIndexed delegate(pal);
+  int r, g, b, index;
   int x = filterMgr->getX();
-  int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
+  int w = filterMgr->getWidth();
+  RowSums sums;
+
+  convolve_row<IndexedTraits>(src, x, y, w, m_matrix, m_rowKernel, m_colKernel,
+                              m_tiledMode, IndexedComponents(pal), sums);
 
-  for (; x<x2; ++x) {
+  for (int i=0; i<w; ++i, ++x) {
     // Avoid the non-selected region
     if (filterMgr->skipPixel()) {
       ++dst_address;
       continue;
     }
 
-    delegate.reset(m_matrix);
-    get_neighboring_pixels<IndexedTraits>(src, x, y,
-                                          m_matrix->getWidth(),
-                                          m_matrix->getHeight(),
-                                          m_matrix->getCenterX(),
-                                          m_matrix->getCenterY(),
-                                          m_tiledMode, delegate);
-
     color = get_pixel_fast<IndexedTraits>(src, x, y);
-    if (delegate.div == 0) {
+
+    int div = m_matrix->getDiv();
+    if (div == 0) {
       *(dst_address++) = color;
       continue;
     }
 
     if (target & TARGET_INDEX_CHANNEL) {
-      delegate.index = delegate.index / m_matrix->getDiv() + m_matrix->getBias();
-      delegate.index = MID(0, delegate.index, 255);
+      index = sums.comps[3][i] / div + m_matrix->getBias();
+      index = MID(0, index, 255);
 
-      *(dst_address++) = delegate.index;
+      *(dst_address++) = index;
     }
     else {
       if (target & TARGET_RED_CHANNEL) {
-        delegate.r = delegate.r / delegate.div + m_matrix->getBias();
-        delegate.r = MID(0, delegate.r, 255);
+        r = sums.comps[0][i] / div + m_matrix->getBias();
+        r = MID(0, r, 255);
       }
       else
-        delegate.r = rgba_getr(pal->getEntry(color));
+        r = rgba_getr(pal->getEntry(color));
 
       if (target & TARGET_GREEN_CHANNEL) {
-        delegate.g =  delegate.g / delegate.div + m_matrix->getBias();
-        delegate.g = MID(0, delegate.g, 255);
+        g = sums.comps[1][i] / div + m_matrix->getBias();
+        g = MID(0, g, 255);
       }
       else
-        delegate.g = rgba_getg(pal->getEntry(color));
+        g = rgba_getg(pal->getEntry(color));
 
       if (target & TARGET_BLUE_CHANNEL) {
-        delegate.b = delegate.b / delegate.div + m_matrix->getBias();
-        delegate.b = MID(0, delegate.b, 255);
+        b = sums.comps[2][i] / div + m_matrix->getBias();
+        b = MID(0, b, 255);
       }
       else
-        delegate.b = rgba_getb(pal->getEntry(color));
+        b = rgba_getb(pal->getEntry(color));
 
-      *(dst_address++) = rgbmap->mapColor(delegate.r, delegate.g, delegate.b);
+      *(dst_address++) = rgbmap->mapColor(r, g, b);
     }
   }
 }
@@ -49,7 +49,11 @@ namespace filters {
   private:
     SharedPtr<ConvolutionMatrix> m_matrix;
     TiledMode m_tiledMode;
-    std::vector<uint8_t*> m_lines;
+
+    // Kernels of a separable matrix (both are empty if the matrix is
+    // not separable).
+    std::vector<int> m_rowKernel;
+    std::vector<int> m_colKernel;
   };
 
 } // namespace filters
@@ -33,17 +33,210 @@
 #include "raster/rgbmap.h"
 
 #include <algorithm>
+#include <cstring>
 
 namespace filters {
 
 using namespace raster;
 
 namespace {
+  // Buffers to sort the components of the neighboring pixels. Each
+  // row uses its own buffers so rows can be filtered in parallel.
+  typedef std::vector<std::vector<uint8_t> > Channels;
+
+  // Windows with this number of pixels (or more) use
+  // MedianHistogram instead of sorting the components of each pixel.
+  const int kMinHistogramWindow = 5*5;
+
+  // Histograms of the components of the pixels inside the window of
+  // the filter. The window slides through the row adding and removing
+  // columns of pixels, so each pixel costs O(height) instead of
+  // O(width*height*log(width*height)). The median is found with a
+  // coarse histogram (16 bins) and the fine one (256 bins).
+  class MedianHistogram {
+  public:
+    MedianHistogram(int nchannels) : m_nchannels(nchannels), m_count(0) {
+      std::memset(m_fine, 0, sizeof(m_fine));
+      std::memset(m_coarse, 0, sizeof(m_coarse));
+    }
+
+    void add(const uint8_t* comps) {
+      for (int c=0; c<m_nchannels; ++c) {
+        ++m_fine[c][comps[c]];
+        ++m_coarse[c][comps[c] >> 4];
+      }
+      ++m_count;
+    }
+
+    void remove(const uint8_t* comps) {
+      for (int c=0; c<m_nchannels; ++c) {
+        --m_fine[c][comps[c]];
+        --m_coarse[c][comps[c] >> 4];
+      }
+      --m_count;
+    }
+
+    // Returns the same value as the element "count/2" of the sorted
+    // components.
+    int median(int c) const {
+      int k = m_count/2;
+      int i = 0;
+
+      while (k >= m_coarse[c][i])
+        k -= m_coarse[c][i++];
+
+      i <<= 4;
+      while (k >= m_fine[c][i])
+        k -= m_fine[c][i++];
+
+      return i;
+    }
+
+  private:
+    int m_nchannels;
+    int m_count;
+    int m_fine[4][256];
+    int m_coarse[4][16];
+  };
+
+  // Applies the median filter to the row of the given FilterManager
+  // using a MedianHistogram. "components" splits each pixel in
+  // "nchannels" components, and "output" returns the filtered pixel
+  // given the original one and the median of each component.
+  template<typename Traits, typename Components, typename Output>
+  void apply_median_with_histograms(FilterManager* filterMgr,
+                                    int width, int height, TiledMode tiledMode,
+                                    int nchannels,
+                                    const Components& components,
+                                    const Output& output)
+  {
+    const Image* src = filterMgr->getSourceImage();
+    typename Traits::address_t dst_address =
+      (typename Traits::address_t)filterMgr->getDestinationAddress();
+    int x = filterMgr->getX();
+    int x2 = x+filterMgr->getWidth();
+    int y = filterMgr->getY();
+    int centerX = width/2;
+    int centerY = height/2;
+    bool tiledX = ((tiledMode & TILED_X_AXIS) ? true: false);
+    bool tiledY = ((tiledMode & TILED_Y_AXIS) ? true: false);
+    MedianHistogram histogram(nchannels);
+    uint8_t comps[4];
+    int medians[4];
+
+    std::vector<int> rows(height);
+    for (int dy=0; dy<height; ++dy)
+      rows[dy] = wrap_coordinate(y-centerY+dy, src->getHeight(), tiledY);
+
+    // Fill the window of the first pixel.
+    for (int dx=0; dx<width; ++dx) {
+      int u = wrap_coordinate(x-centerX+dx, src->getWidth(), tiledX);
+      for (int dy=0; dy<height; ++dy) {
+        components(get_pixel_fast<Traits>(src, u, rows[dy]), comps);
+        histogram.add(comps);
+      }
+    }
+
+    for (; x<x2; ++x) {
+      // Avoid the non-selected region
+      if (!filterMgr->skipPixel()) {
+        for (int c=0; c<nchannels; ++c)
+          medians[c] = histogram.median(c);
+
+        *dst_address = output(get_pixel_fast<Traits>(src, x, y), medians);
+      }
+      ++dst_address;
+
+      // Slide the window one pixel to the right.
+      if (x+1 < x2) {
+        int u1 = wrap_coordinate(x-centerX, src->getWidth(), tiledX);
+        int u2 = wrap_coordinate(x-centerX+width, src->getWidth(), tiledX);
+        for (int dy=0; dy<height; ++dy) {
+          components(get_pixel_fast<Traits>(src, u1, rows[dy]), comps);
+          histogram.remove(comps);
+
+          components(get_pixel_fast<Traits>(src, u2, rows[dy]), comps);
+          histogram.add(comps);
+        }
+      }
+    }
+  }
+
+  struct RgbaComponents {
+    void operator()(RgbTraits::pixel_t color, uint8_t* comps) const {
+      comps[0] = rgba_getr(color);
+      comps[1] = rgba_getg(color);
+      comps[2] = rgba_getb(color);
+      comps[3] = rgba_geta(color);
+    }
+  };
+
+  struct RgbaOutput {
+    Target target;
+    RgbaOutput(Target target) : target(target) { }
+
+    RgbTraits::pixel_t operator()(RgbTraits::pixel_t color, const int* m) const {
+      return rgba((target & TARGET_RED_CHANNEL) ? m[0]: rgba_getr(color),
+                  (target & TARGET_GREEN_CHANNEL) ? m[1]: rgba_getg(color),
+                  (target & TARGET_BLUE_CHANNEL) ? m[2]: rgba_getb(color),
+                  (target & TARGET_ALPHA_CHANNEL) ? m[3]: rgba_geta(color));
+    }
+  };
+
+  struct GrayscaleComponents {
+    void operator()(GrayscaleTraits::pixel_t color, uint8_t* comps) const {
+      comps[0] = graya_getv(color);
+      comps[1] = graya_geta(color);
+    }
+  };
+
+  struct GrayscaleOutput {
+    Target target;
+    GrayscaleOutput(Target target) : target(target) { }
+
+    GrayscaleTraits::pixel_t operator()(GrayscaleTraits::pixel_t color, const int* m) const {
+      return graya((target & TARGET_GRAY_CHANNEL) ? m[0]: graya_getv(color),
+                   (target & TARGET_ALPHA_CHANNEL) ? m[1]: graya_geta(color));
+    }
+  };
+
+  struct IndexedComponents {
+    const Palette* pal;
+    IndexedComponents(const Palette* pal) : pal(pal) { }
+
+    void operator()(IndexedTraits::pixel_t color, uint8_t* comps) const {
+      if (pal) {
+        comps[0] = rgba_getr(pal->getEntry(color));
+        comps[1] = rgba_getg(pal->getEntry(color));
+        comps[2] = rgba_getb(pal->getEntry(color));
+      }
+      else
+        comps[0] = color;
+    }
+  };
+
+  struct IndexedOutput {
+    const Palette* pal;
+    const RgbMap* rgbmap;
+    Target target;
+    IndexedOutput(const Palette* pal, const RgbMap* rgbmap, Target target)
+      : pal(pal), rgbmap(rgbmap), target(target) { }
+
+    IndexedTraits::pixel_t operator()(IndexedTraits::pixel_t color, const int* m) const {
+      if (target & TARGET_INDEX_CHANNEL)
+        return m[0];
+
+      return rgbmap->mapColor((target & TARGET_RED_CHANNEL) ? m[0]: rgba_getr(pal->getEntry(color)),
+                              (target & TARGET_GREEN_CHANNEL) ? m[1]: rgba_getg(pal->getEntry(color)),
+                              (target & TARGET_BLUE_CHANNEL) ? m[2]: rgba_getb(pal->getEntry(color)));
+    }
+  };
+
   struct GetPixelsDelegateRgba {
-    std::vector<std::vector<uint8_t> >& channel;
+    Channels& channel;
     int c;
 
-    GetPixelsDelegateRgba(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+    GetPixelsDelegateRgba(Channels& channel) : channel(channel) { }
 
     void reset() { c = 0; }
 
@@ -58,10 +251,10 @@ namespace {
   };
 
   struct GetPixelsDelegateGrayscale {
-    std::vector<std::vector<uint8_t> >& channel;
+    Channels& channel;
     int c;
 
-    GetPixelsDelegateGrayscale(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+    GetPixelsDelegateGrayscale(Channels& channel) : channel(channel) { }
 
     void reset() { c = 0; }
 
@@ -75,11 +268,11 @@ namespace {
 
   struct GetPixelsDelegateIndexed {
     const Palette* pal;
-    std::vector<std::vector<uint8_t> >& channel;
+    Channels& channel;
     Target target;
     int c;
 
-    GetPixelsDelegateIndexed(const Palette* pal, std::vector<std::vector<uint8_t> >& channel, Target target)
+    GetPixelsDelegateIndexed(const Palette* pal, Channels& channel, Target target)
       : pal(pal), channel(channel), target(target) { }
 
     void reset() { c = 0; }
@@ -104,7 +297,6 @@ MedianFilter::MedianFilter()
   , m_width(0)
   , m_height(0)
   , m_ncolors(0)
-  , m_channel(4)
 {
 }
 
@@ -118,9 +310,6 @@ void MedianFilter::setSize(int width, int height)
   m_width = width;
   m_height = height;
   m_ncolors = width*height;
-
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
 }
 
 const char* MedianFilter::getName()
@@ -130,12 +319,20 @@ const char* MedianFilter::getName()
 
 void MedianFilter::applyToRgba(FilterManager* filterMgr)
 {
+  if (m_ncolors >= kMinHistogramWindow) {
+    apply_median_with_histograms<RgbTraits>(filterMgr, m_width, m_height, m_tiledMode, 4,
+                                            RgbaComponents(),
+                                            RgbaOutput(filterMgr->getTarget()));
+    return;
+  }
+
   const Image* src = filterMgr->getSourceImage();
   uint32_t* dst_address = (uint32_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   int color;
   int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
+  Channels channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateRgba delegate(channel);
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
@@ -154,29 +351,29 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
     color = get_pixel_fast<RgbTraits>(src, x, y);
 
     if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
+      std::sort(channel[0].begin(), channel[0].end());
+      r = channel[0][m_ncolors/2];
     }
     else
       r = rgba_getr(color);
 
     if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
+      std::sort(channel[1].begin(), channel[1].end());
+      g = channel[1][m_ncolors/2];
     }
     else
       g = rgba_getg(color);
 
     if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
+      std::sort(channel[2].begin(), channel[2].end());
+      b = channel[2][m_ncolors/2];
     }
     else
       b = rgba_getb(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
+      std::sort(channel[3].begin(), channel[3].end());
+      a = channel[3][m_ncolors/2];
     }
     else
       a = rgba_geta(color);
@@ -187,11 +384,19 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
 
 void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
 {
+  if (m_ncolors >= kMinHistogramWindow) {
+    apply_median_with_histograms<GrayscaleTraits>(filterMgr, m_width, m_height, m_tiledMode, 2,
+                                                  GrayscaleComponents(),
+                                                  GrayscaleOutput(filterMgr->getTarget()));
+    return;
+  }
+
   const Image* src = filterMgr->getSourceImage();
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
+  Channels channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateGrayscale delegate(channel);
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
@@ -210,15 +415,15 @@ void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
     color = get_pixel_fast<GrayscaleTraits>(src, x, y);
 
     if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
+      std::sort(channel[0].begin(), channel[0].end());
+      k = channel[0][m_ncolors/2];
     }
     else
       k = graya_getv(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
+      std::sort(channel[1].begin(), channel[1].end());
+      a = channel[1][m_ncolors/2];
     }
     else
       a = graya_geta(color);
@@ -235,7 +440,21 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
   int color, r, g, b;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
+
+  if (m_ncolors >= kMinHistogramWindow) {
+    if (target & TARGET_INDEX_CHANNEL)
+      apply_median_with_histograms<IndexedTraits>(filterMgr, m_width, m_height, m_tiledMode, 1,
+                                                  IndexedComponents(NULL),
+                                                  IndexedOutput(pal, rgbmap, target));
+    else
+      apply_median_with_histograms<IndexedTraits>(filterMgr, m_width, m_height, m_tiledMode, 3,
+                                                  IndexedComponents(pal),
+                                                  IndexedOutput(pal, rgbmap, target));
+    return;
+  }
+
+  Channels channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateIndexed delegate(pal, channel, target);
   int x = filterMgr->getX();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->getY();
@@ -252,29 +471,29 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
                                           m_tiledMode, delegate);
 
     if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
+      std::sort(channel[0].begin(), channel[0].end());
+      *(dst_address++) = channel[0][m_ncolors/2];
     }
     else {
       color = get_pixel_fast<IndexedTraits>(src, x, y);
 
       if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
+        std::sort(channel[0].begin(), channel[0].end());
+        r = channel[0][m_ncolors/2];
       }
       else
         r = rgba_getr(pal->getEntry(color));
 
       if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
+        std::sort(channel[1].begin(), channel[1].end());
+        g = channel[1][m_ncolors/2];
       }
       else
         g = rgba_getg(pal->getEntry(color));
 
       if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
+        std::sort(channel[2].begin(), channel[2].end());
+        b = channel[2][m_ncolors/2];
       }
       else
         b = rgba_getb(pal->getEntry(color));
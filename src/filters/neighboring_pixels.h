@@ -29,6 +29,19 @@
 namespace filters {
   using namespace raster;
 
+  // Returns the coordinate of the pixel that get_neighboring_pixels()
+  // uses for the given coordinate "u" (which can be outside the
+  // image): it's wrapped in tiled mode, or clamped to the image edges.
+  inline int wrap_coordinate(int u, int size, bool tiled)
+  {
+    if (tiled) {
+      u %= size;
+      return (u < 0 ? u+size: u);
+    }
+    else
+      return MID(0, u, size-1);
+  }
+
   // Calls the specified "delegate" for all neighboring pixels in a 2D
   // (width*height) matrix located in (x,y) where its center is the
   // (centerX,centerY) element of the matrix.
@@ -42,7 +42,10 @@ namespace raster {
                              double x2, double y2, double x3, double y3,
                              double in_x);
 
-  void algo_floodfill(Image* image, int x, int y, int tolerance, void* data, AlgoHLine proc);
+  // Calls "proc" for each horizontal segment of pixels similar to the
+  // pixel in (x, y). If "contiguous" is false, all similar pixels of
+  // the image are filled (not only the ones connected to x, y).
+  void algo_floodfill(Image* image, int x, int y, int tolerance, bool contiguous, void* data, AlgoHLine proc);
 
   void algo_polygon(int vertices, const int* points, void* data, AlgoHLine proc);
 
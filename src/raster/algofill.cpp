@@ -1,5 +1,5 @@
 // The floodfill routine.
-// By Shawn Hargreaves.
+// Based on the one by Shawn Hargreaves, rewritten to fill spans.
 // Adapted to Aseprite by David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,325 +10,439 @@
 #endif
 
 #include "raster/algo.h"
+#include "raster/blend_simd.h"
 #include "raster/image.h"
-#include "raster/primitives.h"
+#include "raster/image_traits.h"
+#include "raster/primitives_fast.h"
 
-#include <allegro.h>
-#include <allegro/internal/aintern.h>
-#include <limits.h>
-#include <math.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#ifdef RASTER_HAVE_SSE2
+#include <emmintrin.h>
+#endif
 
 namespace raster {
 
-typedef struct FLOODED_LINE     /* store segments which have been flooded */
-{
-  short flags;                  /* status of the segment */
-  short lpos, rpos;             /* left and right ends of segment */
-  short y;                      /* y coordinate of the segment */
-  int next;                     /* linked list if several per line */
-} FLOODED_LINE;
+namespace {
 
-/* Note: a 'short' is not sufficient for 'next' above in some corner cases. */
+// Compares the pixels of one row with the color to be replaced. Each
+// specialization gives the result for kPixels pixels at the same
+// time in a bit mask (bit N for the pixel x+N).
+template<typename ImageTraits>
+class ColorMatch {
+public:
+  enum { kPixels = 1 };
 
+  ColorMatch(const Image* image, color_t color, int tolerance)
+    : m_image(image), m_color(color), m_y(0) {
+  }
 
-static int flood_count;          /* number of flooded segments */
+  void setRow(int y) { m_y = y; }
 
-#define FLOOD_IN_USE             1
-#define FLOOD_TODO_ABOVE         2
-#define FLOOD_TODO_BELOW         4
+  bool matchPixel(int x) const {
+    return (get_pixel_fast<ImageTraits>(m_image, x, m_y) == m_color);
+  }
 
-#define FLOOD_LINE(c)            (((FLOODED_LINE *)_scratch_mem) + c)
+  unsigned mask(int x) const {
+    return (matchPixel(x) ? 1: 0);
+  }
 
-static inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
-{
-  if (tolerance == 0)
-    return (c1 == c2) || (rgba_geta(c1) == 0 && rgba_geta(c2) == 0);
-  else {
-    int r1 = rgba_getr(c1);
-    int g1 = rgba_getg(c1);
-    int b1 = rgba_getb(c1);
-    int a1 = rgba_geta(c1);
-    int r2 = rgba_getr(c2);
-    int g2 = rgba_getg(c2);
-    int b2 = rgba_getb(c2);
-    int a2 = rgba_geta(c2);
-
-    if (a1 == 0 && a2 == 0)
-      return true;
+private:
+  const Image* m_image;
+  color_t m_color;
+  int m_y;
+};
+
+template<>
+class ColorMatch<RgbTraits> {
+public:
+#ifdef RASTER_HAVE_SSE2
+  enum { kPixels = 4 };
+#else
+  enum { kPixels = 1 };
+#endif
 
-    return ((ABS(r1-r2) <= tolerance) &&
-            (ABS(g1-g2) <= tolerance) &&
-            (ABS(b1-b2) <= tolerance) &&
-            (ABS(a1-a2) <= tolerance));
+  ColorMatch(const Image* image, color_t color, int tolerance)
+    : m_image(image), m_color(color), m_tolerance(tolerance), m_row(NULL) {
+#ifdef RASTER_HAVE_SSE2
+    m_colorVec = _mm_set1_epi32(color);
+    m_toleranceVec = _mm_set1_epi8((char)tolerance);
+    m_alphaVec = _mm_set1_epi32(255u << rgba_a_shift);
+#endif
   }
-}
 
-static inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
-{
-  if (tolerance == 0)
-    return (c1 == c2) || (graya_geta(c1) == 0 && graya_geta(c2) == 0);
-  else {
-    int k1 = graya_getv(c1);
-    int a1 = graya_geta(c1);
-    int k2 = graya_getv(c2);
-    int a2 = graya_geta(c2);
+  void setRow(int y) {
+    m_row = (const uint32_t*)m_image->getPixelAddress(0, y);
+  }
 
-    if (a1 == 0 && a2 == 0)
+  bool matchPixel(int x) const {
+    color_t c = m_row[x];
+    if (m_tolerance == 0)
+      return (c == m_color) || (rgba_geta(c) == 0 && rgba_geta(m_color) == 0);
+
+    if (rgba_geta(c) == 0 && rgba_geta(m_color) == 0)
       return true;
 
-    return ((ABS(k1-k2) <= tolerance) &&
-            (ABS(a1-a2) <= tolerance));
+    return ((ABS(rgba_getr(c)-rgba_getr(m_color)) <= m_tolerance) &&
+            (ABS(rgba_getg(c)-rgba_getg(m_color)) <= m_tolerance) &&
+            (ABS(rgba_getb(c)-rgba_getb(m_color)) <= m_tolerance) &&
+            (ABS(rgba_geta(c)-rgba_geta(m_color)) <= m_tolerance));
   }
-}
 
-static inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
-{
-  if (tolerance == 0)
-    return (c1 == c2);
-  else
-    return ABS((int)c1 - (int)c2) <= tolerance;
-}
+  unsigned mask(int x) const {
+#ifdef RASTER_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i px = _mm_loadu_si128((const __m128i*)(m_row+x));
 
+    // |px-color| <= tolerance in the four components
+    __m128i diff = _mm_or_si128(_mm_subs_epu8(px, m_colorVec),
+                                _mm_subs_epu8(m_colorVec, px));
+    __m128i ok = _mm_cmpeq_epi8(_mm_subs_epu8(diff, m_toleranceVec), zero);
+    ok = _mm_cmpeq_epi32(ok, _mm_cmpeq_epi32(zero, zero));
 
+    // All transparent pixels are equal
+    if (rgba_geta(m_color) == 0)
+      ok = _mm_or_si128(ok, _mm_cmpeq_epi32(_mm_and_si128(px, m_alphaVec), zero));
 
-/* flooder:
- *  Fills a horizontal line around the specified position, and adds it
- *  to the list of drawn segments. Returns the first x coordinate after
- *  the part of the line which it has dealt with.
- */
-static int flooder(Image *image, int x, int y,
-                   color_t src_color, int tolerance, void *data, AlgoHLine proc)
-{
-  FLOODED_LINE *p;
-  int left = 0, right = 0;
-  int c;
+    return _mm_movemask_ps(_mm_castsi128_ps(ok));
+#else
+    return (matchPixel(x) ? 1: 0);
+#endif
+  }
 
-  switch (image->getPixelFormat()) {
+private:
+  const Image* m_image;
+  color_t m_color;
+  int m_tolerance;
+  const uint32_t* m_row;
+#ifdef RASTER_HAVE_SSE2
+  __m128i m_colorVec;
+  __m128i m_toleranceVec;
+  __m128i m_alphaVec;
+#endif
+};
+
+template<>
+class ColorMatch<GrayscaleTraits> {
+public:
+#ifdef RASTER_HAVE_SSE2
+  enum { kPixels = 8 };
+#else
+  enum { kPixels = 1 };
+#endif
 
-    case IMAGE_RGB:
-      {
-        uint32_t* address = reinterpret_cast<uint32_t*>(image->getPixelAddress(0, y));
+  ColorMatch(const Image* image, color_t color, int tolerance)
+    : m_image(image), m_color(color), m_tolerance(tolerance), m_row(NULL) {
+#ifdef RASTER_HAVE_SSE2
+    m_colorVec = _mm_set1_epi16((short)color);
+    m_toleranceVec = _mm_set1_epi8((char)tolerance);
+    m_alphaVec = _mm_set1_epi16((short)(255 << graya_a_shift));
+#endif
+  }
 
-        // Check start pixel
-        if (!color_equal_32((int)*(address+x), src_color, tolerance))
-          return x+1;
+  void setRow(int y) {
+    m_row = (const uint16_t*)m_image->getPixelAddress(0, y);
+  }
 
-        // Work left from starting point
-        for (left=x-1; left>=0; left--) {
-          if (!color_equal_32((int)*(address+left), src_color, tolerance))
-            break;
-        }
+  bool matchPixel(int x) const {
+    color_t c = m_row[x];
+    if (m_tolerance == 0)
+      return (c == m_color) || (graya_geta(c) == 0 && graya_geta(m_color) == 0);
 
-        // Work right from starting point
-        for (right=x+1; right<image->getWidth(); right++) {
-          if (!color_equal_32((int)*(address+right), src_color, tolerance))
-            break;
-        }
-      }
-      break;
+    if (graya_geta(c) == 0 && graya_geta(m_color) == 0)
+      return true;
 
-    case IMAGE_GRAYSCALE:
-      {
-        uint16_t* address = reinterpret_cast<uint16_t*>(image->getPixelAddress(0, y));
+    return ((ABS(graya_getv(c)-graya_getv(m_color)) <= m_tolerance) &&
+            (ABS(graya_geta(c)-graya_geta(m_color)) <= m_tolerance));
+  }
 
-        // Check start pixel
-        if (!color_equal_16((int)*(address+x), src_color, tolerance))
-          return x+1;
+  unsigned mask(int x) const {
+#ifdef RASTER_HAVE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128i px = _mm_loadu_si128((const __m128i*)(m_row+x));
 
-        // Work left from starting point
-        for (left=x-1; left>=0; left--) {
-          if (!color_equal_16((int)*(address+left), src_color, tolerance))
-            break;
-        }
+    __m128i diff = _mm_or_si128(_mm_subs_epu8(px, m_colorVec),
+                                _mm_subs_epu8(m_colorVec, px));
+    __m128i ok = _mm_cmpeq_epi8(_mm_subs_epu8(diff, m_toleranceVec), zero);
+    ok = _mm_cmpeq_epi16(ok, _mm_cmpeq_epi16(zero, zero));
 
-        // Work right from starting point
-        for (right=x+1; right<image->getWidth(); right++) {
-          if (!color_equal_16((int)*(address+right), src_color, tolerance))
-            break;
-        }
-      }
-      break;
+    if (graya_geta(m_color) == 0)
+      ok = _mm_or_si128(ok, _mm_cmpeq_epi16(_mm_and_si128(px, m_alphaVec), zero));
 
-    case IMAGE_INDEXED:
-      {
-        uint8_t* address = image->getPixelAddress(0, y);
+    // One byte for each pixel
+    return _mm_movemask_epi8(_mm_packs_epi16(ok, zero));
+#else
+    return (matchPixel(x) ? 1: 0);
+#endif
+  }
 
-        // Check start pixel
-        if (!color_equal_8((int)*(address+x), src_color, tolerance))
-          return x+1;
+private:
+  const Image* m_image;
+  color_t m_color;
+  int m_tolerance;
+  const uint16_t* m_row;
+#ifdef RASTER_HAVE_SSE2
+  __m128i m_colorVec;
+  __m128i m_toleranceVec;
+  __m128i m_alphaVec;
+#endif
+};
+
+template<>
+class ColorMatch<IndexedTraits> {
+public:
+#ifdef RASTER_HAVE_SSE2
+  enum { kPixels = 16 };
+#else
+  enum { kPixels = 1 };
+#endif
 
-        // Work left from starting point
-        for (left=x-1; left>=0; left--) {
-          if (!color_equal_8((int)*(address+left), src_color, tolerance))
-            break;
-        }
+  ColorMatch(const Image* image, color_t color, int tolerance)
+    : m_image(image), m_color(color), m_tolerance(tolerance), m_row(NULL) {
+#ifdef RASTER_HAVE_SSE2
+    m_colorVec = _mm_set1_epi8((char)color);
+    m_toleranceVec = _mm_set1_epi8((char)tolerance);
+#endif
+  }
 
-        // Work right from starting point
-        for (right=x+1; right<image->getWidth(); right++) {
-          if (!color_equal_8((int)*(address+right), src_color, tolerance))
-            break;
-        }
-      }
-      break;
+  void setRow(int y) {
+    m_row = m_image->getPixelAddress(0, y);
+  }
 
-    default:
-      // Check start pixel
-      if (get_pixel(image, x, y) != src_color)
-        return x+1;
+  bool matchPixel(int x) const {
+    return (ABS((int)m_row[x] - (int)m_color) <= m_tolerance);
+  }
 
-      // Work left from starting point
-      for (left=x-1; left>=0; left--) {
-        if (get_pixel(image, left, y) != src_color)
-          break;
-      }
+  unsigned mask(int x) const {
+#ifdef RASTER_HAVE_SSE2
+    __m128i px = _mm_loadu_si128((const __m128i*)(m_row+x));
+    __m128i diff = _mm_or_si128(_mm_subs_epu8(px, m_colorVec),
+                                _mm_subs_epu8(m_colorVec, px));
+    return _mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_subs_epu8(diff, m_toleranceVec), _mm_setzero_si128()));
+#else
+    return (matchPixel(x) ? 1: 0);
+#endif
+  }
 
-      // Work right from starting point
-      for (right=x+1; right<image->getWidth(); right++) {
-        if (get_pixel(image, right, y) != src_color)
-          break;
+private:
+  const Image* m_image;
+  color_t m_color;
+  int m_tolerance;
+  const uint8_t* m_row;
+#ifdef RASTER_HAVE_SSE2
+  __m128i m_colorVec;
+  __m128i m_toleranceVec;
+#endif
+};
+
+// Returns the first x in [x1, x2] where the pixel matches (or doesn't
+// match if "state" is false), or x2+1 if there is no such pixel.
+template<typename Match>
+int find_forward(const Match& match, int x1, int x2, bool state)
+{
+  const int n = Match::kPixels;
+  const unsigned all = (1u << n) - 1;
+  int x = x1;
+
+  if (n > 1) {
+    for (; x+n-1 <= x2; x += n) {
+      unsigned m = match.mask(x);
+      if (!state)
+        m = ~m & all;
+      if (m) {
+        while (!(m & 1)) {
+          m >>= 1;
+          ++x;
+        }
+        return x;
       }
-      break;
+    }
   }
 
-  left++;
-  right--;
+  for (; x <= x2; ++x)
+    if (match.matchPixel(x) == state)
+      return x;
 
-  /* draw the line */
-  (*proc)(left, y, right, data);
-
-  /* store it in the list of flooded segments */
-  c = y;
-  p = FLOOD_LINE(c);
+  return x2+1;
+}
 
-  if (p->flags) {
-    while (p->next) {
-      c = p->next;
-      p = FLOOD_LINE(c);
+// Returns the last x in [x1, x2] where the pixel matches (or doesn't
+// match if "state" is false), or x1-1 if there is no such pixel.
+template<typename Match>
+int find_backward(const Match& match, int x1, int x2, bool state)
+{
+  const int n = Match::kPixels;
+  const unsigned all = (1u << n) - 1;
+  int x = x2;
+
+  if (n > 1) {
+    for (; x-n+1 >= x1; x -= n) {
+      unsigned m = match.mask(x-n+1);
+      if (!state)
+        m = ~m & all;
+      if (m) {
+        unsigned bit = 1u << (n-1);
+        while (!(m & bit)) {
+          bit >>= 1;
+          --x;
+        }
+        return x;
+      }
     }
-
-    p->next = c = flood_count++;
-    _grow_scratch_mem(sizeof(FLOODED_LINE) * flood_count);
-    p = FLOOD_LINE(c);
   }
 
-  p->flags = FLOOD_IN_USE;
-  p->lpos = left;
-  p->rpos = right;
-  p->y = y;
-  p->next = 0;
+  for (; x >= x1; --x)
+    if (match.matchPixel(x) == state)
+      return x;
 
-  if (y > 0)
-    p->flags |= FLOOD_TODO_ABOVE;
+  return x1-1;
+}
 
-  if (y+1 < image->getHeight())
-    p->flags |= FLOOD_TODO_BELOW;
+// Marks the pixels [x1, x2] as filled.
+inline void set_filled_bits(uint32_t* bits, int x1, int x2)
+{
+  int i1 = x1 / 32;
+  int i2 = x2 / 32;
+  uint32_t mask1 = ~0u << (x1 & 31);
+  uint32_t mask2 = ~0u >> (31 - (x2 & 31));
 
-  return right+2;
+  if (i1 == i2) {
+    bits[i1] |= (mask1 & mask2);
+  }
+  else {
+    bits[i1] |= mask1;
+    for (int i=i1+1; i<i2; ++i)
+      bits[i] = ~0u;
+    bits[i2] |= mask2;
+  }
 }
 
+// Pixels [x1, x2] of row "y" are filled, and segments to fill must be
+// searched in the same range of the row "y+dy".
+struct FloodSpan {
+  int x1, x2, y, dy;
 
+  FloodSpan(int x1, int x2, int y, int dy)
+    : x1(x1), x2(x2), y(y), dy(dy) { }
+};
 
-/* check_flood_line:
- *  Checks a line segment, using the scratch buffer is to store a list of
- *  segments which have already been drawn in order to minimise the required
- *  number of tests.
- */
-static int check_flood_line(Image* image, int y, int left, int right,
-                            int src_color, int tolerance, void *data, AlgoHLine proc)
+// Memory reused between calls to avoid allocations in each bucket
+// fill (like the old scratch memory, it isn't thread-safe).
+std::vector<FloodSpan> span_stack;
+std::vector<uint32_t> filled_bits;
+
+template<typename ImageTraits>
+void floodfill_templ(const Image* image, int x, int y, int tolerance,
+                     bool contiguous, void* data, AlgoHLine proc)
 {
-  int c;
-  FLOODED_LINE *p;
-  int ret = false;
+  const int w = image->getWidth();
+  const int h = image->getHeight();
+  ColorMatch<ImageTraits> match(image, get_pixel_fast<ImageTraits>(image, x, y), tolerance);
+
+  // Fill all matching pixels of the image
+  if (!contiguous) {
+    for (int v=0; v<h; ++v) {
+      match.setRow(v);
+
+      for (int u=0; u<w; ) {
+        int left = find_forward(match, u, w-1, true);
+        if (left >= w)
+          break;
+
+        int right = find_forward(match, left, w-1, false) - 1;
+        (*proc)(left, v, right, data);
+        u = right+2;
+      }
+    }
+    return;
+  }
 
-  while (left <= right) {
-    c = y;
+  // One bit for each pixel to know what segments were already filled.
+  // Segments are always filled completely (from a non-matching pixel
+  // to other), so just one pixel of a segment must be checked.
+  const int words_per_row = (w+31) / 32;
+  filled_bits.assign(words_per_row * h, 0);
+  span_stack.clear();
+
+  // First segment
+  match.setRow(y);
+  int left = find_backward(match, 0, x, false) + 1;
+  int right = find_forward(match, x, w-1, false) - 1;
+  set_filled_bits(&filled_bits[words_per_row * y], left, right);
+  (*proc)(left, y, right, data);
 
-    for (;;) {
-      p = FLOOD_LINE(c);
+  span_stack.push_back(FloodSpan(left, right, y, 1));
+  span_stack.push_back(FloodSpan(left, right, y, -1));
 
-      if ((left >= p->lpos) && (left <= p->rpos)) {
-        left = p->rpos+2;
-        break;
-      }
+  while (!span_stack.empty()) {
+    FloodSpan span = span_stack.back();
+    span_stack.pop_back();
 
-      c = p->next;
+    int v = span.y + span.dy;
+    if (v < 0 || v >= h)
+      continue;
 
-      if (!c) {
-        left = flooder (image, left, y, src_color, tolerance, data, proc);
-        ret = true;
+    match.setRow(v);
+    uint32_t* bits = &filled_bits[words_per_row * v];
+
+    for (int u=span.x1; u<=span.x2; ) {
+      u = find_forward(match, u, span.x2, true);
+      if (u > span.x2)
         break;
+
+      // Was this segment already filled?
+      if (bits[u/32] & (1u << (u&31))) {
+        u = find_forward(match, u, w-1, false) + 1;
+        continue;
       }
+
+      left = find_backward(match, 0, u, false) + 1;
+      right = find_forward(match, u, w-1, false) - 1;
+
+      set_filled_bits(bits, left, right);
+      (*proc)(left, v, right, data);
+
+      // Continue in the same direction, and go back in the parts
+      // that are outside the previous span (the pixels just outside
+      // it are already filled or don't match).
+      span_stack.push_back(FloodSpan(left, right, v, span.dy));
+      if (left < span.x1-1)
+        span_stack.push_back(FloodSpan(left, span.x1-2, v, -span.dy));
+      if (right > span.x2+1)
+        span_stack.push_back(FloodSpan(span.x2+2, right, v, -span.dy));
+
+      u = right+2;
     }
   }
-
-  return ret;
 }
 
+} // anonymous namespace
 
-
-/* floodfill:
- *  Fills an enclosed area (starting at point x, y) with the specified color.
- */
-void algo_floodfill(Image* image, int x, int y, int tolerance, void *data, AlgoHLine proc)
+void algo_floodfill(Image* image, int x, int y, int tolerance, bool contiguous,
+                    void* data, AlgoHLine proc)
 {
-  int c, done;
-  FLOODED_LINE *p;
-
-  /* make sure we have a valid starting point */
+  // Make sure we have a valid starting point
   if ((x < 0) || (x >= image->getWidth()) ||
       (y < 0) || (y >= image->getHeight()))
     return;
 
-  /* what color to replace? */
-  color_t src_color = get_pixel(image, x, y);
-
-  /* set up the list of flooded segments */
-  _grow_scratch_mem(sizeof(FLOODED_LINE) * image->getHeight());
-  flood_count = image->getHeight();
-  p = (FLOODED_LINE*)_scratch_mem;
-  for (c=0; c<flood_count; c++) {
-    p[c].flags = 0;
-    p[c].lpos = SHRT_MAX;
-    p[c].rpos = SHRT_MIN;
-    p[c].y = y;
-    p[c].next = 0;
+  switch (image->getPixelFormat()) {
+    case IMAGE_RGB:
+      floodfill_templ<RgbTraits>(image, x, y, tolerance, contiguous, data, proc);
+      break;
+    case IMAGE_GRAYSCALE:
+      floodfill_templ<GrayscaleTraits>(image, x, y, tolerance, contiguous, data, proc);
+      break;
+    case IMAGE_INDEXED:
+      floodfill_templ<IndexedTraits>(image, x, y, tolerance, contiguous, data, proc);
+      break;
+    case IMAGE_BITMAP:
+      floodfill_templ<BitmapTraits>(image, x, y, tolerance, contiguous, data, proc);
+      break;
   }
-
-  /* start up the flood algorithm */
-  flooder(image, x, y, src_color, tolerance, data, proc);
-
-  /* continue as long as there are some segments still to test */
-  do {
-    done = true;
-
-    /* for each line on the screen */
-    for (c=0; c<flood_count; c++) {
-
-      p = FLOOD_LINE(c);
-
-      /* check below the segment? */
-      if (p->flags & FLOOD_TODO_BELOW) {
-        p->flags &= ~FLOOD_TODO_BELOW;
-        if (check_flood_line(image, p->y+1, p->lpos, p->rpos,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-          p = FLOOD_LINE(c);
-        }
-      }
-
-      /* check above the segment? */
-      if (p->flags & FLOOD_TODO_ABOVE) {
-        p->flags &= ~FLOOD_TODO_ABOVE;
-        if (check_flood_line(image, p->y-1, p->lpos, p->rpos,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-          /* special case shortcut for going backwards */
-          if ((c < image->getHeight()) && (c > 0))
-            c -= 2;
-        }
-      }
-    }
-  } while (!done);
 }
 
 } // namespace raster
@@ -0,0 +1,317 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "raster/algo.h"
+#include "raster/image.h"
+#include "raster/primitives.h"
+#include "raster/primitives_fast.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace base;
+using namespace raster;
+
+// Colors used to create test images, and the rules to know if two
+// colors are similar (the same rules used by algo_floodfill()).
+template<typename ImageTraits>
+struct FillColors;
+
+template<>
+struct FillColors<RgbTraits> {
+  static int count() { return 6; }
+  static color_t get(int i) {
+    static const color_t colors[] = {
+      rgba(0, 0, 0, 0), rgba(255, 0, 0, 0),
+      rgba(10, 20, 30, 255), rgba(12, 22, 28, 255),
+      rgba(200, 100, 50, 255), rgba(205, 100, 50, 250) };
+    return colors[i];
+  }
+  static bool match(color_t a, color_t b, int tolerance) {
+    if (rgba_geta(a) == 0 && rgba_geta(b) == 0)
+      return true;
+    return ((ABS(rgba_getr(a)-rgba_getr(b)) <= tolerance) &&
+            (ABS(rgba_getg(a)-rgba_getg(b)) <= tolerance) &&
+            (ABS(rgba_getb(a)-rgba_getb(b)) <= tolerance) &&
+            (ABS(rgba_geta(a)-rgba_geta(b)) <= tolerance));
+  }
+};
+
+template<>
+struct FillColors<GrayscaleTraits> {
+  static int count() { return 6; }
+  static color_t get(int i) {
+    static const color_t colors[] = {
+      graya(0, 0), graya(100, 0),
+      graya(50, 255), graya(53, 255),
+      graya(200, 255), graya(200, 252) };
+    return colors[i];
+  }
+  static bool match(color_t a, color_t b, int tolerance) {
+    if (graya_geta(a) == 0 && graya_geta(b) == 0)
+      return true;
+    return ((ABS(graya_getv(a)-graya_getv(b)) <= tolerance) &&
+            (ABS(graya_geta(a)-graya_geta(b)) <= tolerance));
+  }
+};
+
+template<>
+struct FillColors<IndexedTraits> {
+  static int count() { return 6; }
+  static color_t get(int i) {
+    static const color_t colors[] = { 0, 1, 2, 5, 9, 200 };
+    return colors[i];
+  }
+  static bool match(color_t a, color_t b, int tolerance) {
+    return (ABS((int)a - (int)b) <= tolerance);
+  }
+};
+
+template<>
+struct FillColors<BitmapTraits> {
+  static int count() { return 2; }
+  static color_t get(int i) { return i; }
+  static bool match(color_t a, color_t b, int tolerance) {
+    return (a == b);
+  }
+};
+
+// Pixels filled by algo_floodfill() (the number of times that each
+// pixel was filled).
+struct FillResult {
+  int w, h;
+  std::vector<int> pixels;
+  bool outside;
+
+  FillResult(int w, int h) : w(w), h(h), pixels(w*h, 0), outside(false) { }
+
+  static void hline(int x1, int y, int x2, void* data) {
+    FillResult* result = (FillResult*)data;
+    if (x1 > x2 || x1 < 0 || x2 >= result->w || y < 0 || y >= result->h) {
+      result->outside = true;
+      return;
+    }
+    for (int x=x1; x<=x2; ++x)
+      ++result->pixels[y*result->w + x];
+  }
+};
+
+// Brute force fill (4-connected pixels) to compare the results.
+template<typename ImageTraits>
+std::vector<int> expected_fill(const Image* image, int x, int y, int tolerance, bool contiguous)
+{
+  int w = image->getWidth();
+  int h = image->getHeight();
+  color_t color = get_pixel_fast<ImageTraits>(image, x, y);
+  std::vector<int> pixels(w*h, 0);
+
+  if (!contiguous) {
+    for (int v=0; v<h; ++v)
+      for (int u=0; u<w; ++u)
+        if (FillColors<ImageTraits>::match(get_pixel_fast<ImageTraits>(image, u, v), color, tolerance))
+          pixels[v*w + u] = 1;
+    return pixels;
+  }
+
+  std::vector<int> stack;
+  stack.push_back(y*w + x);
+  pixels[y*w + x] = 1;
+
+  while (!stack.empty()) {
+    int i = stack.back();
+    stack.pop_back();
+
+    int u = i % w;
+    int v = i / w;
+    const int du[4] = { -1, 1, 0, 0 };
+    const int dv[4] = { 0, 0, -1, 1 };
+    for (int k=0; k<4; ++k) {
+      int nu = u + du[k];
+      int nv = v + dv[k];
+      if (nu < 0 || nv < 0 || nu >= w || nv >= h || pixels[nv*w + nu])
+        continue;
+
+      if (FillColors<ImageTraits>::match(get_pixel_fast<ImageTraits>(image, nu, nv), color, tolerance)) {
+        pixels[nv*w + nu] = 1;
+        stack.push_back(nv*w + nu);
+      }
+    }
+  }
+  return pixels;
+}
+
+// Image with areas of the same color (each pixel copies the left or
+// top pixel most of the time).
+template<typename ImageTraits>
+Image* create_random_image(int w, int h)
+{
+  Image* image = Image::create(ImageTraits::pixel_format, w, h);
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      int r = std::rand() % 10;
+      color_t c;
+      if (r < 4 && x > 0)
+        c = get_pixel_fast<ImageTraits>(image, x-1, y);
+      else if (r < 8 && y > 0)
+        c = get_pixel_fast<ImageTraits>(image, x, y-1);
+      else
+        c = FillColors<ImageTraits>::get(std::rand() % FillColors<ImageTraits>::count());
+      put_pixel_fast<ImageTraits>(image, x, y, c);
+    }
+  return image;
+}
+
+template<typename ImageTraits>
+void expect_fill(const Image* image, int x, int y, int tolerance, bool contiguous)
+{
+  FillResult result(image->getWidth(), image->getHeight());
+  algo_floodfill(const_cast<Image*>(image), x, y, tolerance, contiguous,
+                 &result, &FillResult::hline);
+
+  std::vector<int> expected = expected_fill<ImageTraits>(image, x, y, tolerance, contiguous);
+  EXPECT_FALSE(result.outside);
+  for (int v=0; v<image->getHeight(); ++v)
+    for (int u=0; u<image->getWidth(); ++u)
+      ASSERT_EQ(expected[v*image->getWidth() + u],
+                result.pixels[v*image->getWidth() + u])
+        << "Pixel " << u << "," << v << " of a " << image->getWidth() << "x" << image->getHeight()
+        << " image filled from " << x << "," << y << " (tolerance=" << tolerance
+        << ", contiguous=" << contiguous << ")";
+}
+
+template<typename T>
+class FloodFillAllTypes : public testing::Test {
+protected:
+  FloodFillAllTypes() { }
+};
+
+typedef testing::Types<RgbTraits, GrayscaleTraits, IndexedTraits, BitmapTraits> FloodFillAllTraits;
+TYPED_TEST_CASE(FloodFillAllTypes, FloodFillAllTraits);
+
+TYPED_TEST(FloodFillAllTypes, RandomImages)
+{
+  typedef TypeParam ImageTraits;
+  std::srand(1);
+
+  // Widths that are not multiples of the pixels compared at the same
+  // time (4, 8, or 16)
+  const int sizes[] = { 1, 3, 5, 7, 13, 17, 31, 33, 67 };
+  const int tolerances[] = { 0, 1, 4, 10 };
+
+  for (int i=0; i<(int)(sizeof(sizes)/sizeof(sizes[0])); ++i) {
+    int w = sizes[i];
+    int h = sizes[(i+3) % (sizeof(sizes)/sizeof(sizes[0]))];
+    UniquePtr<Image> image(create_random_image<ImageTraits>(w, h));
+
+    for (int j=0; j<8; ++j) {
+      int x = std::rand() % w;
+      int y = std::rand() % h;
+      for (int k=0; k<(int)(sizeof(tolerances)/sizeof(tolerances[0])); ++k) {
+        expect_fill<ImageTraits>(image, x, y, tolerances[k], true);
+        expect_fill<ImageTraits>(image, x, y, tolerances[k], false);
+      }
+    }
+  }
+}
+
+TYPED_TEST(FloodFillAllTypes, UTurns)
+{
+  typedef TypeParam ImageTraits;
+  color_t a = FillColors<ImageTraits>::get(0);
+  color_t b = FillColors<ImageTraits>::get(FillColors<ImageTraits>::count()-1);
+
+  // A spiral and a comb of "a" pixels over "b", the fill must go up
+  // and down several times to cover them.
+  const char* rows[] = {
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+    "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbba",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabba",
+    "abbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbaabba",
+    "abaaaaaaaaaaaaaaaaaaaaaaaaaaaaabaabba",
+    "abababababababababababababababbaabba",
+    "abababababababababababababababbaabba",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabaabba",
+    "bbbbbbbbbbbbbbbbbbbbbbbbbbbbbbbaaabba",
+    "babababababababababababababababbbbba",
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa" };
+  const int h = sizeof(rows)/sizeof(rows[0]);
+  const int w = 37;
+
+  UniquePtr<Image> image(Image::create(ImageTraits::pixel_format, w, h));
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x)
+      put_pixel_fast<ImageTraits>(image, x, y,
+                                  (x < (int)std::strlen(rows[y]) && rows[y][x] == 'a') ? a: b);
+
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      expect_fill<ImageTraits>(image, x, y, 0, true);
+      if (this->HasFatalFailure())
+        return;
+    }
+}
+
+TEST(FloodFill, AllTransparentPixelsAreEqual)
+{
+  // RGB
+  {
+    UniquePtr<Image> image(Image::create(IMAGE_RGB, 19, 3));
+    clear_image(image, rgba(0, 0, 0, 0));
+    put_pixel(image, 3, 1, rgba(255, 0, 0, 0));
+    put_pixel(image, 4, 1, rgba(0, 255, 0, 0));
+    put_pixel(image, 17, 2, rgba(1, 2, 3, 0));
+    for (int x=0; x<19; ++x)
+      put_pixel(image, x, 0, rgba(x, x, x, 0));
+    put_pixel(image, 10, 1, rgba(0, 0, 0, 1));
+
+    FillResult result(19, 3);
+    algo_floodfill(image, 0, 2, 0, true, &result, &FillResult::hline);
+    for (int y=0; y<3; ++y)
+      for (int x=0; x<19; ++x)
+        EXPECT_EQ((x == 10 && y == 1) ? 0: 1, result.pixels[y*19 + x]);
+  }
+
+  // Grayscale
+  {
+    UniquePtr<Image> image(Image::create(IMAGE_GRAYSCALE, 21, 3));
+    clear_image(image, graya(0, 0));
+    for (int x=0; x<21; ++x)
+      put_pixel(image, x, 1, graya(x*10, 0));
+    put_pixel(image, 5, 2, graya(0, 1));
+
+    FillResult result(21, 3);
+    algo_floodfill(image, 20, 0, 0, true, &result, &FillResult::hline);
+    for (int y=0; y<3; ++y)
+      for (int x=0; x<21; ++x)
+        EXPECT_EQ((x == 5 && y == 2) ? 0: 1, result.pixels[y*21 + x]);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
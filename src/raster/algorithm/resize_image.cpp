@@ -22,130 +22,450 @@
 
 #include "raster/algorithm/resize_image.h"
 
+#include "base/parallel_for.h"
 #include "gfx/point.h"
+#include "raster/blend_simd.h"
 #include "raster/image.h"
 #include "raster/image_bits.h"
+#include "raster/image_traits.h"
 #include "raster/palette.h"
+#include "raster/primitives_fast.h"
 #include "raster/rgbmap.h"
 
+#include <algorithm>
+#include <vector>
+
+#ifdef RASTER_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 namespace raster {
 namespace algorithm {
 
-void resize_image(const Image* src, Image* dst, ResizeMethod method, const Palette* pal, const RgbMap* rgbmap)
+namespace {
+
+// Height of each band of destination rows (in pixels).
+const int kResizeBandHeight = 32;
+
+// Minimum number of destination pixels to use several threads.
+const int kMinParallelPixels = 256*256;
+
+// Bilinear weights are fixed-point numbers from 0 to kWeightOne.
+const int kWeightBits = 8;
+const int kWeightOne = 1 << kWeightBits;
+
+// Source pixels used by each destination column (or row). They are
+// calculated once for the whole image.
+struct Samples {
+  std::vector<int> pos1;     // First source pixel
+  std::vector<int> pos2;     // Second source pixel (or the last one + 1 for boxes)
+  std::vector<int> weight;   // Weight of "pos2" for the bilinear method
+};
+
+void nearest_samples(int src_size, int dst_size, Samples& samples)
 {
-  switch (method) {
+  samples.pos1.resize(dst_size);
+  for (int i=0; i<dst_size; ++i)
+    samples.pos1[i] = (int)((int64_t)i * src_size / dst_size);
+}
+
+// The first and last pixels of both images are aligned.
+void bilinear_samples(int src_size, int dst_size, Samples& samples)
+{
+  samples.pos1.resize(dst_size);
+  samples.pos2.resize(dst_size);
+  samples.weight.resize(dst_size);
 
-    // TODO optimize this
-    case RESIZE_METHOD_NEAREST_NEIGHBOR: 
-    {
-      int o_width = src->getWidth(), o_height = src->getHeight();
-      int n_width = dst->getWidth(), n_height = dst->getHeight();
-      double x_ratio = o_width / (double)n_width;
-      double y_ratio = o_height / (double)n_height;
-      double px, py;
-      int i;
-
-      for (int y = 0; y < n_height; y++) {
-        for (int x = 0; x < n_width; x++) {
-          px = floor(x * x_ratio);
-          py = floor(y * y_ratio);
-          i = (int)(py * o_width + px);
-          dst->putPixel(x, y, src->getPixel(i % o_width, i / o_width));
+  for (int i=0; i<dst_size; ++i) {
+    int64_t u = (dst_size > 1 ? (int64_t)i * (src_size-1) * kWeightOne / (dst_size-1): 0);
+
+    samples.pos1[i] = (int)(u >> kWeightBits);
+    samples.pos2[i] = MIN(samples.pos1[i]+1, src_size-1);
+    samples.weight[i] = (int)(u & (kWeightOne-1));
+  }
+}
+
+void box_samples(int src_size, int dst_size, Samples& samples)
+{
+  samples.pos1.resize(dst_size);
+  samples.pos2.resize(dst_size);
+
+  for (int i=0; i<dst_size; ++i) {
+    samples.pos1[i] = (int)((int64_t)i * src_size / dst_size);
+    samples.pos2[i] = MAX(samples.pos1[i]+1,
+                          (int)((int64_t)(i+1) * src_size / dst_size));
+  }
+}
+
+// Converts pixels to components (from 0 to 255) that can be
+// interpolated/averaged, and components back to pixels.
+template<class Traits>
+class PixelComponents;
+
+template<>
+class PixelComponents<RgbTraits> {
+public:
+  enum { count = 4 };
+  PixelComponents(const Palette* palette, const RgbMap* rgbmap) { }
+  void get(uint32_t c, int* v) const {
+    v[0] = rgba_getr(c);
+    v[1] = rgba_getg(c);
+    v[2] = rgba_getb(c);
+    v[3] = rgba_geta(c);
+  }
+  uint32_t make(const int* v) const {
+    return rgba(v[0], v[1], v[2], v[3]);
+  }
+};
+
+template<>
+class PixelComponents<GrayscaleTraits> {
+public:
+  enum { count = 2 };
+  PixelComponents(const Palette* palette, const RgbMap* rgbmap) { }
+  void get(uint16_t c, int* v) const {
+    v[0] = graya_getv(c);
+    v[1] = graya_geta(c);
+  }
+  uint16_t make(const int* v) const {
+    return graya(v[0], v[1]);
+  }
+};
+
+// The index 0 is the transparent color.
+template<>
+class PixelComponents<IndexedTraits> {
+public:
+  enum { count = 4 };
+  PixelComponents(const Palette* palette, const RgbMap* rgbmap)
+    : m_palette(palette), m_rgbmap(rgbmap) { }
+  void get(uint8_t c, int* v) const {
+    uint32_t rgb = m_palette->getEntry(c);
+    v[0] = rgba_getr(rgb);
+    v[1] = rgba_getg(rgb);
+    v[2] = rgba_getb(rgb);
+    v[3] = (c == 0 ? 0: 255);
+  }
+  uint8_t make(const int* v) const {
+    return (v[3] > 127 ? m_rgbmap->mapColor(v[0], v[1], v[2]): 0);
+  }
+private:
+  const Palette* m_palette;
+  const RgbMap* m_rgbmap;
+};
+
+template<>
+class PixelComponents<BitmapTraits> {
+public:
+  enum { count = 1 };
+  PixelComponents(const Palette* palette, const RgbMap* rgbmap) { }
+  void get(uint8_t c, int* v) const {
+    v[0] = (c ? 255: 0);
+  }
+  uint8_t make(const int* v) const {
+    return (v[0] > 127 ? 1: 0);
+  }
+};
+
+template<class Traits>
+class NearestNeighbor {
+public:
+  NearestNeighbor(const Image* src, Image* dst,
+                  const Samples& cols, const Samples& rows)
+    : m_src(src), m_dst(dst), m_cols(cols), m_rows(rows) {
+  }
+
+  // Called from base::parallel_for()
+  void operator()(int band) const {
+    int y1 = band * kResizeBandHeight;
+    int y2 = MIN(y1 + kResizeBandHeight, m_dst->getHeight());
+    int w = m_dst->getWidth();
+
+    for (int y=y1; y<y2; ++y) {
+      int v = m_rows.pos1[y];
+      for (int x=0; x<w; ++x)
+        put_pixel_fast<Traits>(m_dst, x, y,
+                               get_pixel_fast<Traits>(m_src, m_cols.pos1[x], v));
+    }
+  }
+
+private:
+  const Image* m_src;
+  Image* m_dst;
+  const Samples& m_cols;
+  const Samples& m_rows;
+};
+
+template<class Traits>
+class Bilinear {
+public:
+  Bilinear(const Image* src, Image* dst,
+           const Samples& cols, const Samples& rows,
+           const PixelComponents<Traits>& components)
+    : m_src(src), m_dst(dst), m_cols(cols), m_rows(rows)
+    , m_components(components) {
+  }
+
+  // Called from base::parallel_for()
+  void operator()(int band) const {
+    typedef typename Traits::pixel_t pixel_t;
+    const int n = PixelComponents<Traits>::count;
+    int y1 = band * kResizeBandHeight;
+    int y2 = MIN(y1 + kResizeBandHeight, m_dst->getHeight());
+    int w = m_dst->getWidth();
+    int a[n], b[n], c[n], d[n], out[n];
+
+    for (int y=y1; y<y2; ++y) {
+      int v1 = m_rows.pos1[y];
+      int v2 = m_rows.pos2[y];
+      int wy = m_rows.weight[y];
+
+      for (int x=0; x<w; ++x) {
+        int u1 = m_cols.pos1[x];
+        int u2 = m_cols.pos2[x];
+        int wx = m_cols.weight[x];
+
+        m_components.get(get_pixel_fast<Traits>(m_src, u1, v1), a);
+        m_components.get(get_pixel_fast<Traits>(m_src, u2, v1), b);
+        m_components.get(get_pixel_fast<Traits>(m_src, u1, v2), c);
+        m_components.get(get_pixel_fast<Traits>(m_src, u2, v2), d);
+
+        for (int i=0; i<n; ++i) {
+          int top = a[i]*(kWeightOne-wx) + b[i]*wx;
+          int bottom = c[i]*(kWeightOne-wx) + d[i]*wx;
+          out[i] = (top*(kWeightOne-wy) + bottom*wy) >> (2*kWeightBits);
         }
+
+        put_pixel_fast<Traits>(m_dst, x, y, (pixel_t)m_components.make(out));
       }
-      break;
     }
+  }
 
-    // TODO optimize this
-    case RESIZE_METHOD_BILINEAR: {
-      uint32_t color[4], dst_color = 0;
-      double u, v, du, dv;
-      int u_floor, u_floor2;
-      int v_floor, v_floor2;
-      int x, y;
-
-      u = v = 0.0;
-      du = (src->getWidth()-1) * 1.0 / (dst->getWidth()-1);
-      dv = (src->getHeight()-1) * 1.0 / (dst->getHeight()-1);
-      for (y=0; y<dst->getHeight(); ++y) {
-        for (x=0; x<dst->getWidth(); ++x) {
-          u_floor = floor(u);
-          v_floor = floor(v);
-
-          if (u_floor > src->getWidth()-1) {
-            u_floor = src->getWidth()-1;
-            u_floor2 = src->getWidth()-1;
-          }
-          else if (u_floor == src->getWidth()-1)
-            u_floor2 = u_floor;
-          else
-            u_floor2 = u_floor+1;
-
-          if (v_floor > src->getHeight()-1) {
-            v_floor = src->getHeight()-1;
-            v_floor2 = src->getHeight()-1;
-          }
-          else if (v_floor == src->getHeight()-1)
-            v_floor2 = v_floor;
-          else
-            v_floor2 = v_floor+1;
-
-          // get the four colors
-          color[0] = src->getPixel(u_floor,  v_floor);
-          color[1] = src->getPixel(u_floor2, v_floor);
-          color[2] = src->getPixel(u_floor,  v_floor2);
-          color[3] = src->getPixel(u_floor2, v_floor2);
-
-          // calculate the interpolated color
-          double u1 = u - u_floor;
-          double v1 = v - v_floor;
-          double u2 = 1 - u1;
-          double v2 = 1 - v1;
-
-          switch (dst->getPixelFormat()) {
-            case IMAGE_RGB: {
-              int r = ((rgba_getr(color[0])*u2 + rgba_getr(color[1])*u1)*v2 +
-                       (rgba_getr(color[2])*u2 + rgba_getr(color[3])*u1)*v1);
-              int g = ((rgba_getg(color[0])*u2 + rgba_getg(color[1])*u1)*v2 +
-                       (rgba_getg(color[2])*u2 + rgba_getg(color[3])*u1)*v1);
-              int b = ((rgba_getb(color[0])*u2 + rgba_getb(color[1])*u1)*v2 +
-                       (rgba_getb(color[2])*u2 + rgba_getb(color[3])*u1)*v1);
-              int a = ((rgba_geta(color[0])*u2 + rgba_geta(color[1])*u1)*v2 +
-                       (rgba_geta(color[2])*u2 + rgba_geta(color[3])*u1)*v1);
-              dst_color = rgba(r, g, b, a);
-              break;
-            }
-            case IMAGE_GRAYSCALE: {
-              int v = ((graya_getv(color[0])*u2 + graya_getv(color[1])*u1)*v2 +
-                       (graya_getv(color[2])*u2 + graya_getv(color[3])*u1)*v1);
-              int a = ((graya_geta(color[0])*u2 + graya_geta(color[1])*u1)*v2 +
-                       (graya_geta(color[2])*u2 + graya_geta(color[3])*u1)*v1);
-              dst_color = graya(v, a);
-              break;
-            }
-            case IMAGE_INDEXED: {
-              int r = ((rgba_getr(pal->getEntry(color[0]))*u2 + rgba_getr(pal->getEntry(color[1]))*u1)*v2 +
-                       (rgba_getr(pal->getEntry(color[2]))*u2 + rgba_getr(pal->getEntry(color[3]))*u1)*v1);
-              int g = ((rgba_getg(pal->getEntry(color[0]))*u2 + rgba_getg(pal->getEntry(color[1]))*u1)*v2 +
-                       (rgba_getg(pal->getEntry(color[2]))*u2 + rgba_getg(pal->getEntry(color[3]))*u1)*v1);
-              int b = ((rgba_getb(pal->getEntry(color[0]))*u2 + rgba_getb(pal->getEntry(color[1]))*u1)*v2 +
-                       (rgba_getb(pal->getEntry(color[2]))*u2 + rgba_getb(pal->getEntry(color[3]))*u1)*v1);
-              int a = (((color[0] == 0 ? 0: 255)*u2 + (color[1] == 0 ? 0: 255)*u1)*v2 +
-                       ((color[2] == 0 ? 0: 255)*u2 + (color[3] == 0 ? 0: 255)*u1)*v1);
-              dst_color = a > 127 ? rgbmap->mapColor(r, g, b): 0;
-              break;
-            }
-          }
+private:
+  const Image* m_src;
+  Image* m_dst;
+  const Samples& m_cols;
+  const Samples& m_rows;
+  const PixelComponents<Traits>& m_components;
+};
+
+// Interpolates the four 8-bit channels of two RGBA pixels at the
+// same time, "t" is the weight of "b" (from 0 to kWeightOne).
+inline uint32_t lerp_rgba(uint32_t a, uint32_t b, int t)
+{
+  uint32_t rb = ((((a & 0x00ff00ff) * (kWeightOne-t) +
+                   (b & 0x00ff00ff) * t) >> kWeightBits) & 0x00ff00ff);
+  uint32_t ga = ((((a >> 8) & 0x00ff00ff) * (kWeightOne-t) +
+                  ((b >> 8) & 0x00ff00ff) * t) & 0xff00ff00);
+  return rb | ga;
+}
+
+// Same as lerp_rgba() for each pixel of two rows.
+void lerp_rgba_rows(uint32_t* dst, const uint32_t* a, const uint32_t* b, int n, int t)
+{
+  int i = 0;
+
+#ifdef RASTER_HAVE_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ta = _mm_set1_epi16(kWeightOne-t);
+  const __m128i tb = _mm_set1_epi16(t);
+
+  // Sums are smaller than 2^16 so the 16-bit lanes don't overflow
+  for (; i+4 <= n; i += 4) {
+    __m128i pa = _mm_loadu_si128((const __m128i*)(a+i));
+    __m128i pb = _mm_loadu_si128((const __m128i*)(b+i));
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(pa, zero), ta),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(pb, zero), tb));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(pa, zero), ta),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(pb, zero), tb));
+    _mm_storeu_si128((__m128i*)(dst+i),
+                     _mm_packus_epi16(_mm_srli_epi16(lo, kWeightBits),
+                                      _mm_srli_epi16(hi, kWeightBits)));
+  }
+#endif
+
+  for (; i<n; ++i)
+    dst[i] = lerp_rgba(a[i], b[i], t);
+}
+
+// RGB images are interpolated in two passes: source rows are
+// interpolated horizontally (and kept while the following
+// destination rows use them), and then each pair of rows is
+// interpolated vertically.
+template<>
+class Bilinear<RgbTraits> {
+public:
+  Bilinear(const Image* src, Image* dst,
+           const Samples& cols, const Samples& rows,
+           const PixelComponents<RgbTraits>& components)
+    : m_src(src), m_dst(dst), m_cols(cols), m_rows(rows) {
+  }
 
-          dst->putPixel(x, y, dst_color);
-          u += du;
+  // Called from base::parallel_for()
+  void operator()(int band) const {
+    int y1 = band * kResizeBandHeight;
+    int y2 = MIN(y1 + kResizeBandHeight, m_dst->getHeight());
+    int w = m_dst->getWidth();
+    std::vector<uint32_t> row1(w), row2(w);
+    int v1 = -1, v2 = -1;
+
+    for (int y=y1; y<y2; ++y) {
+      if (v1 != m_rows.pos1[y]) {
+        if (v2 == m_rows.pos1[y]) {
+          row1.swap(row2);
+          std::swap(v1, v2);
+        }
+        else {
+          v1 = m_rows.pos1[y];
+          interpolateRow(v1, &row1[0]);
         }
-        u = 0.0;
-        v += dv;
       }
-      break;
+      if (v2 != m_rows.pos2[y]) {
+        v2 = m_rows.pos2[y];
+        interpolateRow(v2, &row2[0]);
+      }
+
+      lerp_rgba_rows((uint32_t*)m_dst->getPixelAddress(0, y),
+                     &row1[0], &row2[0], w, m_rows.weight[y]);
     }
+  }
+
+private:
+  void interpolateRow(int v, uint32_t* dst) const {
+    const uint32_t* src = (const uint32_t*)m_src->getPixelAddress(0, v);
+    int w = m_dst->getWidth();
 
+    for (int x=0; x<w; ++x)
+      dst[x] = lerp_rgba(src[m_cols.pos1[x]], src[m_cols.pos2[x]], m_cols.weight[x]);
+  }
+
+  const Image* m_src;
+  Image* m_dst;
+  const Samples& m_cols;
+  const Samples& m_rows;
+};
+
+template<class Traits>
+class Box {
+public:
+  Box(const Image* src, Image* dst,
+      const Samples& cols, const Samples& rows,
+      const PixelComponents<Traits>& components)
+    : m_src(src), m_dst(dst), m_cols(cols), m_rows(rows)
+    , m_components(components) {
+  }
+
+  // Called from base::parallel_for()
+  void operator()(int band) const {
+    typedef typename Traits::pixel_t pixel_t;
+    const int n = PixelComponents<Traits>::count;
+    int y1 = band * kResizeBandHeight;
+    int y2 = MIN(y1 + kResizeBandHeight, m_dst->getHeight());
+    int w = m_dst->getWidth();
+    int src_w = m_src->getWidth();
+    std::vector<int> columns(src_w * n);
+    int64_t sum[n];
+    int v[n], out[n];
+
+    for (int y=y1; y<y2; ++y) {
+      int sy1 = m_rows.pos1[y];
+      int sy2 = m_rows.pos2[y];
+
+      // Sum the components of each source column in the box rows
+      std::fill(columns.begin(), columns.end(), 0);
+      for (int sy=sy1; sy<sy2; ++sy) {
+        int* col = &columns[0];
+        for (int sx=0; sx<src_w; ++sx, col += n) {
+          m_components.get(get_pixel_fast<Traits>(m_src, sx, sy), v);
+          for (int i=0; i<n; ++i)
+            col[i] += v[i];
+        }
+      }
+
+      for (int x=0; x<w; ++x) {
+        int sx1 = m_cols.pos1[x];
+        int sx2 = m_cols.pos2[x];
+        int64_t area = (int64_t)(sx2 - sx1) * (sy2 - sy1);
+
+        std::fill(sum, sum+n, 0);
+        for (int sx=sx1; sx<sx2; ++sx) {
+          const int* col = &columns[sx*n];
+          for (int i=0; i<n; ++i)
+            sum[i] += col[i];
+        }
+
+        for (int i=0; i<n; ++i)
+          out[i] = (int)((sum[i] + area/2) / area);
+
+        put_pixel_fast<Traits>(m_dst, x, y, (pixel_t)m_components.make(out));
+      }
+    }
+  }
+
+private:
+  const Image* m_src;
+  Image* m_dst;
+  const Samples& m_cols;
+  const Samples& m_rows;
+  const PixelComponents<Traits>& m_components;
+};
+
+template<class Traits>
+void resize_image_templ(const Image* src, Image* dst, ResizeMethod method,
+                        const Palette* palette, const RgbMap* rgbmap)
+{
+  PixelComponents<Traits> components(palette, rgbmap);
+  Samples cols, rows;
+  int bands = (dst->getHeight() + kResizeBandHeight - 1) / kResizeBandHeight;
+  int nthreads = (dst->getWidth() * dst->getHeight() >= kMinParallelPixels ? 0: 1);
+
+  // Indexed pixels are made with the RgbMap, which must be completely
+  // calculated before it's used from several threads.
+  if (Traits::pixel_format == IMAGE_INDEXED && rgbmap && nthreads != 1 &&
+      method != RESIZE_METHOD_NEAREST_NEIGHBOR)
+    rgbmap->regenerateAll();
+
+  switch (method) {
+
+    case RESIZE_METHOD_NEAREST_NEIGHBOR:
+      nearest_samples(src->getWidth(), dst->getWidth(), cols);
+      nearest_samples(src->getHeight(), dst->getHeight(), rows);
+      base::parallel_for(0, bands, NearestNeighbor<Traits>(src, dst, cols, rows), nthreads);
+      break;
+
+    case RESIZE_METHOD_BILINEAR:
+      bilinear_samples(src->getWidth(), dst->getWidth(), cols);
+      bilinear_samples(src->getHeight(), dst->getHeight(), rows);
+      base::parallel_for(0, bands, Bilinear<Traits>(src, dst, cols, rows, components), nthreads);
+      break;
+
+    case RESIZE_METHOD_BOX:
+      box_samples(src->getWidth(), dst->getWidth(), cols);
+      box_samples(src->getHeight(), dst->getHeight(), rows);
+      base::parallel_for(0, bands, Box<Traits>(src, dst, cols, rows, components), nthreads);
+      break;
+  }
+}
+
+} // anonymous namespace
+
+void resize_image(const Image* src, Image* dst, ResizeMethod method, const Palette* pal, const RgbMap* rgbmap)
+{
+  ASSERT(src->getPixelFormat() == dst->getPixelFormat());
+
+  switch (src->getPixelFormat()) {
+    case IMAGE_RGB:
+      resize_image_templ<RgbTraits>(src, dst, method, pal, rgbmap);
+      break;
+    case IMAGE_GRAYSCALE:
+      resize_image_templ<GrayscaleTraits>(src, dst, method, pal, rgbmap);
+      break;
+    case IMAGE_INDEXED:
+      resize_image_templ<IndexedTraits>(src, dst, method, pal, rgbmap);
+      break;
+    case IMAGE_BITMAP:
+      resize_image_templ<BitmapTraits>(src, dst, method, pal, rgbmap);
+      break;
   }
 }
 
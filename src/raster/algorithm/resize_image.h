@@ -32,11 +32,18 @@ namespace raster {
     enum ResizeMethod {
       RESIZE_METHOD_NEAREST_NEIGHBOR,
       RESIZE_METHOD_BILINEAR,
+      RESIZE_METHOD_BOX,
     };
 
     // Resizes the source image 'src' to the destination image 'dst'.
+    // RESIZE_METHOD_BOX averages all source pixels that are inside
+    // each destination pixel (it's useful to reduce images, when the
+    // image is enlarged it works like the nearest neighbor method).
     //
-    // Warning: If you are using the RESIZE_METHOD_BILINEAR, it is
+    // The 'palette' and 'rgbmap' are used only for indexed images
+    // (with RESIZE_METHOD_BILINEAR and RESIZE_METHOD_BOX).
+    //
+    // Warning: If you are using the RESIZE_METHOD_BILINEAR (or BOX), it is
     // recommended to use 'fixup_image_transparent_colors' function
     // over the source image 'src' BEFORE using this routine.
     void resize_image(const Image* src, Image* dst, ResizeMethod method, const Palette* palette, const RgbMap* rgbmap);
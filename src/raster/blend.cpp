@@ -21,6 +21,9 @@
 #endif
 
 #include "raster/blend.h"
+
+#include "base/cpu_features.h"
+#include "raster/blend_simd.h"
 #include "raster/image.h"
 
 namespace raster {
@@ -43,6 +46,24 @@ BLEND_COLOR graya_blenders[] =
   graya_blend_copy,
 };
 
+RGBA_BLEND_ROW rgba_row_blenders[] =
+{
+  rgba_blend_normal_row,
+  rgba_blend_copy_row,
+  rgba_blend_merge_row,
+  rgba_blend_red_tint_row,
+  rgba_blend_blue_tint_row,
+};
+
+GRAYA_BLEND_ROW graya_row_blenders[] =
+{
+  graya_blend_normal_row,
+  graya_blend_copy_row,
+  graya_blend_copy_row,
+  graya_blend_copy_row,
+  graya_blend_copy_row,
+};
+
 /**********************************************************************/
 /* RGB blenders                                                       */
 /**********************************************************************/
@@ -161,7 +182,8 @@ blend_overlay(uint32_t d, uint32_t ad, uint32_t s, uint32_t as)
   return DIV_ONE_UN8(r);
 }
 
-int rgba_blend_color_tint(int back, int front, int opacity, int color)
+// Returns the "front" color with the tint "color" applied.
+static inline int tint_color(int front, int color)
 {
   int F_r, F_g, F_b, F_a;
   int B_r, B_g, B_b, B_a;
@@ -183,7 +205,12 @@ int rgba_blend_color_tint(int back, int front, int opacity, int color)
   F_a = (B_a * (~B_a) + F_a * (~F_a)) / 255;
   F_a += DIV_ONE_UN8(F_a * B_a);
 
-  return rgba_blend_normal(back, rgba(F_r, F_g, F_b, F_a), opacity);
+  return rgba(F_r, F_g, F_b, F_a);
+}
+
+int rgba_blend_color_tint(int back, int front, int opacity, int color)
+{
+  return rgba_blend_normal(back, tint_color(front, color), opacity);
 }
 
 int rgba_blend_red_tint(int back, int front, int opacity)
@@ -274,4 +301,123 @@ int graya_blend_merge(int back, int front, int opacity)
   return graya(D_k, D_a);
 }
 
+/**********************************************************************/
+/* Row blenders                                                       */
+/**********************************************************************/
+
+static void rgba_blend_normal_row_c(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                                    const uint32_t* mask_front, int n, int opacity,
+                                    uint32_t mask_color)
+{
+  for (int i=0; i<n; ++i)
+    dst[i] = (mask_front[i] != mask_color ?
+              rgba_blend_normal(back[i], front[i], opacity): back[i]);
+}
+
+static void rgba_blend_copy_row_c(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                                  const uint32_t* mask_front, int n, int opacity,
+                                  uint32_t mask_color)
+{
+  for (int i=0; i<n; ++i)
+    dst[i] = (mask_front[i] != mask_color ? front[i]: back[i]);
+}
+
+static void rgba_blend_merge_row_c(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                                   const uint32_t* mask_front, int n, int opacity,
+                                   uint32_t mask_color)
+{
+  for (int i=0; i<n; ++i)
+    dst[i] = (mask_front[i] != mask_color ?
+              rgba_blend_merge(back[i], front[i], opacity): back[i]);
+}
+
+namespace {
+
+  struct RgbaRowKernels {
+    RGBA_BLEND_ROW_KERNEL normal;
+    RGBA_BLEND_ROW_KERNEL copy;
+    RGBA_BLEND_ROW_KERNEL merge;
+
+    RgbaRowKernels()
+      : normal(rgba_blend_normal_row_c)
+      , copy(rgba_blend_copy_row_c)
+      , merge(rgba_blend_merge_row_c) {
+#ifdef RASTER_HAVE_AVX2
+      if (base::cpu_has_avx2()) {
+        normal = rgba_blend_normal_row_avx2;
+        copy = rgba_blend_copy_row_avx2;
+        merge = rgba_blend_merge_row_avx2;
+        return;
+      }
+#endif
+#ifdef RASTER_HAVE_SSE2
+      if (base::cpu_has_sse2()) {
+        normal = rgba_blend_normal_row_sse2;
+        copy = rgba_blend_copy_row_sse2;
+        merge = rgba_blend_merge_row_sse2;
+      }
+#endif
+    }
+  };
+
+  // Kernels for the running CPU (selected before main() is called).
+  const RgbaRowKernels rgba_kernels;
+
+}
+
+void rgba_blend_normal_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color)
+{
+  rgba_kernels.normal(dst, back, front, front, n, opacity, mask_color);
+}
+
+void rgba_blend_copy_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color)
+{
+  rgba_kernels.copy(dst, back, front, front, n, opacity, mask_color);
+}
+
+void rgba_blend_merge_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color)
+{
+  rgba_kernels.merge(dst, back, front, front, n, opacity, mask_color);
+}
+
+// The tint is applied to blocks of "front" pixels, and then the tinted
+// pixels are blended with the normal kernel.
+static void rgba_blend_color_tint_row(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                                      int n, int opacity, uint32_t mask_color, int color)
+{
+  const int kBlockSize = 256;
+  uint32_t tinted[kBlockSize];
+
+  for (int i=0; i<n; i+=kBlockSize) {
+    int m = MIN(kBlockSize, n-i);
+    for (int j=0; j<m; ++j)
+      tinted[j] = tint_color(front[i+j], color);
+
+    rgba_kernels.normal(dst+i, back+i, tinted, front+i, m, opacity, mask_color);
+  }
+}
+
+void rgba_blend_red_tint_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color)
+{
+  rgba_blend_color_tint_row(dst, back, front, n, opacity, mask_color, rgba(255, 0, 0, 128));
+}
+
+void rgba_blend_blue_tint_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color)
+{
+  rgba_blend_color_tint_row(dst, back, front, n, opacity, mask_color, rgba(0, 0, 255, 128));
+}
+
+void graya_blend_normal_row(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, uint16_t mask_color)
+{
+  for (int i=0; i<n; ++i)
+    dst[i] = (front[i] != mask_color ?
+              graya_blend_normal(back[i], front[i], opacity): back[i]);
+}
+
+void graya_blend_copy_row(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, uint16_t mask_color)
+{
+  for (int i=0; i<n; ++i)
+    dst[i] = (front[i] != mask_color ? front[i]: back[i]);
+}
+
 } // namespace raster
@@ -51,6 +51,29 @@ namespace raster {
   int graya_blend_forpath(int back, int front, int opacity);
   int graya_blend_merge(int back, int front, int opacity);
 
+  // Row blenders: blend "n" pixels of "front" over "back" and leave
+  // the result in "dst" ("dst" can be equal to "back"). Pixels of
+  // "front" equal to "mask_color" are not blended (the "back" pixel
+  // is used). The result is exactly the same as calling the
+  // BLEND_COLOR function of the same mode for each pixel, but RGBA
+  // rows use SSE2/AVX2 kernels when the CPU supports them.
+  typedef void (*RGBA_BLEND_ROW)(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                                 int n, int opacity, uint32_t mask_color);
+  typedef void (*GRAYA_BLEND_ROW)(uint16_t* dst, const uint16_t* back, const uint16_t* front,
+                                  int n, int opacity, uint16_t mask_color);
+
+  extern RGBA_BLEND_ROW rgba_row_blenders[];
+  extern GRAYA_BLEND_ROW graya_row_blenders[];
+
+  void rgba_blend_normal_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color);
+  void rgba_blend_copy_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color);
+  void rgba_blend_merge_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color);
+  void rgba_blend_red_tint_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color);
+  void rgba_blend_blue_tint_row(uint32_t* dst, const uint32_t* back, const uint32_t* front, int n, int opacity, uint32_t mask_color);
+
+  void graya_blend_normal_row(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, uint16_t mask_color);
+  void graya_blend_copy_row(uint16_t* dst, const uint16_t* back, const uint16_t* front, int n, int opacity, uint16_t mask_color);
+
 } // namespace raster
 
 #endif
@@ -0,0 +1,179 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+// This file is compiled with AVX2 code generation enabled, so it
+// must not include headers with inline functions (e.g. config.h):
+// the linker could pick the AVX2 version of those functions for the
+// rest of the program. The kernels are only called when
+// base::cpu_has_avx2() is true.
+
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "raster/blend_simd.h"
+
+#ifdef RASTER_HAVE_AVX2
+
+// See blend_sse2.cpp, these are the same kernels for 8 pixels.
+
+namespace raster {
+
+namespace {
+
+inline __m256i select_bits(__m256i mask, __m256i a, __m256i b)
+{
+  return _mm256_or_si256(_mm256_and_si256(mask, a), _mm256_andnot_si256(mask, b));
+}
+
+// INT_MULT() for 32-bit lanes with values in [0, 255].
+inline __m256i int_mult(__m256i a, __m256i b)
+{
+  __m256i t = _mm256_add_epi32(_mm256_mullo_epi16(a, b), _mm256_set1_epi32(0x80));
+  return _mm256_srli_epi32(_mm256_add_epi32(_mm256_srli_epi32(t, 8), t), 8);
+}
+
+// Returns b + (f-b) * num / den (with the C integer division).
+inline __m256i lerp(__m256i b, __m256i f, __m256 num, __m256 den)
+{
+  __m256 d = _mm256_cvtepi32_ps(_mm256_sub_epi32(f, b));
+  return _mm256_add_epi32(b, _mm256_cvttps_epi32(_mm256_div_ps(_mm256_mul_ps(d, num), den)));
+}
+
+inline __m256i channel(__m256i c, int shift)
+{
+  return _mm256_and_si256(_mm256_srli_epi32(c, shift), _mm256_set1_epi32(0xff));
+}
+
+struct BlendNormal {
+  static inline __m256i blend(__m256i b, __m256i f, __m256i opacity) {
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i B_a = _mm256_srli_epi32(b, 24);
+    __m256i F_a = _mm256_srli_epi32(f, 24);
+    __m256i F_a2 = int_mult(F_a, opacity);
+    __m256i D_a = _mm256_sub_epi32(_mm256_add_epi32(B_a, F_a2), int_mult(B_a, F_a2));
+    __m256 num = _mm256_cvtepi32_ps(F_a2);
+    __m256 den = _mm256_cvtepi32_ps(D_a);
+
+    __m256i D_r = lerp(channel(b, 0), channel(f, 0), num, den);
+    __m256i D_g = lerp(channel(b, 8), channel(f, 8), num, den);
+    __m256i D_b = lerp(channel(b, 16), channel(f, 16), num, den);
+
+    __m256i result =
+      _mm256_or_si256(_mm256_or_si256(D_r, _mm256_slli_epi32(D_g, 8)),
+                      _mm256_or_si256(_mm256_slli_epi32(D_b, 16), _mm256_slli_epi32(D_a, 24)));
+
+    // Transparent front: keep the back
+    result = select_bits(_mm256_cmpeq_epi32(F_a, zero), b, result);
+
+    // Transparent back: front with the modified alpha
+    __m256i front =
+      _mm256_or_si256(_mm256_and_si256(f, _mm256_set1_epi32(0xffffff)),
+                      _mm256_slli_epi32(F_a2, 24));
+    return select_bits(_mm256_cmpeq_epi32(B_a, zero), front, result);
+  }
+};
+
+struct BlendCopy {
+  static inline __m256i blend(__m256i b, __m256i f, __m256i opacity) {
+    return f;
+  }
+};
+
+struct BlendMerge {
+  static inline __m256i blend(__m256i b, __m256i f, __m256i opacity) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i rgb_mask = _mm256_set1_epi32(0xffffff);
+    __m256i B_a = _mm256_srli_epi32(b, 24);
+    __m256i F_a = _mm256_srli_epi32(f, 24);
+    __m256 num = _mm256_cvtepi32_ps(opacity);
+    __m256 den = _mm256_set1_ps(255.0f);
+
+    __m256i D_r = lerp(channel(b, 0), channel(f, 0), num, den);
+    __m256i D_g = lerp(channel(b, 8), channel(f, 8), num, den);
+    __m256i D_b = lerp(channel(b, 16), channel(f, 16), num, den);
+    __m256i D_a = lerp(B_a, F_a, num, den);
+
+    __m256i rgb =
+      _mm256_or_si256(D_r, _mm256_or_si256(_mm256_slli_epi32(D_g, 8),
+                                           _mm256_slli_epi32(D_b, 16)));
+    rgb = select_bits(_mm256_cmpeq_epi32(F_a, zero), _mm256_and_si256(b, rgb_mask), rgb);
+    rgb = select_bits(_mm256_cmpeq_epi32(B_a, zero), _mm256_and_si256(f, rgb_mask), rgb);
+
+    return _mm256_or_si256(rgb, _mm256_slli_epi32(D_a, 24));
+  }
+};
+
+template<class Op>
+inline __m256i blend8(const uint32_t* back, const uint32_t* front, const uint32_t* mask_front,
+                      __m256i opacity, __m256i mask)
+{
+  __m256i b = _mm256_loadu_si256((const __m256i*)back);
+  __m256i f = _mm256_loadu_si256((const __m256i*)front);
+  __m256i m = _mm256_loadu_si256((const __m256i*)mask_front);
+  return select_bits(_mm256_cmpeq_epi32(m, mask), b, Op::blend(b, f, opacity));
+}
+
+template<class Op>
+void blend_row(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+               const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+{
+  const __m256i opacity8 = _mm256_set1_epi32(opacity);
+  const __m256i mask8 = _mm256_set1_epi32((int)mask_color);
+  int i = 0;
+
+  for (; i+8 <= n; i += 8)
+    _mm256_storeu_si256((__m256i*)(dst+i),
+                        blend8<Op>(back+i, front+i, mask_front+i, opacity8, mask8));
+
+  // The last pixels are blended in a temporary block.
+  if (i < n) {
+    uint32_t tmp[3][8] = { { 0 } };
+    int rest = n - i;
+    for (int j=0; j<rest; ++j) {
+      tmp[0][j] = back[i+j];
+      tmp[1][j] = front[i+j];
+      tmp[2][j] = mask_front[i+j];
+    }
+    _mm256_storeu_si256((__m256i*)tmp[0],
+                        blend8<Op>(tmp[0], tmp[1], tmp[2], opacity8, mask8));
+    for (int j=0; j<rest; ++j)
+      dst[i+j] = tmp[0][j];
+  }
+}
+
+} // anonymous namespace
+
+void rgba_blend_normal_row_avx2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+{
+  blend_row<BlendNormal>(dst, back, front, mask_front, n, opacity, mask_color);
+}
+
+void rgba_blend_copy_row_avx2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+{
+  blend_row<BlendCopy>(dst, back, front, mask_front, n, opacity, mask_color);
+}
+
+void rgba_blend_merge_row_avx2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+{
+  blend_row<BlendMerge>(dst, back, front, mask_front, n, opacity, mask_color);
+}
+
+} // namespace raster
+
+#endif // RASTER_HAVE_AVX2
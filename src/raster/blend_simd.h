@@ -0,0 +1,58 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef RASTER_BLEND_SIMD_H_INCLUDED
+#define RASTER_BLEND_SIMD_H_INCLUDED
+#pragma once
+
+// SIMD kernels used by the RGBA row blenders (see raster/blend.h).
+// Don't use them directly, rgba_row_blenders[] selects the best
+// kernels for the running CPU.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define RASTER_HAVE_SSE2
+#endif
+
+// RASTER_HAVE_AVX2 is defined by src/raster/CMakeLists.txt when the
+// compiler can generate AVX2 code for blend_avx2.cpp.
+
+namespace raster {
+
+  // Like RGBA_BLEND_ROW, but pixels are compared with "mask_color"
+  // using "mask_front" (so the tint blenders can give a modified
+  // "front" row and keep the mask of the original one).
+  typedef void (*RGBA_BLEND_ROW_KERNEL)(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                                        const uint32_t* mask_front, int n, int opacity,
+                                        uint32_t mask_color);
+
+#ifdef RASTER_HAVE_SSE2
+  void rgba_blend_normal_row_sse2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color);
+  void rgba_blend_copy_row_sse2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color);
+  void rgba_blend_merge_row_sse2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color);
+#endif
+
+#ifdef RASTER_HAVE_AVX2
+  void rgba_blend_normal_row_avx2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color);
+  void rgba_blend_copy_row_avx2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color);
+  void rgba_blend_merge_row_avx2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color);
+#endif
+
+} // namespace raster
+
+#endif
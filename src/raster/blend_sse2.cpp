@@ -0,0 +1,180 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "raster/blend_simd.h"
+
+#ifdef RASTER_HAVE_SSE2
+
+#include <emmintrin.h>
+
+// These kernels give exactly the same results as the scalar
+// rgba_blend_*() functions. Integer divisions are done with single
+// precision floats: the numerators are integers smaller than 2^24 and
+// the denominators are between 1 and 255, so the truncated quotient
+// is always the integer one.
+
+namespace raster {
+
+namespace {
+
+inline __m128i select_bits(__m128i mask, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// INT_MULT() for 32-bit lanes with values in [0, 255].
+inline __m128i int_mult(__m128i a, __m128i b)
+{
+  __m128i t = _mm_add_epi32(_mm_mullo_epi16(a, b), _mm_set1_epi32(0x80));
+  return _mm_srli_epi32(_mm_add_epi32(_mm_srli_epi32(t, 8), t), 8);
+}
+
+// Returns b + (f-b) * num / den (with the C integer division).
+inline __m128i lerp(__m128i b, __m128i f, __m128 num, __m128 den)
+{
+  __m128 d = _mm_cvtepi32_ps(_mm_sub_epi32(f, b));
+  return _mm_add_epi32(b, _mm_cvttps_epi32(_mm_div_ps(_mm_mul_ps(d, num), den)));
+}
+
+inline __m128i channel(__m128i c, int shift)
+{
+  return _mm_and_si128(_mm_srli_epi32(c, shift), _mm_set1_epi32(0xff));
+}
+
+struct BlendNormal {
+  static inline __m128i blend(__m128i b, __m128i f, __m128i opacity) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i B_a = _mm_srli_epi32(b, 24);
+    __m128i F_a = _mm_srli_epi32(f, 24);
+    __m128i F_a2 = int_mult(F_a, opacity);
+    __m128i D_a = _mm_sub_epi32(_mm_add_epi32(B_a, F_a2), int_mult(B_a, F_a2));
+    __m128 num = _mm_cvtepi32_ps(F_a2);
+    __m128 den = _mm_cvtepi32_ps(D_a);
+
+    __m128i D_r = lerp(channel(b, 0), channel(f, 0), num, den);
+    __m128i D_g = lerp(channel(b, 8), channel(f, 8), num, den);
+    __m128i D_b = lerp(channel(b, 16), channel(f, 16), num, den);
+
+    __m128i result =
+      _mm_or_si128(_mm_or_si128(D_r, _mm_slli_epi32(D_g, 8)),
+                   _mm_or_si128(_mm_slli_epi32(D_b, 16), _mm_slli_epi32(D_a, 24)));
+
+    // Transparent front: keep the back
+    result = select_bits(_mm_cmpeq_epi32(F_a, zero), b, result);
+
+    // Transparent back: front with the modified alpha
+    __m128i front =
+      _mm_or_si128(_mm_and_si128(f, _mm_set1_epi32(0xffffff)),
+                   _mm_slli_epi32(F_a2, 24));
+    return select_bits(_mm_cmpeq_epi32(B_a, zero), front, result);
+  }
+};
+
+struct BlendCopy {
+  static inline __m128i blend(__m128i b, __m128i f, __m128i opacity) {
+    return f;
+  }
+};
+
+struct BlendMerge {
+  static inline __m128i blend(__m128i b, __m128i f, __m128i opacity) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rgb_mask = _mm_set1_epi32(0xffffff);
+    __m128i B_a = _mm_srli_epi32(b, 24);
+    __m128i F_a = _mm_srli_epi32(f, 24);
+    __m128 num = _mm_cvtepi32_ps(opacity);
+    __m128 den = _mm_set1_ps(255.0f);
+
+    __m128i D_r = lerp(channel(b, 0), channel(f, 0), num, den);
+    __m128i D_g = lerp(channel(b, 8), channel(f, 8), num, den);
+    __m128i D_b = lerp(channel(b, 16), channel(f, 16), num, den);
+    __m128i D_a = lerp(B_a, F_a, num, den);
+
+    __m128i rgb =
+      _mm_or_si128(D_r, _mm_or_si128(_mm_slli_epi32(D_g, 8),
+                                     _mm_slli_epi32(D_b, 16)));
+    rgb = select_bits(_mm_cmpeq_epi32(F_a, zero), _mm_and_si128(b, rgb_mask), rgb);
+    rgb = select_bits(_mm_cmpeq_epi32(B_a, zero), _mm_and_si128(f, rgb_mask), rgb);
+
+    return _mm_or_si128(rgb, _mm_slli_epi32(D_a, 24));
+  }
+};
+
+template<class Op>
+inline __m128i blend4(const uint32_t* back, const uint32_t* front, const uint32_t* mask_front,
+                      __m128i opacity, __m128i mask)
+{
+  __m128i b = _mm_loadu_si128((const __m128i*)back);
+  __m128i f = _mm_loadu_si128((const __m128i*)front);
+  __m128i m = _mm_loadu_si128((const __m128i*)mask_front);
+  return select_bits(_mm_cmpeq_epi32(m, mask), b, Op::blend(b, f, opacity));
+}
+
+template<class Op>
+void blend_row(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+               const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+{
+  const __m128i opacity4 = _mm_set1_epi32(opacity);
+  const __m128i mask4 = _mm_set1_epi32((int)mask_color);
+  int i = 0;
+
+  for (; i+4 <= n; i += 4)
+    _mm_storeu_si128((__m128i*)(dst+i),
+                     blend4<Op>(back+i, front+i, mask_front+i, opacity4, mask4));
+
+  // The last pixels are blended in a temporary block.
+  if (i < n) {
+    uint32_t tmp[3][4] = { { 0 } };
+    int rest = n - i;
+    for (int j=0; j<rest; ++j) {
+      tmp[0][j] = back[i+j];
+      tmp[1][j] = front[i+j];
+      tmp[2][j] = mask_front[i+j];
+    }
+    _mm_storeu_si128((__m128i*)tmp[0],
+                     blend4<Op>(tmp[0], tmp[1], tmp[2], opacity4, mask4));
+    for (int j=0; j<rest; ++j)
+      dst[i+j] = tmp[0][j];
+  }
+}
+
+} // anonymous namespace
+
+void rgba_blend_normal_row_sse2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+{
+  blend_row<BlendNormal>(dst, back, front, mask_front, n, opacity, mask_color);
+}
+
+void rgba_blend_copy_row_sse2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+{
+  blend_row<BlendCopy>(dst, back, front, mask_front, n, opacity, mask_color);
+}
+
+void rgba_blend_merge_row_sse2(uint32_t* dst, const uint32_t* back, const uint32_t* front, const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+{
+  blend_row<BlendMerge>(dst, back, front, mask_front, n, opacity, mask_color);
+}
+
+} // namespace raster
+
+#endif // RASTER_HAVE_SSE2
@@ -0,0 +1,168 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/cpu_features.h"
+#include "raster/blend.h"
+#include "raster/blend_simd.h"
+#include "raster/image.h"
+
+#include <vector>
+
+using namespace raster;
+
+namespace {
+
+  class Random {
+  public:
+    Random() : m_seed(1) { }
+    uint32_t next() {
+      m_seed = m_seed * 1103515245 + 12345;
+      return (m_seed >> 16) | (m_seed << 16);
+    }
+  private:
+    uint32_t m_seed;
+  };
+
+  // Random pixels with a lot of special alpha values (0 and 255).
+  uint32_t random_pixel(Random& random)
+  {
+    uint32_t c = random.next();
+    switch (random.next() % 4) {
+      case 0: return c & 0x00ffffff;
+      case 1: return c | 0xff000000;
+      default: return c;
+    }
+  }
+
+  const uint32_t kMaskColor = 0x00ff00ff;
+
+  struct Rows {
+    std::vector<uint32_t> back, front;
+
+    Rows(int n) : back(n), front(n) {
+      Random random;
+      for (int i=0; i<n; ++i) {
+        back[i] = random_pixel(random);
+        front[i] = (i % 7 == 3 ? kMaskColor: random_pixel(random));
+      }
+    }
+  };
+
+  void expect_row(BLEND_COLOR blender, RGBA_BLEND_ROW_KERNEL kernel)
+  {
+    for (int n=0; n<40; ++n) {
+      Rows rows(n);
+      for (int opacity=1; opacity<=255; opacity+=(opacity < 250 ? 7: 1)) {
+        std::vector<uint32_t> dst(n+1, 0xdeadbeef);
+        if (n > 0)
+          kernel(&dst[0], &rows.back[0], &rows.front[0], &rows.front[0],
+                 n, opacity, kMaskColor);
+
+        for (int i=0; i<n; ++i) {
+          uint32_t expected =
+            (rows.front[i] != kMaskColor ?
+             (uint32_t)(*blender)(rows.back[i], rows.front[i], opacity):
+             rows.back[i]);
+
+          ASSERT_EQ(expected, dst[i]) << "n=" << n << " i=" << i << " opacity=" << opacity
+                                      << " back=" << std::hex << rows.back[i]
+                                      << " front=" << rows.front[i];
+        }
+        EXPECT_EQ(0xdeadbeef, dst[n]);
+      }
+    }
+  }
+
+  // Adapts a RGBA_BLEND_ROW to the kernel signature.
+  RGBA_BLEND_ROW row_blender;
+  void row_blender_kernel(uint32_t* dst, const uint32_t* back, const uint32_t* front,
+                          const uint32_t* mask_front, int n, int opacity, uint32_t mask_color)
+  {
+    (*row_blender)(dst, back, front, n, opacity, mask_color);
+  }
+
+} // anonymous namespace
+
+// Uses the kernels selected for this CPU (e.g. AVX2)
+TEST(Blend, RgbaRowBlenders)
+{
+  for (int mode=0; mode<BLEND_MODE_MAX; ++mode) {
+    row_blender = rgba_row_blenders[mode];
+    expect_row(rgba_blenders[mode], row_blender_kernel);
+  }
+}
+
+TEST(Blend, RgbaRowBlendersInPlace)
+{
+  Rows rows(37);
+  std::vector<uint32_t> expected(rows.back);
+  for (int i=0; i<37; ++i)
+    if (rows.front[i] != kMaskColor)
+      expected[i] = rgba_blend_normal(rows.back[i], rows.front[i], 128);
+
+  rgba_blend_normal_row(&rows.back[0], &rows.back[0], &rows.front[0], 37, 128, kMaskColor);
+  for (int i=0; i<37; ++i)
+    EXPECT_EQ(expected[i], rows.back[i]);
+}
+
+#ifdef RASTER_HAVE_SSE2
+TEST(Blend, RgbaSse2Kernels)
+{
+  if (!base::cpu_has_sse2())
+    return;
+
+  expect_row(rgba_blend_normal, rgba_blend_normal_row_sse2);
+  expect_row(rgba_blend_copy, rgba_blend_copy_row_sse2);
+  expect_row(rgba_blend_merge, rgba_blend_merge_row_sse2);
+}
+#endif
+
+TEST(Blend, GrayaRowBlenders)
+{
+  Random random;
+  std::vector<uint16_t> back(50), front(50), dst(50);
+  for (int i=0; i<50; ++i) {
+    back[i] = random.next();
+    front[i] = (i % 5 == 0 ? 0: random.next());
+  }
+
+  for (int mode=0; mode<BLEND_MODE_MAX; ++mode) {
+    for (int opacity=0; opacity<=255; opacity+=51) {
+      graya_row_blenders[mode](&dst[0], &back[0], &front[0], 50, opacity, 0);
+
+      for (int i=0; i<50; ++i) {
+        uint16_t expected = (front[i] != 0 ?
+                             graya_blenders[mode](back[i], front[i], opacity): back[i]);
+        EXPECT_EQ(expected, dst[i]);
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -20,11 +20,13 @@
 #define RASTER_COLOR_HISTOGRAM_H_INCLUDED
 #pragma once
 
+#include <algorithm>
 #include <limits>
 #include <vector>
 
 #include "raster/image.h"
 #include "raster/image_traits.h"
+#include "raster/kmeans.h"
 #include "raster/median_cut.h"
 #include "raster/palette.h"
 
@@ -86,11 +88,48 @@ namespace quantization {
       }
     }
 
+    // Adds all samples of other histogram (e.g. a histogram filled
+    // by other thread with other part of the images).
+    void addHistogram(const ColorHistogram& other)
+    {
+      for (size_t i=0; i<m_histogram.size(); ++i) {
+        size_t count = other.m_histogram[i];
+        if (m_histogram[i] < std::numeric_limits<size_t>::max()-count) // Avoid overflow
+          m_histogram[i] += count;
+        else
+          m_histogram[i] = std::numeric_limits<size_t>::max();
+      }
+
+      if (m_useHighPrecision) {
+        if (!other.m_useHighPrecision) {
+          m_useHighPrecision = false;
+          return;
+        }
+
+        for (size_t i=0; i<other.m_highPrecision.size(); ++i) {
+          uint32_t color = other.m_highPrecision[i];
+          if (std::find(m_highPrecision.begin(), m_highPrecision.end(), color) != m_highPrecision.end())
+            continue;
+
+          if (m_highPrecision.size() < 256)
+            m_highPrecision.push_back(color);
+          else {
+            m_useHighPrecision = false;
+            break;
+          }
+        }
+      }
+    }
+
     // Creates a set of entries for the given palette in the given range
     // with the more important colors in the histogram. Returns the
     // number of used entries in the palette (maybe the range [from,to]
     // is more than necessary).
-    int createOptimizedPalette(Palette* palette, int from, int to)
+    //
+    // If "refineTime" is greater than 0, the colors found by the
+    // median-cut are refined with k-means for at most the given
+    // number of milliseconds.
+    int createOptimizedPalette(Palette* palette, int from, int to, int refineTime = 0)
     {
       // Can we use the high-precision table?
       if (m_useHighPrecision && int(m_highPrecision.size()) <= (to-from+1)) {
@@ -105,6 +144,9 @@ namespace quantization {
         std::vector<uint32_t> result;
         median_cut(*this, to-from+1, result);
 
+        if (refineTime > 0)
+          kmeans_refine(*this, result, refineTime);
+
         for (int i=0; i<(int)result.size(); ++i)
           palette->setEntry(from+i, result[i]);
 
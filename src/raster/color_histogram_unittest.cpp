@@ -0,0 +1,165 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "raster/color_histogram.h"
+#include "raster/image.h"
+#include "raster/palette.h"
+#include "raster/primitives.h"
+#include "raster/quantization.h"
+
+#include <cstdlib>
+
+using namespace base;
+using namespace raster;
+using namespace raster::quantization;
+
+typedef ColorHistogram<5, 6, 5> Histogram;
+
+static uint32_t random_color()
+{
+  return rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255);
+}
+
+// Sum of the squared distances between the histogram entries and the
+// nearest color (with the same weights used by kmeans_refine()).
+static double quantization_error(const Histogram& histogram, const std::vector<uint32_t>& colors)
+{
+  double error = 0.0;
+
+  for (int i=0; i<Histogram::RElements; ++i)
+    for (int j=0; j<Histogram::GElements; ++j)
+      for (int k=0; k<Histogram::BElements; ++k) {
+        size_t count = histogram.at(i, j, k);
+        if (count == 0)
+          continue;
+
+        int r = 255 * i / (Histogram::RElements-1);
+        int g = 255 * j / (Histogram::GElements-1);
+        int b = 255 * k / (Histogram::BElements-1);
+        double best = -1.0;
+
+        for (size_t c=0; c<colors.size(); ++c) {
+          double dr = 30 * (rgba_getr(colors[c]) - r);
+          double dg = 59 * (rgba_getg(colors[c]) - g);
+          double db = 11 * (rgba_getb(colors[c]) - b);
+          double dist = dr*dr + dg*dg + db*db;
+          if (best < 0.0 || dist < best)
+            best = dist;
+        }
+
+        error += best * count;
+      }
+
+  return error;
+}
+
+TEST(ColorHistogram, AddHistogram)
+{
+  Histogram whole, a, b;
+  std::srand(1);
+
+  for (int i=0; i<5000; ++i) {
+    uint32_t color = random_color();
+    whole.addSamples(color);
+    if (i & 1)
+      a.addSamples(color);
+    else
+      b.addSamples(color);
+  }
+
+  a.addHistogram(b);
+
+  for (int i=0; i<Histogram::RElements; ++i)
+    for (int j=0; j<Histogram::GElements; ++j)
+      for (int k=0; k<Histogram::BElements; ++k)
+        ASSERT_EQ(whole.at(i, j, k), a.at(i, j, k));
+}
+
+TEST(ColorHistogram, AddHistogramWithFewColors)
+{
+  Histogram a, b;
+  a.addSamples(rgba(255, 0, 0, 255));
+  a.addSamples(rgba(0, 255, 0, 255));
+  b.addSamples(rgba(0, 255, 0, 255));
+  b.addSamples(rgba(0, 0, 255, 255));
+  a.addHistogram(b);
+
+  // Exact colors are used for palettes of less than 256 colors.
+  Palette palette(FrameNumber(0), 256);
+  EXPECT_EQ(3, a.createOptimizedPalette(&palette, 1, 255));
+  EXPECT_EQ(rgba(255, 0, 0, 255), palette.getEntry(1));
+  EXPECT_EQ(rgba(0, 255, 0, 255), palette.getEntry(2));
+  EXPECT_EQ(rgba(0, 0, 255, 255), palette.getEntry(3));
+}
+
+TEST(KMeans, RefineDoesNotIncreaseError)
+{
+  Histogram histogram;
+  std::srand(2);
+
+  // Some clusters of colors
+  for (int c=0; c<40; ++c) {
+    uint32_t center = random_color();
+    for (int i=0; i<200; ++i) {
+      histogram.addSamples(rgba(MID(0, rgba_getr(center) + std::rand() % 31 - 15, 255),
+                                MID(0, rgba_getg(center) + std::rand() % 31 - 15, 255),
+                                MID(0, rgba_getb(center) + std::rand() % 31 - 15, 255), 255),
+                           1 + std::rand() % 4);
+    }
+  }
+
+  std::vector<uint32_t> colors;
+  median_cut(histogram, 16, colors);
+  ASSERT_EQ(16, (int)colors.size());
+
+  double before = quantization_error(histogram, colors);
+  kmeans_refine(histogram, colors, 10000);
+  double after = quantization_error(histogram, colors);
+
+  EXPECT_EQ(16, (int)colors.size());
+  EXPECT_LE(after, before * 1.001);
+}
+
+TEST(PaletteGenerator, FewColors)
+{
+  UniquePtr<Image> image(Image::create(IMAGE_RGB, 300, 300));
+  clear_image(image, rgba(0, 0, 0, 0)); // Transparent pixels are ignored
+  fill_rect(image, 0, 0, 99, 299, rgba(10, 20, 30, 255));
+  fill_rect(image, 200, 0, 299, 299, rgba(40, 50, 60, 128));
+
+  PaletteGenerator generator;
+  generator.addImage(image);
+
+  Palette palette(FrameNumber(0), 256);
+  EXPECT_EQ(2, generator.createPalette(&palette, 1));
+  EXPECT_EQ(rgba(10, 20, 30, 255), palette.getEntry(1));
+  EXPECT_EQ(rgba(40, 50, 60, 255), palette.getEntry(2));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
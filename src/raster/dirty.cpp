@@ -80,6 +80,24 @@ inline bool shrink_row(const Image* image, const Image* image_diff, int& x1, int
   return true;
 }
 
+static bool shrink_row(const Image* image, const Image* image_diff, int& x1, int y, int& x2)
+{
+  switch (image->getPixelFormat()) {
+    case IMAGE_RGB:
+      return shrink_row<RgbTraits>(image, image_diff, x1, y, x2);
+
+    case IMAGE_GRAYSCALE:
+      return shrink_row<GrayscaleTraits>(image, image_diff, x1, y, x2);
+
+    case IMAGE_INDEXED:
+      return shrink_row<IndexedTraits>(image, image_diff, x1, y, x2);
+
+    default:
+      ASSERT(false && "Not implemented for bitmaps");
+      return false;
+  }
+}
+
 Dirty::Dirty(Image* image, Image* image_diff, const gfx::Rect& bounds)
   : m_format(image->getPixelFormat())
   , m_x1(bounds.x), m_y1(bounds.y)
@@ -91,25 +109,7 @@ Dirty::Dirty(Image* image, Image* image_diff, const gfx::Rect& bounds)
     x1 = m_x1;
     x2 = m_x2;
 
-    bool res;
-    switch (image->getPixelFormat()) {
-      case IMAGE_RGB:
-        res = shrink_row<RgbTraits>(image, image_diff, x1, y, x2);
-        break;
-
-      case IMAGE_GRAYSCALE:
-        res = shrink_row<GrayscaleTraits>(image, image_diff, x1, y, x2);
-        break;
-
-      case IMAGE_INDEXED:
-        res = shrink_row<IndexedTraits>(image, image_diff, x1, y, x2);
-        break;
-
-      default:
-        ASSERT(false && "Not implemented for bitmaps");
-        return;
-    }
-    if (!res)
+    if (!shrink_row(image, image_diff, x1, y, x2))
       continue;
 
     Col* col = new Col(x1, x2-x1+1);
@@ -122,6 +122,51 @@ Dirty::Dirty(Image* image, Image* image_diff, const gfx::Rect& bounds)
   }
 }
 
+Dirty::Dirty(Image* image, Image* image_diff, const gfx::Region& region)
+  : m_format(image->getPixelFormat())
+{
+  gfx::Rect bounds = region.getBounds();
+  m_x1 = bounds.x;
+  m_y1 = bounds.y;
+  m_x2 = bounds.x2()-1;
+  m_y2 = bounds.y2()-1;
+
+  // Rectangles in a region are sorted in bands (rectangles with the
+  // same "y" and height) from top to bottom and from left to right,
+  // so each row can have one column for each rectangle of its band.
+  std::vector<gfx::Rect> band;
+  gfx::Region::const_iterator it = region.begin();
+  gfx::Region::const_iterator end = region.end();
+
+  while (it != end) {
+    band.clear();
+    band.push_back(*it);
+    for (++it; it != end && (*it).y == band[0].y; ++it)
+      band.push_back(*it);
+
+    for (int y=band[0].y; y<band[0].y2(); ++y) {
+      Row* row = NULL;
+
+      for (size_t i=0; i<band.size(); ++i) {
+        int x1 = band[i].x;
+        int x2 = band[i].x2()-1;
+        if (!shrink_row(image, image_diff, x1, y, x2))
+          continue;
+
+        Col* col = new Col(x1, x2-x1+1);
+        col->data.resize(getLineSize(col->w));
+
+        if (!row)
+          row = new Row(y);
+        row->cols.push_back(col);
+      }
+
+      if (row)
+        m_rows.push_back(row);
+    }
+  }
+}
+
 Dirty::~Dirty()
 {
   RowsList::iterator row_it = m_rows.begin();
@@ -20,6 +20,7 @@
 #define RASTER_DIRTY_H_INCLUDED
 #pragma once
 
+#include "gfx/region.h"
 #include "raster/image.h"
 
 #include <vector>
@@ -59,6 +60,7 @@ public:
     Dirty(PixelFormat format, int x1, int y1, int x2, int y2);
     Dirty(const Dirty& src);
     Dirty(Image* image1, Image* image2, const gfx::Rect& bounds);
+    Dirty(Image* image1, Image* image2, const gfx::Region& region);
     ~Dirty();
 
     int getMemSize() const;
@@ -0,0 +1,130 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "gfx/region.h"
+#include "raster/dirty.h"
+#include "raster/image.h"
+#include "raster/primitives.h"
+#include "raster/primitives_fast.h"
+
+using namespace base;
+using namespace gfx;
+using namespace raster;
+
+template<typename T>
+class DirtyAllTypes : public testing::Test {
+protected:
+  DirtyAllTypes() { }
+};
+
+typedef testing::Types<RgbTraits, GrayscaleTraits, IndexedTraits> DirtyAllTraits;
+TYPED_TEST_CASE(DirtyAllTypes, DirtyAllTraits);
+
+TYPED_TEST(DirtyAllTypes, RegionWithChanges)
+{
+  typedef TypeParam ImageTraits;
+
+  UniquePtr<Image> a(Image::create(ImageTraits::pixel_format, 32, 16));
+  UniquePtr<Image> b(Image::create(ImageTraits::pixel_format, 32, 16));
+  clear_image(a, 0);
+  clear_image(b, 0);
+
+  // Changes inside the region
+  put_pixel_fast<ImageTraits>(b, 3, 2, 1);
+  put_pixel_fast<ImageTraits>(b, 6, 2, 2);
+  put_pixel_fast<ImageTraits>(b, 20, 2, 3);
+  put_pixel_fast<ImageTraits>(b, 25, 10, 4);
+  // Changes outside the region
+  put_pixel_fast<ImageTraits>(b, 12, 2, 5);
+  put_pixel_fast<ImageTraits>(b, 0, 15, 6);
+
+  // Two rectangles in the band y=[1,5), and one in y=[8,12)
+  Region region(Rect(2, 1, 8, 4));
+  region.createUnion(region, Region(Rect(16, 1, 8, 4)));
+  region.createUnion(region, Region(Rect(20, 8, 10, 4)));
+  EXPECT_EQ(3, (int)region.size());
+
+  Dirty dirty(a, b, region);
+  EXPECT_TRUE(dirty.getPixelFormat() == ImageTraits::pixel_format);
+  EXPECT_EQ(2, dirty.x1());
+  EXPECT_EQ(1, dirty.y1());
+  EXPECT_EQ(29, dirty.x2());
+  EXPECT_EQ(11, dirty.y2());
+
+  // Just the rows with changes, and one column for each rectangle
+  // shrunk to the changed pixels.
+  ASSERT_EQ(2, dirty.getRowsCount());
+
+  const Dirty::Row& row1 = dirty.getRow(0);
+  EXPECT_EQ(2, row1.y);
+  ASSERT_EQ(2, (int)row1.cols.size());
+  EXPECT_EQ(3, row1.cols[0]->x);
+  EXPECT_EQ(4, row1.cols[0]->w);
+  EXPECT_EQ(20, row1.cols[1]->x);
+  EXPECT_EQ(1, row1.cols[1]->w);
+  EXPECT_EQ(dirty.getLineSize(4), (int)row1.cols[0]->data.size());
+
+  const Dirty::Row& row2 = dirty.getRow(1);
+  EXPECT_EQ(10, row2.y);
+  ASSERT_EQ(1, (int)row2.cols.size());
+  EXPECT_EQ(25, row2.cols[0]->x);
+  EXPECT_EQ(1, row2.cols[0]->w);
+
+  // Copy the changes of "b" to "a" (and the old pixels of "a" to the dirty)
+  dirty.saveImagePixels(b);
+  dirty.swapImagePixels(a);
+  EXPECT_EQ(1, get_pixel_fast<ImageTraits>(a, 3, 2));
+  EXPECT_EQ(2, get_pixel_fast<ImageTraits>(a, 6, 2));
+  EXPECT_EQ(3, get_pixel_fast<ImageTraits>(a, 20, 2));
+  EXPECT_EQ(4, get_pixel_fast<ImageTraits>(a, 25, 10));
+  EXPECT_EQ(0, get_pixel_fast<ImageTraits>(a, 12, 2));
+  EXPECT_EQ(0, get_pixel_fast<ImageTraits>(a, 0, 15));
+
+  // Undo the changes
+  dirty.swapImagePixels(a);
+  for (int y=0; y<a->getHeight(); ++y)
+    for (int x=0; x<a->getWidth(); ++x)
+      ASSERT_EQ(0, get_pixel_fast<ImageTraits>(a, x, y));
+}
+
+TYPED_TEST(DirtyAllTypes, RegionWithoutChanges)
+{
+  typedef TypeParam ImageTraits;
+
+  UniquePtr<Image> a(Image::create(ImageTraits::pixel_format, 8, 8));
+  UniquePtr<Image> b(Image::create(ImageTraits::pixel_format, 8, 8));
+  clear_image(a, 1);
+  clear_image(b, 1);
+  put_pixel_fast<ImageTraits>(b, 7, 7, 2);
+
+  Dirty dirty(a, b, Region(Rect(0, 0, 4, 4)));
+  EXPECT_EQ(0, dirty.getRowsCount());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -39,6 +39,8 @@ Image::Image(PixelFormat format, int width, int height)
   m_width = width;
   m_height = height;
   m_maskColor = 0;
+  m_hash = 0;
+  m_validHash = false;
 }
 
 Image::~Image()
@@ -50,6 +52,49 @@ int Image::getMemSize() const
   return sizeof(Image) + getRowStrideSize()*m_height;
 }
 
+uint32_t Image::getHash() const
+{
+  if (m_validHash)
+    return m_hash;
+
+  int bands = (m_height + kImageHashBandHeight - 1) / kImageHashBandHeight;
+  if ((int)m_bandHashes.size() != bands) {
+    m_bandHashes.resize(bands);
+    m_validBandHashes.assign(bands, false);
+  }
+
+  for (int band=0; band<bands; ++band) {
+    if (!m_validBandHashes[band]) {
+      m_bandHashes[band] = calculate_image_band_hash(this, band);
+      m_validBandHashes[band] = true;
+    }
+  }
+
+  m_hash = combine_image_band_hashes(this, (bands > 0 ? &m_bandHashes[0]: NULL), bands);
+  m_validHash = true;
+  return m_hash;
+}
+
+void Image::invalidateHash()
+{
+  m_validHash = false;
+  m_validBandHashes.assign(m_validBandHashes.size(), false);
+}
+
+void Image::invalidateHash(const gfx::Rect& bounds)
+{
+  gfx::Rect rc = bounds.createIntersect(getBounds());
+  if (rc.isEmpty())
+    return;
+
+  m_validHash = false;
+
+  int band1 = rc.y / kImageHashBandHeight;
+  int band2 = MIN((rc.y+rc.h-1) / kImageHashBandHeight, (int)m_validBandHashes.size()-1);
+  for (int band=band1; band<=band2; ++band)
+    m_validBandHashes[band] = false;
+}
+
 int Image::getRowStrideSize() const
 {
   return getRowStrideSize(m_width);
@@ -29,6 +29,8 @@
 #include "raster/object.h"
 #include "raster/pixel_format.h"
 
+#include <vector>
+
 namespace raster {
 
   template<typename ImageTraits> class ImageBits;
@@ -63,6 +65,14 @@ namespace raster {
     int getRowStrideSize() const;
     int getRowStrideSize(int pixels_per_row) const;
 
+    // Returns the hash of the image content (see
+    // calculate_image_hash()). It's cached by bands of rows, so when
+    // the pixels are modified directly, the modified area must be
+    // invalidated to recalculate the hash of those rows only.
+    uint32_t getHash() const;
+    void invalidateHash();
+    void invalidateHash(const gfx::Rect& bounds);
+
     template<typename ImageTraits>
     ImageBits<ImageTraits> lockBits(LockType lockType, const gfx::Rect& bounds) {
       return ImageBits<ImageTraits>(this, bounds);
@@ -99,6 +109,12 @@ namespace raster {
     int m_width;
     int m_height;
     color_t m_maskColor;  // Skipped color in merge process.
+
+    // Cached hash of the whole image and of each band of rows.
+    mutable uint32_t m_hash;
+    mutable bool m_validHash;
+    mutable std::vector<uint32_t> m_bandHashes;
+    mutable std::vector<bool> m_validBandHashes;
   };
 
 } // namespace raster
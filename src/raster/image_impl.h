@@ -167,14 +167,13 @@ namespace raster {
     }
 
     void merge(const Image* _src, int x, int y, int opacity, int blend_mode) OVERRIDE {
-      BLEND_COLOR blender = Traits::get_blender(blend_mode);
       const ImageImpl<Traits>* src = (const ImageImpl<Traits>*)_src;
       ImageImpl<Traits>* dst = this;
       address_t src_address;
       address_t dst_address;
-      int xbeg, xend, xsrc, xdst;
+      int xbeg, xend, xsrc;
       int ybeg, yend, ysrc, ydst;
-      register uint32_t mask_color = src->getMaskColor();
+      typename Traits::pixel_t mask_color = src->getMaskColor();
 
       // nothing to do
       if (!opacity)
@@ -210,19 +209,16 @@ namespace raster {
       if (yend >= dst->getHeight())
         yend = dst->getHeight()-1;
 
-      // Merge process
+      // Merge process (row by row, see raster/blend.h)
+
+      typename Traits::blend_row_t blender = Traits::get_row_blender(blend_mode);
+      int w = xend - xbeg + 1;
 
       for (ydst=ybeg; ydst<=yend; ++ydst, ++ysrc) {
         src_address = (address_t)src->address(xsrc, ysrc);
         dst_address = (address_t)dst->address(xbeg, ydst);
 
-        for (xdst=xbeg; xdst<=xend; ++xdst) {
-          if (*src_address != mask_color)
-            *dst_address = (*blender)(*dst_address, *src_address, opacity);
-
-          ++dst_address;
-          ++src_address;
-        }
+        (*blender)(dst_address, dst_address, src_address, w, opacity, mask_color);
       }
     }
 
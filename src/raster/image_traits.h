@@ -38,6 +38,7 @@ namespace raster {
     typedef uint32_t pixel_t;
     typedef pixel_t* address_t;
     typedef const pixel_t* const_address_t;
+    typedef RGBA_BLEND_ROW blend_row_t;
 
     static const pixel_t min_value = 0x00000000l;
     static const pixel_t max_value = 0xffffffffl;
@@ -52,6 +53,12 @@ namespace raster {
       ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
       return rgba_blenders[blend_mode];
     }
+
+    static inline RGBA_BLEND_ROW get_row_blender(int blend_mode)
+    {
+      ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
+      return rgba_row_blenders[blend_mode];
+    }
   };
 
   struct GrayscaleTraits {
@@ -68,6 +75,7 @@ namespace raster {
     typedef uint16_t pixel_t;
     typedef pixel_t* address_t;
     typedef const pixel_t* const_address_t;
+    typedef GRAYA_BLEND_ROW blend_row_t;
 
     static const pixel_t min_value = 0x0000;
     static const pixel_t max_value = 0xffff;
@@ -82,6 +90,12 @@ namespace raster {
       ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
       return graya_blenders[blend_mode];
     }
+
+    static inline GRAYA_BLEND_ROW get_row_blender(int blend_mode)
+    {
+      ASSERT(blend_mode >= 0 && blend_mode < BLEND_MODE_MAX);
+      return graya_row_blenders[blend_mode];
+    }
   };
 
   struct IndexedTraits {
@@ -191,6 +191,61 @@ TYPED_TEST(ImageAllTypes, DrawHLine)
   }
 }
 
+TYPED_TEST(ImageAllTypes, Hash)
+{
+  typedef TypeParam ImageTraits;
+
+  UniquePtr<Image> a(Image::create(ImageTraits::pixel_format, 33, 40));
+  UniquePtr<Image> b(Image::create(ImageTraits::pixel_format, 33, 40));
+  a->clear(0);
+  b->clear(0);
+
+  EXPECT_TRUE(is_same_image(a, b));
+  EXPECT_EQ(a->getHash(), b->getHash());
+  EXPECT_EQ(calculate_image_hash(a), a->getHash());
+
+  // The cached hash is used until the modified area is invalidated
+  uint32_t oldHash = b->getHash();
+  put_pixel(b, 20, 35, 1);
+  EXPECT_FALSE(is_same_image(a, b));
+  EXPECT_EQ(oldHash, b->getHash());
+
+  b->invalidateHash(gfx::Rect(20, 35, 1, 1));
+  EXPECT_NE(a->getHash(), b->getHash());
+  EXPECT_EQ(calculate_image_hash(b), b->getHash());
+
+  put_pixel(b, 20, 35, 0);
+  b->invalidateHash();
+  EXPECT_EQ(a->getHash(), b->getHash());
+
+  // Images with different sizes
+  UniquePtr<Image> c(Image::create(ImageTraits::pixel_format, 40, 33));
+  c->clear(0);
+  EXPECT_FALSE(is_same_image(a, c));
+  EXPECT_NE(a->getHash(), c->getHash());
+}
+
+TYPED_TEST(ImageAllTypes, CopyImageArea)
+{
+  typedef TypeParam ImageTraits;
+
+  UniquePtr<Image> src(Image::create(ImageTraits::pixel_format, 21, 13));
+  UniquePtr<Image> dst(Image::create(ImageTraits::pixel_format, 21, 13));
+  for (int y=0; y<13; ++y)
+    for (int x=0; x<21; ++x)
+      put_pixel(src, x, y, (x+y) % ImageTraits::max_value + 1);
+  dst->clear(0);
+
+  // The area is clipped to the image bounds
+  gfx::Rect area(3, -2, 20, 6);
+  copy_image_area(dst, src, area);
+
+  for (int y=0; y<13; ++y)
+    for (int x=0; x<21; ++x)
+      ASSERT_EQ(area.contains(gfx::Point(x, y)) ? get_pixel(src, x, y): 0,
+                get_pixel(dst, x, y)) << x << "," << y;
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,180 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifndef RASTER_KMEANS_H_INCLUDED
+#define RASTER_KMEANS_H_INCLUDED
+#pragma once
+
+#include "base/chrono.h"
+#include "base/parallel_for.h"
+#include "raster/color.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace raster {
+namespace quantization {
+
+  namespace details {
+
+    // Weight of each component to calculate the distance between
+    // colors (the same weights used by RgbMap).
+    const int kmeans_weights[3] = { 30*30, 59*59, 11*11 };
+
+    // Number of samples assigned by each call of KMeansAssign.
+    const int kmeans_chunk_size = 4096;
+
+    struct KMeansSample {
+      int c[3];
+      size_t count;
+    };
+
+    // Finds the nearest centroid of each sample (it's called from
+    // several threads, one chunk of samples each time).
+    class KMeansAssign {
+    public:
+      KMeansAssign(const std::vector<KMeansSample>& samples,
+                   const std::vector<int>& centroids,
+                   std::vector<int>& nearest)
+        : m_samples(samples)
+        , m_centroids(centroids)
+        , m_nearest(nearest) {
+      }
+
+      void operator()(int chunk) const {
+        int begin = chunk * kmeans_chunk_size;
+        int end = MIN(begin + kmeans_chunk_size, (int)m_samples.size());
+        int k = (int)m_centroids.size() / 3;
+
+        for (int i=begin; i<end; ++i) {
+          const int* c = m_samples[i].c;
+          int best = 0;
+          int bestDist = -1;
+
+          for (int j=0; j<k; ++j) {
+            const int* d = &m_centroids[j*3];
+            int dist =
+              kmeans_weights[0] * (c[0]-d[0]) * (c[0]-d[0]) +
+              kmeans_weights[1] * (c[1]-d[1]) * (c[1]-d[1]) +
+              kmeans_weights[2] * (c[2]-d[2]) * (c[2]-d[2]);
+
+            if (bestDist < 0 || dist < bestDist) {
+              best = j;
+              bestDist = dist;
+              if (dist == 0)
+                break;
+            }
+          }
+
+          m_nearest[i] = best;
+        }
+      }
+
+    private:
+      const std::vector<KMeansSample>& m_samples;
+      const std::vector<int>& m_centroids;
+      std::vector<int>& m_nearest;
+    };
+
+  } // namespace details
+
+  // Refines the given colors (e.g. the result of median_cut()) with
+  // k-means (Lloyd's algorithm) using the histogram entries as
+  // samples. It stops when the colors converge, after "maxIterations",
+  // or after "timeBudget" milliseconds (at least one iteration is
+  // done).
+  template<class Histogram>
+  void kmeans_refine(const Histogram& histogram, std::vector<uint32_t>& colors,
+                     int timeBudget, int maxIterations = 32)
+  {
+    using namespace details;
+
+    base::Chrono chrono;
+    int k = (int)colors.size();
+    if (k == 0)
+      return;
+
+    // Non-empty histogram entries are the samples.
+    std::vector<KMeansSample> samples;
+    for (int i=0; i<Histogram::RElements; ++i)
+      for (int j=0; j<Histogram::GElements; ++j)
+        for (int l=0; l<Histogram::BElements; ++l) {
+          size_t count = histogram.at(i, j, l);
+          if (count > 0) {
+            KMeansSample sample;
+            sample.c[0] = 255 * i / (Histogram::RElements-1);
+            sample.c[1] = 255 * j / (Histogram::GElements-1);
+            sample.c[2] = 255 * l / (Histogram::BElements-1);
+            sample.count = count;
+            samples.push_back(sample);
+          }
+        }
+
+    std::vector<int> centroids(k*3);
+    for (int j=0; j<k; ++j) {
+      centroids[j*3  ] = rgba_getr(colors[j]);
+      centroids[j*3+1] = rgba_getg(colors[j]);
+      centroids[j*3+2] = rgba_getb(colors[j]);
+    }
+
+    std::vector<int> nearest(samples.size());
+    std::vector<double> sums(k*4);
+    int chunks = ((int)samples.size() + kmeans_chunk_size - 1) / kmeans_chunk_size;
+
+    for (int iteration=0; iteration<maxIterations; ++iteration) {
+      base::parallel_for(0, chunks, KMeansAssign(samples, centroids, nearest));
+
+      // Move each centroid to the mean of its samples.
+      std::fill(sums.begin(), sums.end(), 0.0);
+      for (size_t i=0; i<samples.size(); ++i) {
+        double* sum = &sums[nearest[i]*4];
+        double count = (double)samples[i].count;
+        sum[0] += samples[i].c[0] * count;
+        sum[1] += samples[i].c[1] * count;
+        sum[2] += samples[i].c[2] * count;
+        sum[3] += count;
+      }
+
+      bool changed = false;
+      for (int j=0; j<k; ++j) {
+        const double* sum = &sums[j*4];
+        if (sum[3] == 0.0)      // Empty cluster, keep the color
+          continue;
+
+        for (int c=0; c<3; ++c) {
+          int v = MID(0, int(sum[c] / sum[3] + 0.5), 255);
+          if (centroids[j*3+c] != v) {
+            centroids[j*3+c] = v;
+            changed = true;
+          }
+        }
+      }
+
+      if (!changed || chrono.elapsed()*1000.0 >= timeBudget)
+        break;
+    }
+
+    for (int j=0; j<k; ++j)
+      colors[j] = rgba(centroids[j*3], centroids[j*3+1], centroids[j*3+2], 255);
+  }
+
+} // namespace quantization
+} // namespace raster
+
+#endif
@@ -128,10 +128,12 @@ void LayerImage::destroyAllCels()
     Cel* cel = *it;
     Image* image = getSprite()->getStock()->getImage(cel->getImage());
 
-    ASSERT(image != NULL);
-
-    getSprite()->getStock()->removeImage(image);
-    delete image;
+    // The image could be shared with a previous cel (and it was
+    // already deleted).
+    if (image) {
+      getSprite()->getStock()->removeImage(image);
+      delete image;
+    }
     delete cel;
   }
   m_cels.clear();
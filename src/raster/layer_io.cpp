@@ -30,6 +30,7 @@
 #include "raster/stock.h"
 
 #include <iostream>
+#include <set>
 #include <vector>
 
 namespace raster {
@@ -59,14 +60,22 @@ void write_layer(std::ostream& os, LayerSubObjectsSerializer* subObjects, Layer*
       CelIterator it = static_cast<LayerImage*>(layer)->getCelBegin();
       CelIterator end = static_cast<LayerImage*>(layer)->getCelEnd();
 
+      // Images shared by several cels are written just one time.
+      std::set<int> images;
+
       for (; it != end; ++it) {
         Cel* cel = *it;
         subObjects->write_cel(os, cel);
 
-        Image* image = layer->getSprite()->getStock()->getImage(cel->getImage());
-        ASSERT(image != NULL);
+        bool hasImage = images.insert(cel->getImage()).second;
+        write8(os, hasImage ? 1: 0);                  // Has image
+
+        if (hasImage) {
+          Image* image = layer->getSprite()->getStock()->getImage(cel->getImage());
+          ASSERT(image != NULL);
 
-        subObjects->write_image(os, image);
+          subObjects->write_image(os, image);
+        }
       }
       break;
     }
@@ -117,10 +126,12 @@ Layer* read_layer(std::istream& is, LayerSubObjectsSerializer* subObjects, Sprit
         // Add the cel in the layer
         static_cast<LayerImage*>(layer.get())->addCel(cel);
 
-        // Read the cel's image
-        Image* image = subObjects->read_image(is);
+        // Read the cel's image (if it isn't shared with a previous cel)
+        if (read8(is)) {
+          Image* image = subObjects->read_image(is);
 
-        sprite->getStock()->replaceImage(cel->getImage(), image);
+          sprite->getStock()->replaceImage(cel->getImage(), image);
+        }
       }
       break;
     }
@@ -30,7 +30,9 @@
 #include "raster/pen.h"
 #include "raster/rgbmap.h"
 
+#include <cstring>
 #include <stdexcept>
+#include <vector>
 
 namespace raster {
 
@@ -82,6 +84,28 @@ void copy_image(Image* dst, const Image* src, int x, int y)
   dst->copy(src, x, y);
 }
 
+void copy_image_area(Image* dst, const Image* src, const gfx::Rect& area)
+{
+  ASSERT(dst->getPixelFormat() == src->getPixelFormat());
+
+  gfx::Rect rc = area.createIntersect(dst->getBounds())
+                     .createIntersect(src->getBounds());
+  if (rc.isEmpty())
+    return;
+
+  if (dst->getPixelFormat() == IMAGE_BITMAP) {
+    for (int y=rc.y; y<rc.y+rc.h; ++y)
+      for (int x=rc.x; x<rc.x+rc.w; ++x)
+        dst->putPixel(x, y, src->getPixel(x, y));
+  }
+  else {
+    int bytes = calculate_rowstride_bytes(dst->getPixelFormat(), rc.w);
+    for (int y=rc.y; y<rc.y+rc.h; ++y)
+      std::memcpy(dst->getPixelAddress(rc.x, y),
+                  src->getPixelAddress(rc.x, y), bytes);
+  }
+}
+
 void composite_image(Image* dst, const Image* src, int x, int y, int opacity, int blend_mode)
 {
   dst->merge(src, x, y, opacity, blend_mode);
@@ -95,7 +119,9 @@ Image* crop_image(const Image* image, int x, int y, int w, int h, color_t bg, co
   Image* trim = Image::create(image->getPixelFormat(), w, h, buffer);
   trim->setMaskColor(image->getMaskColor());
 
-  clear_image(trim, bg);
+  // Clear only if some part of the trim is outside the image
+  if (!image->getBounds().contains(gfx::Rect(x, y, w, h)))
+    clear_image(trim, bg);
   copy_image(trim, image, -x, -y);
 
   return trim;
@@ -334,4 +360,79 @@ int count_diff_between_images(const Image* i1, const Image* i2)
   return -1;
 }
 
+bool is_same_image(const Image* i1, const Image* i2)
+{
+  if ((i1->getPixelFormat() != i2->getPixelFormat()) ||
+      (i1->getWidth() != i2->getWidth()) || (i1->getHeight() != i2->getHeight()))
+    return false;
+
+  if (i1->getPixelFormat() == IMAGE_BITMAP)
+    return (count_diff_between_images(i1, i2) == 0);
+
+  // Compare whole rows (without the padding of the row stride).
+  int rowBytes = calculate_rowstride_bytes(i1->getPixelFormat(), i1->getWidth());
+  for (int y=0; y<i1->getHeight(); ++y) {
+    if (std::memcmp(i1->getPixelAddress(0, y),
+                    i2->getPixelAddress(0, y), rowBytes) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+// FNV-1a hashes
+static const uint32_t kHashPrime = 16777619u;
+static const uint32_t kHashBasis = 2166136261u;
+
+uint32_t calculate_image_hash(const Image* image)
+{
+  int bands = (image->getHeight() + kImageHashBandHeight - 1) / kImageHashBandHeight;
+  std::vector<uint32_t> bandHashes(bands);
+  for (int band=0; band<bands; ++band)
+    bandHashes[band] = calculate_image_band_hash(image, band);
+
+  return combine_image_band_hashes(image, (bands > 0 ? &bandHashes[0]: NULL), bands);
+}
+
+uint32_t calculate_image_band_hash(const Image* image, int band)
+{
+  int y1 = band * kImageHashBandHeight;
+  int y2 = MIN(y1 + kImageHashBandHeight, image->getHeight());
+  uint32_t hash = kHashBasis;
+
+  if (image->getPixelFormat() == IMAGE_BITMAP) {
+    for (int y=y1; y<y2; ++y)
+      for (int x=0; x<image->getWidth(); ++x)
+        hash = (hash ^ image->getPixel(x, y)) * kHashPrime;
+    return hash;
+  }
+
+  // Hash whole rows (without the padding of the row stride).
+  int rowBytes = calculate_rowstride_bytes(image->getPixelFormat(), image->getWidth());
+  for (int y=y1; y<y2; ++y) {
+    const uint8_t* p = image->getPixelAddress(0, y);
+    const uint8_t* end = p + rowBytes;
+    for (; p != end; ++p)
+      hash = (hash ^ *p) * kHashPrime;
+  }
+
+  return hash;
+}
+
+uint32_t combine_image_band_hashes(const Image* image, const uint32_t* bandHashes, int bands)
+{
+  uint32_t hash = kHashBasis;
+
+  uint32_t header[3] = { static_cast<uint32_t>(image->getPixelFormat()),
+                         static_cast<uint32_t>(image->getWidth()),
+                         static_cast<uint32_t>(image->getHeight()) };
+  for (int i=0; i<3; ++i)
+    hash = (hash ^ header[i]) * kHashPrime;
+
+  for (int band=0; band<bands; ++band)
+    hash = (hash ^ bandHashes[band]) * kHashPrime;
+
+  return hash;
+}
+
 } // namespace raster
@@ -20,6 +20,7 @@
 #define RASTER_PRIMITIVES_H_INCLUDED
 #pragma once
 
+#include "gfx/rect.h"
 #include "raster/color.h"
 #include "raster/image_buffer.h"
 
@@ -35,6 +36,9 @@ namespace raster {
   void clear_image(Image* image, color_t bg);
 
   void copy_image(Image* dst, const Image* src, int x, int y);
+  // Copies the pixels inside "area" from "src" to the same position
+  // in "dst" (both images must have the same pixel format).
+  void copy_image_area(Image* dst, const Image* src, const gfx::Rect& area);
   void composite_image(Image* dst, const Image* src, int x, int y, int opacity, int blend_mode);
 
   Image* crop_image(const Image* image, int x, int y, int w, int h, color_t bg, const ImageBufferPtr& buffer = ImageBufferPtr());
@@ -51,6 +55,18 @@ namespace raster {
 
   int count_diff_between_images(const Image* i1, const Image* i2);
 
+  // Returns true if both images have the same format, size, and pixels.
+  bool is_same_image(const Image* i1, const Image* i2);
+
+  // Returns a hash of the image content (equal images, as in
+  // is_same_image(), have equal hashes). It combines the hashes of
+  // bands of kImageHashBandHeight rows, so Image::getHash() can cache
+  // them and recalculate only the bands with modified rows.
+  const int kImageHashBandHeight = 16;
+  uint32_t calculate_image_hash(const Image* image);
+  uint32_t calculate_image_band_hash(const Image* image, int band);
+  uint32_t combine_image_band_hashes(const Image* image, const uint32_t* bandHashes, int bands);
+
 } // namespace raster
 
 #endif
@@ -22,6 +22,7 @@
 
 #include "raster/quantization.h"
 
+#include "base/parallel_for.h"
 #include "gfx/hsv.h"
 #include "gfx/rgb.h"
 #include "raster/blend.h"
@@ -44,15 +45,17 @@ namespace quantization {
 
 using namespace gfx;
 
-// Converts a RGB image to indexed with ordered dithering method.
-static Image* ordered_dithering(const Image* src_image,
-                                int offsetx, int offsety,
-                                const RgbMap* rgbmap,
-                                const Palette* palette);
-
-static void create_palette_from_bitmaps(const std::vector<Image*>& images, Palette* palette, bool has_background_layer);
-
-Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber)
+// Converts the given rows of a RGB image to indexed with ordered
+// dithering method.
+static void ordered_dithering(const Image* src_image,
+                              Image* dst_image,
+                              const gfx::Rect& bounds,
+                              int offsetx, int offsety,
+                              const RgbMap* rgbmap,
+                              const Palette* palette);
+
+Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber,
+                                 int refineTime)
 {
   bool has_background_layer = (sprite->getBackgroundLayer() != NULL);
   Palette* palette = new Palette(FrameNumber(0), 256);
@@ -69,55 +72,64 @@ Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber)
   sprite->render(flat_image, 0, 0, frameNumber);
 
   // Create an array of images
-  size_t nimage = images.size() + 1; // +1 for flat_image
-  std::vector<Image*> image_array(nimage);
-
-  size_t c = 0;
+  std::vector<const Image*> image_array;
   for (ImagesCollector::ItemsIterator it=images.begin(); it!=images.end(); ++it)
-    image_array[c++] = it->image();
-  image_array[c++] = flat_image; // The 'flat_image'
+    image_array.push_back(it->image());
+  image_array.push_back(flat_image); // The 'flat_image'
+
+  // If the sprite has a background layer, the first entry can be
+  // used, in other case the 0 indexed will be the mask color, so it
+  // will not be used later in the color conversion (from RGB to
+  // Indexed).
+  int first_usable_entry = (has_background_layer ? 0: 1);
 
   // Generate an optimized palette for all images
-  create_palette_from_bitmaps(image_array, palette, has_background_layer);
+  PaletteGenerator generator;
+  generator.addImages(image_array);
+  generator.createPalette(palette, first_usable_entry, refineTime);
 
   delete flat_image;
   return palette;
 }
 
-Image* convert_pixel_format(const Image* image,
-                            PixelFormat pixelFormat,
-                            DitheringMethod ditheringMethod,
-                            const RgbMap* rgbmap,
-                            const Palette* palette,
-                            bool is_background_layer)
+// Converts the given rows of "image" to "new_image" (which must be
+// created with the new pixel format). This function is called from
+// several threads at the same time for different rows.
+static void convert_rows(const Image* image,
+                         Image* new_image,
+                         const gfx::Rect& bounds,
+                         DitheringMethod ditheringMethod,
+                         const RgbMap* rgbmap,
+                         const Palette* palette,
+                         bool is_background_layer)
 {
   // RGB -> Indexed with ordered dithering
   if (image->getPixelFormat() == IMAGE_RGB &&
-      pixelFormat == IMAGE_INDEXED &&
+      new_image->getPixelFormat() == IMAGE_INDEXED &&
       ditheringMethod == DITHERING_ORDERED) {
-    return ordered_dithering(image, 0, 0, rgbmap, palette);
+    ordered_dithering(image, new_image, bounds, 0, 0, rgbmap, palette);
+    return;
   }
 
-  Image* new_image = Image::create(pixelFormat, image->getWidth(), image->getHeight());
   color_t c;
   int r, g, b;
 
   switch (image->getPixelFormat()) {
 
     case IMAGE_RGB: {
-      const LockImageBits<RgbTraits> srcBits(image);
+      const LockImageBits<RgbTraits> srcBits(image, bounds);
       LockImageBits<RgbTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
 
       switch (new_image->getPixelFormat()) {
 
         // RGB -> RGB
         case IMAGE_RGB:
-          new_image->copy(image, 0, 0);
+          ASSERT(false);            // Handled in convert_pixel_format()
           break;
 
         // RGB -> Grayscale
         case IMAGE_GRAYSCALE: {
-          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<GrayscaleTraits>::iterator dst_it = dstBits.begin(), dst_end = dstBits.end();
 
           for (; src_it != src_end; ++src_it, ++dst_it) {
@@ -136,7 +148,7 @@ Image* convert_pixel_format(const Image* image,
 
         // RGB -> Indexed
         case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin(), dst_end = dstBits.end();
 
           for (; src_it != src_end; ++src_it, ++dst_it) {
@@ -160,14 +172,14 @@ Image* convert_pixel_format(const Image* image,
     }
 
     case IMAGE_GRAYSCALE: {
-      const LockImageBits<GrayscaleTraits> srcBits(image);
+      const LockImageBits<GrayscaleTraits> srcBits(image, bounds);
       LockImageBits<GrayscaleTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
 
       switch (new_image->getPixelFormat()) {
 
         // Grayscale -> RGB
         case IMAGE_RGB: {
-          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<RgbTraits>::iterator dst_it = dstBits.begin(), dst_end = dstBits.end();
 
           for (; src_it != src_end; ++src_it, ++dst_it) {
@@ -184,12 +196,12 @@ Image* convert_pixel_format(const Image* image,
 
         // Grayscale -> Grayscale
         case IMAGE_GRAYSCALE:
-          new_image->copy(image, 0, 0);
+          ASSERT(false);            // Handled in convert_pixel_format()
           break;
 
         // Grayscale -> Indexed
         case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin(), dst_end = dstBits.end();
 
           for (; src_it != src_end; ++src_it, ++dst_it) {
@@ -209,14 +221,14 @@ Image* convert_pixel_format(const Image* image,
     }
 
     case IMAGE_INDEXED: {
-      const LockImageBits<IndexedTraits> srcBits(image);
+      const LockImageBits<IndexedTraits> srcBits(image, bounds);
       LockImageBits<IndexedTraits>::const_iterator src_it = srcBits.begin(), src_end = srcBits.end();
 
       switch (new_image->getPixelFormat()) {
 
         // Indexed -> RGB
         case IMAGE_RGB: {
-          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<RgbTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<RgbTraits>::iterator dst_it = dstBits.begin(), dst_end = dstBits.end();
 
           for (; src_it != src_end; ++src_it, ++dst_it) {
@@ -236,7 +248,7 @@ Image* convert_pixel_format(const Image* image,
 
         // Indexed -> Grayscale
         case IMAGE_GRAYSCALE: {
-          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<GrayscaleTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<GrayscaleTraits>::iterator dst_it = dstBits.begin(), dst_end = dstBits.end();
 
           for (; src_it != src_end; ++src_it, ++dst_it) {
@@ -260,7 +272,7 @@ Image* convert_pixel_format(const Image* image,
 
         // Indexed -> Indexed
         case IMAGE_INDEXED: {
-          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock);
+          LockImageBits<IndexedTraits> dstBits(new_image, Image::WriteLock, bounds);
           LockImageBits<IndexedTraits>::iterator dst_it = dstBits.begin(), dst_end = dstBits.end();
           color_t dstMaskColor = new_image->getMaskColor();
 
@@ -287,7 +299,136 @@ Image* convert_pixel_format(const Image* image,
     }
   }
 
-  return new_image;
+}
+
+
+namespace {
+
+  // Rows of an image converted by one thread.
+  struct ConversionBand {
+    int image;
+    int y1, y2;
+  };
+
+  // Height of each band of rows (in pixels).
+  const int kConversionBandHeight = 64;
+
+  // Minimum number of pixels to convert to use several threads.
+  const int kMinParallelPixels = 256*256;
+
+  class ConvertBands {
+  public:
+    ConvertBands(const std::vector<ConversionBand>& bands,
+                 const std::vector<const Image*>& images,
+                 const std::vector<bool>& is_background_layer,
+                 const std::vector<Image*>& new_images,
+                 DitheringMethod ditheringMethod,
+                 const RgbMap* rgbmap,
+                 const Palette* palette)
+      : m_bands(bands)
+      , m_images(images)
+      , m_is_background_layer(is_background_layer)
+      , m_new_images(new_images)
+      , m_ditheringMethod(ditheringMethod)
+      , m_rgbmap(rgbmap)
+      , m_palette(palette) {
+    }
+
+    // Called from base::parallel_for()
+    void operator()(int i) const {
+      const ConversionBand& band = m_bands[i];
+      const Image* image = m_images[band.image];
+
+      convert_rows(image, m_new_images[band.image],
+                   gfx::Rect(0, band.y1, image->getWidth(), band.y2 - band.y1),
+                   m_ditheringMethod, m_rgbmap, m_palette,
+                   m_is_background_layer[band.image]);
+    }
+
+  private:
+    const std::vector<ConversionBand>& m_bands;
+    const std::vector<const Image*>& m_images;
+    const std::vector<bool>& m_is_background_layer;
+    const std::vector<Image*>& m_new_images;
+    DitheringMethod m_ditheringMethod;
+    const RgbMap* m_rgbmap;
+    const Palette* m_palette;
+  };
+
+} // anonymous namespace
+
+Image* convert_pixel_format(const Image* image,
+                            PixelFormat pixelFormat,
+                            DitheringMethod ditheringMethod,
+                            const RgbMap* rgbmap,
+                            const Palette* palette,
+                            bool is_background_layer)
+{
+  std::vector<const Image*> images(1, image);
+  std::vector<bool> is_background(1, is_background_layer);
+  std::vector<Image*> new_images;
+
+  convert_pixel_format(images, is_background, pixelFormat,
+                       ditheringMethod, rgbmap, palette, new_images);
+
+  return new_images[0];
+}
+
+void convert_pixel_format(const std::vector<const Image*>& images,
+                          const std::vector<bool>& is_background_layer,
+                          PixelFormat pixelFormat,
+                          DitheringMethod ditheringMethod,
+                          const RgbMap* rgbmap,
+                          const Palette* palette,
+                          std::vector<Image*>& new_images)
+{
+  ASSERT(images.size() == is_background_layer.size());
+
+  std::vector<ConversionBand> bands;
+  int pixels = 0;
+
+  new_images.resize(images.size(), NULL);
+  try {
+    for (int i=0; i<(int)images.size(); ++i) {
+      const Image* image = images[i];
+      Image* new_image = Image::create(pixelFormat, image->getWidth(), image->getHeight());
+      new_images[i] = new_image;
+
+      // Same pixel format
+      if (image->getPixelFormat() == pixelFormat &&
+          pixelFormat != IMAGE_INDEXED) {
+        new_image->copy(image, 0, 0);
+        continue;
+      }
+
+      for (int y=0; y<image->getHeight(); y+=kConversionBandHeight) {
+        ConversionBand band;
+        band.image = i;
+        band.y1 = y;
+        band.y2 = MIN(y+kConversionBandHeight, image->getHeight());
+        bands.push_back(band);
+      }
+      pixels = MIN(pixels + image->getWidth() * image->getHeight(),
+                   kMinParallelPixels);
+    }
+
+    // Rows are converted in parallel. The RgbMap must be completely
+    // calculated before it's used from several threads.
+    bool parallel = (pixels >= kMinParallelPixels);
+    if (parallel && rgbmap && pixelFormat == IMAGE_INDEXED)
+      rgbmap->regenerateAll();
+
+    base::parallel_for(0, (int)bands.size(),
+                       ConvertBands(bands, images, is_background_layer, new_images,
+                                    ditheringMethod, rgbmap, palette),
+                       (parallel ? 0: 1));
+  }
+  catch (...) {
+    for (int i=0; i<(int)new_images.size(); ++i)
+      delete new_images[i];
+    new_images.clear();
+    throw;
+  }
 }
 
 /* Based on Gary Oberbrunner: */
@@ -321,13 +462,14 @@ static int pattern[8][8] = {
                                  4 * ((g1)-(g2)) * ((g1)-(g2)) +        \
                                  2 * ((b1)-(b2)) * ((b1)-(b2)))
 
-static Image* ordered_dithering(const Image* src_image,
-                                int offsetx, int offsety,
-                                const RgbMap* rgbmap,
-                                const Palette* palette)
+static void ordered_dithering(const Image* src_image,
+                              Image* dst_image,
+                              const gfx::Rect& bounds,
+                              int offsetx, int offsety,
+                              const RgbMap* rgbmap,
+                              const Palette* palette)
 {
   int oppr, oppg, oppb, oppnrcm;
-  Image *dst_image;
   int dither_const;
   int nr, ng, nb;
   int r, g, b, a;
@@ -335,28 +477,43 @@ static Image* ordered_dithering(const Image* src_image,
   int x, y;
   color_t c;
 
-  dst_image = Image::create(IMAGE_INDEXED, src_image->getWidth(), src_image->getHeight());
-  if (!dst_image)
-    return NULL;
+  // Result of the last color, consecutive pixels usually have the
+  // same color so we can avoid the RgbMap lookups.
+  color_t last_color = 0;
+  int last_nearestcm = 0;
+  int last_oppnrcm = 0;
+  int last_dither_const = 0;
 
-  const LockImageBits<RgbTraits> src_bits(src_image);
-  LockImageBits<IndexedTraits> dst_bits(dst_image);
+  // Row of the dither pattern for the current line
+  int thresholds[8];
+
+  const LockImageBits<RgbTraits> src_bits(src_image, bounds);
+  LockImageBits<IndexedTraits> dst_bits(dst_image, Image::WriteLock, bounds);
   LockImageBits<RgbTraits>::const_iterator src_it = src_bits.begin();
   LockImageBits<IndexedTraits>::iterator dst_it = dst_bits.begin();
 
-  for (y=0; y<src_image->getHeight(); ++y) {
-    for (x=0; x<src_image->getWidth(); ++x, ++src_it, ++dst_it) {
+  for (y=bounds.y; y<bounds.y+bounds.h; ++y) {
+    for (x=0; x<8; ++x)
+      thresholds[x] = pattern[(x+offsetx) & 7][(y+offsety) & 7];
+
+    for (x=bounds.x; x<bounds.x+bounds.w; ++x, ++src_it, ++dst_it) {
       ASSERT(src_it != src_bits.end());
       ASSERT(dst_it != dst_bits.end());
 
       c = *src_it;
-
-      r = rgba_getr(c);
-      g = rgba_getg(c);
-      b = rgba_getb(c);
       a = rgba_geta(c);
 
-      if (a != 0) {
+      if (a == 0) {
+        *dst_it = 0;
+        continue;
+      }
+
+      c |= 0xff000000;
+      if (c != last_color) {
+        r = rgba_getr(c);
+        g = rgba_getg(c);
+        b = rgba_getb(c);
+
         nearestcm = rgbmap->mapColor(r, g, b);
         /* rgb values for nearest color */
         nr = rgba_getr(palette->getEntry(nearestcm));
@@ -376,6 +533,7 @@ static Image* ordered_dithering(const Image* src_image,
            some triangulation error can be introduced.  In the worst
            case the r-nr distance can actually be less than the nr-oppr
            distance. */
+        dither_const = 0;
         if (oppnrcm != nearestcm) {
           oppr = rgba_getr(palette->getEntry(oppnrcm));
           oppg = rgba_getg(palette->getEntry(oppnrcm));
@@ -385,41 +543,44 @@ static Image* ordered_dithering(const Image* src_image,
           if (dither_const != 0) {
             dither_const = 64 * DIST(r, g, b, nr, ng, nb) / dither_const;
             dither_const = MIN(63, dither_const);
-
-            if (pattern[(x+offsetx) & 7][(y+offsety) & 7] < dither_const)
-              nearestcm = oppnrcm;
           }
         }
+
+        last_color = c;
+        last_nearestcm = nearestcm;
+        last_oppnrcm = oppnrcm;
+        last_dither_const = dither_const;
       }
-      else
-        nearestcm = 0;
 
-      *dst_it = nearestcm;
+      // The dither_const is 0 when the color isn't dithered (and
+      // thresholds are never less than 0).
+      if (thresholds[x & 7] < last_dither_const)
+        *dst_it = last_oppnrcm;
+      else
+        *dst_it = last_nearestcm;
     }
   }
-
-  return dst_image;
 }
 
 //////////////////////////////////////////////////////////////////////
 // Creation of optimized palette for RGB images
 // by David Capello
 
-static void create_palette_from_bitmaps(const std::vector<Image*>& images, Palette* palette, bool has_background_layer)
-{
-  quantization::ColorHistogram<5, 6, 5> histogram;
-  uint32_t color;
+typedef ColorHistogram<5, 6, 5> PaletteHistogram;
 
-  // If the sprite has a background layer, the first entry can be
-  // used, in other case the 0 indexed will be the mask color, so it
-  // will not be used later in the color conversion (from RGB to
-  // Indexed).
-  int first_usable_entry = (has_background_layer ? 0: 1);
+class PaletteGeneratorImpl {
+public:
+  PaletteHistogram histogram;
+};
 
-  for (int i=0; i<(int)images.size(); ++i) {
-    const Image* image = images[i];
-    const LockImageBits<RgbTraits> bits(image);
+namespace {
+
+  void add_rows_to_histogram(const Image* image, const gfx::Rect& bounds,
+                             PaletteHistogram& histogram)
+  {
+    const LockImageBits<RgbTraits> bits(image, bounds);
     LockImageBits<RgbTraits>::const_iterator it = bits.begin(), end = bits.end();
+    uint32_t color;
 
     for (; it != end; ++it) {
       color = *it;
@@ -431,8 +592,105 @@ static void create_palette_from_bitmaps(const std::vector<Image*>& images, Palet
     }
   }
 
-  int used_colors = histogram.createOptimizedPalette(palette, first_usable_entry, 255);
-  //palette->resize(first_usable_entry+used_colors);   // TODO
+  // Each thread adds some bands of rows to its own histogram.
+  class FillHistograms {
+  public:
+    FillHistograms(const std::vector<ConversionBand>& bands,
+                   const std::vector<const Image*>& images,
+                   const std::vector<PaletteHistogram*>& histograms)
+      : m_bands(bands)
+      , m_images(images)
+      , m_histograms(histograms) {
+    }
+
+    // Called from base::parallel_for()
+    void operator()(int t) const {
+      for (int i=t; i<(int)m_bands.size(); i+=(int)m_histograms.size()) {
+        const ConversionBand& band = m_bands[i];
+        const Image* image = m_images[band.image];
+
+        add_rows_to_histogram(image,
+                              gfx::Rect(0, band.y1, image->getWidth(), band.y2 - band.y1),
+                              *m_histograms[t]);
+      }
+    }
+
+  private:
+    const std::vector<ConversionBand>& m_bands;
+    const std::vector<const Image*>& m_images;
+    const std::vector<PaletteHistogram*>& m_histograms;
+  };
+
+} // anonymous namespace
+
+PaletteGenerator::PaletteGenerator()
+  : m_impl(new PaletteGeneratorImpl)
+{
+}
+
+PaletteGenerator::~PaletteGenerator()
+{
+  delete m_impl;
+}
+
+void PaletteGenerator::addImage(const Image* image)
+{
+  addImages(std::vector<const Image*>(1, image));
+}
+
+void PaletteGenerator::addImages(const std::vector<const Image*>& images)
+{
+  std::vector<ConversionBand> bands;
+  int pixels = 0;
+
+  for (int i=0; i<(int)images.size(); ++i) {
+    const Image* image = images[i];
+    ASSERT(image->getPixelFormat() == IMAGE_RGB);
+
+    for (int y=0; y<image->getHeight(); y+=kConversionBandHeight) {
+      ConversionBand band;
+      band.image = i;
+      band.y1 = y;
+      band.y2 = MIN(y+kConversionBandHeight, image->getHeight());
+      bands.push_back(band);
+    }
+    pixels = MIN(pixels + image->getWidth() * image->getHeight(),
+                 kMinParallelPixels);
+  }
+
+  int nthreads = (pixels >= kMinParallelPixels ? base::thread::hardware_concurrency(): 1);
+  nthreads = MIN(nthreads, (int)bands.size());
+
+  if (nthreads <= 1) {
+    std::vector<PaletteHistogram*> histograms(1, &m_impl->histogram);
+    FillHistograms(bands, images, histograms)(0);
+    return;
+  }
+
+  // Each thread uses its own histogram (then they are merged).
+  std::vector<PaletteHistogram*> histograms;
+  try {
+    for (int t=0; t<nthreads; ++t)
+      histograms.push_back(new PaletteHistogram);
+
+    base::parallel_for(0, nthreads, FillHistograms(bands, images, histograms), nthreads);
+
+    for (int t=0; t<nthreads; ++t)
+      m_impl->histogram.addHistogram(*histograms[t]);
+  }
+  catch (...) {
+    for (int t=0; t<(int)histograms.size(); ++t)
+      delete histograms[t];
+    throw;
+  }
+
+  for (int t=0; t<nthreads; ++t)
+    delete histograms[t];
+}
+
+int PaletteGenerator::createPalette(Palette* palette, int first_usable_entry, int refineTime)
+{
+  return m_impl->histogram.createOptimizedPalette(palette, first_usable_entry, 255, refineTime);
 }
 
 } // namespace quantization
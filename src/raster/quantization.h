@@ -20,10 +20,13 @@
 #define RASTER_QUANTIZATION_H_INCLUDED
 #pragma once
 
+#include "base/disable_copying.h"
 #include "raster/dithering_method.h"
 #include "raster/frame_number.h"
 #include "raster/pixel_format.h"
 
+#include <vector>
+
 namespace raster {
 
   class Image;
@@ -34,8 +37,38 @@ namespace raster {
 
   namespace quantization {
 
+    // Default number of milliseconds used to refine the median-cut
+    // colors with k-means when an optimized palette is created.
+    enum { DefaultRefineTime = 250 };
+
+    // Collects the colors of RGB images to create an optimized
+    // palette. Big images are processed with several threads (each
+    // one fills its own histogram, and then they are merged).
+    class PaletteGenerator {
+    public:
+      PaletteGenerator();
+      ~PaletteGenerator();
+
+      void addImage(const Image* image);
+      void addImages(const std::vector<const Image*>& images);
+
+      // Creates the entries from "first_usable_entry" to 255 of the
+      // palette with the more important colors of the added images.
+      // The median-cut colors are refined with k-means for
+      // "refineTime" milliseconds (0 means no refinement). Returns the
+      // number of used entries.
+      int createPalette(Palette* palette, int first_usable_entry,
+                        int refineTime = DefaultRefineTime);
+
+    private:
+      class PaletteGeneratorImpl* m_impl;
+
+      DISABLE_COPYING(PaletteGenerator);
+    };
+
     // Creates a new palette suitable to quantize the given RGB sprite to Indexed color.
-    Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber);
+    Palette* create_palette_from_rgb(const Sprite* sprite, FrameNumber frameNumber,
+                                     int refineTime = DefaultRefineTime);
 
     // Changes the image pixel format. The dithering method is used only
     // when you want to convert from RGB to Indexed.
@@ -46,6 +79,19 @@ namespace raster {
                                 const Palette* palette,
                                 bool is_background_layer);
 
+    // Changes the pixel format of several images at the same time
+    // (e.g. all the images of a sprite). Rows of all images are
+    // converted in parallel. "is_background_layer" must contain one
+    // element for each image. The new images are returned in
+    // "new_images" in the same order.
+    void convert_pixel_format(const std::vector<const Image*>& images,
+                              const std::vector<bool>& is_background_layer,
+                              PixelFormat pixelFormat,
+                              DitheringMethod ditheringMethod,
+                              const RgbMap* rgbmap,
+                              const Palette* palette,
+                              std::vector<Image*>& new_images);
+
   } // namespace quantization
 } // namespace raster
 
@@ -0,0 +1,133 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "raster/image.h"
+#include "raster/palette.h"
+#include "raster/primitives.h"
+#include "raster/quantization.h"
+#include "raster/rgbmap.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace raster;
+
+static Image* create_random_rgb_image(int w, int h)
+{
+  Image* image = Image::create(IMAGE_RGB, w, h);
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      // Runs of pixels with the same color
+      if (x > 0 && (std::rand() % 3) == 0)
+        put_pixel(image, x, y, get_pixel(image, x-1, y));
+      else
+        put_pixel(image, x, y, rgba(std::rand() % 256,
+                                    std::rand() % 256,
+                                    std::rand() % 256,
+                                    (std::rand() % 4) == 0 ? 0: 255));
+    }
+  return image;
+}
+
+TEST(Quantization, PaletteColorsToIndexed)
+{
+  Palette pal(FrameNumber(0), 4);
+  pal.setEntry(0, rgba(0, 0, 0, 255));
+  pal.setEntry(1, rgba(255, 0, 0, 255));
+  pal.setEntry(2, rgba(0, 255, 0, 255));
+  pal.setEntry(3, rgba(0, 0, 255, 255));
+
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal);
+
+  base::UniquePtr<Image> src(Image::create(IMAGE_RGB, 300, 300));
+  for (int y=0; y<300; ++y)
+    for (int x=0; x<300; ++x)
+      put_pixel(src, x, y, (x+y) % 5 == 4 ? 0: pal.getEntry(1 + (x+y) % 5 % 3));
+
+  for (int dithering=0; dithering<2; ++dithering) {
+    base::UniquePtr<Image> dst(
+      quantization::convert_pixel_format(src, IMAGE_INDEXED,
+                                         dithering ? DITHERING_ORDERED: DITHERING_NONE,
+                                         &rgbmap, &pal, false));
+
+    for (int y=0; y<300; ++y)
+      for (int x=0; x<300; ++x) {
+        color_t c = get_pixel(src, x, y);
+        if (rgba_geta(c) == 0)
+          ASSERT_EQ(0, get_pixel(dst, x, y));
+        else
+          ASSERT_EQ(c, pal.getEntry(get_pixel(dst, x, y)));
+      }
+  }
+}
+
+TEST(Quantization, SeveralImages)
+{
+  std::srand(1);
+
+  Palette pal(FrameNumber(0), 256);
+  for (int i=0; i<256; ++i)
+    pal.setEntry(i, rgba(std::rand() % 256, std::rand() % 256, std::rand() % 256, 255));
+
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal);
+
+  std::vector<const Image*> images;
+  std::vector<bool> is_background;
+  for (int i=0; i<8; ++i) {
+    images.push_back(create_random_rgb_image(50 + 40*i, 200 - 20*i));
+    is_background.push_back(i == 0);
+  }
+
+  for (int dithering=0; dithering<2; ++dithering) {
+    DitheringMethod method = (dithering ? DITHERING_ORDERED: DITHERING_NONE);
+
+    std::vector<Image*> new_images;
+    quantization::convert_pixel_format(images, is_background, IMAGE_INDEXED,
+                                       method, &rgbmap, &pal, new_images);
+    ASSERT_EQ(images.size(), new_images.size());
+
+    for (int i=0; i<(int)images.size(); ++i) {
+      base::UniquePtr<Image> expected(
+        quantization::convert_pixel_format(images[i], IMAGE_INDEXED, method,
+                                           &rgbmap, &pal, is_background[i]));
+
+      ASSERT_EQ(IMAGE_INDEXED, new_images[i]->getPixelFormat());
+      ASSERT_EQ(0, count_diff_between_images(expected, new_images[i]));
+      delete new_images[i];
+    }
+  }
+
+  for (int i=0; i<(int)images.size(); ++i)
+    delete images[i];
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -92,6 +92,34 @@ TEST(ResizeImage, NearestNeighborInterp)
   ASSERT_TRUE(compare_images(dst, test_dst)) << "resize_image() result does not match test image!";
 }
 
+TEST(ResizeImage, BilinearInterpRGBMiddle)
+{
+  color_t data[2] = { rgba(0, 0, 0, 255), rgba(255, 255, 255, 255) };
+  Image* src = create_image_from_data(IMAGE_RGB, data, 2, 1);
+  Image* dst = Image::create(IMAGE_RGB, 3, 1);
+
+  algorithm::resize_image(src, dst, algorithm::RESIZE_METHOD_BILINEAR, NULL, NULL);
+
+  EXPECT_EQ(rgba(0, 0, 0, 255), dst->getPixel(0, 0));
+  EXPECT_EQ(rgba(127, 127, 127, 255), dst->getPixel(1, 0));
+  EXPECT_EQ(rgba(255, 255, 255, 255), dst->getPixel(2, 0));
+}
+
+TEST(ResizeImage, BoxDownscale)
+{
+  color_t data[8] = {
+    rgba(0, 0, 0, 255), rgba(255, 255, 255, 255), rgba(10, 20, 30, 0), rgba(10, 20, 30, 0),
+    rgba(0, 0, 0, 255), rgba(255, 255, 255, 255), rgba(10, 20, 30, 0), rgba(30, 40, 50, 255)
+  };
+  Image* src = create_image_from_data(IMAGE_RGB, data, 4, 2);
+  Image* dst = Image::create(IMAGE_RGB, 2, 1);
+
+  algorithm::resize_image(src, dst, algorithm::RESIZE_METHOD_BOX, NULL, NULL);
+
+  EXPECT_EQ(rgba(128, 128, 128, 255), dst->getPixel(0, 0));
+  EXPECT_EQ(rgba(15, 25, 35, 64), dst->getPixel(1, 0));
+}
+
 #if 0                           // TODO complete this test
 TEST(ResizeImage, BilinearInterpRGBType)
 {
@@ -22,23 +22,162 @@
 
 #include "raster/rgbmap.h"
 
-#include "raster/conversion_alleg.h"
+#include "base/parallel_for.h"
 #include "raster/palette.h"
 
-#include <allegro.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 namespace raster {
 
+// Weights of each component to calculate the distance between two
+// colors (the same weights used by Palette::findBestfit()).
+static const int kWeights[3] = { 30, 59, 11 };
+
+// k-d tree of palette entries to find the nearest entry of a color.
+// Nodes are stored as an implicit balanced tree: the node of the
+// range [lo, hi) is the element in the middle, and its children are
+// the ranges [lo, mid) and [mid+1, hi).
+class PaletteKdTree {
+public:
+  // Adds the entries from "firstIndex" to the end of the palette.
+  void build(const Palette* palette, int firstIndex) {
+    m_points.clear();
+    for (int i=firstIndex; i<palette->size(); ++i) {
+      color_t c = palette->getEntry(i);
+      Point pt;
+      pt.c[0] = rgba_getr(c) * kWeights[0];
+      pt.c[1] = rgba_getg(c) * kWeights[1];
+      pt.c[2] = rgba_getb(c) * kWeights[2];
+      pt.index = i;
+      pt.axis = 0;
+      m_points.push_back(pt);
+    }
+    buildRange(0, (int)m_points.size());
+  }
+
+  bool empty() const {
+    return m_points.empty();
+  }
+
+  // Returns the palette index of the nearest entry (the lowest index
+  // if there are several entries at the same distance).
+  int findNearest(int r, int g, int b) const {
+    ASSERT(!m_points.empty());
+
+    int q[3] = { r * kWeights[0], g * kWeights[1], b * kWeights[2] };
+    int bestIndex = -1;
+    int bestDist = 0;
+    search(0, (int)m_points.size(), q, bestIndex, bestDist);
+    return bestIndex;
+  }
+
+private:
+  struct Point {
+    int c[3];
+    int index;
+    int axis;
+  };
+
+  class CompareAxis {
+  public:
+    CompareAxis(int axis) : m_axis(axis) { }
+    bool operator()(const Point& a, const Point& b) const {
+      return a.c[m_axis] < b.c[m_axis];
+    }
+  private:
+    int m_axis;
+  };
+
+  void buildRange(int lo, int hi) {
+    if (hi - lo <= 1)
+      return;
+
+    // Split the axis with the largest spread.
+    int axis = 0, spread = -1;
+    for (int k=0; k<3; ++k) {
+      int min = m_points[lo].c[k], max = min;
+      for (int i=lo+1; i<hi; ++i) {
+        min = MIN(min, m_points[i].c[k]);
+        max = MAX(max, m_points[i].c[k]);
+      }
+      if (max - min > spread) {
+        spread = max - min;
+        axis = k;
+      }
+    }
+
+    int mid = (lo + hi) / 2;
+    std::nth_element(m_points.begin()+lo,
+                     m_points.begin()+mid,
+                     m_points.begin()+hi, CompareAxis(axis));
+    m_points[mid].axis = axis;
+
+    buildRange(lo, mid);
+    buildRange(mid+1, hi);
+  }
+
+  void search(int lo, int hi, const int q[3], int& bestIndex, int& bestDist) const {
+    if (lo >= hi)
+      return;
+
+    int mid = (lo + hi) / 2;
+    const Point& pt = m_points[mid];
+
+    int dist = 0;
+    for (int k=0; k<3; ++k) {
+      int d = q[k] - pt.c[k];
+      dist += d*d;
+    }
+    if (bestIndex < 0 || dist < bestDist ||
+        (dist == bestDist && pt.index < bestIndex)) {
+      bestIndex = pt.index;
+      bestDist = dist;
+    }
+
+    if (hi - lo == 1)
+      return;
+
+    // Nearest side first. The other side is visited if it can contain
+    // an entry at the same distance (to get the lowest index on ties).
+    int d = q[pt.axis] - pt.c[pt.axis];
+    if (d < 0) {
+      search(lo, mid, q, bestIndex, bestDist);
+      if (d*d <= bestDist)
+        search(mid+1, hi, q, bestIndex, bestDist);
+    }
+    else {
+      search(mid+1, hi, q, bestIndex, bestDist);
+      if (d*d <= bestDist)
+        search(lo, mid, q, bestIndex, bestDist);
+    }
+  }
+
+  std::vector<Point> m_points;
+};
+
 class RgbMapImpl {
 public:
-  RgbMapImpl() {
-    m_allegMap = new RGB_MAP;
-    m_palette = NULL;
-    m_modifications = 0;
+  // The table is divided in chunks of 2^kChunkBits cells, which are
+  // allocated when they are used for the first time.
+  enum { kChunkBits = 12 };
+
+  RgbMapImpl(int bits)
+    : m_bits(bits)
+    , m_chunks(1 << (3*bits - kChunkBits), (uint8_t*)NULL)
+    , m_complete(false)
+    , m_palette(NULL)
+    , m_modifications(0) {
+    ASSERT(bits >= 5 && bits <= 8);
   }
 
   ~RgbMapImpl() {
-    delete m_allegMap;
+    destroyChunks();
+  }
+
+  int getPrecision() const {
+    return m_bits;
   }
 
   bool match(const Palette* palette) const {
@@ -50,37 +189,122 @@ public:
     m_palette = palette;
     m_modifications = palette->getModifications();
 
-    PALETTE allegPal;
-    convert_palette_to_allegro(palette, allegPal);
-    create_rgb_table(m_allegMap, allegPal, NULL);
-
-    for (int r=0; r<32; ++r)
-      for (int g=0; g<32; ++g)
-        for (int b=0; b<32; ++b) {
-          if (m_allegMap->data[r][g][b] >= palette->size())
-            m_allegMap->data[r][g][b] = palette->findBestfit(_rgb_scale_5[r],
-                                                             _rgb_scale_5[g],
-                                                             _rgb_scale_5[b]);
-        }
+    // The entry 0 is used only if it's the only one.
+    m_tree.build(palette, palette->size() > 1 ? 1: 0);
+
+    destroyChunks();
+    m_complete = false;
+  }
+
+  void regenerateAll() const;
+
+  // Calculates all cells of the chunk "i".
+  void fillChunk(int i) const {
+    uint8_t* chunk = m_chunks[i];
+    if (!chunk)
+      chunk = m_chunks[i] = createChunk();
+
+    int max = (1 << m_bits) - 1;
+    int mask = (1 << m_bits) - 1;
+    for (int j=0; j<(1 << kChunkBits); ++j) {
+      int cell = (i << kChunkBits) | j;
+      int r = (cell >> (2*m_bits)) & mask;
+      int g = (cell >> m_bits) & mask;
+      int b = cell & mask;
+      chunk[j] = m_tree.findNearest(r * 255 / max,
+                                    g * 255 / max,
+                                    b * 255 / max);
+    }
   }
 
   int mapColor(int r, int g, int b) const {
     ASSERT(r >= 0 && r < 256);
     ASSERT(g >= 0 && g < 256);
     ASSERT(b >= 0 && b < 256);
-    return m_allegMap->data[r>>3][g>>3][b>>3];
+
+    if (m_tree.empty())
+      return 0;
+
+    int shift = 8 - m_bits;
+    r >>= shift;
+    g >>= shift;
+    b >>= shift;
+
+    int cell = (((r << m_bits) | g) << m_bits) | b;
+    uint8_t* chunk = m_chunks[cell >> kChunkBits];
+    if (m_complete)
+      return chunk[cell & ((1 << kChunkBits) - 1)];
+
+    if (!chunk)
+      chunk = m_chunks[cell >> kChunkBits] = createChunk();
+
+    // Cells with 0 are not calculated yet (the entry 0 is never the
+    // result, except when there is just one entry).
+    uint8_t& index = chunk[cell & ((1 << kChunkBits) - 1)];
+    if (index == 0) {
+      int max = (1 << m_bits) - 1;
+      index = m_tree.findNearest(r * 255 / max,
+                                 g * 255 / max,
+                                 b * 255 / max);
+    }
+    return index;
   }
 
 private:
-  RGB_MAP* m_allegMap;
+  static uint8_t* createChunk() {
+    uint8_t* chunk = new uint8_t[1 << kChunkBits];
+    std::memset(chunk, 0, 1 << kChunkBits);
+    return chunk;
+  }
+
+  void destroyChunks() {
+    for (size_t i=0; i<m_chunks.size(); ++i) {
+      delete[] m_chunks[i];
+      m_chunks[i] = NULL;
+    }
+  }
+
+  int m_bits;
+  PaletteKdTree m_tree;
+  mutable std::vector<uint8_t*> m_chunks;
+  mutable bool m_complete;
   const Palette* m_palette;
   int m_modifications;
 };
 
-RgbMap::RgbMap()
+namespace {
+
+class FillChunks {
+public:
+  FillChunks(const RgbMapImpl* impl) : m_impl(impl) { }
+
+  // Called from base::parallel_for()
+  void operator()(int i) const {
+    m_impl->fillChunk(i);
+  }
+
+private:
+  const RgbMapImpl* m_impl;
+};
+
+} // anonymous namespace
+
+void RgbMapImpl::regenerateAll() const
+{
+  if (m_complete)
+    return;
+
+  // With an empty tree mapColor() returns 0 without using the table.
+  if (!m_tree.empty())
+    base::parallel_for(0, (int)m_chunks.size(), FillChunks(this));
+
+  m_complete = true;
+}
+
+RgbMap::RgbMap(int bits)
   : Object(OBJECT_RGBMAP)
 {
-  m_impl = new RgbMapImpl;
+  m_impl = new RgbMapImpl(bits);
 }
 
 RgbMap::~RgbMap()
@@ -88,6 +312,11 @@ RgbMap::~RgbMap()
   delete m_impl;
 }
 
+int RgbMap::getPrecision() const
+{
+  return m_impl->getPrecision();
+}
+
 bool RgbMap::match(const Palette* palette) const
 {
   return m_impl->match(palette);
@@ -98,6 +327,11 @@ void RgbMap::regenerate(const Palette* palette)
   m_impl->regenerate(palette);
 }
 
+void RgbMap::regenerateAll() const
+{
+  m_impl->regenerateAll();
+}
+
 int RgbMap::mapColor(int r, int g, int b) const
 {
   return m_impl->mapColor(r, g, b);
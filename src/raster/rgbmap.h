@@ -27,14 +27,33 @@ namespace raster {
 
   class Palette;
 
+  // Maps RGB colors to the nearest palette entry (the entry 0 is not
+  // used, it's reserved for the transparent color, unless the palette
+  // has just one color).
+  //
+  // Colors are quantized to "bits" bits per channel (5 to 8) to look up
+  // a table of results. The table is filled lazily: each cell is
+  // calculated the first time it's used with a k-d tree of the palette
+  // entries, so regenerate() is cheap. As mapColor() can modify the
+  // table, it cannot be called from several threads at the same time
+  // unless regenerateAll() was called before.
   class RgbMap : public Object {
   public:
-    RgbMap();
+    enum { DefaultPrecision = 6 };
+
+    RgbMap(int bits = DefaultPrecision);
     virtual ~RgbMap();
 
+    int getPrecision() const;
+
     bool match(const Palette* palette) const;
     void regenerate(const Palette* palette);
 
+    // Calculates all cells of the table (in parallel). After this,
+    // mapColor() doesn't modify the table until the next regenerate(),
+    // so it can be used from several threads.
+    void regenerateAll() const;
+
     int mapColor(int r, int g, int b) const;
 
   private:
@@ -0,0 +1,193 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "raster/palette.h"
+#include "raster/rgbmap.h"
+
+#include <cstdlib>
+
+using namespace raster;
+
+// Brute force search with the same distance and rules used by RgbMap.
+static int nearest(const Palette* pal, int r, int g, int b)
+{
+  int best = 0, bestDist = 0;
+  for (int i=(pal->size() > 1 ? 1: 0); i<pal->size(); ++i) {
+    color_t c = pal->getEntry(i);
+    int dr = (rgba_getr(c) - r) * 30;
+    int dg = (rgba_getg(c) - g) * 59;
+    int db = (rgba_getb(c) - b) * 11;
+    int dist = dr*dr + dg*dg + db*db;
+    if (best == 0 || dist < bestDist) {
+      best = i;
+      bestDist = dist;
+    }
+  }
+  return best;
+}
+
+static void randomize_palette(Palette* pal)
+{
+  for (int i=0; i<pal->size(); ++i) {
+    // Repeat some entries to check ties
+    if (i > 2 && (std::rand() % 8) == 0)
+      pal->setEntry(i, pal->getEntry(std::rand() % i));
+    else
+      pal->setEntry(i, rgba(std::rand() % 256,
+                            std::rand() % 256,
+                            std::rand() % 256, 255));
+  }
+}
+
+TEST(RgbMap, ExactColors)
+{
+  std::srand(1);
+
+  for (int ncolors=2; ncolors<=256; ncolors*=2) {
+    Palette pal(FrameNumber(0), ncolors);
+    randomize_palette(&pal);
+
+    RgbMap rgbmap(8);
+    rgbmap.regenerate(&pal);
+    EXPECT_TRUE(rgbmap.match(&pal));
+
+    for (int i=0; i<2000; ++i) {
+      int r = std::rand() % 256;
+      int g = std::rand() % 256;
+      int b = std::rand() % 256;
+      ASSERT_EQ(nearest(&pal, r, g, b), rgbmap.mapColor(r, g, b));
+    }
+
+    // Palette entries (except the 0) are mapped to themselves (or the
+    // first entry with the same color).
+    for (int i=1; i<ncolors; ++i) {
+      color_t c = pal.getEntry(i);
+      int j = rgbmap.mapColor(rgba_getr(c), rgba_getg(c), rgba_getb(c));
+      EXPECT_EQ(c & 0xffffff, pal.getEntry(j) & 0xffffff);
+      EXPECT_LE(j, i);
+    }
+  }
+}
+
+TEST(RgbMap, Precision)
+{
+  std::srand(2);
+
+  Palette pal(FrameNumber(0), 64);
+  randomize_palette(&pal);
+
+  for (int bits=5; bits<=8; ++bits) {
+    RgbMap rgbmap(bits);
+    rgbmap.regenerate(&pal);
+    EXPECT_EQ(bits, rgbmap.getPrecision());
+
+    // Colors in the same cell are mapped to the nearest entry of
+    // the cell's color.
+    int max = (1 << bits) - 1;
+    int shift = 8 - bits;
+    for (int i=0; i<500; ++i) {
+      int r = std::rand() % 256;
+      int g = std::rand() % 256;
+      int b = std::rand() % 256;
+      EXPECT_EQ(nearest(&pal,
+                        (r >> shift) * 255 / max,
+                        (g >> shift) * 255 / max,
+                        (b >> shift) * 255 / max),
+                rgbmap.mapColor(r, g, b));
+    }
+  }
+}
+
+TEST(RgbMap, Regenerate)
+{
+  Palette pal(FrameNumber(0), 3);
+  pal.setEntry(0, rgba(0, 0, 0, 255));
+  pal.setEntry(1, rgba(255, 255, 255, 255));
+  pal.setEntry(2, rgba(255, 0, 0, 255));
+
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal);
+
+  // The entry 0 is never used
+  EXPECT_EQ(2, rgbmap.mapColor(0, 0, 0));
+  EXPECT_EQ(1, rgbmap.mapColor(250, 250, 250));
+  EXPECT_EQ(2, rgbmap.mapColor(250, 10, 10));
+
+  pal.setEntry(2, rgba(0, 0, 0, 255));
+  EXPECT_FALSE(rgbmap.match(&pal));
+  rgbmap.regenerate(&pal);
+  EXPECT_EQ(2, rgbmap.mapColor(0, 0, 0));
+  EXPECT_EQ(2, rgbmap.mapColor(250, 10, 10));
+
+  // Just one color
+  pal.resize(1);
+  rgbmap.regenerate(&pal);
+  EXPECT_EQ(0, rgbmap.mapColor(250, 10, 10));
+}
+
+TEST(RgbMap, RegenerateAll)
+{
+  std::srand(3);
+
+  Palette pal(FrameNumber(0), 32);
+  randomize_palette(&pal);
+
+  for (int bits=5; bits<=7; ++bits) {
+    RgbMap lazy(bits), full(bits);
+    lazy.regenerate(&pal);
+    full.regenerate(&pal);
+    full.regenerateAll();
+
+    // Every cell of the complete table is equal to the lazy result.
+    int step = 1 << (8 - bits);
+    for (int r=0; r<256; r+=step)
+      for (int g=0; g<256; g+=step)
+        for (int b=0; b<256; b+=step)
+          ASSERT_EQ(lazy.mapColor(r, g, b), full.mapColor(r, g, b));
+  }
+
+  // regenerate() discards the complete table.
+  RgbMap rgbmap;
+  rgbmap.regenerate(&pal);
+  rgbmap.regenerateAll();
+
+  pal.setEntry(5, rgba(1, 2, 3, 255));
+  rgbmap.regenerate(&pal);
+  EXPECT_EQ(nearest(&pal, 0, 0, 0), rgbmap.mapColor(0, 0, 0));
+  rgbmap.regenerateAll();
+  EXPECT_EQ(nearest(&pal, 0, 0, 0), rgbmap.mapColor(0, 0, 0));
+
+  // Just one color
+  pal.resize(1);
+  rgbmap.regenerate(&pal);
+  rgbmap.regenerateAll();
+  EXPECT_EQ(0, rgbmap.mapColor(250, 10, 10));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
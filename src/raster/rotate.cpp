@@ -11,15 +11,16 @@
 #include "config.h"
 #endif
 
+#include "base/parallel_for.h"
 #include "raster/blend.h"
 #include "raster/image.h"
-#include "raster/image_bits.h"
 #include "raster/primitives.h"
 #include "raster/primitives_fast.h"
 
 #include <allegro.h>
 #include <allegro/internal/aintern.h>
 #include <math.h>
+#include <vector>
 
 #ifndef _AL_SINCOS
 #if defined (__i386__) && defined (__GNUC__)
@@ -143,113 +144,172 @@ void image_parallelogram (Image *bmp, Image *sprite,
 
 // Scanline drawers.
 
-template<class Traits, class Delegate>
-static void draw_scanline(Image *bmp, Image *spr,
-  fixed l_bmp_x, int bmp_y_i,
-  fixed r_bmp_x,
-  fixed l_spr_x, fixed l_spr_y,
-  fixed spr_dx, fixed spr_dy,
-  Delegate& delegate)
-{
-  r_bmp_x >>= 16;
-  l_bmp_x >>= 16;
+// Destination pixels [x1, x2] of row "y" are filled with the source
+// pixels at (spr_x, spr_y), (spr_x+spr_dx, spr_y+spr_dy), etc.
+struct MapScanline {
+  int y, x1, x2;
+  fixed spr_x, spr_y;
 
-  delegate.lockBits(bmp, gfx::Rect(l_bmp_x, bmp_y_i, r_bmp_x - l_bmp_x + 1, 1));
+  MapScanline(int y, int x1, int x2, fixed spr_x, fixed spr_y)
+    : y(y), x1(x1), x2(x2), spr_x(spr_x), spr_y(spr_y) { }
+};
 
-  for (int x=(int)l_bmp_x; x<=(int)r_bmp_x; ++x) {
-    delegate.feedLine(spr, l_spr_x>>16, l_spr_y>>16);
+// All the scanlines to draw a parallelogram. They are collected first
+// so they can be drawn from several threads.
+struct MapScanlines {
+  fixed spr_dx, spr_dy;
+  std::vector<MapScanline> items;
+};
 
-    l_spr_x += spr_dx;
-    l_spr_y += spr_dy;
+// Reads the source pixels of one scanline in "buf".
+template<class Traits>
+static void fetch_scanline(const Image* spr,
+  const typename Traits::pixel_t* const* rows,
+  fixed spr_x, fixed spr_y, fixed spr_dx, fixed spr_dy,
+  int n, typename Traits::pixel_t* buf)
+{
+  int i = 0;
+
+  // Four pixels in each step
+  for (; i+3<n; i+=4) {
+    buf[i  ] = rows[ spr_y            >>16][ spr_x            >>16];
+    buf[i+1] = rows[(spr_y +   spr_dy)>>16][(spr_x +   spr_dx)>>16];
+    buf[i+2] = rows[(spr_y + 2*spr_dy)>>16][(spr_x + 2*spr_dx)>>16];
+    buf[i+3] = rows[(spr_y + 3*spr_dy)>>16][(spr_x + 3*spr_dx)>>16];
+    spr_x += 4*spr_dx;
+    spr_y += 4*spr_dy;
   }
 
-  delegate.unlockBits();
+  for (; i<n; ++i) {
+    buf[i] = rows[spr_y>>16][spr_x>>16];
+    spr_x += spr_dx;
+    spr_y += spr_dy;
+  }
 }
 
-template<class Traits>
-class GenericDelegate {
-public:
-  void lockBits(Image* bmp, const gfx::Rect& bounds) {
-    m_bits = bmp->lockBits<Traits>(Image::ReadWriteLock, bounds);
-    m_it = m_bits.begin();
-    m_end = m_bits.end();
+template<>
+void fetch_scanline<BitmapTraits>(const Image* spr,
+  const BitmapTraits::pixel_t* const* rows,
+  fixed spr_x, fixed spr_y, fixed spr_dx, fixed spr_dy,
+  int n, BitmapTraits::pixel_t* buf)
+{
+  for (int i=0; i<n; ++i) {
+    buf[i] = get_pixel_fast<BitmapTraits>(spr, spr_x>>16, spr_y>>16);
+    spr_x += spr_dx;
+    spr_y += spr_dy;
   }
+}
 
-  void unlockBits() {
-    m_bits.unlock();
-  }
+// Draws the "n" pixels of "buf" in the position x, y of "bmp".
+template<class Traits>
+static void blend_scanline(Image* bmp, int x, int y, const typename Traits::pixel_t* buf, int n,
+                           color_t mask_color);
 
-private:
-  ImageBits<Traits> m_bits;
+template<>
+void blend_scanline<RgbTraits>(Image* bmp, int x, int y, const uint32_t* buf, int n,
+                               color_t mask_color)
+{
+  uint32_t* dst = (uint32_t*)bmp->getPixelAddress(x, y);
 
-protected:
-  typename LockImageBits<Traits>::iterator m_it, m_end;
-};
+  // Transparent pixels don't modify the destination (except for the
+  // RGB values of transparent destination pixels).
+  rgba_row_blenders[BLEND_MODE_NORMAL](dst, dst, buf, n, 255, 0);
+}
 
-class RgbDelegate : public GenericDelegate<RgbTraits> {
-public:
-  RgbDelegate() {
-    m_blender = rgba_blenders[BLEND_MODE_NORMAL];
-  }
+template<>
+void blend_scanline<GrayscaleTraits>(Image* bmp, int x, int y, const uint16_t* buf, int n,
+                                     color_t mask_color)
+{
+  uint16_t* dst = (uint16_t*)bmp->getPixelAddress(x, y);
+  graya_row_blenders[BLEND_MODE_NORMAL](dst, dst, buf, n, 255, 0);
+}
 
-  void feedLine(Image* spr, int spr_x, int spr_y) {
-    ASSERT(m_it != m_end);
+template<>
+void blend_scanline<IndexedTraits>(Image* bmp, int x, int y, const uint8_t* buf, int n,
+                                   color_t mask_color)
+{
+  uint8_t* dst = bmp->getPixelAddress(x, y);
+  for (int i=0; i<n; ++i)
+    if (buf[i] != mask_color)
+      dst[i] = buf[i];
+}
 
-    *m_it = m_blender(*m_it, spr->getPixel(spr_x, spr_y), 255);
-    ++m_it;
-  }
+template<>
+void blend_scanline<BitmapTraits>(Image* bmp, int x, int y, const uint8_t* buf, int n,
+                                  color_t mask_color)
+{
+  for (int i=0; i<n; ++i)
+    if (buf[i] != 0)            // TODO
+      put_pixel_fast<BitmapTraits>(bmp, x+i, y, buf[i]);
+}
 
-private:
-  BLEND_COLOR m_blender;
-};
+const int kScanlinesPerBand = 32;
+const int kMinParallelPixels = 256*256;
 
-class GrayscaleDelegate : public GenericDelegate<GrayscaleTraits> {
+template<class Traits>
+class DrawScanlines {
 public:
-  GrayscaleDelegate() {
-    m_blender = graya_blenders[BLEND_MODE_NORMAL];
+  typedef typename Traits::pixel_t pixel_t;
+
+  DrawScanlines(Image* bmp, const Image* spr,
+                const std::vector<const pixel_t*>& rows,
+                const MapScanlines& scanlines)
+    : m_bmp(bmp)
+    , m_spr(spr)
+    , m_rows(rows)
+    , m_scanlines(scanlines) {
   }
 
-  void feedLine(Image* spr, int spr_x, int spr_y) {
-    ASSERT(m_it != m_end);
+  // Called from base::parallel_for()
+  void operator()(int band) const {
+    const std::vector<MapScanline>& items = m_scanlines.items;
+    int i = band*kScanlinesPerBand;
+    int end = MIN(i+kScanlinesPerBand, (int)items.size());
+    std::vector<pixel_t> buf(m_bmp->getWidth());
+    color_t mask_color = m_spr->getMaskColor();
+
+    for (; i<end; ++i) {
+      const MapScanline& scanline = items[i];
+      int n = scanline.x2 - scanline.x1 + 1;
+
+      fetch_scanline<Traits>(m_spr, &m_rows[0],
+        scanline.spr_x, scanline.spr_y,
+        m_scanlines.spr_dx, m_scanlines.spr_dy, n, &buf[0]);
 
-    *m_it = m_blender(*m_it, spr->getPixel(spr_x, spr_y), 255);
-    ++m_it;
+      blend_scanline<Traits>(m_bmp, scanline.x1, scanline.y, &buf[0], n, mask_color);
+    }
   }
 
 private:
-  BLEND_COLOR m_blender;
+  Image* m_bmp;
+  const Image* m_spr;
+  const std::vector<const pixel_t*>& m_rows;
+  const MapScanlines& m_scanlines;
 };
 
-class IndexedDelegate : public GenericDelegate<IndexedTraits> {
-public:
-  IndexedDelegate(color_t mask_color) :
-    m_mask_color(mask_color) {
-  }
-
-  void feedLine(Image* spr, int spr_x, int spr_y) {
-    ASSERT(m_it != m_end);
+template<class Traits>
+static void draw_scanlines(Image* bmp, const Image* spr, const MapScanlines& scanlines)
+{
+  typedef typename Traits::pixel_t pixel_t;
 
-    register int c = spr->getPixel(spr_x, spr_y);
-    if (c != m_mask_color)
-      *m_it = c;
-    ++m_it;
-  }
+  if (scanlines.items.empty())
+    return;
 
-private:
-  color_t m_mask_color;
-};
+  std::vector<const pixel_t*> rows(spr->getHeight());
+  for (int y=0; y<spr->getHeight(); ++y)
+    rows[y] = (const pixel_t*)spr->getPixelAddress(0, y);
 
-class BitmapDelegate : public GenericDelegate<BitmapTraits> {
-public:
-  void feedLine(Image* spr, int spr_x, int spr_y) {
-    ASSERT(m_it != m_end);
+  int pixels = 0;
+  for (size_t i=0; i<scanlines.items.size(); ++i)
+    pixels += scanlines.items[i].x2 - scanlines.items[i].x1 + 1;
 
-    register int c = spr->getPixel(spr_x, spr_y);
-    if (c != 0)                 // TODO
-      *m_it = c;
-    ++m_it;
-  }
-};
+  // Scanlines are in different rows of "bmp", so bands can be drawn
+  // in parallel.
+  int bands = (scanlines.items.size() + kScanlinesPerBand - 1) / kScanlinesPerBand;
+  base::parallel_for(0, bands,
+                     DrawScanlines<Traits>(bmp, spr, rows, scanlines),
+                     (pixels >= kMinParallelPixels ? 0: 1));
+}
 
 /* _parallelogram_map:
  *  Worker routine for drawing rotated and/or scaled and/or flipped sprites:
@@ -275,10 +335,9 @@ public:
  *  at least partly covered by the sprite. This is useful for doing
  *  anti-aliased blending.
  */
-template<class Traits, class Delegate>
 static void ase_parallelogram_map(
   Image *bmp, Image *spr, fixed xs[4], fixed ys[4],
-  int sub_pixel_accuracy, Delegate delegate = Delegate())
+  int sub_pixel_accuracy, MapScanlines& scanlines)
 {
   /* Index in xs[] and ys[] to topmost point. */
   int top_index;
@@ -470,6 +529,9 @@ static void ase_parallelogram_map(
                    ((xs[3] - xs[0]) * (double)(ys[1] - ys[0]) -
                     (xs[1] - xs[0]) * (double)(ys[3] - ys[0])));
 
+  scanlines.spr_dx = spr_dx;
+  scanlines.spr_dy = spr_dy;
+
   /*
    * Loop through scanlines.
    */
@@ -649,10 +711,9 @@ static void ase_parallelogram_map(
           }
         }
       }
-      draw_scanline<Traits, Delegate>(bmp, spr,
-        l_bmp_x_rounded, bmp_y_i, r_bmp_x_rounded,
-        l_spr_x_rounded, l_spr_y_rounded,
-        spr_dx, spr_dy, delegate);
+      scanlines.items.push_back(
+        MapScanline(bmp_y_i, l_bmp_x_rounded>>16, r_bmp_x_rounded>>16,
+                    l_spr_x_rounded, l_spr_y_rounded));
 
     }
     /* I'm not going to apoligize for this label and its gotos: to get
@@ -683,24 +744,27 @@ static void ase_parallelogram_map(
 static void ase_parallelogram_map_standard(Image *bmp, Image *sprite,
                                            fixed xs[4], fixed ys[4])
 {
+  ASSERT(bmp->getPixelFormat() == sprite->getPixelFormat());
+
+  MapScanlines scanlines;
+  ase_parallelogram_map(bmp, sprite, xs, ys, false, scanlines);
+
   switch (bmp->getPixelFormat()) {
 
     case IMAGE_RGB:
-      ase_parallelogram_map<RgbTraits, RgbDelegate>(bmp, sprite, xs, ys, false);
+      draw_scanlines<RgbTraits>(bmp, sprite, scanlines);
       break;
 
     case IMAGE_GRAYSCALE:
-      ase_parallelogram_map<GrayscaleTraits, GrayscaleDelegate>(bmp, sprite, xs, ys, false);
+      draw_scanlines<GrayscaleTraits>(bmp, sprite, scanlines);
       break;
 
-    case IMAGE_INDEXED: {
-      IndexedDelegate delegate(sprite->getMaskColor());
-      ase_parallelogram_map<IndexedTraits, IndexedDelegate>(bmp, sprite, xs, ys, false, delegate);
+    case IMAGE_INDEXED:
+      draw_scanlines<IndexedTraits>(bmp, sprite, scanlines);
       break;
-    }
 
     case IMAGE_BITMAP:
-      ase_parallelogram_map<BitmapTraits, BitmapDelegate>(bmp, sprite, xs, ys, false);
+      draw_scanlines<BitmapTraits>(bmp, sprite, scanlines);
       break;
   }
 }
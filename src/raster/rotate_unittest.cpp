@@ -0,0 +1,155 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "raster/image.h"
+#include "raster/primitives.h"
+#include "raster/primitives_fast.h"
+#include "raster/rotate.h"
+
+#include <allegro.h>
+#include <cstdlib>
+
+using namespace base;
+using namespace raster;
+
+template<typename T>
+class RotateAllTypes : public testing::Test {
+protected:
+  RotateAllTypes() { }
+};
+
+typedef testing::Types<RgbTraits, GrayscaleTraits, IndexedTraits, BitmapTraits> RotateAllTraits;
+TYPED_TEST_CASE(RotateAllTypes, RotateAllTraits);
+
+// Creates an image with opaque pixels (and different from the mask
+// color), so image_parallelogram() copies them as they are.
+template<typename ImageTraits>
+Image* create_opaque_image(int w, int h)
+{
+  Image* image = Image::create(ImageTraits::pixel_format, w, h);
+  for (int y=0; y<h; ++y)
+    for (int x=0; x<w; ++x) {
+      int v = std::rand() % 256;
+      color_t c;
+      switch (ImageTraits::pixel_format) {
+        case IMAGE_RGB:       c = rgba(v, 255-v, (v*7) & 255, 255); break;
+        case IMAGE_GRAYSCALE: c = graya(v, 255); break;
+        case IMAGE_INDEXED:   c = 1 + v % 255; break;
+        case IMAGE_BITMAP:    c = v & 1; break;
+      }
+      put_pixel_fast<ImageTraits>(image, x, y, c);
+    }
+  return image;
+}
+
+// Transformations from "dst" pixel coordinates to "src" coordinates.
+struct Rotate90 {
+  int w, h;
+  void operator()(int x, int y, int& u, int& v) const { u = y; v = h-1-x; }
+};
+
+struct Rotate180 {
+  int w, h;
+  void operator()(int x, int y, int& u, int& v) const { u = w-1-x; v = h-1-y; }
+};
+
+struct Scale {
+  int scale;
+  void operator()(int x, int y, int& u, int& v) const { u = x/scale; v = y/scale; }
+};
+
+template<typename ImageTraits, typename Transform>
+void expect_pixels(const Image* dst, const Image* src, const Transform& transform)
+{
+  for (int y=0; y<dst->getHeight(); ++y)
+    for (int x=0; x<dst->getWidth(); ++x) {
+      int u, v;
+      transform(x, y, u, v);
+      ASSERT_EQ(get_pixel_fast<ImageTraits>(src, u, v),
+                get_pixel_fast<ImageTraits>(dst, x, y))
+        << "Pixel " << x << "," << y << " of a " << dst->getWidth() << "x" << dst->getHeight()
+        << " image (source pixel " << u << "," << v << ")";
+    }
+}
+
+TYPED_TEST(RotateAllTypes, Parallelogram90)
+{
+  typedef TypeParam ImageTraits;
+  std::srand(1);
+
+  const int w = 7, h = 5;
+  UniquePtr<Image> src(create_opaque_image<ImageTraits>(w, h));
+  UniquePtr<Image> dst(Image::create(ImageTraits::pixel_format, h, w));
+  clear_image(dst, 0);
+
+  //    4-----1
+  //    |     |
+  //    |     |
+  //    3-----2
+  image_parallelogram(dst, src, h, 0, h, w, 0, w, 0, 0);
+
+  Rotate90 transform = { w, h };
+  expect_pixels<ImageTraits>(dst, src, transform);
+}
+
+TYPED_TEST(RotateAllTypes, Parallelogram180)
+{
+  typedef TypeParam ImageTraits;
+  std::srand(2);
+
+  const int w = 7, h = 5;
+  UniquePtr<Image> src(create_opaque_image<ImageTraits>(w, h));
+  UniquePtr<Image> dst(Image::create(ImageTraits::pixel_format, w, h));
+  clear_image(dst, 0);
+
+  image_parallelogram(dst, src, w, h, 0, h, 0, 0, w, 0);
+
+  Rotate180 transform = { w, h };
+  expect_pixels<ImageTraits>(dst, src, transform);
+}
+
+TYPED_TEST(RotateAllTypes, ParallelogramScaled)
+{
+  typedef TypeParam ImageTraits;
+  std::srand(3);
+
+  // The scaled image is big enough to be drawn from several threads.
+  const int w = 20, h = 15, scale = 16;
+  UniquePtr<Image> src(create_opaque_image<ImageTraits>(w, h));
+  UniquePtr<Image> dst(Image::create(ImageTraits::pixel_format, w*scale, h*scale));
+  clear_image(dst, 0);
+
+  image_parallelogram(dst, src, 0, 0, w*scale, 0, w*scale, h*scale, 0, h*scale);
+
+  Scale transform = { scale };
+  expect_pixels<ImageTraits>(dst, src, transform);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  install_allegro(SYSTEM_NONE, &errno, atexit);
+  return RUN_ALL_TESTS();
+}
@@ -27,6 +27,7 @@
 #include "raster/primitives.h"
 #include "raster/primitives_fast.h"
 #include "raster/rotate.h"
+#include "raster/rotsprite.h"
 
 namespace raster {
 
@@ -164,28 +165,47 @@ static void image_scale2x(Image* dst, const Image* src, int src_w, int src_h)
   }
 }
 
-void image_rotsprite(Image* bmp, Image* spr,
-                     int x1, int y1, int x2, int y2,
-                     int x3, int y3, int x4, int y4)
+static const int kScale = 8;
+
+RotSpriteCache::RotSpriteCache()
+  : m_source(NULL)
+  , m_scaled(NULL)
+  , m_scaledBuf(new ImageBuffer(1))
+  , m_renderBuf(new ImageBuffer(1))
 {
-  static ImageBufferPtr buf1, buf2, buf3; // TODO non-thread safe
+}
 
-  if (!buf1) buf1.reset(new ImageBuffer(1));
-  if (!buf2) buf2.reset(new ImageBuffer(1));
-  if (!buf3) buf3.reset(new ImageBuffer(1));
+RotSpriteCache::~RotSpriteCache()
+{
+  delete m_scaled;
+}
 
-  int scale = 8;
-  base::UniquePtr<Image> bmp_copy(Image::create(bmp->getPixelFormat(), bmp->getWidth()*scale, bmp->getHeight()*scale, buf1));
-  base::UniquePtr<Image> tmp_copy(Image::create(spr->getPixelFormat(), spr->getWidth()*scale, spr->getHeight()*scale, buf2));
-  base::UniquePtr<Image> spr_copy(Image::create(spr->getPixelFormat(), spr->getWidth()*scale, spr->getHeight()*scale, buf3));
+void RotSpriteCache::invalidate()
+{
+  delete m_scaled;
+  m_scaled = NULL;
+  m_source = NULL;
+}
+
+Image* RotSpriteCache::getScaledImage(const Image* spr)
+{
+  if (m_scaled && m_source == spr) {
+    m_scaled->setMaskColor(spr->getMaskColor());
+    return m_scaled;
+  }
+
+  invalidate();
+
+  // The temporary image is needed only to build the scaled image, so
+  // its buffer (as big as the scaled image) is released at the end.
+  base::UniquePtr<Image> tmp_copy(Image::create(spr->getPixelFormat(), spr->getWidth()*kScale, spr->getHeight()*kScale));
+  base::UniquePtr<Image> spr_copy(Image::create(spr->getPixelFormat(), spr->getWidth()*kScale, spr->getHeight()*kScale, m_scaledBuf));
 
   color_t maskColor = spr->getMaskColor();
 
-  bmp_copy->setMaskColor(maskColor);
   tmp_copy->setMaskColor(maskColor);
   spr_copy->setMaskColor(maskColor);
 
-  bmp_copy->clear(maskColor);
   spr_copy->clear(maskColor);
   spr_copy->copy(spr, 0, 0);
 
@@ -195,11 +215,47 @@ void image_rotsprite(Image* bmp, Image* spr,
     spr_copy->copy(tmp_copy, 0, 0);
   }
 
+  m_source = spr;
+  m_scaled = spr_copy.release();
+  return m_scaled;
+}
+
+void image_rotsprite(Image* bmp, Image* spr,
+                     int x1, int y1, int x2, int y2,
+                     int x3, int y3, int x4, int y4)
+{
+  static RotSpriteCache cache; // TODO non-thread safe
+
+  // The pixels of "spr" could be different from the previous call.
+  cache.invalidate();
+
+  image_rotsprite(bmp, spr, &cache, x1, y1, x2, y2, x3, y3, x4, y4);
+}
+
+void image_rotsprite(Image* bmp, Image* spr, RotSpriteCache* cache,
+                     int x1, int y1, int x2, int y2,
+                     int x3, int y3, int x4, int y4)
+{
+  Image* spr_copy = cache->getScaledImage(spr);
+  base::UniquePtr<Image> bmp_copy(Image::create(bmp->getPixelFormat(), bmp->getWidth()*kScale, bmp->getHeight()*kScale, cache->getRenderBuffer()));
+
+  color_t maskColor = spr->getMaskColor();
+  bmp_copy->setMaskColor(maskColor);
+  bmp_copy->clear(maskColor);
+
   image_parallelogram(bmp_copy, spr_copy,
-    x1*scale, y1*scale, x2*scale, y2*scale,
-    x3*scale, y3*scale, x4*scale, y4*scale);
+    x1*kScale, y1*kScale, x2*kScale, y2*kScale,
+    x3*kScale, y3*kScale, x4*kScale, y4*kScale);
 
   image_scale(bmp, bmp_copy, 0, 0, bmp->getWidth(), bmp->getHeight());
 }
 
+void image_rotsprite_preview(Image* bmp, Image* spr, RotSpriteCache* cache,
+                             int x1, int y1, int x2, int y2,
+                             int x3, int y3, int x4, int y4)
+{
+  image_parallelogram(bmp, cache->getScaledImage(spr),
+    x1, y1, x2, y2, x3, y3, x4, y4);
+}
+
 } // namespace raster
@@ -20,13 +20,52 @@
 #define RASTER_ROTSPRITE_H_INCLUDED
 #pragma once
 
+#include "raster/image_buffer.h"
+
 namespace raster {
   class Image;
 
+  // Keeps the RotSprite upsampled version (8x with Scale2x) of a
+  // source image, so it can be transformed several times (e.g. while
+  // the user drags the image) without scaling it again in each step.
+  class RotSpriteCache {
+  public:
+    RotSpriteCache();
+    ~RotSpriteCache();
+
+    // Discards the scaled image. It must be called when the pixels of
+    // the source image are modified.
+    void invalidate();
+
+    // Returns the scaled version of "spr" (it's calculated only the
+    // first time or when "spr" is a different image).
+    Image* getScaledImage(const Image* spr);
+
+    // Buffer used to render the transformed image.
+    const ImageBufferPtr& getRenderBuffer() const { return m_renderBuf; }
+
+  private:
+    const Image* m_source;
+    Image* m_scaled;
+    ImageBufferPtr m_scaledBuf;
+    ImageBufferPtr m_renderBuf;
+  };
+
   void image_rotsprite(Image* bmp, Image* spr,
     int x1, int y1, int x2, int y2,
     int x3, int y3, int x4, int y4);
 
+  void image_rotsprite(Image* bmp, Image* spr, RotSpriteCache* cache,
+    int x1, int y1, int x2, int y2,
+    int x3, int y3, int x4, int y4);
+
+  // Fast approximation of image_rotsprite() to preview the
+  // transformation: the scaled image is mapped directly to "bmp"
+  // (without rendering it 8x bigger).
+  void image_rotsprite_preview(Image* bmp, Image* spr, RotSpriteCache* cache,
+    int x1, int y1, int x2, int y2,
+    int x3, int y3, int x4, int y4);
+
 } // namespace raster
 
 #endif
@@ -0,0 +1,106 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/unique_ptr.h"
+#include "raster/image.h"
+#include "raster/primitives.h"
+#include "raster/primitives_fast.h"
+#include "raster/rotsprite.h"
+
+#include <allegro.h>
+#include <cstdlib>
+
+using namespace base;
+using namespace raster;
+
+template<typename T>
+class RotSpriteAllTypes : public testing::Test {
+protected:
+  RotSpriteAllTypes() { }
+};
+
+typedef testing::Types<RgbTraits, GrayscaleTraits, IndexedTraits, BitmapTraits> RotSpriteAllTraits;
+TYPED_TEST_CASE(RotSpriteAllTypes, RotSpriteAllTraits);
+
+template<typename ImageTraits>
+void fill_random_image(Image* image)
+{
+  for (int y=0; y<image->getHeight(); ++y)
+    for (int x=0; x<image->getWidth(); ++x) {
+      color_t c = std::rand() % 4;
+      if (ImageTraits::pixel_format == IMAGE_RGB)
+        c = rgba(c*80, 255-c*60, c*20, c == 0 ? 0: 255);
+      else if (ImageTraits::pixel_format == IMAGE_GRAYSCALE)
+        c = graya(c*80, c == 0 ? 0: 255);
+      else if (ImageTraits::pixel_format == IMAGE_BITMAP)
+        c = c & 1;
+      put_pixel_fast<ImageTraits>(image, x, y, c);
+    }
+}
+
+TYPED_TEST(RotSpriteAllTypes, CachedEqualsUncached)
+{
+  typedef TypeParam ImageTraits;
+  std::srand(1);
+
+  // Corners of the transformed image (x1,y1 ... x4,y4)
+  const int corners[][8] = {
+    { 0, 0, 7, 0, 7, 5, 0, 5 },         // Same image
+    { 2, 0, 9, 3, 6, 10, -1, 7 },       // Rotated
+    { 8, 6, 0, 6, 0, 0, 8, 0 },         // 180 degrees
+    { 1, 1, 15, 2, 14, 11, 0, 10 },     // Scaled and rotated
+  };
+  const int n = sizeof(corners) / sizeof(corners[0]);
+
+  UniquePtr<Image> spr(Image::create(ImageTraits::pixel_format, 8, 6));
+  UniquePtr<Image> expected(Image::create(ImageTraits::pixel_format, 16, 12));
+  UniquePtr<Image> result(Image::create(ImageTraits::pixel_format, 16, 12));
+  RotSpriteCache cache;
+
+  // Two different sets of pixels, the cache is invalidated between them.
+  for (int k=0; k<2; ++k) {
+    fill_random_image<ImageTraits>(spr);
+    cache.invalidate();
+
+    for (int i=0; i<n; ++i) {
+      const int* c = corners[i];
+
+      clear_image(expected, 0);
+      image_rotsprite(expected, spr, c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7]);
+
+      clear_image(result, 0);
+      image_rotsprite(result, spr, &cache, c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7]);
+
+      EXPECT_EQ(0, count_diff_between_images(expected, result))
+        << "Transformation " << i << " with pixels set " << k;
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  install_allegro(SYSTEM_NONE, &errno, atexit);
+  return RUN_ALL_TESTS();
+}
@@ -30,6 +30,8 @@
 #include "raster/raster.h"
 
 #include <cstring>
+#include <map>
+#include <set>
 #include <vector>
 
 namespace raster {
@@ -378,12 +380,16 @@ void Sprite::remapImages(FrameNumber frameFrom, FrameNumber frameTo, const std::
   CelList cels;
   getCels(cels);
 
+  // Images shared by several cels must be remapped just one time.
+  std::set<int> remapped;
+
   for (CelIterator it = cels.begin(); it != cels.end(); ++it) {
     Cel* cel = *it;
 
     // Remap this Cel because is inside the specified range
     if (cel->getFrame() >= frameFrom &&
-        cel->getFrame() <= frameTo) {
+        cel->getFrame() <= frameTo &&
+        remapped.insert(cel->getImage()).second) {
       Image* image = getStock()->getImage(cel->getImage());
       LockImageBits<IndexedTraits> bits(image);
       LockImageBits<IndexedTraits>::iterator
@@ -392,8 +398,99 @@ void Sprite::remapImages(FrameNumber frameFrom, FrameNumber frameTo, const std::
 
       for (; it != end; ++it)
         *it = mapping[*it];
+
+      image->invalidateHash();
+    }
+  }
+}
+
+static void merge_duplicate_images_in_layer(Stock* stock, Layer* layer, std::vector<int>& merged)
+{
+  switch (layer->type()) {
+
+    case OBJECT_LAYER_IMAGE: {
+      // Unique images of this layer by hash, and the stock entry that
+      // replaces each entry used by the layer.
+      std::multimap<uint32_t, int> unique;
+      std::map<int, int> replacements;
+
+      CelIterator it = static_cast<LayerImage*>(layer)->getCelBegin();
+      CelIterator end = static_cast<LayerImage*>(layer)->getCelEnd();
+      for (; it != end; ++it) {
+        Cel* cel = *it;
+        int index = cel->getImage();
+
+        std::map<int, int>::iterator replacement = replacements.find(index);
+        if (replacement != replacements.end()) {
+          cel->setImage(replacement->second);
+          continue;
+        }
+
+        int shared = index;
+        if (stock->isImageLoaded(index) && stock->getImage(index)) {
+          const Image* image = stock->getImage(index);
+          uint32_t hash = stock->getImageHash(index);
+
+          // Equal hashes don't mean equal images, so each candidate
+          // is compared pixel by pixel.
+          std::pair<std::multimap<uint32_t, int>::iterator,
+                    std::multimap<uint32_t, int>::iterator> range = unique.equal_range(hash);
+          for (; range.first != range.second; ++range.first) {
+            if (is_same_image(stock->getImage(range.first->second), image)) {
+              shared = range.first->second;
+              break;
+            }
+          }
+
+          if (shared == index)
+            unique.insert(std::make_pair(hash, index));
+          else
+            merged.push_back(index);
+        }
+
+        replacements[index] = shared;
+        cel->setImage(shared);
+      }
+      break;
+    }
+
+    case OBJECT_LAYER_FOLDER: {
+      LayerIterator it = static_cast<LayerFolder*>(layer)->getLayerBegin();
+      LayerIterator end = static_cast<LayerFolder*>(layer)->getLayerEnd();
+      for (; it != end; ++it)
+        merge_duplicate_images_in_layer(stock, *it, merged);
+      break;
+    }
+
+  }
+}
+
+int Sprite::mergeDuplicateImages()
+{
+  std::vector<int> merged;
+  merge_duplicate_images_in_layer(m_stock, m_folder, merged);
+  if (merged.empty())
+    return 0;
+
+  // Count the references to each image, as an image could be used by
+  // cels from other layers too.
+  std::vector<int> refs(m_stock->size(), 0);
+  CelList cels;
+  getCels(cels);
+  for (CelIterator it = cels.begin(); it != cels.end(); ++it)
+    ++refs[(*it)->getImage()];
+
+  int count = 0;
+  for (size_t i=0; i<merged.size(); ++i) {
+    int index = merged[i];
+    if (refs[index] == 0) {
+      Image* image = m_stock->getImage(index);
+      m_stock->replaceImage(index, NULL);
+      delete image;
+      ++count;
     }
   }
+  return count;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -128,6 +128,15 @@ namespace raster {
 
     void remapImages(FrameNumber frameFrom, FrameNumber frameTo, const std::vector<uint8_t>& mapping);
 
+    // Makes the cels of each layer with identical images share the
+    // same stock entry, the duplicated images are removed from the
+    // stock and deleted. Images that weren't loaded yet (see
+    // StockImageLoader) are not compared. It doesn't generate undo
+    // information, so it's used just after a sprite is created
+    // (e.g. when a file is loaded). Returns the number of deleted
+    // images.
+    int mergeDuplicateImages();
+
     // Draws the sprite in the given image at the given position. Before
     // drawing the sprite, this function clears (with the sprite's
     // background color) the rectangle area that will occupy the drawn
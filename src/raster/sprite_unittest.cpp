@@ -0,0 +1,98 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "raster/cel.h"
+#include "raster/image.h"
+#include "raster/layer.h"
+#include "raster/primitives.h"
+#include "raster/sprite.h"
+#include "raster/stock.h"
+
+using namespace raster;
+
+static Cel* add_cel(Sprite* sprite, LayerImage* layer, int frame, color_t color)
+{
+  Image* image = Image::create(IMAGE_RGB, 8, 8);
+  clear_image(image, color);
+
+  Cel* cel = new Cel(FrameNumber(frame), sprite->getStock()->addImage(image));
+  layer->addCel(cel);
+  return cel;
+}
+
+TEST(Sprite, MergeDuplicateImages)
+{
+  Sprite sprite(IMAGE_RGB, 8, 8, 256);
+  sprite.setTotalFrames(FrameNumber(4));
+
+  LayerImage* layer1 = new LayerImage(&sprite);
+  LayerImage* layer2 = new LayerImage(&sprite);
+  sprite.getFolder()->addLayer(layer1);
+  sprite.getFolder()->addLayer(layer2);
+
+  color_t red = rgba(255, 0, 0, 255);
+  color_t blue = rgba(0, 0, 255, 255);
+  Cel* a = add_cel(&sprite, layer1, 0, red);
+  Cel* b = add_cel(&sprite, layer1, 1, blue);
+  Cel* c = add_cel(&sprite, layer1, 2, red);
+  Cel* d = add_cel(&sprite, layer1, 3, red);
+  Cel* e = add_cel(&sprite, layer2, 0, red);
+
+  EXPECT_EQ(2, sprite.mergeDuplicateImages());
+
+  EXPECT_EQ(a->getImage(), c->getImage());
+  EXPECT_EQ(a->getImage(), d->getImage());
+  EXPECT_NE(a->getImage(), b->getImage());
+  EXPECT_EQ(3u, sprite.getImageRefs(a->getImage()));
+
+  // Images are not shared between layers
+  EXPECT_NE(a->getImage(), e->getImage());
+  EXPECT_EQ(1u, sprite.getImageRefs(e->getImage()));
+
+  // Nothing else to merge
+  EXPECT_EQ(0, sprite.mergeDuplicateImages());
+}
+
+TEST(Sprite, MergeDuplicateImagesWithDifferentContent)
+{
+  Sprite sprite(IMAGE_RGB, 8, 8, 256);
+  sprite.setTotalFrames(FrameNumber(2));
+
+  LayerImage* layer = new LayerImage(&sprite);
+  sprite.getFolder()->addLayer(layer);
+
+  color_t red = rgba(255, 0, 0, 255);
+  Cel* a = add_cel(&sprite, layer, 0, red);
+  Cel* b = add_cel(&sprite, layer, 1, red);
+  put_pixel(sprite.getStock()->getImage(b->getImage()), 7, 7, 0);
+
+  EXPECT_EQ(0, sprite.mergeDuplicateImages());
+  EXPECT_NE(a->getImage(), b->getImage());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
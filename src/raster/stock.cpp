@@ -22,6 +22,8 @@
 
 #include "raster/stock.h"
 
+#include "base/scoped_lock.h"
+#include "base/unique_ptr.h"
 #include "raster/image.h"
 
 #include <cstring>
@@ -64,9 +66,12 @@ Stock::Stock(const Stock& stock)
 Stock::~Stock()
 {
   for (int i=0; i<size(); ++i) {
-    if (getImage(i))
-      delete getImage(i);
+    if (m_image[i])
+      delete m_image[i];
   }
+
+  for (int i=0; i<(int)m_pending.size(); ++i)
+    delete m_pending[i];
 }
 
 PixelFormat Stock::getPixelFormat() const
@@ -81,16 +86,31 @@ void Stock::setPixelFormat(PixelFormat pixelFormat)
 
 Image* Stock::getImage(int index) const
 {
-  ASSERT((index >= 0) && (index < size()));
+  PendingImage* pending;
+  {
+    base::scoped_lock hold(m_mutex);
+    ASSERT((index >= 0) && (index < size()));
 
-  return m_image[index];
+    if (index >= (int)m_pending.size() ||
+        !m_pending[index] ||
+        m_pending[index]->loaded)
+      return m_image[index];
+
+    pending = m_pending[index];
+  }
+
+  return loadImage(index, pending);
 }
 
 int Stock::addImage(Image* image)
 {
+  base::scoped_lock hold(m_mutex);
+
   int i = m_image.size();
   try {
     m_image.resize(m_image.size()+1);
+    if (!m_pending.empty())
+      m_pending.resize(m_image.size(), NULL);
   }
   catch (...) {
     delete image;
@@ -100,8 +120,72 @@ int Stock::addImage(Image* image)
   return i;
 }
 
+int Stock::addImageLoader(StockImageLoader* loader)
+{
+  base::UniquePtr<PendingImage> pending(new PendingImage(loader));
+  base::scoped_lock hold(m_mutex);
+
+  int i = m_image.size();
+  m_pending.resize(m_image.size()+1, NULL);
+  m_image.push_back(NULL);
+  m_pending[i] = pending.release();
+  return i;
+}
+
+bool Stock::isImageLoaded(int index) const
+{
+  base::scoped_lock hold(m_mutex);
+  ASSERT((index >= 0) && (index < size()));
+
+  return (index >= (int)m_pending.size() ||
+          !m_pending[index] ||
+          m_pending[index]->loaded);
+}
+
+void Stock::loadAllImages()
+{
+  for (int i=0; i<size(); ++i)
+    getImage(i);
+}
+
+void Stock::takeLoadErrors(std::vector<std::string>& errors)
+{
+  base::scoped_lock hold(m_mutex);
+
+  errors.insert(errors.end(), m_loadErrors.begin(), m_loadErrors.end());
+  m_loadErrors.clear();
+}
+
+Image* Stock::loadImage(int index, PendingImage* pending) const
+{
+  // Only threads that need this same image wait here, other images
+  // can be loaded at the same time.
+  base::scoped_lock holdPending(pending->mutex);
+
+  if (!pending->loaded) {
+    std::string error;
+    Image* image = pending->loader->loadImage(error);
+
+    delete pending->loader;
+    pending->loader = NULL;
+
+    base::scoped_lock hold(m_mutex);
+    const_cast<Stock*>(this)->m_image[index] = image;
+    if (!error.empty())
+      m_loadErrors.push_back(error);
+
+    pending->loaded = true;
+    return image;
+  }
+
+  base::scoped_lock hold(m_mutex);
+  return m_image[index];
+}
+
 void Stock::removeImage(Image* image)
 {
+  base::scoped_lock hold(m_mutex);
+
   for (int i=0; i<size(); i++)
     if (m_image[i] == image) {
       m_image[i] = NULL;
@@ -113,8 +197,36 @@ void Stock::removeImage(Image* image)
 
 void Stock::replaceImage(int index, Image* image)
 {
+  base::scoped_lock hold(m_mutex);
   ASSERT((index > 0) && (index < size()));
+
   m_image[index] = image;
+
+  // The old image will not be needed anymore.
+  if (index < (int)m_pending.size() && m_pending[index]) {
+    delete m_pending[index];
+    m_pending[index] = NULL;
+  }
+}
+
+uint32_t Stock::getImageHash(int index) const
+{
+  ASSERT((index >= 0) && (index < size()));
+
+  const Image* image = getImage(index);
+  return (image ? image->getHash(): 0);
+}
+
+void Stock::invalidateImageHash(int index)
+{
+  ASSERT((index >= 0) && (index < size()));
+
+  // Images of pending loaders don't have a hash yet.
+  if (isImageLoaded(index)) {
+    Image* image = getImage(index);
+    if (image)
+      image->invalidateHash();
+  }
 }
 
 } // namespace raster
@@ -20,9 +20,11 @@
 #define RASTER_STOCK_H_INCLUDED
 #pragma once
 
+#include "base/mutex.h"
 #include "raster/object.h"
 #include "raster/pixel_format.h"
 
+#include <string>
 #include <vector>
 
 namespace raster {
@@ -31,6 +33,19 @@ namespace raster {
 
   typedef std::vector<Image*> ImagesList;
 
+  // Creates the image of a stock entry the first time that it is
+  // used (e.g. to keep the pixels compressed in the file until they
+  // are needed).
+  class StockImageLoader {
+  public:
+    virtual ~StockImageLoader() { }
+
+    // Creates the image. If the data is corrupted, the image is
+    // returned anyway (e.g. with the pixels that could be loaded) and
+    // "error" is set with the problem.
+    virtual Image* loadImage(std::string& error) = 0;
+  };
+
   class Stock : public Object {
   public:
     Stock(PixelFormat format);
@@ -53,6 +68,23 @@ namespace raster {
     // Stock::getImage() function).
     int addImage(Image* image);
 
+    // Adds a new entry in the stock which image will be created by the
+    // given loader when it is requested for first time with
+    // getImage() (the stock owns the loader).
+    int addImageLoader(StockImageLoader* loader);
+
+    // Returns true if the image in the "index" position was already
+    // created (i.e. it doesn't have a pending loader).
+    bool isImageLoaded(int index) const;
+
+    // Creates the images of all pending loaders (e.g. before the file
+    // used by the loaders is overwritten).
+    void loadAllImages();
+
+    // Moves to "errors" the problems found by loaders since the last
+    // call (e.g. to show that some images were corrupted).
+    void takeLoadErrors(std::vector<std::string>& errors);
+
     // Removes a image from the stock, it doesn't resize the stock.
     void removeImage(Image* image);
 
@@ -66,9 +98,38 @@ namespace raster {
     //
     void replaceImage(int index, Image* image);
 
+    // Returns the hash of the image in the "index" position (see
+    // Image::getHash(), the image caches it by bands of rows).
+    // invalidateImageHash() must be called when the image pixels are
+    // modified in place.
+    uint32_t getImageHash(int index) const;
+    void invalidateImageHash(int index);
+
     //private: TODO uncomment this line
     PixelFormat m_format; // Type of images (all images in the stock must be of this type).
     ImagesList m_image;   // The images-array where the images are.
+
+  private:
+    // An entry created by a loader. The loader is used just one time
+    // (with the entry's mutex locked, so other threads that need the
+    // same image wait for it) and then "loaded" is set.
+    struct PendingImage {
+      StockImageLoader* loader;
+      bool loaded;
+      base::mutex mutex;
+      PendingImage(StockImageLoader* loader) : loader(loader), loaded(false) { }
+      ~PendingImage() { delete loader; }
+    };
+
+    Image* loadImage(int index, PendingImage* pending) const;
+
+    // Entries created by loaders (it's empty if loaders were never
+    // used). Images are loaded from the render threads too, so
+    // "m_image", "m_pending" and "m_loadErrors" are accessed with
+    // "m_mutex" locked (but images are loaded without it).
+    std::vector<PendingImage*> m_pending;
+    mutable std::vector<std::string> m_loadErrors;
+    mutable base::mutex m_mutex;
   };
 
 } // namespace raster
@@ -0,0 +1,246 @@
+/* Aseprite
+ * Copyright (C) 2001-2014  David Capello
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "base/mutex.h"
+#include "base/scoped_lock.h"
+#include "base/thread.h"
+#include "raster/image.h"
+#include "raster/primitives.h"
+#include "raster/stock.h"
+
+#include <utility>
+
+using namespace raster;
+
+class TestLoader : public StockImageLoader {
+public:
+  TestLoader(int& loads, int& deletes, const char* error = "")
+    : m_loads(loads), m_deletes(deletes), m_error(error) { }
+  ~TestLoader() { ++m_deletes; }
+
+  Image* loadImage(std::string& error) OVERRIDE {
+    ++m_loads;
+    error = m_error;
+    return Image::create(IMAGE_RGB, 4, 4);
+  }
+
+private:
+  int& m_loads;
+  int& m_deletes;
+  const char* m_error;
+};
+
+TEST(Stock, ImageLoader)
+{
+  int loads = 0, deletes = 0;
+  {
+    Stock stock(IMAGE_RGB);
+    int a = stock.addImageLoader(new TestLoader(loads, deletes));
+    int b = stock.addImage(Image::create(IMAGE_RGB, 2, 2));
+    int c = stock.addImageLoader(new TestLoader(loads, deletes));
+    EXPECT_EQ(1, a);
+    EXPECT_EQ(2, b);
+    EXPECT_EQ(3, c);
+    EXPECT_FALSE(stock.isImageLoaded(a));
+    EXPECT_TRUE(stock.isImageLoaded(b));
+    EXPECT_EQ(0, loads);
+
+    // The image is loaded just one time
+    Image* image = stock.getImage(a);
+    ASSERT_TRUE(image != NULL);
+    EXPECT_EQ(4, image->getWidth());
+    EXPECT_EQ(image, stock.getImage(a));
+    EXPECT_TRUE(stock.isImageLoaded(a));
+    EXPECT_EQ(1, loads);
+    EXPECT_EQ(1, deletes);
+
+    EXPECT_EQ(2, stock.getImage(b)->getWidth());
+    EXPECT_EQ(1, loads);
+  }
+  // The pending loader is deleted with the stock
+  EXPECT_EQ(1, loads);
+  EXPECT_EQ(2, deletes);
+}
+
+TEST(Stock, ReplaceImageWithLoader)
+{
+  int loads = 0, deletes = 0;
+  Stock stock(IMAGE_RGB);
+  int a = stock.addImageLoader(new TestLoader(loads, deletes));
+
+  stock.replaceImage(a, Image::create(IMAGE_RGB, 8, 8));
+  EXPECT_EQ(0, loads);
+  EXPECT_EQ(1, deletes);
+  EXPECT_EQ(8, stock.getImage(a)->getWidth());
+}
+
+TEST(Stock, LoadAllImages)
+{
+  int loads = 0, deletes = 0;
+  Stock stock(IMAGE_RGB);
+  for (int i=0; i<10; ++i)
+    stock.addImageLoader(new TestLoader(loads, deletes));
+
+  stock.loadAllImages();
+  EXPECT_EQ(10, loads);
+  EXPECT_EQ(10, deletes);
+
+  for (int i=1; i<stock.size(); ++i)
+    EXPECT_TRUE(stock.isImageLoaded(i));
+
+  // The copy doesn't use loaders
+  Stock copy(stock);
+  EXPECT_EQ(stock.size(), copy.size());
+  EXPECT_EQ(10, loads);
+}
+
+// Loader that waits (up to one second) until other loader is
+// creating its image at the same time.
+class WaitingLoader : public StockImageLoader {
+public:
+  WaitingLoader(base::mutex& mutex, int& loading, bool& together)
+    : m_mutex(mutex), m_loading(loading), m_together(together) { }
+
+  Image* loadImage(std::string& error) OVERRIDE {
+    {
+      base::scoped_lock hold(m_mutex);
+      ++m_loading;
+    }
+    for (int i=0; i<1000; ++i) {
+      {
+        base::scoped_lock hold(m_mutex);
+        if (m_loading > 1) {
+          m_together = true;
+          break;
+        }
+      }
+      base::this_thread::sleep_for(0.001);
+    }
+    {
+      base::scoped_lock hold(m_mutex);
+      --m_loading;
+    }
+    return Image::create(IMAGE_RGB, 4, 4);
+  }
+
+private:
+  base::mutex& m_mutex;
+  int& m_loading;
+  bool& m_together;
+};
+
+static void get_stock_image(Stock* stock, std::pair<int, Image*>* entry)
+{
+  entry->second = stock->getImage(entry->first);
+}
+
+TEST(Stock, LoadImagesFromSeveralThreads)
+{
+  base::mutex mutex;
+  int loading = 0;
+  bool together = false;
+  Stock stock(IMAGE_RGB);
+  int a = stock.addImageLoader(new WaitingLoader(mutex, loading, together));
+  int b = stock.addImageLoader(new WaitingLoader(mutex, loading, together));
+
+  // Two threads load "a" and other one "b"
+  std::pair<int, Image*> images[3] = {
+    std::make_pair(a, (Image*)NULL),
+    std::make_pair(a, (Image*)NULL),
+    std::make_pair(b, (Image*)NULL) };
+  {
+    base::thread t1(&get_stock_image, &stock, &images[0]);
+    base::thread t2(&get_stock_image, &stock, &images[1]);
+    base::thread t3(&get_stock_image, &stock, &images[2]);
+    t1.join();
+    t2.join();
+    t3.join();
+  }
+
+  // Different images are loaded at the same time, but each image is
+  // loaded just one time.
+  EXPECT_TRUE(together);
+  EXPECT_EQ(images[0].second, images[1].second);
+  EXPECT_EQ(stock.getImage(a), images[0].second);
+  EXPECT_EQ(stock.getImage(b), images[2].second);
+  EXPECT_TRUE(stock.isImageLoaded(a));
+  EXPECT_TRUE(stock.isImageLoaded(b));
+}
+
+TEST(Stock, LoadErrors)
+{
+  int loads = 0, deletes = 0;
+  Stock stock(IMAGE_RGB);
+  int a = stock.addImageLoader(new TestLoader(loads, deletes));
+  int b = stock.addImageLoader(new TestLoader(loads, deletes, "Bad image"));
+
+  std::vector<std::string> errors;
+  stock.getImage(a);
+  stock.takeLoadErrors(errors);
+  EXPECT_TRUE(errors.empty());
+
+  // The image is created even if the loader reports an error
+  EXPECT_TRUE(stock.getImage(b) != NULL);
+  stock.takeLoadErrors(errors);
+  ASSERT_EQ(1, (int)errors.size());
+  EXPECT_EQ("Bad image", errors[0]);
+
+  // Errors are reported just one time
+  errors.clear();
+  stock.takeLoadErrors(errors);
+  EXPECT_TRUE(errors.empty());
+}
+
+TEST(Stock, ImageHash)
+{
+  Stock stock(IMAGE_RGB);
+  Image* a = Image::create(IMAGE_RGB, 4, 4);
+  Image* b = Image::create(IMAGE_RGB, 4, 4);
+  clear_image(a, rgba(255, 0, 0, 255));
+  clear_image(b, rgba(255, 0, 0, 255));
+  int ia = stock.addImage(a);
+  int ib = stock.addImage(b);
+
+  EXPECT_EQ(calculate_image_hash(a), stock.getImageHash(ia));
+  EXPECT_EQ(stock.getImageHash(ia), stock.getImageHash(ib));
+
+  // The cached hash is used until it's invalidated
+  put_pixel(b, 0, 0, rgba(0, 0, 255, 255));
+  EXPECT_EQ(stock.getImageHash(ia), stock.getImageHash(ib));
+  stock.invalidateImageHash(ib);
+  EXPECT_NE(stock.getImageHash(ia), stock.getImageHash(ib));
+  EXPECT_EQ(calculate_image_hash(b), stock.getImageHash(ib));
+
+  // The new image has its own hash
+  Image* c = Image::createCopy(a);
+  stock.replaceImage(ib, c);
+  delete b;
+  EXPECT_EQ(stock.getImageHash(ia), stock.getImageHash(ib));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
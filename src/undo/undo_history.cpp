@@ -14,6 +14,7 @@
 #include "undo/undoer.h"
 #include "undo/undoers_stack.h"
 
+#include <algorithm>
 #include <limits>
 
 namespace undo {
@@ -141,24 +142,6 @@ void UndoHistory::runUndo(Direction direction)
   } while (level);
 }
 
-void UndoHistory::discardTail()
-{
-  int level = 0;
-
-  do {
-    Undoer* undoer = m_undoers->popUndoer(UndoersStack::PopFromTail);
-    if (!undoer)
-      break;
-
-    if (undoer->isOpenGroup())
-      level++;
-    else if (undoer->isCloseGroup())
-      level--;
-
-    undoer->dispose();
-  } while (level);
-}
-
 void UndoHistory::pushUndoer(Undoer* undoer)
 {
   // Add the undoer in the undoers stack
@@ -216,12 +199,20 @@ void UndoHistory::postUndoerAddedEvent(Undoer* undoer)
 // Discards undoers in in case the UndoHistory is bigger than the given limit.
 void UndoHistory::checkSizeLimit()
 {
-  // Is undo history too big?
-  size_t groups = m_undoers->countUndoGroups();
   size_t undoLimit = m_delegate->getUndoSizeLimit();
-  while (groups > 1 && m_undoers->getMemSize() > undoLimit) {
-    discardTail();
-    groups--;
+
+  // Move the data of the oldest undoers out of memory.
+  if (m_undoers->getMemSize() > undoLimit)
+    m_undoers->swapOut(undoLimit);
+
+  // Is undo history still too big? (e.g. undoers that cannot be
+  // swapped out) Discard the oldest groups, but keep the last one.
+  if (m_undoers->getMemSize() > undoLimit) {
+    size_t groups = m_undoers->countUndoGroups();
+    size_t discard = m_undoers->countTailGroupsToDiscard(undoLimit);
+
+    if (groups > 1 && discard > 0)
+      m_undoers->discardTail(std::min(discard, groups-1));
   }
 }
 
@@ -63,7 +63,6 @@ namespace undo {
     enum Direction { UndoDirection, RedoDirection };
 
     void runUndo(Direction direction);
-    void discardTail();
     void updateUndo();
     void postUndoerAddedEvent(Undoer* undoer);
     void checkSizeLimit();
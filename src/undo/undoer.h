@@ -32,6 +32,12 @@ namespace undo {
     // using to revert the action.
     virtual size_t getMemSize() const = 0;
 
+    // Moves the data used to revert the action out of memory (e.g. to
+    // a file in disk) and returns the number of released bytes (which
+    // are not counted by getMemSize() anymore). The data must be
+    // loaded again by revert() when it is needed.
+    virtual size_t swapOut() = 0;
+
     // Returns the kind of modification that this item does with the
     // document.
     virtual Modification getModification() const = 0;
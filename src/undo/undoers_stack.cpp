@@ -19,6 +19,10 @@ UndoersStack::UndoersStack(UndoHistory* undoHistory)
 {
   m_undoHistory = undoHistory;
   m_size = 0;
+  m_groups = 0;
+  m_headLevel = 0;
+  m_tailLevel = 0;
+  m_swappedTail = 0;
 }
 
 UndoersStack::~UndoersStack()
@@ -32,6 +36,10 @@ void UndoersStack::clear()
     (*it)->dispose();           // Delete the Undoer.
 
   m_size = 0;
+  m_groups = 0;
+  m_headLevel = 0;
+  m_tailLevel = 0;
+  m_swappedTail = 0;
   m_items.clear();              // Clear the list of items.
 }
 
@@ -40,6 +48,15 @@ size_t UndoersStack::getMemSize() const
   return m_size;
 }
 
+void UndoersStack::swapOut(size_t limit)
+{
+  Items::reverse_iterator it = m_items.rbegin() + m_swappedTail;
+  Items::reverse_iterator end = m_items.rend();
+
+  for (; it != end && m_size > limit; ++it, ++m_swappedTail)
+    m_size -= (*it)->swapOut();
+}
+
 ObjectsContainer* UndoersStack::getObjects() const
 {
   return m_undoHistory->getObjects();
@@ -50,7 +67,7 @@ void UndoersStack::pushUndoer(Undoer* undoer)
   ASSERT(undoer != NULL);
 
   try {
-    m_items.insert(begin(), undoer);
+    m_items.push_front(undoer);
   }
   catch (...) {
     undoer->dispose();
@@ -58,22 +75,37 @@ void UndoersStack::pushUndoer(Undoer* undoer)
   }
 
   m_size += undoer->getMemSize();
+  updateGroupsOnPush(undoer);
 }
 
 Undoer* UndoersStack::popUndoer(PopFrom popFrom)
 {
   Undoer* undoer;
-  iterator it;
 
   if (!empty()) {
-    if (popFrom == PopFromHead)
-      it = begin();
-    else
-      it = --end();
-
-    undoer = (*it);                 // Set the undoer to return.
-    m_items.erase(it);              // Erase the item from the stack.
+    if (popFrom == PopFromHead) {
+      undoer = m_items.front();
+      m_items.pop_front();
+      updateGroupsOnPopHead(undoer);
+
+      if (m_swappedTail > m_items.size())
+        m_swappedTail = m_items.size();
+    }
+    else {
+      undoer = m_items.back();
+      m_items.pop_back();
+      updateGroupsOnPopTail(undoer);
+
+      if (m_swappedTail > 0)
+        --m_swappedTail;
+    }
     m_size -= undoer->getMemSize(); // Reduce the stack size.
+
+    if (empty()) {
+      m_groups = 0;
+      m_headLevel = 0;
+      m_tailLevel = 0;
+    }
   }
   else
     undoer = NULL;
@@ -81,30 +113,108 @@ Undoer* UndoersStack::popUndoer(PopFrom popFrom)
   return undoer;
 }
 
-size_t UndoersStack::countUndoGroups() const
+size_t UndoersStack::countTailGroupsToDiscard(size_t sizeLimit) const
 {
+  size_t size = m_size;
   size_t groups = 0;
-  int level;
+  int level = m_tailLevel;
 
-  const_iterator it = begin();
-  while (it != end()) {
-    level = 0;
+  if (size <= sizeLimit)
+    return 0;
 
-    do {
-      const Undoer* undoer = (*it);
-      ++it;
+  for (Items::const_reverse_iterator it = m_items.rbegin(), end = m_items.rend();
+       it != end; ++it) {
+    const Undoer* undoer = *it;
+    size -= undoer->getMemSize();
 
-      if (undoer->isOpenGroup())
-        level++;
-      else if (undoer->isCloseGroup())
-        level--;
-    } while (level && (it != end()));
+    if (undoer->isOpenGroup())
+      level++;
+    else if (undoer->isCloseGroup())
+      level--;
 
-    if (level == 0)
+    // Groups are discarded completely
+    if (level == 0) {
       groups++;
+      if (size <= sizeLimit)
+        break;
+    }
   }
 
   return groups;
 }
 
+void UndoersStack::discardTail(size_t groups)
+{
+  Items::iterator it = m_items.end();
+  Items::iterator begin = m_items.begin();
+
+  while (groups > 0 && it != begin) {
+    Undoer* undoer = *(--it);
+    m_size -= undoer->getMemSize();
+
+    if (undoer->isOpenGroup())
+      m_tailLevel++;
+    else if (undoer->isCloseGroup())
+      m_tailLevel--;
+
+    if (m_tailLevel == 0) {
+      ASSERT(m_groups > 0);
+      m_groups--;
+      groups--;
+    }
+
+    undoer->dispose();
+  }
+
+  size_t discarded = m_items.end() - it;
+  m_items.erase(it, m_items.end());
+
+  m_swappedTail = (m_swappedTail > discarded ? m_swappedTail - discarded: 0);
+
+  if (empty()) {
+    m_groups = 0;
+    m_headLevel = 0;
+    m_tailLevel = 0;
+  }
+}
+
+// Undoers are pushed in the same order that they are added to the
+// UndoHistory, so the head of the stack contains the CloseGroup of
+// the last group and the tail the OpenGroup of the oldest one.
+
+void UndoersStack::updateGroupsOnPush(const Undoer* undoer)
+{
+  if (undoer->isOpenGroup())
+    m_headLevel++;
+  else if (undoer->isCloseGroup()) {
+    if (--m_headLevel == 0)
+      m_groups++;
+  }
+  else if (m_headLevel == 0)
+    m_groups++;
+}
+
+void UndoersStack::updateGroupsOnPopHead(const Undoer* undoer)
+{
+  if (undoer->isOpenGroup())
+    m_headLevel--;
+  else if (undoer->isCloseGroup()) {
+    if (m_headLevel++ == 0 && m_groups > 0)
+      m_groups--;
+  }
+  else if (m_headLevel == 0 && m_groups > 0)
+    m_groups--;
+}
+
+void UndoersStack::updateGroupsOnPopTail(const Undoer* undoer)
+{
+  if (undoer->isOpenGroup())
+    m_tailLevel++;
+  else if (undoer->isCloseGroup())
+    m_tailLevel--;
+
+  if (m_tailLevel == 0 && m_groups > 0)
+    m_groups--;
+}
+
 } // namespace undo
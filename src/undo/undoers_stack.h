@@ -10,7 +10,7 @@
 
 #include "undo/undoers_collector.h"
 
-#include <vector>
+#include <deque>
 
 namespace undo {
 
@@ -28,7 +28,7 @@ namespace undo {
       PopFromTail
     };
 
-    typedef std::vector<Undoer*> Items;
+    typedef std::deque<Undoer*> Items;
     typedef Items::iterator iterator;
     typedef Items::const_iterator const_iterator;
 
@@ -51,6 +51,10 @@ namespace undo {
 
     size_t getMemSize() const;
 
+    // Calls Undoer::swapOut() from the oldest undoer to the newest one
+    // until the memory used by the stack is equal or less than "limit".
+    void swapOut(size_t limit);
+
     // UndoersCollector implementation
     void pushUndoer(Undoer* undoer);
 
@@ -58,14 +62,40 @@ namespace undo {
     // deleted by the caller using Undoer::dispose().
     Undoer* popUndoer(PopFrom popFrom);
 
-    size_t countUndoGroups() const;
+    // Returns the number of complete groups in the stack (a undoer
+    // outside a group counts as one group). Undoers of a group that
+    // is still open are not counted.
+    size_t countUndoGroups() const { return m_groups; }
+
+    // Returns how many of the oldest groups must be discarded so the
+    // stack uses "sizeLimit" bytes or less.
+    size_t countTailGroupsToDiscard(size_t sizeLimit) const;
+
+    // Discards (and disposes) the undoers of the N oldest groups.
+    void discardTail(size_t groups);
 
   private:
+    void updateGroupsOnPush(const Undoer* undoer);
+    void updateGroupsOnPopHead(const Undoer* undoer);
+    void updateGroupsOnPopTail(const Undoer* undoer);
+
     UndoHistory* m_undoHistory;
     Items m_items;
 
     // Bytes occupied by all undoers in the stack.
     size_t m_size;
+
+    // Number of complete groups, and nesting level of groups at the
+    // head (the level of the group that is being added) and at the
+    // tail (the level of a group that is being removed from the
+    // tail, zero if no group is partially removed).
+    size_t m_groups;
+    int m_headLevel;
+    int m_tailLevel;
+
+    // Number of undoers at the tail that were already swapped out
+    // with swapOut() (they are skipped by the next calls).
+    size_t m_swappedTail;
   };
 
 } // namespace undo
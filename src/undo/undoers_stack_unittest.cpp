@@ -0,0 +1,232 @@
+// Aseprite Undo Library
+// Copyright (C) 2001-2014 David Capello
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "undo/undoer.h"
+#include "undo/undoers_stack.h"
+
+using namespace undo;
+
+class TestUndoer : public Undoer {
+public:
+  enum Type { Action, OpenGroup, CloseGroup };
+
+  TestUndoer(Type type, size_t size, int* disposed)
+    : m_type(type), m_size(size), m_disposed(disposed) { }
+
+  void dispose() {
+    ++*m_disposed;
+    delete this;
+  }
+  size_t getMemSize() const { return m_size; }
+  size_t swapOut() {
+    size_t size = m_size;
+    m_size = 0;
+    return size;
+  }
+  Modification getModification() const { return DoesntModifyDocument; }
+  bool isOpenGroup() const { return m_type == OpenGroup; }
+  bool isCloseGroup() const { return m_type == CloseGroup; }
+  void revert(ObjectsContainer* objects, UndoersCollector* redoers) { }
+
+private:
+  Type m_type;
+  size_t m_size;
+  int* m_disposed;
+};
+
+class UndoersStackTest : public testing::Test {
+protected:
+  UndoersStackTest() : stack(NULL), disposed(0) { }
+
+  TestUndoer* push(TestUndoer::Type type, size_t size = 0) {
+    TestUndoer* undoer = new TestUndoer(type, size, &disposed);
+    stack.pushUndoer(undoer);
+    return undoer;
+  }
+
+  void pushGroup(size_t size) {
+    push(TestUndoer::OpenGroup);
+    push(TestUndoer::Action, size);
+    push(TestUndoer::CloseGroup);
+  }
+
+  void popAndDispose(UndoersStack::PopFrom popFrom) {
+    Undoer* undoer = stack.popUndoer(popFrom);
+    ASSERT_TRUE(undoer != NULL);
+    undoer->dispose();
+  }
+
+  UndoersStack stack;
+  int disposed;
+};
+
+TEST_F(UndoersStackTest, CountGroups)
+{
+  EXPECT_EQ(0, stack.countUndoGroups());
+
+  push(TestUndoer::Action, 10);
+  EXPECT_EQ(1, stack.countUndoGroups());
+
+  pushGroup(20);
+  EXPECT_EQ(2, stack.countUndoGroups());
+  EXPECT_EQ(30, stack.getMemSize());
+
+  popAndDispose(UndoersStack::PopFromHead); // CloseGroup
+  EXPECT_EQ(1, stack.countUndoGroups());
+  push(TestUndoer::CloseGroup);
+  EXPECT_EQ(2, stack.countUndoGroups());
+
+  popAndDispose(UndoersStack::PopFromTail); // Action
+  EXPECT_EQ(1, stack.countUndoGroups());
+  EXPECT_EQ(20, stack.getMemSize());
+}
+
+TEST_F(UndoersStackTest, NestedGroups)
+{
+  // Open(Open(a) b Open(c Open(d) ) )
+  push(TestUndoer::OpenGroup);
+  push(TestUndoer::OpenGroup);
+  push(TestUndoer::Action, 1);
+  push(TestUndoer::CloseGroup);
+  EXPECT_EQ(0, stack.countUndoGroups());
+  push(TestUndoer::Action, 2);
+  push(TestUndoer::OpenGroup);
+  push(TestUndoer::Action, 3);
+  push(TestUndoer::OpenGroup);
+  push(TestUndoer::Action, 4);
+  push(TestUndoer::CloseGroup);
+  push(TestUndoer::CloseGroup);
+  EXPECT_EQ(0, stack.countUndoGroups());
+  push(TestUndoer::CloseGroup);
+
+  // Just the outer group is counted
+  EXPECT_EQ(1, stack.countUndoGroups());
+  EXPECT_EQ(10, stack.getMemSize());
+
+  pushGroup(5);
+  EXPECT_EQ(2, stack.countUndoGroups());
+
+  // The whole outer group is discarded
+  EXPECT_EQ(1, stack.countTailGroupsToDiscard(5));
+  stack.discardTail(1);
+  EXPECT_EQ(1, stack.countUndoGroups());
+  EXPECT_EQ(5, stack.getMemSize());
+  EXPECT_EQ(12, disposed);
+
+  // Removing the CloseGroup from the head reopens the group
+  popAndDispose(UndoersStack::PopFromHead);
+  EXPECT_EQ(0, stack.countUndoGroups());
+  popAndDispose(UndoersStack::PopFromHead);
+  popAndDispose(UndoersStack::PopFromHead);
+  EXPECT_TRUE(stack.empty());
+  EXPECT_EQ(0, stack.countUndoGroups());
+  EXPECT_EQ(0, stack.getMemSize());
+}
+
+TEST_F(UndoersStackTest, DiscardTailWithOpenGroup)
+{
+  pushGroup(10);
+  pushGroup(20);
+  push(TestUndoer::Action, 30);
+
+  // A group that is still open at the head
+  push(TestUndoer::OpenGroup);
+  push(TestUndoer::Action, 40);
+  EXPECT_EQ(3, stack.countUndoGroups());
+  EXPECT_EQ(100, stack.getMemSize());
+
+  // The open group is never counted to be discarded
+  EXPECT_EQ(3, stack.countTailGroupsToDiscard(0));
+  EXPECT_EQ(2, stack.countTailGroupsToDiscard(70));
+
+  stack.discardTail(2);
+  EXPECT_EQ(1, stack.countUndoGroups());
+  EXPECT_EQ(70, stack.getMemSize());
+  EXPECT_EQ(6, disposed);
+
+  // Close the open group
+  push(TestUndoer::Action, 50);
+  push(TestUndoer::CloseGroup);
+  EXPECT_EQ(2, stack.countUndoGroups());
+  EXPECT_EQ(120, stack.getMemSize());
+
+  stack.discardTail(1);
+  EXPECT_EQ(1, stack.countUndoGroups());
+  EXPECT_EQ(90, stack.getMemSize());
+
+  stack.discardTail(1);
+  EXPECT_TRUE(stack.empty());
+  EXPECT_EQ(0, stack.countUndoGroups());
+  EXPECT_EQ(0, stack.getMemSize());
+  EXPECT_EQ(11, disposed);
+
+  // The stack works as new
+  pushGroup(10);
+  EXPECT_EQ(1, stack.countUndoGroups());
+}
+
+TEST_F(UndoersStackTest, SwappedTailAfterDiscardTail)
+{
+  TestUndoer* a = push(TestUndoer::Action, 10);
+  TestUndoer* b = push(TestUndoer::Action, 20);
+  TestUndoer* c = push(TestUndoer::Action, 30);
+  TestUndoer* d = push(TestUndoer::Action, 40);
+
+  // "a" and "b" are swapped out
+  stack.swapOut(70);
+  EXPECT_EQ(70, stack.getMemSize());
+  EXPECT_EQ(0, a->getMemSize());
+  EXPECT_EQ(0, b->getMemSize());
+  EXPECT_EQ(30, c->getMemSize());
+
+  // Discard "a", "b" is still swapped out, so the next swapOut()
+  // starts from "c".
+  stack.discardTail(1);
+  EXPECT_EQ(3, stack.countUndoGroups());
+  EXPECT_EQ(70, stack.getMemSize());
+
+  stack.swapOut(40);
+  EXPECT_EQ(40, stack.getMemSize());
+  EXPECT_EQ(0, c->getMemSize());
+  EXPECT_EQ(40, d->getMemSize());
+
+  // Discard more undoers than the swapped ones
+  stack.discardTail(2);
+  EXPECT_EQ(1, stack.countUndoGroups());
+  EXPECT_EQ(40, stack.getMemSize());
+
+  // New undoers are swapped out from "d"
+  TestUndoer* e = push(TestUndoer::Action, 50);
+  stack.swapOut(50);
+  EXPECT_EQ(0, d->getMemSize());
+  EXPECT_EQ(50, e->getMemSize());
+  EXPECT_EQ(50, stack.getMemSize());
+
+  // Pop everything from the head
+  popAndDispose(UndoersStack::PopFromHead);
+  popAndDispose(UndoersStack::PopFromHead);
+  EXPECT_TRUE(stack.empty());
+  EXPECT_EQ(0, stack.getMemSize());
+
+  // A new undoer must be swapped out (the counter of swapped undoers
+  // was reset).
+  TestUndoer* f = push(TestUndoer::Action, 60);
+  stack.swapOut(0);
+  EXPECT_EQ(0, f->getMemSize());
+  EXPECT_EQ(0, stack.getMemSize());
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}